@@ -0,0 +1,478 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+ctypes bindings for the native alignment core (build/alignment_core.so)
+
+Build the library with `python build_native.py`. When it is missing,
+load_native_core() returns None and the analyzer keeps its Python loop.
+"""
+
+import copy
+import time
+import ctypes
+import threading
+from array import array
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+ABI_VERSION = 8
+
+AC_OK = 0
+AC_TRUNCATED = 1
+AC_ERR_DEADLINE = -5
+LIMIT_DEADLINE = 0x1
+LIMIT_RULES = 0x2
+CROSS_START = 0x1
+CROSS_END = 0x2
+
+LIBRARY_NAME = 'alignment_core.so'
+
+
+class AlignmentStats(ctypes.Structure):
+    _fields_ = [
+        ('total_rules', ctypes.c_uint64),
+        ('aligned_rules', ctypes.c_uint64),
+        ('distinct_rules', ctypes.c_uint64),
+        ('distinct_aligned', ctypes.c_uint64),
+        ('unaligned_count', ctypes.c_uint64),
+        ('type_count', ctypes.c_uint64),
+    ]
+
+
+class ArenaUsage(ctypes.Structure):
+    _fields_ = [
+        ('in_use', ctypes.c_uint64),
+        ('high_water', ctypes.c_uint64),
+        ('capacity', ctypes.c_uint64),
+        ('block_allocations', ctypes.c_uint64),
+        ('resets', ctypes.c_uint64),
+    ]
+
+
+class Limits(ctypes.Structure):
+    _fields_ = [
+        ('deadline_ns', ctypes.c_uint64),
+        ('max_rules', ctypes.c_uint64),
+    ]
+
+
+class StageTimes(ctypes.Structure):
+    """Nanoseconds per native stage in the last extract (parse, walk) and score (dedup, score) call."""
+    _fields_ = [
+        ('parse_ns', ctypes.c_uint64),
+        ('walk_ns', ctypes.c_uint64),
+        ('dedup_ns', ctypes.c_uint64),
+        ('score_ns', ctypes.c_uint64),
+    ]
+
+
+class DeadlineExceeded(RuntimeError):
+    """The per-file deadline passed before there was any result (e.g. during the parse)."""
+
+    def __init__(self, reason: str = 'deadline'):
+        super().__init__(reason)
+        self.reason = reason
+
+
+def limit_reason(flags: int) -> Optional[str]:
+    """'deadline' or 'rule_budget' for ac_context_limit_hit flags, None when no limit was hit."""
+    if flags & LIMIT_DEADLINE:
+        return 'deadline'
+    if flags & LIMIT_RULES:
+        return 'rule_budget'
+    return None
+
+
+class UnalignedRecord(ctypes.Structure):
+    _fields_ = [
+        ('rule_index', ctypes.c_uint32),
+        ('flags', ctypes.c_uint32),
+        ('start_token', ctypes.c_int32),
+        ('end_token', ctypes.c_int32),
+        ('start_prev_cp', ctypes.c_uint32),
+        ('start_curr_cp', ctypes.c_uint32),
+        ('end_prev_cp', ctypes.c_uint32),
+        ('end_curr_cp', ctypes.c_uint32),
+    ]
+
+
+class TypeCount(ctypes.Structure):
+    _fields_ = [
+        ('type_id', ctypes.c_uint32),
+        ('rules', ctypes.c_uint32),
+        ('aligned', ctypes.c_uint32),
+    ]
+
+
+_u32_p = ctypes.POINTER(ctypes.c_uint32)
+
+
+def _byte_view(buf):
+    """ctypes argument for source bytes: bytes as-is, a writable buffer such as a
+    copy-on-write mmap (analyzer.read_source) in place, without copying."""
+    if isinstance(buf, bytes):
+        return buf
+    if not len(buf):
+        return None
+    return (ctypes.c_char * len(buf)).from_buffer(buf)
+
+
+def _u32_view(values):
+    """Zero-copy ctypes argument for an array('I') or a pointer returned by the core."""
+    if not isinstance(values, array):
+        return values
+    if not len(values):
+        return None
+    return (ctypes.c_uint32 * len(values)).from_buffer(values)
+
+
+def _u32_array(pointer, n: int):
+    """ctypes uint32 array of n entries over a buffer returned by the core, without copying."""
+    return ctypes.cast(pointer, ctypes.POINTER(ctypes.c_uint32 * n)).contents
+
+
+class RuleSpans:
+    """Extracted rules as struct-of-arrays: interned type ids plus start/end byte offsets.
+
+    The columns are either array('I') (Python walker) or ctypes pointers into a
+    native context (native walker); both index the same way. type_names maps a
+    type id back to the Tree-sitter node type. truncated is the per-file limit
+    ('rule_budget', 'deadline') that cut the extraction short, if any, so every
+    tokenizer scoring these rules reports the file as truncated.
+    """
+    __slots__ = ('types', 'starts', 'ends', 'count', 'type_names', 'truncated')
+
+    def __init__(self, types, starts, ends, count: int, type_names, truncated: Optional[str] = None):
+        self.types = types
+        self.starts = starts
+        self.ends = ends
+        self.count = count
+        self.type_names = type_names
+        self.truncated = truncated
+
+    def __len__(self):
+        return self.count
+
+    def type_name(self, i: int) -> str:
+        return self.type_names[self.types[i]]
+
+    def detached(self) -> 'RuleSpans':
+        """These rules with array('I') columns, independent of any native context."""
+        if isinstance(self.types, array):
+            return self
+        size = 4 * self.count
+        columns = [array('I', ctypes.string_at(column, size)) if size else array('I')
+                   for column in (self.types, self.starts, self.ends)]
+        return RuleSpans(*columns, self.count, self.type_names, self.truncated)
+
+
+class NativeLanguage:
+    """A grammar loaded into the native walker, with its interned type-name table."""
+
+    def __init__(self, lib, handle, name: str):
+        self._lib = lib
+        self._handle = handle
+        self.name = name
+        self.type_names = [
+            lib.ac_language_type_name(handle, i).decode('utf-8')
+            for i in range(lib.ac_language_type_count(handle))
+        ]
+
+    def close(self):
+        if getattr(self, '_handle', None):
+            self._lib.ac_language_free(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+
+class NativeBPE:
+    """A byte-level BPE model built in the native core from a tokenizer's merges (native/bpe.cpp)."""
+
+    def __init__(self, lib, handle):
+        self._lib = lib
+        self._handle = handle
+        self.merge_count = lib.ac_bpe_merge_count(handle)
+
+    def close(self):
+        if getattr(self, '_handle', None):
+            self._lib.ac_bpe_free(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+
+class NativeAlignmentCore:
+    """Thin wrapper over one ac_context. Not thread-safe; use one per thread (see clone)."""
+
+    def __init__(self, library_path: Path):
+        lib = ctypes.CDLL(str(library_path))
+        lib.ac_abi_version.restype = ctypes.c_int
+        lib.ac_abi_version.argtypes = []
+        if lib.ac_abi_version() != ABI_VERSION:
+            raise RuntimeError(f"ABI mismatch: {library_path} is v{lib.ac_abi_version()}, expected v{ABI_VERSION}; rebuild with build_native.py")
+        lib.ac_unicode_version.restype = ctypes.c_char_p
+        lib.ac_unicode_version.argtypes = []
+        lib.ac_monotonic_ns.restype = ctypes.c_uint64
+        lib.ac_monotonic_ns.argtypes = []
+        lib.ac_context_new.restype = ctypes.c_void_p
+        lib.ac_context_new.argtypes = []
+        lib.ac_context_free.restype = None
+        lib.ac_context_free.argtypes = [ctypes.c_void_p]
+        lib.ac_context_arena_usage.restype = ctypes.c_int
+        lib.ac_context_arena_usage.argtypes = [ctypes.c_void_p, ctypes.POINTER(ArenaUsage)]
+        lib.ac_context_set_limits.restype = ctypes.c_int
+        lib.ac_context_set_limits.argtypes = [ctypes.c_void_p, ctypes.POINTER(Limits)]
+        lib.ac_context_limit_hit.restype = ctypes.c_uint32
+        lib.ac_context_limit_hit.argtypes = [ctypes.c_void_p]
+        lib.ac_context_stage_times.restype = ctypes.c_int
+        lib.ac_context_stage_times.argtypes = [ctypes.c_void_p, ctypes.POINTER(StageTimes)]
+        lib.ac_score_rules.restype = ctypes.c_int
+        lib.ac_score_rules.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_void_p, ctypes.c_size_t,
+            _u32_p, _u32_p, _u32_p, ctypes.c_size_t,
+            _u32_p, _u32_p, ctypes.c_size_t,
+            ctypes.POINTER(AlignmentStats),
+        ]
+        lib.ac_unaligned_records.restype = ctypes.POINTER(UnalignedRecord)
+        lib.ac_unaligned_records.argtypes = [ctypes.c_void_p]
+        lib.ac_type_counts.restype = ctypes.POINTER(TypeCount)
+        lib.ac_type_counts.argtypes = [ctypes.c_void_p]
+        lib.ac_has_tree_sitter.restype = ctypes.c_int
+        lib.ac_has_tree_sitter.argtypes = []
+        lib.ac_language_load.restype = ctypes.c_void_p
+        lib.ac_language_load.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+        lib.ac_language_free.restype = None
+        lib.ac_language_free.argtypes = [ctypes.c_void_p]
+        lib.ac_language_type_count.restype = ctypes.c_uint32
+        lib.ac_language_type_count.argtypes = [ctypes.c_void_p]
+        lib.ac_language_type_name.restype = ctypes.c_char_p
+        lib.ac_language_type_name.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+        lib.ac_extract_rules.restype = ctypes.c_int
+        lib.ac_extract_rules.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+        lib.ac_rule_count.restype = ctypes.c_size_t
+        lib.ac_rule_count.argtypes = [ctypes.c_void_p]
+        for column in ('ac_rule_types', 'ac_rule_starts', 'ac_rule_ends'):
+            getattr(lib, column).restype = _u32_p
+            getattr(lib, column).argtypes = [ctypes.c_void_p]
+        lib.ac_simd_kernel.restype = ctypes.c_char_p
+        lib.ac_simd_kernel.argtypes = []
+        lib.ac_offset_maps.restype = ctypes.c_int
+        lib.ac_offset_maps.argtypes = [ctypes.c_void_p, ctypes.c_size_t, _u32_p, ctypes.c_size_t, _u32_p,
+                                       ctypes.POINTER(ctypes.c_size_t)]
+        lib.ac_context_offset_maps.restype = ctypes.c_int
+        lib.ac_context_offset_maps.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int,
+                                               ctypes.POINTER(ctypes.c_size_t)]
+        for column in ('ac_char_to_byte', 'ac_byte_to_utf16'):
+            getattr(lib, column).restype = _u32_p
+            getattr(lib, column).argtypes = [ctypes.c_void_p]
+        lib.ac_bpe_new.restype = ctypes.c_void_p
+        lib.ac_bpe_new.argtypes = [ctypes.c_char_p, _u32_p, _u32_p, ctypes.c_size_t]
+        lib.ac_bpe_free.restype = None
+        lib.ac_bpe_free.argtypes = [ctypes.c_void_p]
+        lib.ac_bpe_merge_count.restype = ctypes.c_size_t
+        lib.ac_bpe_merge_count.argtypes = [ctypes.c_void_p]
+        lib.ac_bpe_encode.restype = ctypes.c_int
+        lib.ac_bpe_encode.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t,
+                                      ctypes.POINTER(ctypes.c_size_t)]
+        for column in ('ac_token_starts', 'ac_token_ends'):
+            getattr(lib, column).restype = _u32_p
+            getattr(lib, column).argtypes = [ctypes.c_void_p]
+
+        self._lib = lib
+        self.library_path = Path(library_path)
+        self.unicode_version = lib.ac_unicode_version().decode('ascii')
+        self.has_tree_walker = bool(lib.ac_has_tree_sitter())
+        self.simd_kernel = lib.ac_simd_kernel().decode('ascii')
+        self._ctx = lib.ac_context_new()
+        if not self._ctx:
+            raise MemoryError("ac_context_new failed")
+        self._limits = (None, 0)
+        # Which limit stopped the last extract_rules/score_rules call ('deadline', 'rule_budget' or None)
+        self.limit_hit = None
+        # Arena usage of closed clones, shared by every clone of this core (see arena_report)
+        self._closed_usage = {'contexts': 0, 'high_water': 0, 'block_allocations': 0, 'resets': 0}
+        self._closed_lock = threading.Lock()
+
+    def clone(self) -> 'NativeAlignmentCore':
+        """Another wrapper over the same library with its own ac_context, for use from another thread.
+
+        Loaded languages are read-only and can be shared between clones."""
+        other = copy.copy(self)
+        other._ctx = self._lib.ac_context_new()
+        if not other._ctx:
+            raise MemoryError("ac_context_new failed")
+        other._limits = (None, 0)
+        other.limit_hit = None
+        return other
+
+    def close(self):
+        if getattr(self, '_ctx', None):
+            try:
+                usage = self.arena_usage()
+                with self._closed_lock:
+                    closed = self._closed_usage
+                    closed['contexts'] += 1
+                    closed['high_water'] = max(closed['high_water'], usage.high_water)
+                    closed['block_allocations'] += usage.block_allocations
+                    closed['resets'] += usage.resets
+            except Exception:
+                pass  # e.g. at interpreter shutdown; only the report loses this context
+            self._lib.ac_context_free(self._ctx)
+            self._ctx = None
+
+    def __del__(self):
+        self.close()
+
+    def arena_report(self) -> dict:
+        """Arena usage of this context and every closed clone of its core: the largest
+        high-water mark of one context, and heap block allocations and resets in total."""
+        usage = self.arena_usage()
+        with self._closed_lock:
+            closed = dict(self._closed_usage)
+        return {
+            'contexts': closed['contexts'] + 1,
+            'high_water': max(closed['high_water'], usage.high_water),
+            'block_allocations': closed['block_allocations'] + usage.block_allocations,
+            'resets': closed['resets'] + usage.resets,
+        }
+
+    def load_language(self, library_path: Path, symbol: str) -> Optional[NativeLanguage]:
+        """Load a compiled grammar into the native walker, or None if unsupported."""
+        if not self.has_tree_walker:
+            return None
+        handle = self._lib.ac_language_load(str(library_path).encode('utf-8'), symbol.encode('utf-8'))
+        if not handle:
+            return None
+        return NativeLanguage(self._lib, handle, symbol)
+
+    def set_limits(self, deadline: Optional[float] = None, max_rules: int = 0):
+        """Limits of later calls: a time.monotonic() deadline and a rule budget (None/0: none)."""
+        if (deadline, max_rules) == self._limits:
+            return
+        limits = Limits(0, max(0, int(max_rules)))
+        if deadline is not None:
+            remaining_ns = int((deadline - time.monotonic()) * 1e9)
+            limits.deadline_ns = max(1, self._lib.ac_monotonic_ns() + remaining_ns)
+        self._lib.ac_context_set_limits(self._ctx, ctypes.byref(limits))
+        self._limits = (deadline, max_rules)
+
+    def _check_status(self, status: int, entry_point: str):
+        if status == AC_ERR_DEADLINE:
+            self.limit_hit = 'deadline'
+            raise DeadlineExceeded('deadline')
+        if status not in (AC_OK, AC_TRUNCATED):
+            raise RuntimeError(f"{entry_point} failed with status {status}")
+        self.limit_hit = limit_reason(self._lib.ac_context_limit_hit(self._ctx)) if status == AC_TRUNCATED else None
+
+    def extract_rules(self, language: NativeLanguage, code_bytes: bytes,
+                      deadline: Optional[float] = None, max_rules: int = 0) -> RuleSpans:
+        """Parse and walk code_bytes natively. The returned columns point into this
+        context and are only valid until the next extract_rules call.
+
+        With a deadline (time.monotonic()) or max_rules, the walk may stop early and
+        return a prefix (limit_hit says why); a parse that runs out of time raises
+        DeadlineExceeded."""
+        self.set_limits(deadline, max_rules)
+        status = self._lib.ac_extract_rules(self._ctx, language._handle, _byte_view(code_bytes), len(code_bytes))
+        self._check_status(status, 'ac_extract_rules')
+        count = self._lib.ac_rule_count(self._ctx)
+        return RuleSpans(self._lib.ac_rule_types(self._ctx), self._lib.ac_rule_starts(self._ctx),
+                         self._lib.ac_rule_ends(self._ctx), count, language.type_names)
+
+    def offset_maps(self, code_bytes: bytes, n_chars: int, with_utf16: bool):
+        """char->byte map (n_chars + 1 entries) and optionally the byte->UTF-16 index map (len + 1).
+
+        Both are ctypes arrays over this context's buffers, only valid until the
+        next offset_maps call; copy them (e.g. list()) to keep them longer."""
+        out_chars = ctypes.c_size_t()
+        status = self._lib.ac_context_offset_maps(self._ctx, _byte_view(code_bytes), len(code_bytes), int(with_utf16),
+                                                  ctypes.byref(out_chars))
+        if status != AC_OK or out_chars.value != n_chars:
+            raise RuntimeError(f"ac_context_offset_maps failed with status {status}")
+        char_to_byte = _u32_array(self._lib.ac_char_to_byte(self._ctx), n_chars + 1)
+        byte_to_utf16 = _u32_array(self._lib.ac_byte_to_utf16(self._ctx), len(code_bytes) + 1) if with_utf16 else None
+        return char_to_byte, byte_to_utf16
+
+    def load_bpe(self, merges: List[Tuple[bytes, bytes]]) -> NativeBPE:
+        """A native BPE model from (left, right) merges in rank order, as raw bytes."""
+        data = b''.join(left + right for left, right in merges)
+        left_lens = array('I', [len(left) for left, _ in merges])
+        right_lens = array('I', [len(right) for _, right in merges])
+        handle = self._lib.ac_bpe_new(data, _u32_view(left_lens), _u32_view(right_lens), len(merges))
+        if not handle:
+            raise MemoryError("ac_bpe_new failed")
+        return NativeBPE(self._lib, handle)
+
+    def bpe_encode(self, bpe: NativeBPE, code_bytes: bytes) -> Tuple[array, array]:
+        """Token start and end byte offsets of code_bytes under bpe, as array('I') copies."""
+        n_tokens = ctypes.c_size_t()
+        status = self._lib.ac_bpe_encode(self._ctx, bpe._handle, _byte_view(code_bytes), len(code_bytes),
+                                         ctypes.byref(n_tokens))
+        self._check_status(status, 'ac_bpe_encode')
+        size = 4 * n_tokens.value
+        if not size:
+            return array('I'), array('I')
+        return (array('I', ctypes.string_at(self._lib.ac_token_starts(self._ctx), size)),
+                array('I', ctypes.string_at(self._lib.ac_token_ends(self._ctx), size)))
+
+    def arena_usage(self) -> ArenaUsage:
+        """Memory of this context's per-file arenas (bytes in use, high-water mark, heap blocks)."""
+        usage = ArenaUsage()
+        if self._lib.ac_context_arena_usage(self._ctx, ctypes.byref(usage)) != AC_OK:
+            raise RuntimeError("ac_context_arena_usage failed")
+        return usage
+
+    def stage_times(self) -> StageTimes:
+        """Native stage timers of the last extract_rules and score_rules calls on this context."""
+        times = StageTimes()
+        if self._lib.ac_context_stage_times(self._ctx, ctypes.byref(times)) != AC_OK:
+            raise RuntimeError("ac_context_stage_times failed")
+        return times
+
+    def score_rules(self, code_bytes: bytes, rules: RuleSpans, token_starts: array, token_ends: array,
+                    deadline: Optional[float] = None, max_rules: int = 0) -> Tuple[AlignmentStats, List[UnalignedRecord]]:
+        """Score rule spans against token spans (byte offsets; tokens as array('I')).
+
+        Returns the counters and the unaligned records in first-occurrence order.
+        When a limit stops the loop, the counters cover the rules scored so far and
+        limit_hit says which limit it was.
+        """
+        self.set_limits(deadline, max_rules)
+        stats = AlignmentStats()
+        status = self._lib.ac_score_rules(
+            self._ctx, _byte_view(code_bytes), len(code_bytes),
+            _u32_view(rules.types), _u32_view(rules.starts), _u32_view(rules.ends), rules.count,
+            _u32_view(token_starts), _u32_view(token_ends), len(token_starts),
+            ctypes.byref(stats),
+        )
+        self._check_status(status, 'ac_score_rules')
+        records = self._lib.ac_unaligned_records(self._ctx)
+        unaligned = records[:stats.unaligned_count] if stats.unaligned_count else []
+        return stats, unaligned
+
+    def type_counts(self, stats: AlignmentStats, type_names) -> Dict[str, Tuple[int, int]]:
+        """(distinct rules, distinct aligned) by node type of the score_rules call that returned stats."""
+        if not stats.type_count:
+            return {}
+        records = self._lib.ac_type_counts(self._ctx)[:stats.type_count]
+        return {type_names[rec.type_id]: (rec.rules, rec.aligned) for rec in records}
+
+
+def default_library_path() -> Path:
+    return Path(__file__).resolve().parent / 'build' / LIBRARY_NAME
+
+
+def load_native_core(library_path: Optional[Path] = None) -> Optional[NativeAlignmentCore]:
+    """Load the native core, or return None if it is not built or unusable."""
+    path = Path(library_path) if library_path else default_library_path()
+    if not path.exists():
+        return None
+    try:
+        return NativeAlignmentCore(path)
+    except (OSError, AttributeError, RuntimeError) as e:
+        print(f"✗ native alignment core unavailable: {e}")
+        return None
@@ -4,6 +4,11 @@
 """
 Memory Usage Analysis Tool
 For analyzing memory usage of various components in the project
+
+With --live URL it is a dashboard of a running analyzer.py --metrics_port or
+analyzer_server.py instead: it polls their /metrics endpoint (metrics.py) and
+prints throughput, latency percentiles, cache hit rate, limits, queues and RSS
+every --interval seconds, then plots the RSS of the whole run.
 """
 
 import os
@@ -18,6 +23,7 @@ from pathlib import Path
 
 # Import analyzer
 from analyzer import QuickMultiLanguageAnalyzer
+from metrics import fetch_metrics, histogram_quantile
 
 class MemoryProfiler:
     """Memory profiler class for measuring and recording memory usage"""
@@ -387,6 +393,80 @@ def compare_models_memory_usage(code_dir="code_samples", language="python", mode
     print(f"\nModel comparison chart saved as: {filepath}")
 
 
+def _metric_sum(samples, name, **labels):
+    """Sum of the samples of name whose labels include labels."""
+    return sum(value for sample, sample_labels, value in samples
+               if sample == name and all(sample_labels.get(k) == v for k, v in labels.items()))
+
+
+def _latency_buckets(samples):
+    """Cumulative analyzer_file_seconds buckets summed over models and languages, by upper bound."""
+    buckets = {}
+    for sample, labels, value in samples:
+        if sample == 'analyzer_file_seconds_bucket':
+            bound = float(labels['le'])
+            buckets[bound] = buckets.get(bound, 0) + value
+    return buckets
+
+
+def live_dashboard(url, interval=2.0, duration=0, output_dir="memory_profiles"):
+    """Poll the /metrics endpoint at url and print one line of rates per interval, until it goes away."""
+    profiler = MemoryProfiler(output_dir=output_dir)
+    start = time.time()
+    previous = None
+    history = []  # (seconds since start, RSS MB of the process and its workers)
+    print(f"📈 Polling {url} every {interval:g}s (Ctrl-C to stop)")
+    header = (f"{'time':>7} {'files':>8} {'files/s':>8} {'KB/s':>8} {'p50 ms':>8} {'p99 ms':>8} {'cache':>6} "
+              f"{'timeout':>7} {'skipped':>7} {'queued':>6} {'RSS MB':>8}")
+    try:
+        while not duration or time.time() - start < duration:
+            try:
+                samples = fetch_metrics(url)
+            except OSError as e:
+                if previous is not None:
+                    print(f"✓ Endpoint closed ({e.__class__.__name__}); the run is over")
+                    break
+                print(f"⚠️  Waiting for {url}: {e}")
+                time.sleep(interval)
+                continue
+            now = time.time()
+            current = {
+                'time': now,
+                'files': _metric_sum(samples, 'analyzer_files_total'),
+                'bytes': _metric_sum(samples, 'analyzer_bytes_total'),
+                'buckets': _latency_buckets(samples),
+            }
+            rss = (_metric_sum(samples, 'process_resident_memory_bytes') +
+                   _metric_sum(samples, 'process_children_resident_memory_bytes')) / 1024 / 1024
+            history.append((now - start, rss))
+            if previous is None:
+                print(header)
+            else:
+                elapsed = max(now - previous['time'], 1e-9)
+                # Latency percentiles of the files finished since the last poll
+                delta = [(bound, count - previous['buckets'].get(bound, 0)) for bound, count in current['buckets'].items()]
+                p50, p99 = histogram_quantile(0.5, delta), histogram_quantile(0.99, delta)
+                hits = _metric_sum(samples, 'analyzer_cache_lookups_total', result='hit')
+                lookups = _metric_sum(samples, 'analyzer_cache_lookups_total')
+                queued = (_metric_sum(samples, 'analyzer_pipeline_queue_depth') +
+                          _metric_sum(samples, 'analyzer_server_queue_depth'))
+                print(f"{now - start:>6.0f}s {current['files']:>8.0f} "
+                      f"{(current['files'] - previous['files']) / elapsed:>8.1f} "
+                      f"{(current['bytes'] - previous['bytes']) / elapsed / 1024:>8.1f} "
+                      f"{'-' if p50 is None else f'{p50 * 1000:.1f}':>8} {'-' if p99 is None else f'{p99 * 1000:.1f}':>8} "
+                      f"{f'{hits / lookups:.0%}' if lookups else '-':>6} "
+                      f"{_metric_sum(samples, 'analyzer_limited_files_total', reason='deadline'):>7.0f} "
+                      f"{_metric_sum(samples, 'analyzer_limited_files_total', kind='skipped'):>7.0f} "
+                      f"{queued:>6.0f} {rss:>8.1f}")
+            previous = current
+            time.sleep(interval)
+    except KeyboardInterrupt:
+        pass
+    if len(history) > 1:
+        times, memories = zip(*history)
+        profiler.plot_memory_usage(list(times), list(memories), label="Live Run")
+
+
 def main():
     parser = argparse.ArgumentParser(description='Memory Usage Analysis Tool')
     parser.add_argument('--code_dir', default='code_samples', help='Code directory')
@@ -395,10 +475,16 @@ def main():
     parser.add_argument('--compare_models', action='store_true', help='Compare memory usage of different models')
     parser.add_argument('--models', nargs='+', default=['gpt2', 'bert-base-uncased', 'roberta-base'], 
                         help='List of models to compare')
+    parser.add_argument('--live', type=str, default=None, metavar='URL',
+                        help='Dashboard of a running analyzer.py --metrics_port or analyzer_server.py: poll URL/metrics')
+    parser.add_argument('--interval', type=float, default=2.0, help='Seconds between two --live polls')
+    parser.add_argument('--duration', type=float, default=0, help='Stop --live after this many seconds (0 = when the run ends)')
     
     args = parser.parse_args()
     
-    if args.compare_models:
+    if args.live:
+        live_dashboard(args.live, args.interval, args.duration)
+    elif args.compare_models:
         compare_models_memory_usage(args.code_dir, args.language, args.models)
     else:
         analyze_analyzer_memory_usage(args.code_dir, args.language, args.model)
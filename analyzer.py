@@ -9,27 +9,131 @@ import json
 import time
 import argparse
 from pathlib import Path
-from collections import defaultdict, Counter
+from collections import defaultdict, Counter, deque
 from typing import Dict, List, Tuple, Optional
+from array import array
+from bisect import bisect_left, bisect_right
 
 from tree_sitter import Language, Parser
 from transformers import AutoTokenizer
 from tqdm import tqdm
+from alignment_native import load_native_core, RuleSpans, CROSS_START, CROSS_END, DeadlineExceeded
+from compact_results import DETAIL_LEVELS, UnalignedTable, unaligned_details_entry, jsonable_results, write_compact_report
+from pipeline import Pipeline, Stage
+from result_cache import ResultCache, content_digest, grammar_version, cache_summary
+from result_stream import ResultStream, stream_path
+from run_manifest import RunManifest
+from run_coordinator import CoordinatorClient, CoordinatorError, TOKEN_ENV
+from file_scan import SCHEDULES, DEFAULT_BIN_BYTES, scan_files, largest_first, byte_bins
+from stage_timers import StageClock, TraceRecorder, stage_seconds, stage_breakdown
+from metrics import Registry, RunMetrics, MetricsServer, process_collector
+from node_types import NodeTypeTotals, column_type_counts, most_unaligned, table_path as node_types_path
+from sampling import Sketch, keep_sample, merge_sketches
+from hf_reader import PrefetchReader
+from tokenizer_backends import TOKENIZER_BACKENDS, ByteBoundaries, make_backend
+from incremental import (FileState, line_edits, apply_tree_edits, splice_tokens, merge_windows,
+                         region_delta, shift_row)
+import unicodedata
 import warnings
 warnings.filterwarnings('ignore')
 import concurrent.futures
+import itertools
+import mmap
 import multiprocessing
+import threading
 from typing import Any
-import signal
+import socket
+import shutil
+import tempfile
+
+# Files at least this large are memory-mapped by read_source instead of read()
+MMAP_MIN_BYTES = 64 * 1024
+# Larger source files are skipped (at scan time when their size is known)
+MAX_FILE_BYTES = 1 * 1024 * 1024
+# Nodes walked / rules scored between two deadline checks (AC_LIMIT_CHECK_INTERVAL in the native core)
+LIMIT_CHECK_INTERVAL = 4096
+
+
+def read_source(file_path, max_bytes: Optional[int] = None):
+    """(code, code_bytes) for a source file, or None if it is empty or over max_bytes.
+
+    The size is checked with stat before reading. Files of MMAP_MIN_BYTES and up
+    are mapped copy-on-write, and code_bytes is the mapping itself: tree-sitter
+    and the native core read it in place. The text is decoded once, for the
+    tokenizer. Files that are not plain UTF-8 with LF newlines are re-read as text
+    (universal newlines, errors='ignore') so results match open().read().
+    """
+    size = os.stat(file_path).st_size
+    if max_bytes is not None and size > max_bytes:
+        return None
+    if size == 0:
+        return None
+    with open(file_path, 'rb') as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_COPY) if size >= MMAP_MIN_BYTES else f.read()
+    code = None
+    if data.find(b'\r') == -1:
+        try:
+            code = str(data, 'utf-8')
+        except UnicodeDecodeError:
+            code = None
+    if code is None:
+        with open(file_path, 'r', encoding='utf-8', errors='ignore') as f:
+            code = f.read()
+        data = code.encode('utf-8')
+    if not code.strip():
+        return None
+    return code, data
+
+
+# Tree-sitter symbol and file extensions per language
+LANGUAGE_CONFIGS = {
+    'python': {'symbol': 'python', 'extensions': ['.py']},
+    'javascript': {'symbol': 'javascript', 'extensions': ['.js']},
+    'typescript': {'symbol': 'typescript', 'extensions': ['.ts']},
+    'java': {'symbol': 'java', 'extensions': ['.java']},
+    'c': {'symbol': 'c', 'extensions': ['.c', '.h']},
+    'cpp': {'symbol': 'cpp', 'extensions': ['.cpp', '.cc', '.cxx', '.hpp']},
+    'csharp': {'symbol': 'c_sharp', 'extensions': ['.cs']},
+    'go': {'symbol': 'go', 'extensions': ['.go']},
+    'ruby': {'symbol': 'ruby', 'extensions': ['.rb']},
+    'rust': {'symbol': 'rust', 'extensions': ['.rs']},
+    'scala': {'symbol': 'scala', 'extensions': ['.scala']}
+}
+
+
+def scan_code_files(base_path: Path, language: str) -> List[Tuple[Path, int]]:
+    """(path, size) of the files for language under base_path, sorted by path (one parallel walk, see file_scan.py).
+
+    Prefers the legacy code_dir/<language> layout, and falls back to all of
+    base_path when that directory holds no matching files.
+    """
+    extensions = LANGUAGE_CONFIGS[language]['extensions']
+    language_dir = base_path / language
+    if language_dir.exists():
+        found = scan_files(language_dir, extensions)
+        if found:
+            return found
+    return scan_files(base_path, extensions)
+
+
+def iter_code_files(base_path: Path, language: str):
+    """Files for language under base_path, preferring the legacy code_dir/<language> layout."""
+    for file_path, _ in scan_code_files(base_path, language):
+        yield file_path
+
 
 # Global worker analyzer for process pool
 WORKER_ANALYZER: Optional["QuickMultiLanguageAnalyzer"] = None
 
-def _worker_init(model_name: str, emit_utf16: bool, target_language: str):
+def _worker_init(model_name: str, emit_utf16: bool, target_language: str, use_native: bool = True,
+                 result_cache: Optional[str] = None, detail_level: str = 'full', rule_budget: int = 0, trace: bool = False,
+                 tokenizer_backend: str = 'hf'):
     global WORKER_ANALYZER
     try:
         os.environ.setdefault('TOKENIZERS_PARALLELISM', 'false')
-        WORKER_ANALYZER = QuickMultiLanguageAnalyzer(model_name=model_name, emit_utf16_offsets=emit_utf16, allowed_languages=[target_language])
+        WORKER_ANALYZER = QuickMultiLanguageAnalyzer(model_name=model_name, emit_utf16_offsets=emit_utf16, allowed_languages=[target_language], use_native=use_native,
+                                                     result_cache=result_cache, detail_level=detail_level, rule_budget=rule_budget,
+                                                     trace=trace, tokenizer_backend=tokenizer_backend)
     except Exception:
         WORKER_ANALYZER = None
 
@@ -41,101 +145,251 @@ def _worker_analyze_file(args: Tuple[str, str]) -> Optional[Dict[str, Any]]:
     if WORKER_ANALYZER is None:
         return None
     try:
-        # timeout support per file (Unix)
-        def _timeout_handler(signum, frame):
-            raise TimeoutError("per-file timeout")
-        old_handler = signal.signal(signal.SIGALRM, _timeout_handler)
+        # Cooperative per-file deadline: the parse, the walk and the scoring loop stop at it
         timeout_secs = int(os.environ.get('ANALYZER_PER_FILE_TIMEOUT', '10'))
-        signal.alarm(max(1, timeout_secs))
-
-        with open(file_path, 'r', encoding='utf-8', errors='ignore') as f:
-            code = f.read()
-        MAX_CODE_BYTES = 1 * 1024 * 1024
-        if len(code.encode('utf-8')) > MAX_CODE_BYTES:
-            signal.alarm(0) 
-            signal.signal(signal.SIGALRM, old_handler)
-            return None 
-        if not code.strip():
-            signal.alarm(0)
-            signal.signal(signal.SIGALRM, old_handler)
-            return None
-        code_size = len(code)
-        file_start_time = time.time()
-        score, details = WORKER_ANALYZER.calculate_rule_level_alignment(code, language)
-        signal.alarm(0)
-        signal.signal(signal.SIGALRM, old_handler)
-        file_analysis_time = time.time() - file_start_time
-        aligned_count = sum(1 for d in details.values() if d['fully_aligned'])
-        unaligned_rules_list = [
-            {
-                'rule_key': rk,
-                'type': rd.get('type'),
-                'start_byte': rd.get('start_byte'),
-                'end_byte': rd.get('end_byte'),
-                'start_aligned': rd.get('start_aligned'),
-                'end_aligned': rd.get('end_aligned'),
-                'crossing_start': rd.get('crossing_start'),
-                'crossing_end': rd.get('crossing_end'),
-                'crossing_start_reason': rd.get('crossing_start_reason'),
-                'crossing_end_reason': rd.get('crossing_end_reason'),
-                'token_start_context': rd.get('token_start_context'),
-                'token_end_context': rd.get('token_end_context'),
-                'explain_tree_sitter': rd.get('explain_tree_sitter'),
-                'explain_tokenizer': rd.get('explain_tokenizer'),
-                'fully_aligned': rd.get('fully_aligned'),
-                'text_preview': rd.get('text_preview')
-            }
-            for rk, rd in details.items() if not rd.get('fully_aligned')
-        ]
-        return {
-            'file': file_path.name,
-            'path': str(file_path),
-            'score': score,
-            'total_rules': len(details),
-            'aligned_rules': aligned_count,
-            'unaligned_rules': unaligned_rules_list,
-            'code_size': code_size,
-            'analysis_time': file_analysis_time,
-            'processing_speed': code_size / file_analysis_time if file_analysis_time > 0 else 0,
-            'is_perfect': len(unaligned_rules_list) == 0
-        }
-    except TimeoutError:
-        try:
-            signal.alarm(0)
-            signal.signal(signal.SIGALRM, old_handler)
-        except Exception:
-            pass
-        return None
+        WORKER_ANALYZER._begin_file_limits(time.monotonic() + max(1, timeout_secs))
+        cache = WORKER_ANALYZER.result_cache
+        hits = cache.counters['hits'] if cache is not None else 0
+        result = WORKER_ANALYZER.analyze_file(file_path, language)
+        # The parent counts cache hits from this flag (see _count_cache_hit)
+        if result is not None and cache is not None:
+            result['cache_hit'] = cache.counters['hits'] > hits
+        # Trace events travel with the results; the parent writes the trace (see _count_stage_times)
+        if result is not None and WORKER_ANALYZER.stage_trace is not None:
+            result['trace_events'] = WORKER_ANALYZER.stage_trace.drain()
+        return result
+    except DeadlineExceeded as e:
+        WORKER_ANALYZER._take_stage_times()
+        return {'path': file_path_str, 'skipped': e.reason}  # counted by the parent (see _count_limits)
     except Exception:
         return None
+    finally:
+        WORKER_ANALYZER._begin_file_limits(None)
+
+def _worker_analyze_files(args: Tuple[List[str], str]) -> List[Optional[Dict[str, Any]]]:
+    """One byte-budget bin of files (see file_scan.byte_bins), each under its own per-file deadline."""
+    file_paths, language = args
+    return [_worker_analyze_file((path, language)) for path in file_paths]
+
+class LanguageTotals:
+    """Running totals of one language's single run in analyze_language_files.
+
+    add() takes per-file results as they are collected, writes a part report every
+    flush_every files, and keeps only imperfect files for the report; finish()
+    prints the language summary, saves the remaining part and returns the result.
+    Reports go through analyzer._save_results, so they are named by its model.
+    With --result_format ndjson imperfect files go to the analyzer's result stream
+    instead and only their count and score sum are kept (no part reports).
+    """
+
+    def __init__(self, analyzer: "QuickMultiLanguageAnalyzer", language: str, flush_every: int, output_dir: str,
+                 label_model: bool = False):
+        self.analyzer = analyzer
+        self.label_model = label_model
+        self.language = language
+        self.flush_every = flush_every
+        self.output_dir = output_dir
+        self.file_results = []
+        self.stream = analyzer._result_stream(output_dir)
+        self.streamed_files = 0
+        self.streamed_score = 0.0
+        self.total_rules = 0
+        self.total_aligned = 0
+        self.total_code_size = 0
+        self.total_files = 0
+        self.start_time = time.time()
+        self.chunk_idx = 0
+        self.files_since_flush = 0
+        self.chunk_start_time = time.time()
+
+    def add(self, batch_results):
+        for res in batch_results:
+            if not res:
+                continue
+            self.analyzer._count_cache_hit(res)
+            self.analyzer._count_limits(res)
+            self.analyzer._count_stage_times(self.language, res)
+            self.analyzer._count_node_types(self.language, res.get('unaligned_rules'))
+            self.analyzer._count_sample(self.language, res)
+            self.analyzer._observe_metrics(self.language, res)
+            # Always include in totals and counts
+            self.total_rules += res['total_rules']
+            self.total_aligned += res['aligned_rules']
+            self.total_code_size += res['code_size']
+            self.files_since_flush += 1
+            self.total_files += 1
+            # Include in report list only if not perfect
+            if not res.get('is_perfect', False):
+                if self.stream is not None:
+                    self.stream.write_file(self.language, res)
+                    self.streamed_files += 1
+                    self.streamed_score += res['score']
+                else:
+                    self.file_results.append(res)
+            if self.stream is None and self.flush_every and self.files_since_flush >= self.flush_every:
+                self._save_chunk()
+                self.file_results = []
+                self.files_since_flush = 0
+                self.chunk_start_time = time.time()
+
+    def _save_chunk(self):
+        file_results = self.file_results
+        self.chunk_idx += 1
+        chunk_total_rules = sum(r['total_rules'] for r in file_results)
+        chunk_total_aligned = sum(r['aligned_rules'] for r in file_results)
+        chunk_total_size = sum(r['code_size'] for r in file_results)
+        chunk_total_time = time.time() - self.chunk_start_time
+        chunk_avg_score = sum(r['score'] for r in file_results) / len(file_results)
+        chunk_avg_speed = chunk_total_size / chunk_total_time if chunk_total_time > 0 else 0
+        language_chunk_result = {
+            'language': self.language,
+            'file_count': len(file_results),
+            'avg_score': chunk_avg_score,
+            'total_rules': chunk_total_rules,
+            'total_aligned': chunk_total_aligned,
+            'overall_alignment': (chunk_total_aligned / chunk_total_rules * 100) if chunk_total_rules > 0 else 0,
+            'total_code_size': chunk_total_size,
+            'total_analysis_time': chunk_total_time,
+            'avg_processing_speed': chunk_avg_speed,
+            'files': file_results
+        }
+        self.analyzer._save_results({self.language: language_chunk_result}, [], self.output_dir, chunk_total_time,
+                                    suffix=f"_{self.language}_part_{self.chunk_idx}")
+
+    def finish(self) -> Dict:
+        # Calculate total analysis time and speed
+        total_time = time.time() - self.start_time
+        avg_speed = self.total_code_size / total_time if total_time > 0 else 0
+        file_results = self.file_results
+        
+        if self.stream is not None:
+            if not self.streamed_files:
+                return {}
+            avg_score = self.streamed_score / self.streamed_files
+        elif not file_results:
+            return {}
+        else:
+            # If there are remaining unflushed files, they will be included in final stats and report
+            # Calculate statistics
+            avg_score = sum(r['score'] for r in file_results) / len(file_results)
+        overall_alignment = (self.total_aligned / self.total_rules * 100) if self.total_rules > 0 else 0
+        
+        result = {
+            'language': self.language,
+            'file_count': self.total_files,
+            'avg_score': avg_score,
+            'total_rules': self.total_rules,
+            'total_aligned': self.total_aligned,
+            'overall_alignment': overall_alignment,
+            'total_code_size': self.total_code_size,
+            'total_analysis_time': total_time,
+            'avg_processing_speed': avg_speed,
+            'files': file_results
+        }
+        
+        print(f"\n{self.language.upper()} Analysis Summary" + (f" ({self.analyzer.model_name})" if self.label_model else "") + ":")
+        print(f"  File count: {result['file_count']}")
+        print(f"  Average score: {result['avg_score']:.2f}%")
+        print(f"  Total rules: {result['total_rules']}")
+        print(f"  Total aligned: {result['total_aligned']}")
+        print(f"  Overall alignment rate: {result['overall_alignment']:.2f}%")
+        print(f"  Total code size: {result['total_code_size']/1024:.2f} KB")
+        print(f"  Total analysis time: {result['total_analysis_time']:.2f} seconds")
+        print(f"  Average processing speed: {result['avg_processing_speed']/1024:.2f} KB/sec")
+        
+        # If any remaining unflushed files and flush_every was set, save a final chunk for remainder
+        if self.flush_every and file_results:
+            self._save_chunk()
+        
+        return result
+
 
 class QuickMultiLanguageAnalyzer:
     """Quick Multilingual Analyzer - Using compiled libraries"""
     
-    def __init__(self, model_name: str = "gpt2", emit_utf16_offsets: bool = False, allowed_languages: Optional[List[str]] = None):
+    def __init__(self, model_name: str = "gpt2", emit_utf16_offsets: bool = False, allowed_languages: Optional[List[str]] = None, use_native: bool = True, result_format: str = 'json',
+                 result_cache: Optional[str] = None, detail_level: str = 'full', stream_compression: Optional[str] = None,
+                 rule_budget: int = 0, trace: bool = False, tokenizer_backend: str = 'hf', tokenizer_threads: int = 0):
         self.model_name = model_name
+        self.use_native = use_native
+        # Report files written by _save_results: 'json', 'compact' (.acr, see compact_results.py) or 'both'
+        self.result_format = result_format
+        # How much of each unaligned rule compact results keep: 'score', 'spans' or 'full' (DETAIL_LEVELS)
+        self.detail_level = detail_level
+        # --result_format ndjson: one ResultStream per output directory (result_stream.py), None or 'zstd'
+        self.stream_compression = stream_compression
+        self._result_streams: Dict[str, ResultStream] = {}
+        self._stream_lock = threading.Lock()
         self.tokenizer = AutoTokenizer.from_pretrained(model_name)
         self.emit_utf16_offsets = emit_utf16_offsets
         self.allowed_languages = set(allowed_languages) if allowed_languages else None
         
         # Language configurations
-        self.language_configs = {
-            'python': {'symbol': 'python', 'extensions': ['.py']},
-            'javascript': {'symbol': 'javascript', 'extensions': ['.js']},
-            'typescript': {'symbol': 'typescript', 'extensions': ['.ts']},
-            'java': {'symbol': 'java', 'extensions': ['.java']},
-            'c': {'symbol': 'c', 'extensions': ['.c', '.h']},
-            'cpp': {'symbol': 'cpp', 'extensions': ['.cpp', '.cc', '.cxx', '.hpp']},
-            'csharp': {'symbol': 'c_sharp', 'extensions': ['.cs']},
-            'go': {'symbol': 'go', 'extensions': ['.go']},
-            'ruby': {'symbol': 'ruby', 'extensions': ['.rb']},
-            'rust': {'symbol': 'rust', 'extensions': ['.rs']},
-            'scala': {'symbol': 'scala', 'extensions': ['.scala']}
-        }
+        self.language_configs = LANGUAGE_CONFIGS
         
         self.parsers = {}
         self.languages = {}
+        self.language_libraries: Dict[str, Path] = {}
         self._setup_parsers()
+
+        # Interned node type names for rules extracted in Python (RuleSpans.types index this list)
+        self._type_ids: Dict[str, int] = {}
+        self._type_names: List[str] = []
+        self._type_lock = threading.Lock()
+
+        # Batched tokenization (--tokenize_batch / --tokenize_batch_bytes): calls, files, seconds
+        self.tokenize_counters = Counter()
+
+        # --threads mode: the constructing thread uses self.parsers / self.native_core,
+        # pool threads get their own parser per language and native context
+        self._owner_thread = threading.get_ident()
+        self._thread_state = threading.local()
+
+        # Per-file limits: at most rule_budget rules are extracted and scored (0 = no limit),
+        # and a deadline armed with _begin_file_limits. Files cut short by a limit are
+        # counted under 'truncated', files with no result by the deadline under 'skipped'
+        self.rule_budget = max(0, int(rule_budget or 0))
+        self.limit_counters = Counter()
+        self._limit_lock = threading.Lock()
+
+        # Per-stage timers (stage_timers.py): seconds per (language, stage) summed over
+        # file results, and (language, 'files'); a trace of every stage with trace=True
+        self.stage_counters = Counter()
+        self._stage_lock = threading.Lock()
+        self.stage_trace = TraceRecorder() if trace else None
+
+        # Distinct and aligned rules per (language, node type), summed over file results
+        self.node_types = NodeTypeTotals()
+
+        # --sample_rate (sampling.py): sketch of the sampled files per language of the running analysis
+        self._samples: Dict[str, Sketch] = {}
+
+        # Prometheus metrics (metrics.py, --metrics_port): None until register_metrics;
+        # the pipeline of the running --pipeline analysis, for its queue depths
+        self.metrics: Optional[RunMetrics] = None
+        self._active_pipeline: Optional[Pipeline] = None
+
+        # Native alignment core (build/alignment_core.so); None keeps the Python scoring loop
+        self.native_core = None
+        self.native_languages = {}
+        if use_native:
+            self._setup_native_core()
+
+        # Where token byte spans come from (tokenizer_backends.py): the fast tokenizer's
+        # offset_mapping ('hf'), or byte-level BPE in the native core ('native_bpe')
+        self.tokenizer_backend = make_backend(tokenizer_backend, self.tokenizer, self.native_core, tokenizer_threads)
+        if self.tokenizer_backend.name != 'hf':
+            print(f"✓ tokenizer backend: {self.tokenizer_backend.describe()}")
+
+        # Persistent per-file results keyed by content hash (--result_cache, see result_cache.py)
+        self.result_cache_path = result_cache
+        self.result_cache = ResultCache(result_cache, model_name, detail_level) if result_cache else None
+        self._grammar_versions: Dict[str, str] = {}
+
+        # calculate_rule_level_incremental: FileState of the last revision per key, and
+        # files analyzed in full / incrementally / unchanged, rules rescored / reused
+        self._incremental_states: Dict[str, FileState] = {}
+        self.incremental_counters = Counter()
     
     def _normalize_language_name(self, raw_language: Optional[str]) -> Optional[str]:
         """Normalize various language labels to our internal keys.
@@ -200,92 +454,579 @@ class QuickMultiLanguageAnalyzer:
                 
                 self.parsers[lang_name] = parser
                 self.languages[lang_name] = language
+                self.language_libraries[lang_name] = library_path
                 print(f"✓ {lang_name} parser available (using {library_path.name})")
                 
             except Exception as e:
                 print(f"✗ {lang_name} parser unavailable: {e}")
     
+    def _setup_native_core(self):
+        """Load the native alignment core built by build_native.py, if present"""
+        self.native_core = load_native_core()
+        if self.native_core is None:
+            return
+        print(f"✓ native alignment core available (using {self.native_core.library_path.name})")
+        if self.native_core.unicode_version != unicodedata.unidata_version:
+            print(f"⚠️  native word-char table is Unicode {self.native_core.unicode_version}, Python has {unicodedata.unidata_version}; "
+                  f"rebuild with 'python build_native.py --regen_unicode' for exact parity")
+        if not self.native_core.has_tree_walker:
+            return
+        for lang_name, library_path in self.language_libraries.items():
+            native_language = self.native_core.load_language(library_path, self.language_configs[lang_name]['symbol'])
+            if native_language is not None:
+                self.native_languages[lang_name] = native_language
+        if self.native_languages:
+            print(f"✓ native tree walker available for: {', '.join(sorted(self.native_languages))}")
+
     def get_available_languages(self) -> List[str]:
         """Get list of available languages"""
         return list(self.parsers.keys())
+
+    def _thread_parser(self, language: str):
+        """Parser for language owned by the calling thread (a Parser must not be shared across threads)."""
+        if threading.get_ident() == self._owner_thread:
+            return self.parsers[language]
+        parsers = getattr(self._thread_state, 'parsers', None)
+        if parsers is None:
+            parsers = self._thread_state.parsers = {}
+        parser = parsers.get(language)
+        if parser is None:
+            parser = parsers[language] = Parser()
+            parser.set_language(self.languages[language])
+        return parser
+
+    def _thread_native_core(self):
+        """Native core with an ac_context owned by the calling thread, or None for the Python loop."""
+        core = self.native_core
+        if core is None or threading.get_ident() == self._owner_thread:
+            return core
+        if getattr(self._thread_state, 'native_core', None) is None:
+            self._thread_state.native_core = core.clone()
+        return self._thread_state.native_core
+
+    def _begin_file_limits(self, deadline: Optional[float]):
+        """Arm the calling thread's per-file deadline (a time.monotonic() value; None disarms it)."""
+        self._thread_state.deadline = deadline
+
+    def _file_deadline(self) -> Optional[float]:
+        return getattr(self._thread_state, 'deadline', None)
+
+    def _note_limit(self, reason: Optional[str]):
+        """Record that a limit cut the calling thread's current file short (the first one wins)."""
+        if reason and getattr(self._thread_state, 'limit_hit', None) is None:
+            self._thread_state.limit_hit = reason
+
+    def _deadline_passed(self, deadline: Optional[float]) -> bool:
+        if deadline is not None and time.monotonic() >= deadline:
+            self._note_limit('deadline')
+            return True
+        return False
+
+    def _count_limits(self, res: Dict) -> bool:
+        """Count a truncated or skipped per-file result; False for a skip, which has no result."""
+        skipped = res.get('skipped')
+        reason = skipped or res.get('truncated')
+        if reason:
+            with self._limit_lock:
+                self.limit_counters[('skipped' if skipped else 'truncated', reason)] += 1
+        return not skipped
+
+    def limit_report(self, before: Optional[Counter] = None) -> Optional[Dict]:
+        """Files truncated or skipped per limit since the counters snapshot before (None when there were none)."""
+        with self._limit_lock:
+            counters = self.limit_counters - (before or Counter())
+        if not counters:
+            return None
+        report = {'truncated': {}, 'skipped': {}}
+        for (kind, reason), count in sorted(counters.items()):
+            report[kind][reason] = count
+        if self.rule_budget:
+            report['rule_budget'] = self.rule_budget
+        return report
+
+    def _stage_clock(self) -> StageClock:
+        """The calling thread's stage timers (see stage_timers.py)."""
+        clock = getattr(self._thread_state, 'stage_clock', None)
+        if clock is None:
+            clock = self._thread_state.stage_clock = StageClock(self.stage_trace)
+        return clock
+
+    def _take_stage_times(self, label=None) -> Dict[str, float]:
+        """Seconds per stage of the calling thread's current file, for its result; resets the timers."""
+        return stage_seconds(self._stage_clock().take(label))
+
+    def _count_stage_times(self, language: str, res: Dict):
+        """Add a per-file result's stage times to the language totals (and its worker's trace events to ours)."""
+        events = res.pop('trace_events', None)
+        if events and self.stage_trace is not None:
+            self.stage_trace.extend(events)
+        stage_times = res.get('stage_times')
+        if stage_times is None:
+            return
+        with self._stage_lock:
+            self.stage_counters[(language, 'files')] += 1
+            for stage, seconds in stage_times.items():
+                self.stage_counters[(language, stage)] += seconds
+
+    def _count_node_types(self, language: str, table):
+        """Add the per-type counts of a per-file result's table to the language totals."""
+        if isinstance(table, UnalignedTable):
+            self.node_types.add(language, table.type_counts)
+
+    def _begin_sample(self, language: str, sample_rate: float, sample_seed: int, population: int = 0) -> Optional[Sketch]:
+        """Start the sketch of language's sampled files of an analysis (None and no sketch without sampling)."""
+        self._samples.pop(language, None)
+        if sample_rate >= 1:
+            return None
+        sketch = self._samples[language] = Sketch(sample_rate, sample_seed)
+        sketch.population = population
+        return sketch
+
+    def _count_sample(self, language: str, res: Dict):
+        """Add a per-file result to its language's sketch, when the analysis samples."""
+        sketch = self._samples.get(language)
+        if sketch is None:
+            return
+        table = res.get('unaligned_rules')
+        sketch.add(res['score'], res['total_rules'], res['aligned_rules'],
+                   table.type_counts if isinstance(table, UnalignedTable) else None)
+
+    def _with_sample(self, language: str, result: Dict) -> Dict:
+        """result with the language's sketch state under 'sample' (mergeable across shards, see sample_report).
+
+        Like the language itself, the sketch is left out when no file was sampled.
+        """
+        sketch = self._samples.pop(language, None)
+        if sketch is not None and result and result.get('file_count'):
+            result['sample'] = sketch.to_dict()
+        return result
+
+    def sample_report(self, results: Dict) -> Optional[Dict]:
+        """Estimates with 95% intervals from the sketches of per-language results (None unless they were sampled).
+
+        Node type estimates are lists indexed by the node_types_<model>.json ids.
+        """
+        sampled = {language: result['sample'] for language, result in results.items() if result.get('sample')}
+        if not sampled:
+            return None
+        table = self.node_types.table()
+        languages = {}
+        for language, state in sorted(sampled.items()):
+            type_ids = {name: i for i, name in enumerate(table.get(language, []))}
+            languages[language] = Sketch.from_dict(state).estimate(type_ids)
+        overall = merge_sketches(list(sampled.values())).estimate()
+        del overall['node_types']  # ids and names are per grammar
+        first = next(iter(sampled.values()))
+        return {'rate': first['rate'], 'seed': first['seed'], 'overall': overall, 'languages': languages}
+
+    def stage_report(self, before: Optional[Counter] = None) -> Optional[Dict]:
+        """Per-language stage breakdown since the counters snapshot before (None when no file was timed)."""
+        with self._stage_lock:
+            counters = self.stage_counters - (before or Counter())
+        seconds: Dict[str, Dict[str, float]] = defaultdict(dict)
+        files: Dict[str, int] = {}
+        for (language, stage), value in counters.items():
+            if stage == 'files':
+                files[language] = value
+            else:
+                seconds[language][stage] = value
+        if not files:
+            return None
+        return {language: stage_breakdown(seconds[language], files[language]) for language in sorted(files)}
+
+    def register_metrics(self, registry: Registry):
+        """Count files, bytes and latency into registry, and expose this analyzer's counters at scrape time."""
+        self.metrics = RunMetrics(registry)
+        registry.collector(self._collect_metrics)
+
+    def _observe_metrics(self, language: str, res: Dict):
+        """Add a per-file result to the metrics (no-op without register_metrics)."""
+        if self.metrics is None or 'code_size' not in res:
+            return
+        self.metrics.observe_file(self.model_name, language, res['code_size'], res.get('analysis_time', 0.0),
+                                  res.get('total_rules', 0), res.get('stage_times'))
+
+    def _collect_metrics(self):
+        """Metric families of the counters kept elsewhere: result cache, per-file limits, pipeline queues."""
+        model = self.model_name
+        if self.result_cache is not None:
+            counters = self.result_cache.counters
+            yield ('analyzer_cache_lookups_total', 'counter', 'Result cache lookups by outcome',
+                   [({'model': model, 'result': 'hit'}, counters['hits']),
+                    ({'model': model, 'result': 'miss'}, counters['misses'])])
+        with self._limit_lock:
+            limits = sorted(self.limit_counters.items())
+        yield ('analyzer_limited_files_total', 'counter',
+               'Files truncated or skipped by a per-file limit (deadline = timeout, rule_budget)',
+               [({'model': model, 'kind': kind, 'reason': reason}, count) for (kind, reason), count in limits])
+        pipeline = self._active_pipeline
+        if pipeline is not None:
+            yield ('analyzer_pipeline_queue_depth', 'gauge', 'Items waiting in front of a --pipeline stage',
+                   [({'model': model, 'stage': stage}, depth) for stage, depth in pipeline.queue_depths().items()])
+
+    def write_trace(self, path) -> Optional[int]:
+        """Write the stage trace to path as Chrome trace JSON; None without trace=True."""
+        if self.stage_trace is None:
+            return None
+        return self.stage_trace.write(path)
     
     def calculate_rule_level_alignment(self, code: str, language: str) -> Tuple[float, Dict]:
         """Calculate rule-level alignment score"""
+        score, _, _, rule_details = self._rule_level_alignment(code, language, include_aligned=True)
+        return score, rule_details
+
+    def calculate_rule_level_summary(self, code: str, language: str) -> Tuple[float, int, int, Dict]:
+        """Calculate alignment as (score, total_rules, aligned_rules, unaligned_details).
+
+        Counts match calculate_rule_level_alignment, but the details dict only holds
+        unaligned rules, so aligned rules never get a key or an entry built.
+        """
+        return self._rule_level_alignment(code, language, include_aligned=False)
+
+    def calculate_rule_level_compact(self, code: str, language: str, offsets: Optional[List] = None,
+                                     code_bytes=None) -> Tuple[float, int, int, UnalignedTable]:
+        """Like calculate_rule_level_summary, but unaligned rules are packed into an
+        UnalignedTable (compact_results.py) instead of one details dict per rule.
+
+        offsets is this file's offset_mapping when it was already tokenized in a batch,
+        code_bytes its UTF-8 bytes when already at hand (see read_source).
+        """
+        digest, cached = self._cache_lookup(code, language, code_bytes)
+        if cached is not None:
+            return cached
+        return self._compact_result(code, language, offsets, code_bytes, digest)
+
+    def _compact_result(self, code: str, language: str, offsets, code_bytes, digest: Optional[bytes],
+                        rules: Optional[RuleSpans] = None):
+        """Analyze code into a compact result, and store it in the result cache under digest.
+
+        rules are the file's already extracted rule spans, e.g. shared by several tokenizers;
+        a limit that truncated them marks this result truncated too.
+        """
+        if rules is not None:
+            self._thread_state.limit_hit = rules.truncated
+        table = UnalignedTable(self.detail_level)
+        score, rule_count, aligned_count, _ = self._rule_level_alignment(code, language, include_aligned=False, table=table,
+                                                                          offsets=offsets, code_bytes=code_bytes, rules=rules)
+        result = (score, rule_count, aligned_count, table)
+        # A truncated result depends on the limits (and the clock), so it is never cached
+        table.truncated = getattr(self._thread_state, 'limit_hit', None)
+        if digest is not None and table.truncated is None:
+            self.result_cache.put(digest, language, self._grammar_version(language), result)
+        return result
+
+    def _result_stream(self, output_dir: str) -> Optional[ResultStream]:
+        """The NDJSON stream of reports under output_dir, opened on first use (None unless --result_format ndjson)."""
+        if self.result_format != 'ndjson':
+            return None
+        key = str(Path(output_dir).resolve())
+        with self._stream_lock:
+            stream = self._result_streams.get(key)
+            if stream is None:
+                header = {'model': self.model_name, 'detail_level': self.detail_level}
+                try:
+                    stream = ResultStream(stream_path(output_dir, self.model_name, self.stream_compression), self.stream_compression, header)
+                except RuntimeError as e:
+                    print(f"⚠️  {e}; writing uncompressed NDJSON")
+                    self.stream_compression = None
+                    stream = ResultStream(stream_path(output_dir, self.model_name), None, header)
+                self._result_streams[key] = stream
+        return stream
+
+    def _close_result_stream(self, output_dir: str) -> Optional[ResultStream]:
+        with self._stream_lock:
+            stream = self._result_streams.pop(str(Path(output_dir).resolve()), None)
+        if stream is not None:
+            stream.close()
+        return stream
+
+    def _grammar_version(self, language: str) -> str:
+        version = self._grammar_versions.get(language)
+        if version is None:
+            version = self._grammar_versions[language] = grammar_version(
+                self.language_libraries[language], self.language_configs[language]['symbol'])
+        return version
+
+    def _cache_lookup(self, code: str, language: str, code_bytes=None) -> Tuple[Optional[bytes], Optional[Tuple]]:
+        """(content digest, cached compact result or None); (None, None) without --result_cache."""
+        if self.result_cache is None or language not in self.parsers:
+            return None, None
+        digest = content_digest(code_bytes if code_bytes is not None else code.encode('utf-8', errors='surrogatepass'))
+        return digest, self.result_cache.get(digest, language, self._grammar_version(language))
+
+    def _count_cache_hit(self, res: Dict):
+        """Fold the cache_hit flag of a worker process result into this process's counters."""
+        hit = res.pop('cache_hit', None)
+        if hit is not None and self.result_cache is not None:
+            self.result_cache.counters['hits' if hit else 'misses'] += 1
+
+    def cache_report(self, before: Optional[Counter] = None) -> Optional[Dict]:
+        """Result cache hit rate since the counters snapshot before (None without --result_cache)."""
+        if self.result_cache is None:
+            return None
+        counters = self.result_cache.counters - (before or Counter())
+        return dict(cache_summary(counters), path=str(self.result_cache.path))
+
+    def _batch_offset_mappings(self, codes: List[str], codes_bytes: Optional[List] = None) -> List[Optional[List]]:
+        """Token offsets of several files from one backend call (offset_mappings, or ByteBoundaries);
+        None entries are tokenized per file."""
+        return self.tokenizer_backend.encode_batch(codes, codes_bytes)
+
+    def _iter_batch_tokenized(self, samples, tokenize_batch: int = 0, tokenize_batch_bytes: int = 0):
+        """Score (code, language, payload, code_bytes or None) samples, tokenizing several files per tokenizer call.
+
+        Samples are gathered until tokenize_batch files or tokenize_batch_bytes characters,
+        whichever comes first, and tokenized with one batch call (the fast tokenizer
+        spreads a batch over its own threads). Yields (payload, code, compact result or
+        None on error, seconds); a batch's tokenization time is split over its files by size.
+        Files found in the result cache are not tokenized.
+        """
+        if tokenize_batch <= 1 and tokenize_batch_bytes <= 0:
+            for code, language, payload, code_bytes in samples:
+                start = time.time()
+                try:
+                    result = self.calculate_rule_level_compact(code, language, code_bytes=code_bytes)
+                except Exception:
+                    result = None
+                yield payload, code, result, time.time() - start
+            return
+
+        def score_batch(batch, batch_chars):
+            misses = [sample for sample, (_, cached, _) in zip(batch, lookups) if cached is None]
+            tokenize_time = 0.0
+            mappings = iter(())
+            clock = self._stage_clock()
+            tokenize_start = tokenize_ns = 0
+            if misses:
+                start = time.time()
+                tokenize_start = time.monotonic_ns()
+                mappings = iter(self._batch_offset_mappings([sample[0] for sample in misses], [sample[3] for sample in misses]))
+                tokenize_ns = time.monotonic_ns() - tokenize_start
+                tokenize_time = time.time() - start
+                self.tokenize_counters['batch_calls'] += 1
+                self.tokenize_counters['batched_files'] += len(misses)
+                self.tokenize_counters['batch_seconds'] += tokenize_time
+            for (code, language, payload, code_bytes), (digest, cached, lookup_time) in zip(batch, lookups):
+                if cached is not None:
+                    yield payload, code, cached, lookup_time
+                    continue
+                # Each file's share of the batch call, laid end to end on the trace
+                share_ns = tokenize_ns * len(code) // max(1, batch_chars)
+                clock.record('tokenize', tokenize_start, share_ns)
+                tokenize_start += share_ns
+                start = time.time()
+                try:
+                    result = self._compact_result(code, language, next(mappings), code_bytes, digest)
+                except Exception:
+                    result = None
+                yield payload, code, result, time.time() - start + lookup_time + tokenize_time * len(code) / max(1, batch_chars)
+
+        batch, lookups, batch_chars = [], [], 0
+        for sample in samples:
+            start = time.time()
+            digest, cached = self._cache_lookup(sample[0], sample[1], sample[3])
+            batch.append(sample)
+            lookups.append((digest, cached, time.time() - start))
+            if cached is None:
+                batch_chars += len(sample[0])
+            if (tokenize_batch > 0 and len(batch) >= tokenize_batch) or \
+                    (tokenize_batch_bytes > 0 and batch_chars >= tokenize_batch_bytes):
+                yield from score_batch(batch, batch_chars)
+                batch, lookups, batch_chars = [], [], 0
+        if batch:
+            yield from score_batch(batch, batch_chars)
+
+    def _iter_multi_model(self, samples, companions):
+        """Like _iter_batch_tokenized, scoring each file with this analyzer and each companion.
+
+        Yields (path, code, [compact result or None per model], [seconds per model]);
+        the shared parse and rule extraction are counted in every model's time.
+        """
+        analyzers = [self] + list(companions)
+        for code, language, file_path, code_bytes in samples:
+            start = time.time()
+            lookups = [a._cache_lookup(code, language, code_bytes) for a in analyzers]
+            rules = None
+            if any(cached is None for _, cached in lookups):
+                if code_bytes is None:
+                    code_bytes = code.encode('utf-8')
+                try:
+                    rules = self._extract_rules(code_bytes, language)
+                except Exception:
+                    yield file_path, code, [cached for _, cached in lookups], [time.time() - start] * len(analyzers)
+                    continue
+            shared_time = time.time() - start
+            # Like shared_time, the read and parse stages count for every model
+            shared_stages = dict(self._stage_clock().ns)
+            for a in companions:
+                a._stage_clock().merge(shared_stages)
+            results, times = [], []
+            for a, (digest, cached) in zip(analyzers, lookups):
+                start = time.time()
+                if cached is None:
+                    try:
+                        cached = a._compact_result(code, language, None, code_bytes, digest, rules=rules)
+                    except Exception:
+                        cached = None
+                results.append(cached)
+                times.append(shared_time + time.time() - start)
+            yield file_path, code, results, times
+
+    @staticmethod
+    def _file_result(file_path: Path, code: str, compact: Tuple, file_analysis_time: float,
+                     stage_times: Optional[Dict[str, float]] = None) -> Dict[str, Any]:
+        """Per-file result of a local file from its compact analysis (and its _take_stage_times)."""
+        score, rule_count, aligned_count, unaligned_rules_list = compact
+        code_size = len(code)
+        result = {
+            'file': file_path.name,
+            'path': str(file_path),
+            'score': score,
+            'total_rules': rule_count,
+            'aligned_rules': aligned_count,
+            'unaligned_rules': unaligned_rules_list,
+            'code_size': code_size,
+            'analysis_time': file_analysis_time,
+            'processing_speed': code_size / file_analysis_time if file_analysis_time > 0 else 0
+        }
+        if stage_times is not None:
+            result['stage_times'] = stage_times
+        if getattr(unaligned_rules_list, 'truncated', None):
+            result['truncated'] = unaligned_rules_list.truncated
+        return result
+
+    def _iter_incremental(self, samples, base_path: Path):
+        """Like _iter_batch_tokenized, scoring each file against its last revision.
+
+        Files are keyed by their path relative to base_path, so the same file in
+        successive checkouts of a repository is matched up.
+        """
+        for code, language, file_path, code_bytes in samples:
+            key = str(file_path.relative_to(base_path)) if base_path.is_dir() else file_path.name
+            start = time.time()
+            try:
+                result = self.calculate_rule_level_incremental(key, code, language, code_bytes=code_bytes)
+            except Exception:
+                result = None
+            yield file_path, code, result, time.time() - start
+
+    def _iter_file_samples(self, code_files, language: str):
+        """(code, language, path, code_bytes) for every readable, non-empty file."""
+        clock = self._stage_clock()
+        for file_path in code_files:
+            start = time.monotonic_ns()
+            try:
+                source = read_source(file_path)
+            except Exception:
+                continue
+            if source is not None:
+                clock.lap('read', start)
+                yield source[0], language, file_path, source[1]
+
+    def _rule_level_alignment(self, code: str, language: str, include_aligned: bool,
+                              table: Optional[UnalignedTable] = None, offsets: Optional[List] = None,
+                              code_bytes=None, rules: Optional[RuleSpans] = None) -> Tuple[float, int, int, Dict]:
         if language not in self.parsers:
             raise ValueError(f"Unsupported language: {language}")
         
-        parser = self.parsers[language]
-        code_bytes = code.encode('utf-8')
-        
-        # Parse code
+        if code_bytes is None:
+            code_bytes = code.encode('utf-8')
+        if rules is None:
+            rules = self._extract_rules(code_bytes, language)
+        return self._align_rules(code, code_bytes, rules, include_aligned, table=table, offsets=offsets)
+
+    def _extract_rules(self, code_bytes: bytes, language: str) -> RuleSpans:
+        """Parse code and extract rules (natively when the tree walker is built).
+
+        Native columns point into the calling thread's context and are only valid
+        until its next extract; use RuleSpans.detached() to hand them to another thread.
+        Starts a new file for the per-file limits: the walk stops at rule_budget rules
+        or at the thread's deadline, and a parse that runs out of time raises
+        DeadlineExceeded.
+        """
+        self._thread_state.limit_hit = None
+        deadline = self._file_deadline()
+        clock = self._stage_clock()
+        native_core = self._thread_native_core()
+        native_language = self.native_languages.get(language)
+        if native_language is not None and native_core is not None:
+            start = time.monotonic_ns()
+            try:
+                rules = native_core.extract_rules(native_language, code_bytes, deadline, self.rule_budget)
+                self._note_limit(native_core.limit_hit)
+                rules.truncated = self._thread_state.limit_hit
+                # The native core times the parse; walk is the rest of the call
+                parse_ns = native_core.stage_times().parse_ns
+                clock.record('parse', start, parse_ns)
+                clock.lap('walk', start + parse_ns)
+                return rules
+            except DeadlineExceeded:
+                self._note_limit('deadline')
+                raise
+            except RuntimeError:
+                pass
+        if not isinstance(code_bytes, bytes):
+            code_bytes = bytes(code_bytes)  # the Python binding only parses bytes
+        start = time.monotonic_ns()
+        tree = self._parse_before(self._thread_parser(language), code_bytes, deadline)
+        start = clock.lap('parse', start)
+        rules = self._extract_rule_spans(tree, deadline, self.rule_budget)
+        rules.truncated = self._thread_state.limit_hit
+        clock.lap('walk', start)
+        return rules
+
+    def _parse_before(self, parser, code_bytes: bytes, deadline: Optional[float]):
+        """parser.parse(code_bytes), given the time left until deadline when the binding supports timeouts."""
+        if deadline is None and not getattr(parser, 'timeout_micros', 0):
+            return parser.parse(code_bytes)
+        remaining = None if deadline is None else deadline - time.monotonic()
+        if remaining is not None and remaining <= 0:
+            self._note_limit('deadline')
+            raise DeadlineExceeded('deadline')
+        try:
+            parser.timeout_micros = 0 if remaining is None else max(1, int(remaining * 1e6))
+        except AttributeError:
+            pass  # older bindings: the parse runs to completion and the walk checks the deadline
         tree = parser.parse(code_bytes)
-        
-        # Extract rules
-        def extract_rules(node, rules=None):
-            if rules is None:
-                rules = []
-            
-            if node.type and not node.type.startswith('ERROR'):
-                rules.append({
-                    'type': node.type,
-                    'start_byte': node.start_byte,
-                    'end_byte': node.end_byte
-                })
-            
-            for child in node.children:
-                extract_rules(child, rules)
-            
-            return rules
-        
-        rules = extract_rules(tree.root_node)
-        
-        # Tokenization with reliable offsets (prefer fast tokenizer offset_mapping)
+        if tree is None:
+            parser.reset()
+            self._note_limit('deadline')
+            raise DeadlineExceeded('deadline')
+        return tree
+
+    def _align_rules(self, code: str, code_bytes: bytes, rules: RuleSpans, include_aligned: bool,
+                     table: Optional[UnalignedTable] = None, offsets: Optional[List] = None) -> Tuple[float, int, int, Dict]:
+        """Score extracted rules against the tokenization of code (or token offsets from a batch)."""
+        clock = self._stage_clock()
+        start = time.monotonic_ns()
+        # Tokenization with reliable offsets (the backend's offset_mapping or byte spans)
         token_boundaries = []
         token_source = 'offset_mapping'
+        tokenize_error = None
+        if offsets is None:
+            try:
+                offsets = self.tokenizer_backend.encode(code, code_bytes)
+            except Exception as e:
+                tokenize_error = e
+            start = clock.lap('tokenize', start)
+
+        # char->byte map for tokenizer offsets, and optionally byte->UTF-16 indices; byte spans
+        # scored natively need neither
+        if isinstance(offsets, ByteBoundaries) and self.native_core is not None:
+            char_to_byte = None
+            byte_to_utf16_index = self._offset_maps(code, code_bytes, True)[1] if self.emit_utf16_offsets else None
+        else:
+            char_to_byte, byte_to_utf16_index = self._offset_maps(code, code_bytes, self.emit_utf16_offsets)
+        start = clock.lap('offset_maps', start)
+
         try:
-            encoding = self.tokenizer(
-                code,
-                add_special_tokens=False,
-                return_offsets_mapping=True
-            )
-            offsets = encoding.get('offset_mapping')
             if offsets is None:
-                raise ValueError('offset_mapping not available')
-
-            # Build char->byte mapping once
-            char_to_byte = [0] * (len(code) + 1)
-            bpos = 0
-            for i, ch in enumerate(code):
-                blen = len(ch.encode('utf-8'))
-                char_to_byte[i] = bpos
-                bpos += blen
-            char_to_byte[len(code)] = len(code_bytes)
-
-            # Normalize and filter offsets; exclude zero-length pairs and specials
-            norm_offsets = []
-            for pair in offsets:
-                if pair is None:
-                    continue
-                if isinstance(pair, (list, tuple)) and len(pair) == 2:
-                    s, e = pair
-                else:
-                    continue
-                if s is None or e is None:
-                    continue
-                if e <= s:
-                    continue
-                s = max(0, min(s, len(code)))
-                e = max(0, min(e, len(code)))
-                norm_offsets.append((s, e))
-
-            token_boundaries = [(char_to_byte[s], char_to_byte[e]) for (s, e) in norm_offsets]
-
-            # Final guard: ensure we have tuples of two ints within range
-            token_boundaries = [
-                (int(max(0, min(sb, len(code_bytes)))), int(max(0, min(eb, len(code_bytes)))))
-                for (sb, eb) in token_boundaries
-                if isinstance(sb, int) and isinstance(eb, int) and eb > sb
-            ]
+                raise ValueError(f'offset_mapping not available ({tokenize_error})')
+            if isinstance(offsets, ByteBoundaries):
+                token_boundaries = offsets
+                token_source = offsets.token_source
+            else:
+                token_boundaries = self._offset_boundaries(code, code_bytes, char_to_byte, offsets)
         except Exception:
             # Fallback: heuristic byte-search per token id (less reliable across tokenizers)
             try:
@@ -293,7 +1034,7 @@ class QuickMultiLanguageAnalyzer:
                 token_texts = [self.tokenizer.decode([token], clean_up_tokenization_spaces=False) for token in tokens]
             except Exception as e:
                 print(f"Tokenization error: {e}")
-                return 0.0, {}
+                return 0.0, 0, 0, {}
             token_source = 'heuristic_decode'
 
         # Build token boundaries if we fell back or need to reconstruct
@@ -323,10 +1064,359 @@ class QuickMultiLanguageAnalyzer:
         if not token_boundaries:
             token_source = 'single_byte_fallback'
             token_boundaries = [(i, i + 1) for i in range(len(code_bytes))]
+        start = clock.lap('tokenize', start)
+
+        # Unaligned rules become details dicts, or rows of the caller's table; a 'score'
+        # table only needs the counts (make_entry None), a 'spans' one no previews
+        make_entry = self._unaligned_details_entry
+        contexts = True
+        if table is not None:
+            contexts = table.detail == 'full'
+            if table.detail == 'score':
+                make_entry = None
+            else:
+                def make_entry(rule_type, rule_start, rule_end, code_bytes, *boundary_info):
+                    text_preview = self._text_preview(code_bytes, rule_start, rule_end) if contexts else None
+                    return table.add(rule_type, rule_start, rule_end, text_preview, *boundary_info)
+
+        # The tokenizer call cannot be interrupted; the scoring loop checks the deadline again
+        deadline = self._file_deadline()
+        type_counts = table.type_counts if table is not None else None
+        if self.native_core is not None:
+            return self._score_rules_native(code_bytes, rules, token_boundaries, token_source, byte_to_utf16_index, include_aligned,
+                                            make_entry, contexts, deadline, self.rule_budget, type_counts)
+
+        if make_entry is None:
+            alignment_score, counted = self._score_rules_python(code, code_bytes, char_to_byte, rules, token_boundaries, token_source, None, None,
+                                                                deadline=deadline, max_rules=self.rule_budget, type_counts=type_counts)
+            clock.lap('score', start)
+            return alignment_score, len(counted), sum(counted.values()), {}
+        alignment_score, rule_details = self._score_rules_python(code, code_bytes, char_to_byte, rules, token_boundaries, token_source, byte_to_utf16_index,
+                                                                 make_entry, contexts, deadline, self.rule_budget, type_counts)
+        clock.lap('score', start)
+        aligned_count = sum(1 for d in rule_details.values() if d['fully_aligned'])
+        total_rules = len(rule_details)
+        if not include_aligned:
+            rule_details = {rk: rd for rk, rd in rule_details.items() if not rd['fully_aligned']}
+        return alignment_score, total_rules, aligned_count, rule_details
+
+    @staticmethod
+    def _offset_boundaries(code: str, code_bytes: bytes, char_to_byte, offsets) -> List[Tuple[int, int]]:
+        """Byte-offset token boundaries from a tokenizer offset_mapping over code."""
+        # Normalize and filter offsets; exclude zero-length pairs and specials
+        norm_offsets = []
+        for pair in offsets:
+            if pair is None:
+                continue
+            if isinstance(pair, (list, tuple)) and len(pair) == 2:
+                s, e = pair
+            else:
+                continue
+            if s is None or e is None:
+                continue
+            if e <= s:
+                continue
+            s = max(0, min(s, len(code)))
+            e = max(0, min(e, len(code)))
+            norm_offsets.append((s, e))
+
+        token_boundaries = [(char_to_byte[s], char_to_byte[e]) for (s, e) in norm_offsets]
+
+        # Final guard: ensure we have tuples of two ints within range
+        return [
+            (int(max(0, min(sb, len(code_bytes)))), int(max(0, min(eb, len(code_bytes)))))
+            for (sb, eb) in token_boundaries
+            if isinstance(sb, int) and isinstance(eb, int) and eb > sb
+        ]
+
+    def _extract_rule_spans(self, tree, deadline: Optional[float] = None, max_rules: int = 0) -> RuleSpans:
+        """Pre-order walk with a TreeCursor, collecting every non-ERROR node into flat arrays.
+
+        With a deadline or max_rules, the walk stops early and keeps the rules found so far.
+        """
+        type_ids = self._type_ids
+        type_names = self._type_names
+        types, starts, ends = array('I'), array('I'), array('I')
+        cursor = tree.walk()
+        visited = 0
+        while True:
+            if deadline is not None:
+                visited += 1
+                if visited % LIMIT_CHECK_INTERVAL == 0 and self._deadline_passed(deadline):
+                    return RuleSpans(types, starts, ends, len(types), type_names)
+            node = cursor.node
+            node_type = node.type
+            if node_type and not node_type.startswith('ERROR'):
+                if max_rules and len(types) >= max_rules:
+                    self._note_limit('rule_budget')
+                    return RuleSpans(types, starts, ends, len(types), type_names)
+                type_id = type_ids.get(node_type)
+                if type_id is None:
+                    with self._type_lock:
+                        type_id = type_ids.get(node_type)
+                        if type_id is None:
+                            type_names.append(node_type)
+                            type_id = type_ids[node_type] = len(type_names) - 1
+                types.append(type_id)
+                starts.append(node.start_byte)
+                ends.append(node.end_byte)
+            if cursor.goto_first_child():
+                continue
+            while not cursor.goto_next_sibling():
+                if not cursor.goto_parent():
+                    return RuleSpans(types, starts, ends, len(types), type_names)
+
+    def calculate_rule_level_incremental(self, key: str, code: str, language: str,
+                                         code_bytes=None) -> Tuple[float, int, int, UnalignedTable]:
+        """calculate_rule_level_compact for a new revision of the file last analyzed under key.
+
+        The previous revision's tree, token boundaries and rule results are kept per
+        key (incremental.py). The new code is diffed against them, the old tree is
+        edited and reparsed, only a few lines around each edit are re-tokenized and
+        only rules intersecting those windows are scored again. The first revision
+        of a key is analyzed in full. Uses the Python tree-sitter binding (the native
+        walker cannot reparse an edited tree); not safe across threads.
+
+        rule_budget holds here too: a revision with more rules goes through the
+        full path, which truncates and flags it, and keeps no state (a later
+        revision has no complete rule set to splice into).
+        """
+        if language not in self.parsers:
+            raise ValueError(f"Unsupported language: {language}")
+        if code_bytes is None:
+            code_bytes = code.encode('utf-8')
+        elif not isinstance(code_bytes, bytes):
+            code_bytes = bytes(code_bytes)
+        old = self._incremental_states.pop(key, None)
+        if old is not None and old.language != language:
+            old = None
+        if old is not None and old.code_bytes == code_bytes:
+            self.incremental_counters['unchanged'] += 1
+            self._incremental_states[key] = old
+            return old.result
+
+        parser = self._thread_parser(language)
+        splice = None
+        if old is not None:
+            edits = line_edits(old.code_bytes, code_bytes)
+            apply_tree_edits(old.tree, edits, old.code_bytes, code_bytes)
+            tree = parser.parse(code_bytes, old.tree)
+            if old.token_source in ('offset_mapping', ByteBoundaries.token_source):
+                splice = splice_tokens(old.token_starts, old.token_ends, code_bytes, edits,
+                                       lambda ws, we: self._window_token_boundaries(code_bytes, ws, we))
+        else:
+            tree = parser.parse(code_bytes)
+
+        state = FileState(language, code, code_bytes, tree)
+        if splice is not None:
+            windows = splice.windows + [(r.start_byte, r.end_byte) for r in old.tree.changed_ranges(tree)]
+            state.token_starts, state.token_ends = splice.starts, splice.ends
+            state.token_source = old.token_source
+            self.incremental_counters['incremental'] += 1
+        else:
+            token_boundaries = self._token_boundaries(code, code_bytes) or []
+            if not token_boundaries:
+                # Heuristic token boundaries are only rebuilt in full; keep no state for them
+                self.incremental_counters['full'] += 1
+                return self.calculate_rule_level_compact(code, language, code_bytes=code_bytes)
+            state.token_starts = [tb[0] for tb in token_boundaries]
+            state.token_ends = [tb[1] for tb in token_boundaries]
+            state.token_source = getattr(token_boundaries, 'token_source', 'offset_mapping')
+            windows, old = [(0, len(code_bytes))], None
+            self.incremental_counters['full'] += 1
+
+        fresh, copied_rows = self._incremental_rules(state, merge_windows(windows), old, splice)
+        if self.rule_budget and len(state.types) > self.rule_budget:
+            if splice is not None:
+                self.incremental_counters['incremental'] -= 1
+                self.incremental_counters['full'] += 1
+            return self._compact_result(code, language, None, code_bytes, None)
+        fresh_rows = self._score_fresh_rules(state, fresh)
+        rows = sorted(copied_rows + fresh_rows, key=lambda item: item[0])
+        state.row_index = array('I', [index for index, _ in rows])
+        state.rows = [row for _, row in rows]
+        self.incremental_counters['rescored_rules'] += len(fresh)
+        self.incremental_counters['reused_rules'] += len(state.types) - len(fresh)
+
+        count = len(state.types)
+        table = UnalignedTable(self.detail_level)
+        for row in state.rows:
+            table.add(row[0], row[1], row[2], row[3], state.token_source, *row[4:])
+        table.type_counts = column_type_counts(state.types, state.dup, state.unaligned, self._type_names)
+        distinct_rules = count - state.dup.count(1)
+        score = ((count - state.unaligned.count(1)) / count * 100) if count else 0
+        state.result = (score, distinct_rules, distinct_rules - len(state.rows), table)
+        self._incremental_states[key] = state
+        return state.result
+
+    def _window_token_boundaries(self, code_bytes: bytes, ws: int, we: int) -> Optional[List[Tuple[int, int]]]:
+        """Token boundaries of code_bytes[ws:we] (whole lines), relative to ws."""
+        window_bytes = code_bytes[ws:we]
+        try:
+            window = window_bytes.decode('utf-8')
+        except UnicodeDecodeError:
+            return None
+        return self._token_boundaries(window, window_bytes)
+
+    def _token_boundaries(self, code: str, code_bytes: bytes) -> Optional[List[Tuple[int, int]]]:
+        """Token byte spans of code from the tokenizer backend; None without offsets."""
+        try:
+            offsets = self.tokenizer_backend.encode(code, code_bytes)
+        except Exception:
+            return None
+        if offsets is None or isinstance(offsets, ByteBoundaries):
+            return offsets
+        char_to_byte, _ = self._offset_maps(code, code_bytes, False)
+        return self._offset_boundaries(code, code_bytes, char_to_byte, offsets)
+
+    def _intern_type(self, node_type: str) -> int:
+        type_id = self._type_ids.get(node_type)
+        if type_id is None:
+            with self._type_lock:
+                type_id = self._type_ids.get(node_type)
+                if type_id is None:
+                    self._type_names.append(node_type)
+                    type_id = self._type_ids[node_type] = len(self._type_names) - 1
+        return type_id
+
+    def _incremental_rules(self, state, windows: List[Tuple[int, int]], old, splice):
+        """Fill state's rule columns from its tree, in the pre-order _extract_rule_spans uses.
+
+        A rule outside every (closed) window whose subtree was already in old is
+        copied over with its whole subtree, shifted to its new position, instead of
+        being walked. Returns the indices of the rules left to score, and the
+        shifted (index, row) unaligned rows of the copied ones.
+        """
+        types, starts, ends, sizes = state.types, state.starts, state.ends, state.sizes
+        dup, unaligned = state.dup, state.unaligned
+        window_starts = [w[0] for w in windows]
+        fresh = []
+        copied_rows = []
+        open_rules = []  # (depth, index) of walked rules whose subtree is not finished
+        cursor = state.tree.walk()
+        depth = 0
+        while True:
+            node = cursor.node
+            node_type = node.type
+            descend = True
+            if node_type and not node_type.startswith('ERROR'):
+                type_id = self._intern_type(node_type)
+                start, end = node.start_byte, node.end_byte
+                index = len(types)
+                # Same (type, start, end) as an earlier rule? Those share this start, so they are adjacent
+                k = index - 1
+                while k >= 0 and starts[k] == start and not (ends[k] == end and types[k] == type_id):
+                    k -= 1
+                repeat = int(k >= 0 and starts[k] == start)
+                w = bisect_right(window_starts, end)
+                old_index = None
+                if old is not None and (w == 0 or windows[w - 1][1] < start):
+                    byte_shift, token_shift = region_delta(splice, start)
+                    old_index = self._old_rule_index(old, type_id, start - byte_shift, end - byte_shift)
+                    if old_index is not None and old.dup[old_index] != repeat:
+                        old_index = None
+                if old_index is not None:
+                    stop = old_index + old.sizes[old_index]
+                    types.extend(old.types[old_index:stop])
+                    if byte_shift:
+                        starts.extend(v + byte_shift for v in old.starts[old_index:stop])
+                        ends.extend(v + byte_shift for v in old.ends[old_index:stop])
+                    else:
+                        starts.extend(old.starts[old_index:stop])
+                        ends.extend(old.ends[old_index:stop])
+                    sizes.extend(old.sizes[old_index:stop])
+                    dup.extend(old.dup[old_index:stop])
+                    unaligned.extend(old.unaligned[old_index:stop])
+                    for r in range(bisect_left(old.row_index, old_index), bisect_left(old.row_index, stop)):
+                        copied_rows.append((old.row_index[r] - old_index + index,
+                                            shift_row(old.rows[r], byte_shift, token_shift)))
+                    descend = False
+                else:
+                    types.append(type_id)
+                    starts.append(start)
+                    ends.append(end)
+                    sizes.append(1)
+                    dup.append(repeat)
+                    unaligned.append(0)
+                    fresh.append(index)
+                    open_rules.append((depth, index))
+            if descend and cursor.goto_first_child():
+                depth += 1
+                continue
+            while True:
+                while open_rules and open_rules[-1][0] >= depth:
+                    _, index = open_rules.pop()
+                    sizes[index] = len(types) - index
+                if cursor.goto_next_sibling():
+                    break
+                if not cursor.goto_parent():
+                    return fresh, copied_rows
+                depth -= 1
+
+    @staticmethod
+    def _old_rule_index(old, type_id: int, start: int, end: int) -> Optional[int]:
+        """Index of the first rule (type_id, start, end) of the previous revision, if any."""
+        k = bisect_left(old.starts, start)
+        while k < len(old.starts) and old.starts[k] == start:
+            if old.ends[k] == end and old.types[k] == type_id:
+                return k
+            k += 1
+        return None
+
+    def _score_fresh_rules(self, state, fresh: List[int]) -> List[Tuple[int, Tuple]]:
+        """Score the rules at indices fresh; marks them in state.unaligned and returns their (index, row) rows."""
+        if not fresh:
+            return []
+        code, code_bytes = state.code, state.code_bytes
+        rules = RuleSpans(array('I', [state.types[i] for i in fresh]), array('I', [state.starts[i] for i in fresh]),
+                          array('I', [state.ends[i] for i in fresh]), len(fresh), self._type_names)
+        token_boundaries = list(zip(state.token_starts, state.token_ends))
+
+        def make_entry(rule_type, rule_start, rule_end, code_bytes, token_source, *boundary_info):
+            return {'fully_aligned': False,
+                    'row': (rule_type, rule_start, rule_end, self._text_preview(code_bytes, rule_start, rule_end), *boundary_info)}
+
+        if self.native_core is not None:
+            _, _, _, details = self._score_rules_native(code_bytes, rules, token_boundaries, state.token_source, None, False, make_entry)
+        else:
+            char_to_byte, _ = self._offset_maps(code, code_bytes, False)
+            _, details = self._score_rules_python(code, code_bytes, char_to_byte, rules, token_boundaries, state.token_source, None, make_entry)
+        rows = []
+        for j, index in enumerate(fresh):
+            entry = details.get(f"{rules.type_name(j)}_{rules.starts[j]}_{rules.ends[j]}")
+            if entry is None or entry['fully_aligned']:
+                continue
+            state.unaligned[index] = 1
+            if not state.dup[index]:
+                rows.append((index, entry['row']))
+        return rows
+
+    def _offset_maps(self, code: str, code_bytes: bytes, with_utf16: bool):
+        """char->byte map (len(code) + 1 entries) and, if requested, the byte->UTF-16 index map.
+
+        Pure ASCII needs no work (both maps are the identity); otherwise the native
+        kernel builds both in one pass, with the per-character Python loop as fallback.
+        """
+        if code.isascii():
+            identity = range(len(code_bytes) + 1)
+            return identity, (identity if with_utf16 else None)
+        native_core = self._thread_native_core()
+        if native_core is not None:
+            try:
+                return native_core.offset_maps(code_bytes, len(code), with_utf16)
+            except RuntimeError:
+                pass
+
+        char_to_byte = [0] * (len(code) + 1)
+        bpos = 0
+        for i, ch in enumerate(code):
+            char_to_byte[i] = bpos
+            bpos += len(ch.encode('utf-8'))
+        char_to_byte[len(code)] = len(code_bytes)
 
         # Optionally build byte->UTF16 code unit index mapping (for emoji safety / external consumers)
         byte_to_utf16_index = None
-        if self.emit_utf16_offsets:
+        if with_utf16:
             try:
                 # Build mapping of byte positions to UTF-16 code unit indices
                 byte_to_utf16_index = [0] * (len(code_bytes) + 1)
@@ -346,37 +1436,173 @@ class QuickMultiLanguageAnalyzer:
                     utf16_index += units
             except Exception:
                 byte_to_utf16_index = None
-        
+        return char_to_byte, byte_to_utf16_index
+
+    @staticmethod
+    def _token_context(code_bytes: bytes, token_boundaries: List[Tuple[int, int]], idx: int) -> Dict:
+        tb_start, tb_end = token_boundaries[idx]
+        # 50 characters never need more than 200 UTF-8 bytes
+        text = code_bytes[tb_start:min(tb_end, tb_start + 200)].decode('utf-8', errors='ignore')
+        return {
+            'token_index': idx,
+            'token_start': tb_start,
+            'token_end': tb_end,
+            'token_text_preview': text[:50]
+        }
+
+    @staticmethod
+    def _text_preview(code_bytes: bytes, rule_start: int, rule_end: int) -> str:
+        return code_bytes[rule_start:min(rule_end, rule_start + 200)].decode('utf-8', errors='ignore')[:50]
+
+    @staticmethod
+    def _unaligned_details_entry(rule_type: str, rule_start: int, rule_end: int, code_bytes: bytes, token_source: str,
+                                 start_chars: Optional[Tuple[str, str]], end_chars: Optional[Tuple[str, str]],
+                                 token_start_context: Optional[Dict], token_end_context: Optional[Dict]) -> Dict:
+        """Details for a rule whose start and/or end boundary splits a word.
+
+        start_chars/end_chars are the (left, right) characters of a crossing boundary, None if not crossing.
+        """
+        return unaligned_details_entry(
+            rule_type, rule_start, rule_end, QuickMultiLanguageAnalyzer._text_preview(code_bytes, rule_start, rule_end),
+            token_source, start_chars, end_chars, token_start_context, token_end_context)
+
+    @staticmethod
+    def _attach_utf16(details_entry: Dict, sb: int, eb: int, byte_to_utf16_index: Optional[List[int]]):
+        if byte_to_utf16_index is not None:
+            if 0 <= sb < len(byte_to_utf16_index):
+                details_entry['start_utf16'] = byte_to_utf16_index[sb]
+            if 0 <= eb <= len(byte_to_utf16_index):
+                details_entry['end_utf16'] = byte_to_utf16_index[eb]
+
+    def _score_rules_native(self, code_bytes: bytes, rules: RuleSpans, token_boundaries: List[Tuple[int, int]],
+                            token_source: str, byte_to_utf16_index: Optional[List[int]],
+                            include_aligned: bool, make_entry, contexts: bool = True,
+                            deadline: Optional[float] = None, max_rules: int = 0,
+                            type_counts: Optional[Dict] = None) -> Tuple[float, int, int, Dict]:
+        """Score rules with the native core; only unaligned rules are materialized in Python.
+
+        make_entry None only counts (no details); contexts=False skips the token contexts.
+        With a deadline or max_rules, the counters cover the rules scored before the loop stopped.
+        type_counts, if given, gets the (distinct rules, distinct aligned) of each node type.
+        """
+        clock = self._stage_clock()
+        start = time.monotonic_ns()
+        token_starts = array('I', [tb[0] for tb in token_boundaries])
+        token_ends = array('I', [tb[1] for tb in token_boundaries])
+        native_core = self._thread_native_core()
+        stats, records = native_core.score_rules(code_bytes, rules, token_starts, token_ends, deadline, max_rules)
+        self._note_limit(native_core.limit_hit)
+        if type_counts is not None:
+            type_counts.update(native_core.type_counts(stats, rules.type_names))
+        # dedup as timed by the native core; score is the rest, including the details built below
+        dedup_ns = native_core.stage_times().dedup_ns
+        clock.record('dedup', start, dedup_ns)
+        start += dedup_ns
+        alignment_score = (stats.aligned_rules / stats.total_rules * 100) if stats.total_rules else 0
+        if make_entry is None:
+            clock.lap('score', start)
+            return alignment_score, stats.distinct_rules, stats.distinct_aligned, {}
+
+        unaligned = {}
+        for rec in records:
+            i = rec.rule_index
+            rule_start, rule_end = rules.starts[i], rules.ends[i]
+            crossing_start = bool(rec.flags & CROSS_START)
+            crossing_end = bool(rec.flags & CROSS_END)
+            entry = make_entry(
+                rules.type_name(i), rule_start, rule_end, code_bytes, token_source,
+                (chr(rec.start_prev_cp), chr(rec.start_curr_cp)) if crossing_start else None,
+                (chr(rec.end_prev_cp), chr(rec.end_curr_cp)) if crossing_end else None,
+                self._token_context(code_bytes, token_boundaries, rec.start_token) if contexts and rec.start_token >= 0 else None,
+                self._token_context(code_bytes, token_boundaries, rec.end_token) if contexts and rec.end_token >= 0 else None,
+            )
+            self._attach_utf16(entry, rule_start, rule_end, byte_to_utf16_index)
+            unaligned[i] = entry
+
+        if include_aligned:
+            # Rebuild the full details dict in rule order (first occurrence of each key wins its slot)
+            rule_details = {}
+            for i in range(stats.total_rules):
+                rule_start, rule_end = rules.starts[i], rules.ends[i]
+                rule_key = f"{rules.type_name(i)}_{rule_start}_{rule_end}"
+                if rule_key in rule_details:
+                    continue
+                entry = unaligned.get(i)
+                if entry is None:
+                    entry = {'fully_aligned': True}
+                    self._attach_utf16(entry, rule_start, rule_end, byte_to_utf16_index)
+                rule_details[rule_key] = entry
+        else:
+            rule_details = {
+                f"{rules.type_name(i)}_{rules.starts[i]}_{rules.ends[i]}": entry
+                for i, entry in unaligned.items()
+            }
+        clock.lap('score', start)
+        return alignment_score, stats.distinct_rules, stats.distinct_aligned, rule_details
+
+    def _score_rules_python(self, code: str, code_bytes: bytes, char_to_byte, rules: RuleSpans, token_boundaries: List[Tuple[int, int]],
+                            token_source: str, byte_to_utf16_index: Optional[List[int]], make_entry,
+                            contexts: bool = True, deadline: Optional[float] = None, max_rules: int = 0,
+                            type_counts: Optional[Dict] = None) -> Tuple[float, Dict]:
+        """Reference scoring loop, used when the native core is not built.
+
+        With make_entry None the dict only maps each distinct (type id, start, end)
+        to whether it is fully aligned; contexts=False skips the token contexts.
+        Stops after max_rules rules, or at the deadline (checked like the native loop).
+        type_counts, if given, gets the (distinct rules, distinct aligned) of each node type.
+        """
         # Calculate alignment with boundary-crossing detection
         aligned_rules = 0
         rule_details = {}
         
+        # Tokenizer offsets are monotone, so the tokens starting before pos form a prefix
+        # and the ones ending after it a suffix of that prefix: two bisects find the first match
+        token_starts = [tb[0] for tb in token_boundaries]
+        token_ends = [tb[1] for tb in token_boundaries]
+        monotone_tokens = all(
+            token_starts[k - 1] <= token_starts[k] and token_ends[k - 1] <= token_ends[k]
+            for k in range(1, len(token_boundaries))
+        )
+
         def _find_containing_token(pos):
+            if monotone_tokens:
+                prefix = bisect_left(token_starts, pos)
+                idx = bisect_right(token_ends, pos, 0, prefix)
+                return idx if idx < prefix else None
             for idx, (tb_start, tb_end) in enumerate(token_boundaries):
                 if tb_start < pos < tb_end:
-                    return idx, tb_start, tb_end
+                    return idx
             return None
 
-        # Build char->byte and byte->char boundary maps for mid-word detection (independent of tokenizer)
-        if 'char_to_byte' not in locals():
-            char_to_byte = [0] * (len(code) + 1)
-            bpos_tmp = 0
-            for i_tmp, ch_tmp in enumerate(code):
-                char_to_byte[i_tmp] = bpos_tmp
-                bpos_tmp += len(ch_tmp.encode('utf-8'))
-            char_to_byte[len(code)] = len(code_bytes)
-        byte_to_char = {char_to_byte[i]: i for i in range(len(char_to_byte))}
+        # byte->char boundary map for mid-word detection (independent of tokenizer); identity for ASCII
+        if code.isascii():
+            byte_to_char_get = lambda b: b if 0 <= b <= len(code) else None
+        else:
+            byte_to_char_get = {char_to_byte[i]: i for i in range(len(char_to_byte))}.get
 
         def _is_word_char(ch: str) -> bool:
             return ch.isalnum() or ch == '_'
 
-        for rule in rules:
-            rule_start = rule['start_byte']
-            rule_end = rule['end_byte']
+        # Distinct and distinct aligned rules per type id, like the native loop's arrays
+        type_rules = [0] * len(rules.type_names)
+        type_aligned = [0] * len(rules.type_names)
+
+        rule_count = rules.count
+        if max_rules and rule_count > max_rules:
+            rule_count = max_rules
+            self._note_limit('rule_budget')
+        for i in range(rule_count):
+            if deadline is not None and i and i % LIMIT_CHECK_INTERVAL == 0 and self._deadline_passed(deadline):
+                rule_count = i
+                break
+            type_id = rules.types[i]
+            rule_type = rules.type_names[type_id]
+            rule_start = rules.starts[i]
+            rule_end = rules.ends[i]
             
             # Mid-word boundary detection based on source text, per research definition
-            start_ci = byte_to_char.get(rule_start)
-            end_ci = byte_to_char.get(rule_end)
+            start_ci = byte_to_char_get(rule_start)
+            end_ci = byte_to_char_get(rule_end)
 
             prev_ch_s = code[start_ci - 1] if start_ci is not None and start_ci > 0 else None
             curr_ch_s = code[start_ci] if start_ci is not None and start_ci < len(code) else None
@@ -386,94 +1612,267 @@ class QuickMultiLanguageAnalyzer:
             curr_ch_e = code[end_ci] if end_ci is not None and end_ci < len(code) else None
             mid_word_end = bool(prev_ch_e and curr_ch_e and _is_word_char(prev_ch_e) and _is_word_char(curr_ch_e))
 
-            # Aligned if boundary does not split a word
-            start_aligned = not mid_word_start
-            end_aligned = not mid_word_end
-
             # Crossing = only when a boundary splits a word
-            crossing_start = mid_word_start
-            crossing_end = mid_word_end
-
             fully_aligned = not (mid_word_start or mid_word_end)
             if fully_aligned:
                 aligned_rules += 1
+            if make_entry is None:
+                key = (type_id, rule_start, rule_end)
+                if key not in rule_details:
+                    rule_details[key] = fully_aligned
+                    type_rules[type_id] += 1
+                    type_aligned[type_id] += fully_aligned
+                continue
             
-            rule_key = f"{rule['type']}_{rule['start_byte']}_{rule['end_byte']}"
-
-            # Only compute token context if boundary splits a word
-            crossing_start_reason = None
-            token_start_context = None
-            if crossing_start:
-                start_cross_info = _find_containing_token(rule_start)
-                if start_cross_info is not None:
-                    s_idx, s_tb, s_te = start_cross_info
-                    s_text = code_bytes[s_tb:s_te].decode('utf-8', errors='ignore')
-                    token_start_context = {
-                        'token_index': s_idx,
-                        'token_start': s_tb,
-                        'token_end': s_te,
-                        'token_text_preview': s_text[:50]
-                    }
-                left = prev_ch_s if prev_ch_s is not None else ''
-                right = curr_ch_s if curr_ch_s is not None else ''
-                crossing_start_reason = f"rule.start_byte={rule_start} splits word between '{left}' and '{right}'"
-
-            crossing_end_reason = None
-            token_end_context = None
-            if crossing_end:
-                end_cross_info = _find_containing_token(rule_end)
-                if end_cross_info is not None:
-                    e_idx, e_tb, e_te = end_cross_info
-                    e_text = code_bytes[e_tb:e_te].decode('utf-8', errors='ignore')
-                    token_end_context = {
-                        'token_index': e_idx,
-                        'token_start': e_tb,
-                        'token_end': e_te,
-                        'token_text_preview': e_text[:50]
-                    }
-                left = prev_ch_e if prev_ch_e is not None else ''
-                right = curr_ch_e if curr_ch_e is not None else ''
-                crossing_end_reason = f"rule.end_byte={rule_end} splits word between '{left}' and '{right}'"
+            rule_key = f"{rule_type}_{rule_start}_{rule_end}"
+            if rule_key in rule_details:
+                # Same (type, start, end) as an earlier rule: identical entry, already recorded
+                continue
+            type_rules[type_id] += 1
+            type_aligned[type_id] += fully_aligned
 
             if fully_aligned:
                 details_entry = {
                     'fully_aligned': True
                 }
             else:
-                details_entry = {
-                    'type': rule['type'],
-                    'start_byte': rule['start_byte'],
-                    'end_byte': rule['end_byte'],
-                    'start_aligned': start_aligned,
-                    'end_aligned': end_aligned,
-                    'crossing_start': crossing_start,
-                    'crossing_end': crossing_end,
-                    'crossing_start_reason': crossing_start_reason,
-                    'crossing_end_reason': crossing_end_reason,
-                    'token_start_context': token_start_context,
-                    'token_end_context': token_end_context,
-                    'fully_aligned': False,
-                    'text_preview': code_bytes[rule_start:rule_end].decode('utf-8', errors='ignore')[:50],
-                    'explain_tree_sitter': f"Tree-sitter node '{rule['type']}' spans bytes [{rule_start}, {rule_end}) from node.start_byte/end_byte.",
-                    'explain_tokenizer': f"Token boundaries derived via {token_source}; offsets mapped to UTF-8 byte positions.",
-                }
-            if byte_to_utf16_index is not None:
-                sb = rule['start_byte']
-                eb = rule['end_byte']
-                if 0 <= sb < len(byte_to_utf16_index):
-                    details_entry['start_utf16'] = byte_to_utf16_index[sb]
-                if 0 <= eb <= len(byte_to_utf16_index):
-                    details_entry['end_utf16'] = byte_to_utf16_index[eb]
+                # Only compute token context if boundary splits a word
+                token_start_context = None
+                if contexts and mid_word_start:
+                    s_idx = _find_containing_token(rule_start)
+                    if s_idx is not None:
+                        token_start_context = self._token_context(code_bytes, token_boundaries, s_idx)
+                token_end_context = None
+                if contexts and mid_word_end:
+                    e_idx = _find_containing_token(rule_end)
+                    if e_idx is not None:
+                        token_end_context = self._token_context(code_bytes, token_boundaries, e_idx)
+                details_entry = make_entry(
+                    rule_type, rule_start, rule_end, code_bytes, token_source,
+                    (prev_ch_s, curr_ch_s) if mid_word_start else None,
+                    (prev_ch_e, curr_ch_e) if mid_word_end else None,
+                    token_start_context, token_end_context,
+                )
+            self._attach_utf16(details_entry, rule_start, rule_end, byte_to_utf16_index)
             rule_details[rule_key] = details_entry
         
-        alignment_score = (aligned_rules / len(rules) * 100) if rules else 0
+        if type_counts is not None:
+            type_counts.update({rules.type_names[t]: (n, type_aligned[t]) for t, n in enumerate(type_rules) if n})
+        alignment_score = (aligned_rules / rule_count * 100) if rule_count else 0
         return alignment_score, rule_details
     
     def _analyze_single_file(self, args_tuple):
         """Deprecated: replaced by top-level worker function for pickling safety."""
         return _worker_analyze_file(args_tuple)
 
-    def analyze_language_files(self, code_dir: str, language: str, flush_every: int = 0, output_dir: str = "results/multilang", workers: int = 1, per_file_timeout: int = 10, max_files: Optional[int] = None, batch_size: int = 0, start_index: int = 0) -> Dict:
+    def analyze_file(self, file_path: Path, language: str) -> Optional[Dict[str, Any]]:
+        """Analyze one file into a per-file result, or None if it is empty or over MAX_FILE_BYTES.
+
+        Shared by the process workers and the --threads pool. A result cut short by a
+        per-file limit has a 'truncated' key; DeadlineExceeded means there is none.
+        """
+        clock = self._stage_clock()
+        start = time.monotonic_ns()
+        source = read_source(file_path, MAX_FILE_BYTES)
+        if source is None:
+            return None
+        clock.lap('read', start)
+        code, code_bytes = source
+        code_size = len(code)
+        file_start_time = time.time()
+        score, rule_count, aligned_count, unaligned_rules_list = self.calculate_rule_level_compact(code, language, code_bytes=code_bytes)
+        file_analysis_time = time.time() - file_start_time
+        result = {
+            'file': file_path.name,
+            'path': str(file_path),
+            'score': score,
+            'total_rules': rule_count,
+            'aligned_rules': aligned_count,
+            'unaligned_rules': unaligned_rules_list,
+            'code_size': code_size,
+            'analysis_time': file_analysis_time,
+            'processing_speed': code_size / file_analysis_time if file_analysis_time > 0 else 0,
+            'is_perfect': aligned_count == rule_count,
+            'stage_times': self._take_stage_times(file_path)
+        }
+        if unaligned_rules_list.truncated:
+            result['truncated'] = unaligned_rules_list.truncated
+        return result
+
+    def _threaded_file_result(self, file_path: Path, language: str, per_file_timeout: int) -> Optional[Dict[str, Any]]:
+        # Same cooperative deadline as a process worker's, armed on this pool thread
+        self._begin_file_limits(time.monotonic() + max(1, per_file_timeout))
+        try:
+            return self.analyze_file(file_path, language)
+        except DeadlineExceeded as e:
+            self._take_stage_times(file_path)
+            self._count_limits({'skipped': e.reason})
+            return None
+        except Exception:
+            return None
+        finally:
+            self._begin_file_limits(None)
+
+    def _iter_threaded(self, code_files: List[Path], language: str, threads: int, per_file_timeout: int):
+        """Analyze files on a pool of threads, yielding results in input order.
+
+        Idle threads take the next file from the pool's shared queue, so one slow
+        file never holds up the others. Each thread lazily builds its own parser
+        per language and native context; the tokenizer and the loaded grammars
+        are shared read-only. Native calls go through ctypes and run without the
+        GIL. At most threads * 4 files are in flight.
+        """
+        window = max(1, threads) * 4
+        pending = deque()
+        with concurrent.futures.ThreadPoolExecutor(max_workers=threads, thread_name_prefix='analyzer') as ex:
+            for file_path in code_files:
+                pending.append(ex.submit(self._threaded_file_result, file_path, language, per_file_timeout))
+                if len(pending) >= window:
+                    yield pending.popleft().result()
+            while pending:
+                yield pending.popleft().result()
+
+    def _analysis_pipeline(self, language: str, tokenize_batch: int = 0, tokenize_batch_bytes: int = 0,
+                           queue_depth: int = 64) -> Pipeline:
+        """read -> parse -> tokenize -> align stages for one language (see pipeline.py).
+
+        Every stage runs on its own thread with its own parser and native context;
+        items are per-file dicts, turned into the usual per-file result by align.
+        Files found in the result cache pass through parse and tokenize untouched.
+        Stage timers are carried along by the items (see _carry_stages).
+        """
+        def read(item):
+            start = time.time()
+            start_ns = time.monotonic_ns()
+            source = read_source(item['path'], MAX_FILE_BYTES)
+            if source is None:
+                return None
+            self._stage_clock().lap('read', start_ns)
+            digest, cached = self._cache_lookup(source[0], language, source[1])
+            item.update(code=source[0], code_bytes=source[1], digest=digest, cached=cached, seconds=time.time() - start)
+            self._carry_stages(item)
+            return item
+
+        def parse(item):
+            if item['cached'] is not None:
+                return item
+            start = time.time()
+            # detached: the next extract on this thread reuses the native buffers
+            item['rules'] = self._extract_rules(item['code_bytes'], language).detached()
+            item['limit_hit'] = self._thread_state.limit_hit
+            item['seconds'] += time.time() - start
+            self._carry_stages(item)
+            return item
+
+        def tokenize(batch):
+            misses = [item for item in batch if item['cached'] is None]
+            if not misses:
+                return batch
+            start = time.time()
+            start_ns = time.monotonic_ns()
+            mappings = self._batch_offset_mappings([item['code'] for item in misses], [item.get('code_bytes') for item in misses])
+            elapsed = time.time() - start
+            # One trace event for the call; every item gets its share of the time
+            clock = self._stage_clock()
+            elapsed_ns = clock.lap('tokenize', start_ns) - start_ns
+            clock.take(f"{len(misses)} files")
+            batch_chars = max(1, sum(len(item['code']) for item in misses))
+            for item, offsets in zip(misses, mappings):
+                item['offsets'] = offsets
+                item['seconds'] += elapsed * len(item['code']) / batch_chars
+                carried = item['stage_ns']
+                carried['tokenize'] = carried.get('tokenize', 0) + elapsed_ns * len(item['code']) // batch_chars
+            return batch
+
+        def align(item):
+            start = time.time()
+            code, file_path = item['code'], item['path']
+            if item['cached'] is not None:
+                score, rule_count, aligned_count, table = item['cached']
+            else:
+                table = UnalignedTable(self.detail_level)
+                self._thread_state.limit_hit = item['limit_hit']  # a rule budget hit by the parse stage
+                score, rule_count, aligned_count, _ = self._align_rules(code, item['code_bytes'], item['rules'], False,
+                                                                        table=table, offsets=item['offsets'])
+                table.truncated = self._thread_state.limit_hit
+                if item['digest'] is not None and table.truncated is None:
+                    self.result_cache.put(item['digest'], language, self._grammar_version(language),
+                                          (score, rule_count, aligned_count, table))
+            self._carry_stages(item)
+            file_analysis_time = item['seconds'] + time.time() - start
+            result = {
+                'file': file_path.name,
+                'path': str(file_path),
+                'score': score,
+                'total_rules': rule_count,
+                'aligned_rules': aligned_count,
+                'unaligned_rules': table,
+                'code_size': len(code),
+                'analysis_time': file_analysis_time,
+                'processing_speed': len(code) / file_analysis_time if file_analysis_time > 0 else 0,
+                'is_perfect': aligned_count == rule_count,
+                'stage_times': stage_seconds(item['stage_ns'])
+            }
+            if table.truncated:
+                result['truncated'] = table.truncated
+            return result
+
+        if tokenize_batch > 1 or tokenize_batch_bytes > 0:
+            tokenize_stage = Stage('tokenize', tokenize, max_items=tokenize_batch, max_weight=tokenize_batch_bytes,
+                                   weight=lambda item: len(item['code']))
+        else:
+            tokenize_stage = Stage('tokenize', lambda item: tokenize([item])[0])
+        return Pipeline([Stage('read', read), Stage('parse', parse), tokenize_stage, Stage('align', align)],
+                        queue_depth=queue_depth)
+
+    def _carry_stages(self, item: Dict):
+        """Move the calling thread's stage times onto a pipeline item (its stages run on different threads)."""
+        carried = item.setdefault('stage_ns', {})
+        for stage, ns in self._stage_clock().take(item['path']).items():
+            carried[stage] = carried.get(stage, 0) + ns
+
+    def _run_pipeline(self, code_files, language: str, sink, tokenize_batch: int = 0, tokenize_batch_bytes: int = 0,
+                      queue_depth: int = 64):
+        """Stream code_files through the analysis pipeline; sink(result) runs on the writer thread."""
+        pipeline = self._analysis_pipeline(language, tokenize_batch, tokenize_batch_bytes, queue_depth)
+        progress = tqdm(desc=f"Analyzing {language}", unit="files")
+
+        def write(result):
+            sink(result)
+            progress.update(1)
+
+        self._active_pipeline = pipeline
+        try:
+            pipeline.run(({'path': Path(p)} for p in code_files), write)
+        finally:
+            self._active_pipeline = None
+        progress.close()
+        print(f"  Pipeline stages (busy time): {pipeline.summary()}")
+        return pipeline
+
+    def _iter_code_files(self, base_path: Path, language: str):
+        return iter_code_files(base_path, language)
+
+    def _pool_results(self, ex, files: List[Path], language: str, schedule: str, schedule_bytes: int,
+                      sizes: Dict[Path, int]):
+        """Per-file results of a process pool, in the order of files.
+
+        With the largest schedule, tasks are byte-budget bins, so a task of a few big
+        files is as long as one of many small files; otherwise chunks of 64 files.
+        """
+        if schedule != 'largest':
+            results = ex.map(_worker_analyze_file, ((str(p), language) for p in files), chunksize=64)
+        else:
+            bins = byte_bins([(p, sizes.get(p, 0)) for p in files], schedule_bytes)
+            chunks = ex.map(_worker_analyze_files, (([str(p) for p, _ in b], language) for b in bins))
+            results = (res for chunk in chunks for res in chunk)
+        # A worker reports a file skipped at its deadline as {'path', 'skipped'}: count it, yield None
+        return (None if res and 'skipped' in res and not self._count_limits(res) else res for res in results)
+
+    def analyze_language_files(self, code_dir: str, language: str, flush_every: int = 0, output_dir: str = "results/multilang", workers: int = 1, per_file_timeout: int = 10, max_files: Optional[int] = None, batch_size: int = 0, start_index: int = 0, threads: int = 0, tokenize_batch: int = 0, tokenize_batch_bytes: int = 0, pipeline: bool = False, pipeline_depth: int = 64, incremental: bool = False,
+                               companions: Optional[List["QuickMultiLanguageAnalyzer"]] = None, code_files: Optional[List[Path]] = None,
+                               schedule: str = 'largest', schedule_bytes: int = DEFAULT_BIN_BYTES,
+                               sample_rate: float = 1.0, sample_seed: int = 0) -> Dict:
         """Analyze all files for a specific language.
 
         Supports two layouts:
@@ -481,6 +1880,19 @@ class QuickMultiLanguageAnalyzer:
         2) A flat or nested directory tree at code_dir where we recursively
            collect files by extension for the specified language.
         Also supports passing a single file path in code_dir.
+
+        companions are analyzers for further tokenizer models: each file is then
+        parsed once and scored with every model, and the result is {model: result}.
+        code_files, when given, is the file list to analyze instead of walking code_dir
+        (e.g. a shard of a run manifest).
+
+        Files over MAX_FILE_BYTES are dropped once their size is known. With schedule
+        'largest' the rest are dispatched largest first and process-pool tasks hold
+        about schedule_bytes of source each (file_scan.py); 'walk' keeps path order.
+
+        With sample_rate < 1 only a deterministic sample of the files (by a hash of
+        their path under code_dir and sample_seed) is analyzed, and the result has the
+        sketch of the sample under 'sample' (sampling.py, sample_report).
         """
         if language not in self.parsers:
             print(f"Skipping unsupported language: {language}")
@@ -489,28 +1901,20 @@ class QuickMultiLanguageAnalyzer:
         base_path = Path(code_dir)
         extensions = self.language_configs[language]['extensions']
 
-        code_files = []
-
+        sizes: Dict[Path, int] = {}
+        if code_files is not None:
+            code_files = list(code_files)
         # If a single file path is passed, check and use it directly
-        if base_path.is_file():
+        elif base_path.is_file():
             if any(str(base_path).endswith(ext) for ext in extensions):
                 code_files = [base_path]
             else:
                 print(f"Provided file does not match {language} extensions: {base_path}")
                 return {}
         else:
-            # Prefer legacy layout if present: code_dir/<language>
-            language_dir = base_path / language
-            search_root = language_dir if language_dir.exists() else base_path
-
-            # Recursively gather files by extension from preferred root
-            for ext in extensions:
-                code_files.extend(search_root.rglob(f"*{ext}"))
-
-            # Fallback: if language_dir exists but yielded no files, also scan base_path recursively
-            if not code_files and language_dir.exists():
-                for ext in extensions:
-                    code_files.extend(base_path.rglob(f"*{ext}"))
+            # One walk for all extensions, with sizes for the scheduler
+            sizes = dict(scan_code_files(base_path, language))
+            code_files = list(sizes)
         
         if not code_files:
             print(f"No {language} files found under {base_path}")
@@ -527,9 +1931,41 @@ class QuickMultiLanguageAnalyzer:
             # If max_files specified, limit the total number of files to analyze
             if max_files is not None and max_files > 0:
                 code_files = code_files[:max_files]
+
+        population = len(code_files)
+        if sample_rate < 1:
+            root = base_path if base_path.is_dir() else base_path.parent
+            code_files = [p for p in code_files if keep_sample(self._sample_key(p, root), sample_rate, sample_seed)]
+            print(f"Sampling {len(code_files)} of {population} {language} files (rate {sample_rate:g}, seed {sample_seed})")
+        for a in [self] + list(companions or []):
+            a._begin_sample(language, sample_rate, sample_seed, population)
+
+        if schedule == 'largest':
+            for p in code_files:
+                if p not in sizes:
+                    try:
+                        sizes[p] = os.stat(p).st_size
+                    except OSError:
+                        sizes[p] = 0
+            code_files = [p for p, _ in largest_first([(p, sizes[p]) for p in code_files])]
+        if sizes:
+            oversized = sum(1 for p in code_files if sizes.get(p, 0) > MAX_FILE_BYTES)
+            if oversized:
+                code_files = [p for p in code_files if sizes.get(p, 0) <= MAX_FILE_BYTES]
+                print(f"Skipping {oversized} {language} files over {MAX_FILE_BYTES // 1024} KB")
         
         print(f"\nAnalyzing {language.upper()} ({len(code_files)} files)")
         print("-" * 50)
+        if companions and (batch_size or incremental or pipeline or (threads and threads > 1) or (workers and workers > 1)):
+            print("⚠️  Single-pass multi-model analysis runs serially; ignoring --batch_size/--pipeline/--threads/--workers")
+            batch_size, incremental, pipeline, threads, workers = 0, False, False, 0, 1
+        elif incremental and (pipeline or (threads and threads > 1) or (workers and workers > 1)):
+            print("⚠️  Incremental analysis runs serially; ignoring --pipeline/--threads/--workers")
+            pipeline, threads, workers = False, 0, 1
+        elif pipeline and ((threads and threads > 1) or (workers and workers > 1)):
+            print("⚠️  --pipeline takes precedence over --threads/--workers")
+        elif threads and threads > 1 and workers and workers > 1:
+            print(f"⚠️  --threads {threads} takes precedence over --workers {workers}")
         
         # If batch_size specified (>0), process in fixed-size batches (saving after each batch)
         if batch_size and batch_size > 0:
@@ -547,6 +1983,10 @@ class QuickMultiLanguageAnalyzer:
             }
             overall_start = time.time()
             part_idx = 0
+            # --result_format ndjson: imperfect files are streamed, not kept, and no part reports are written
+            stream = self._result_stream(output_dir)
+            streamed_files = 0
+            streamed_score = 0.0
 
             for start in range(0, len(code_files), batch_size):
                 batch = code_files[start:start+batch_size]
@@ -561,10 +2001,16 @@ class QuickMultiLanguageAnalyzer:
                 batch_start_time = time.time()
 
                 def process_collected_batch(batch_results):
-                    nonlocal file_results, total_rules, total_aligned, total_code_size, total_files
+                    nonlocal file_results, total_rules, total_aligned, total_code_size, total_files, streamed_files, streamed_score
                     for res in batch_results:
                         if not res:
                             continue
+                        self._count_cache_hit(res)
+                        self._count_limits(res)
+                        self._count_stage_times(language, res)
+                        self._count_node_types(language, res.get('unaligned_rules'))
+                        self._count_sample(language, res)
+                        self._observe_metrics(language, res)
                         # Always include in totals
                         total_rules += res['total_rules']
                         total_aligned += res['aligned_rules']
@@ -572,21 +2018,41 @@ class QuickMultiLanguageAnalyzer:
                         total_files += 1
                         # Include in report list only if not perfect
                         if not res.get('is_perfect', False):
-                            file_results.append(res)
-
-                if workers and workers > 1:
+                            if stream is not None:
+                                stream.write_file(language, res)
+                                streamed_files += 1
+                                streamed_score += res['score']
+                            else:
+                                file_results.append(res)
+
+                if pipeline:
+                    buf = []
+                    self._run_pipeline(batch, language, buf.append, tokenize_batch, tokenize_batch_bytes, pipeline_depth)
+                    process_collected_batch(buf)
+                elif threads and threads > 1:
+                    buf = []
+                    for res in tqdm(self._iter_threaded(batch, language, threads, per_file_timeout),
+                                    total=len(batch), desc=f"Analyzing {language}", unit="files"):
+                        buf.append(res)
+                        if len(buf) >= 256:
+                            process_collected_batch(buf)
+                            buf = []
+                    if buf:
+                        process_collected_batch(buf)
+                elif workers and workers > 1:
                     max_workers = workers if workers > 0 else (multiprocessing.cpu_count() or 1)
                     mp_ctx = multiprocessing.get_context('spawn')
                     with concurrent.futures.ProcessPoolExecutor(
                         max_workers=max_workers,
                         mp_context=mp_ctx,
                         initializer=_worker_init,
-                        initargs=(self.model_name, self.emit_utf16_offsets, language)
+                        initargs=(self.model_name, self.emit_utf16_offsets, language, self.use_native, self.result_cache_path,
+                                  self.detail_level, self.rule_budget, self.stage_trace is not None, self.tokenizer_backend.name)
                     ) as ex:
                         os.environ['ANALYZER_PER_FILE_TIMEOUT'] = str(max(1, int(per_file_timeout)))
-                        batch_iter = ex.map(_worker_analyze_file, ((str(p), language) for p in batch), chunksize=64)
+                        batch_iter = self._pool_results(ex, batch, language, schedule, schedule_bytes, sizes)
                         buf = []
-                        for res in tqdm(batch_iter, desc=f"Analyzing {language}", unit="files"):
+                        for res in tqdm(batch_iter, total=len(batch), desc=f"Analyzing {language}", unit="files"):
                             buf.append(res)
                             if len(buf) >= 256:
                                 process_collected_batch(buf)
@@ -595,53 +2061,22 @@ class QuickMultiLanguageAnalyzer:
                             process_collected_batch(buf)
                 else:
                     results_local = []
-                    for file_path in tqdm(batch, desc=f"Analyzing {language}", unit="files"):
+                    samples = self._iter_file_samples(tqdm(batch, desc=f"Analyzing {language}", unit="files"), language)
+                    if incremental:
+                        scored = self._iter_incremental(samples, base_path)
+                    else:
+                        scored = self._iter_batch_tokenized(samples, tokenize_batch, tokenize_batch_bytes)
+                    for file_path, code, compact, file_analysis_time in scored:
                         # serial process single file
-                        try:
-                            with open(file_path, 'r', encoding='utf-8', errors='ignore') as f:
-                                code = f.read()
-                            if not code.strip():
-                                continue
-                            code_size = len(code)
-                            file_start_time = time.time()
-                            score, details = self.calculate_rule_level_alignment(code, language)
-                            file_analysis_time = time.time() - file_start_time
-                            aligned_count = sum(1 for d in details.values() if d['fully_aligned'])
-                            unaligned_rules_list = [
-                                {
-                                    'rule_key': rk,
-                                    'type': rd.get('type'),
-                                    'start_byte': rd.get('start_byte'),
-                                    'end_byte': rd.get('end_byte'),
-                                    'start_aligned': rd.get('start_aligned'),
-                                    'end_aligned': rd.get('end_aligned'),
-                                    'crossing_start': rd.get('crossing_start'),
-                                    'crossing_end': rd.get('crossing_end'),
-                                    'crossing_start_reason': rd.get('crossing_start_reason'),
-                                    'crossing_end_reason': rd.get('crossing_end_reason'),
-                                    'token_start_context': rd.get('token_start_context'),
-                                    'token_end_context': rd.get('token_end_context'),
-                                    'explain_tree_sitter': rd.get('explain_tree_sitter'),
-                                    'explain_tokenizer': rd.get('explain_tokenizer'),
-                                    'fully_aligned': rd.get('fully_aligned'),
-                                    'text_preview': rd.get('text_preview')
-                                }
-                                for rk, rd in details.items() if not rd.get('fully_aligned')
-                            ]
-                            results_local.append({
-                                'file': file_path.name,
-                                'path': str(file_path),
-                                'score': score,
-                                'total_rules': len(details),
-                                'aligned_rules': aligned_count,
-                                'unaligned_rules': unaligned_rules_list,
-                                'code_size': code_size,
-                                'analysis_time': file_analysis_time,
-                                'processing_speed': code_size / file_analysis_time if file_analysis_time > 0 else 0,
-                                'is_perfect': len(unaligned_rules_list) == 0
-                            })
-                        except Exception:
-                            pass
+                        stage_times = self._take_stage_times(file_path)
+                        if compact is None:
+                            continue
+                        res = self._file_result(file_path, code, compact, file_analysis_time, stage_times)
+                        res['is_perfect'] = res['aligned_rules'] == res['total_rules']
+                        results_local.append(res)
+                        if len(results_local) >= 256:
+                            process_collected_batch(results_local)
+                            results_local = []
                     process_collected_batch(results_local)
 
                 # finalize batch stats and save
@@ -662,7 +2097,8 @@ class QuickMultiLanguageAnalyzer:
                     'avg_processing_speed': avg_speed,
                     'files': file_results
                 }
-                self._save_results({language: language_chunk_result}, [], output_dir, batch_time, suffix=f"_{language}_part_{part_idx}")
+                if stream is None:
+                    self._save_results({language: language_chunk_result}, [], output_dir, batch_time, suffix=f"_{language}_part_{part_idx}")
 
                 # accumulate into overall totals
                 total_results['file_count'] += language_chunk_result['file_count']
@@ -676,80 +2112,81 @@ class QuickMultiLanguageAnalyzer:
                 if max_files is not None and total_results['file_count'] >= max_files:
                     break
 
-            # finalize overall aggregates
+            # finalize overall aggregates; avg_score is over imperfect files, whose count and sum shard merges need
+            if stream is not None:
+                total_results['scored_files'], total_results['score_sum'] = streamed_files, streamed_score
+            else:
+                total_results['scored_files'] = len(total_results['files'])
+                total_results['score_sum'] = sum(r['score'] for r in total_results['files'])
             if total_results['file_count'] > 0:
-                total_results['avg_score'] = (sum(r['score'] for r in total_results['files']) / len(total_results['files'])) if total_results['files'] else 0.0
+                scored = total_results['scored_files']
+                total_results['avg_score'] = total_results['score_sum'] / scored if scored else 0.0
                 total_results['overall_alignment'] = (total_results['total_aligned'] / total_results['total_rules'] * 100) if total_results['total_rules'] > 0 else 0.0
                 total_results['avg_processing_speed'] = total_results['total_code_size'] / total_results['total_analysis_time'] if total_results['total_analysis_time'] > 0 else 0.0
-            return total_results
+            return self._with_sample(language, total_results)
 
         # Analyze files (single run, with optional flush_every)
-        file_results = []
-        total_rules = 0
-        total_aligned = 0
-        total_code_size = 0
-        total_files = 0
-        start_time = time.time()
-        chunk_idx = 0
-        files_since_flush = 0
-        chunk_start_time = time.time()
-        
-        # Parallel or serial processing of files
-        def process_collected(batch_results):
-            nonlocal file_results, total_rules, total_aligned, total_code_size, files_since_flush, chunk_idx, chunk_start_time, total_files
-            for res in batch_results:
-                if not res:
-                    continue
-                # Always include in totals and counts
-                total_rules += res['total_rules']
-                total_aligned += res['aligned_rules']
-                total_code_size += res['code_size']
-                files_since_flush += 1
-                total_files += 1
-                # Include in report list only if not perfect
-                if not res.get('is_perfect', False):
-                    file_results.append(res)
-                if flush_every and files_since_flush >= flush_every:
-                    chunk_idx += 1
-                    chunk_total_rules = sum(r['total_rules'] for r in file_results)
-                    chunk_total_aligned = sum(r['aligned_rules'] for r in file_results)
-                    chunk_total_size = sum(r['code_size'] for r in file_results)
-                    chunk_total_time = time.time() - chunk_start_time
-                    chunk_avg_score = sum(r['score'] for r in file_results) / len(file_results)
-                    chunk_avg_speed = chunk_total_size / chunk_total_time if chunk_total_time > 0 else 0
-                    language_chunk_result = {
-                        'language': language,
-                        'file_count': len(file_results),
-                        'avg_score': chunk_avg_score,
-                        'total_rules': chunk_total_rules,
-                        'total_aligned': chunk_total_aligned,
-                        'overall_alignment': (chunk_total_aligned / chunk_total_rules * 100) if chunk_total_rules > 0 else 0,
-                        'total_code_size': chunk_total_size,
-                        'total_analysis_time': chunk_total_time,
-                        'avg_processing_speed': chunk_avg_speed,
-                        'files': file_results
-                    }
-                    self._save_results({language: language_chunk_result}, [], output_dir, chunk_total_time, suffix=f"_{language}_part_{chunk_idx}")
-                    file_results = []
-                    files_since_flush = 0
-                    chunk_start_time = time.time()
-
-        if workers and workers > 1:
+        totals = LanguageTotals(self, language, flush_every, output_dir, label_model=bool(companions))
+        process_collected = totals.add
+
+        if companions:
+            # One parse and rule extraction per file, scored with every model's tokenizer
+            analyzers = [self] + list(companions)
+            model_totals = [totals] + [LanguageTotals(a, language, flush_every, output_dir, label_model=True)
+                                       for a in companions]
+            buffers = [[] for _ in analyzers]
+            samples = self._iter_file_samples(tqdm(code_files, desc=f"Analyzing {language}", unit="files"), language)
+            for file_path, code, compacts, times in self._iter_multi_model(samples, companions):
+                for a, buf, acc, compact, file_analysis_time in zip(analyzers, buffers, model_totals, compacts, times):
+                    stage_times = a._take_stage_times(file_path)
+                    if compact is not None:
+                        buf.append(self._file_result(file_path, code, compact, file_analysis_time, stage_times))
+                    if len(buf) >= 256:
+                        acc.add(buf)
+                        buf.clear()
+            for buf, acc in zip(buffers, model_totals):
+                if buf:
+                    acc.add(buf)
+            return {a.model_name: a._with_sample(language, acc.finish()) for a, acc in zip(analyzers, model_totals)}
+        elif pipeline:
+            # process_collected (including flush_every saves) runs on the writer thread
+            buf = []
+
+            def collect(res):
+                buf.append(res)
+                if len(buf) >= 256:
+                    process_collected(buf)
+                    buf.clear()
+            self._run_pipeline(code_files, language, collect, tokenize_batch, tokenize_batch_bytes, pipeline_depth)
+            if buf:
+                process_collected(buf)
+        elif threads and threads > 1:
+            buf = []
+            for res in tqdm(self._iter_threaded(code_files, language, threads, per_file_timeout),
+                            total=len(code_files), desc=f"Analyzing {language}", unit="files"):
+                buf.append(res)
+                if len(buf) >= 256:
+                    process_collected(buf)
+                    buf = []
+            if buf:
+                process_collected(buf)
+        elif workers and workers > 1:
             max_workers = workers if workers > 0 else (multiprocessing.cpu_count() or 1)
             mp_ctx = multiprocessing.get_context('spawn')
             with concurrent.futures.ProcessPoolExecutor(
                 max_workers=max_workers,
                 mp_context=mp_ctx,
                 initializer=_worker_init,
-                initargs=(self.model_name, self.emit_utf16_offsets, language)
+                initargs=(self.model_name, self.emit_utf16_offsets, language, self.use_native, self.result_cache_path,
+                                  self.detail_level, self.rule_budget, self.stage_trace is not None, self.tokenizer_backend.name)
             ) as ex:
                 # pass timeout to workers via env
                 os.environ['ANALYZER_PER_FILE_TIMEOUT'] = str(max(1, int(per_file_timeout)))
-                # map returns in order; use chunksize for throughput
-                batch_iter = ex.map(_worker_analyze_file, ((str(p), language) for p in code_files), chunksize=64)
+                # map returns in order; tasks are chunks of files (by bytes with the largest schedule)
+                batch_iter = self._pool_results(ex, code_files, language, schedule, schedule_bytes, sizes)
                 # consume in minibatches for reduced overhead
                 buf = []
-                for res in tqdm(batch_iter, desc=f"Analyzing {language}", unit="files"):
+                for res in tqdm(batch_iter, total=len(code_files), desc=f"Analyzing {language}", unit="files"):
                     buf.append(res)
                     if len(buf) >= 256:
                         process_collected(buf)
@@ -758,124 +2195,31 @@ class QuickMultiLanguageAnalyzer:
                     process_collected(buf)
         else:
             results = []
-            for file_path in tqdm(code_files, desc=f"Analyzing {language}", unit="files"):
-                # serial path: best-effort timeout using monotonic time check
-                start_t = time.time()
-                try:
-                    with open(file_path, 'r', encoding='utf-8', errors='ignore') as f:
-                        code = f.read()
-                    if not code.strip():
-                        continue
-                    code_size = len(code)
-                    file_start_time = time.time()
-                    score, details = self.calculate_rule_level_alignment(code, language)
-                    file_analysis_time = time.time() - file_start_time
-                    aligned_count = sum(1 for d in details.values() if d['fully_aligned'])
-                    unaligned_rules_list = [
-                        {
-                            'rule_key': rk,
-                            'type': rd.get('type'),
-                            'start_byte': rd.get('start_byte'),
-                            'end_byte': rd.get('end_byte'),
-                            'start_aligned': rd.get('start_aligned'),
-                            'end_aligned': rd.get('end_aligned'),
-                            'crossing_start': rd.get('crossing_start'),
-                            'crossing_end': rd.get('crossing_end'),
-                            'crossing_start_reason': rd.get('crossing_start_reason'),
-                            'crossing_end_reason': rd.get('crossing_end_reason'),
-                            'token_start_context': rd.get('token_start_context'),
-                            'token_end_context': rd.get('token_end_context'),
-                            'explain_tree_sitter': rd.get('explain_tree_sitter'),
-                            'explain_tokenizer': rd.get('explain_tokenizer'),
-                            'fully_aligned': rd.get('fully_aligned'),
-                            'text_preview': rd.get('text_preview')
-                        }
-                        for rk, rd in details.items() if not rd.get('fully_aligned')
-                    ]
-                    results.append({
-                        'file': file_path.name,
-                        'path': str(file_path),
-                        'score': score,
-                        'total_rules': len(details),
-                        'aligned_rules': aligned_count,
-                        'unaligned_rules': unaligned_rules_list,
-                        'code_size': code_size,
-                        'analysis_time': file_analysis_time,
-                        'processing_speed': code_size / file_analysis_time if file_analysis_time > 0 else 0
-                    })
-                except Exception:
-                    pass
-                finally:
-                    if time.time() - start_t > per_file_timeout:
-                        # skip this file if took too long
-                        continue
+            samples = self._iter_file_samples(tqdm(code_files, desc=f"Analyzing {language}", unit="files"), language)
+            if incremental:
+                scored = self._iter_incremental(samples, base_path)
+            else:
+                scored = self._iter_batch_tokenized(samples, tokenize_batch, tokenize_batch_bytes)
+            for file_path, code, compact, file_analysis_time in scored:
+                stage_times = self._take_stage_times(file_path)
+                if compact is None:
+                    continue
+                results.append(self._file_result(file_path, code, compact, file_analysis_time, stage_times))
                 if len(results) >= 256:
                     process_collected(results)
                     results = []
             if results:
                 process_collected(results)
-        
-        # Calculate total analysis time and speed
-        total_time = time.time() - start_time
-        avg_speed = total_code_size / total_time if total_time > 0 else 0
-        
-        if not file_results:
-            return {}
-        
-        # If there are remaining unflushed files, they will be included in final stats and report
-        # Calculate statistics
-        avg_score = (sum(r['score'] for r in file_results) / len(file_results)) if file_results else 0.0
-        overall_alignment = (total_aligned / total_rules * 100) if total_rules > 0 else 0
-        
-        result = {
-            'language': language,
-            'file_count': total_files,
-            'avg_score': avg_score,
-            'total_rules': total_rules,
-            'total_aligned': total_aligned,
-            'overall_alignment': overall_alignment,
-            'total_code_size': total_code_size,
-            'total_analysis_time': total_time,
-            'avg_processing_speed': avg_speed,
-            'files': file_results
-        }
-        
-        print(f"\n{language.upper()} Analysis Summary:")
-        print(f"  File count: {result['file_count']}")
-        print(f"  Average score: {result['avg_score']:.2f}%")
-        print(f"  Total rules: {result['total_rules']}")
-        print(f"  Total aligned: {result['total_aligned']}")
-        print(f"  Overall alignment rate: {result['overall_alignment']:.2f}%")
-        print(f"  Total code size: {result['total_code_size']/1024:.2f} KB")
-        print(f"  Total analysis time: {result['total_analysis_time']:.2f} seconds")
-        print(f"  Average processing speed: {result['avg_processing_speed']/1024:.2f} KB/sec")
-        
-        # If any remaining unflushed files and flush_every was set, save a final chunk for remainder
-        if flush_every and file_results:
-            chunk_idx += 1
-            chunk_total_rules = sum(r['total_rules'] for r in file_results)
-            chunk_total_aligned = sum(r['aligned_rules'] for r in file_results)
-            chunk_total_size = sum(r['code_size'] for r in file_results)
-            chunk_total_time = time.time() - chunk_start_time
-            chunk_avg_score = sum(r['score'] for r in file_results) / len(file_results)
-            chunk_avg_speed = chunk_total_size / chunk_total_time if chunk_total_time > 0 else 0
-
-            language_chunk_result = {
-                'language': language,
-                'file_count': len(file_results),
-                'avg_score': chunk_avg_score,
-                'total_rules': chunk_total_rules,
-                'total_aligned': chunk_total_aligned,
-                'overall_alignment': (chunk_total_aligned / chunk_total_rules * 100) if chunk_total_rules > 0 else 0,
-                'total_code_size': chunk_total_size,
-                'total_analysis_time': chunk_total_time,
-                'avg_processing_speed': chunk_avg_speed,
-                'files': file_results
-            }
 
-            self._save_results({language: language_chunk_result}, [], output_dir, chunk_total_time, suffix=f"_{language}_part_{chunk_idx}")
-        
-        return result
+        return self._with_sample(language, totals.finish())
+
+    @staticmethod
+    def _sample_key(path: Path, root: Path) -> str:
+        """Sampling key of a file: its path under root, so every machine samples the same files."""
+        try:
+            return Path(path).relative_to(root).as_posix()
+        except ValueError:
+            return Path(path).as_posix()
 
     def analyze_hf_dataset(
         self,
@@ -889,13 +2233,28 @@ class QuickMultiLanguageAnalyzer:
         streaming: bool = True,
         use_auth_token: Optional[str] = None,
         output_dir: str = "results/multilang",
-        flush_every: int = 0
+        flush_every: int = 0,
+        tokenize_batch: int = 0,
+        tokenize_batch_bytes: int = 0,
+        start_index: int = 0,
+        max_examples: Optional[int] = None,
+        sample_rate: float = 1.0,
+        sample_seed: int = 0,
+        prefetch: int = 0,
+        shard_parallelism: int = 1
     ) -> Dict:
         """Analyze code samples from a HuggingFace dataset.
 
         - If fixed_language is provided, all samples will be analyzed with that language.
         - If language_field is provided, each example can specify its language; unsupported ones are skipped.
         - Results are aggregated per language and saved using the same reporting format.
+        - tokenize_batch / tokenize_batch_bytes tokenize several samples per tokenizer call.
+        - start_index / max_examples restrict the run to dataset examples [start_index, start_index + max_examples)
+          (before language filtering; a shard of a run manifest).
+        - sample_rate < 1 analyzes a deterministic sample of the examples (by a hash of their id), limit counting
+          the examples sampled from; per-language results get the sketch of their sample under 'sample'.
+        - prefetch > 0 reads record batches ahead on background threads (hf_reader.py), up to prefetch batches;
+          shard_parallelism > 1 reads that many dataset shards at once (not with start_index / max_examples).
         """
         try:
             # Lazy import to avoid hard dependency if unused
@@ -961,8 +2320,12 @@ class QuickMultiLanguageAnalyzer:
                     'total_code_size': 0,
                     'total_analysis_time': 0.0,
                     'avg_processing_speed': 0.0,  # will compute later
-                    'files': []
+                    'files': [],
+                    'streamed_files': 0,
+                    'streamed_score': 0.0
                 }
+        # --result_format ndjson: imperfect samples are streamed instead of kept and flushed in parts
+        stream = self._result_stream(output_dir)
         # Per-language chunking helpers
         lang_chunk_index: Dict[str, int] = {}
         lang_files_since_flush: Dict[str, int] = {}
@@ -970,12 +2333,28 @@ class QuickMultiLanguageAnalyzer:
 
         processed = 0
         overall_start_time = time.time()
-        iterator = dataset if streaming else iter(dataset)
-
-        try:
-            pbar = tqdm(iterator, desc="Analyzing HF samples", unit="samples")
-            for i, example in enumerate(pbar):
-                if limit is not None and processed >= limit:
+        reader = None
+        if prefetch > 0 or shard_parallelism > 1:
+            parallelism = shard_parallelism
+            if parallelism > 1 and (start_index or max_examples is not None):
+                print("⚠️  Example offsets need the dataset order; reading with one prefetch thread")
+                parallelism = 1
+            columns = [c for c in (text_column, language_field, 'id') if c]
+            reader = PrefetchReader(dataset, prefetch=max(1, prefetch), parallelism=parallelism, columns=columns)
+            print(f"Prefetching up to {max(1, prefetch)} batches with {reader.parallelism} reader threads "
+                  f"({len(reader.jobs)} shards)")
+            iterator = reader
+        else:
+            iterator = dataset if streaming else iter(dataset)
+        self._samples.clear()
+        if start_index or max_examples is not None:
+            stop = start_index + max_examples if max_examples is not None else None
+            iterator = itertools.islice(iterator, start_index, stop)
+
+        def iter_samples(pbar):
+            produced = 0
+            for i, example in enumerate(pbar, start_index):
+                if limit is not None and produced >= limit:
                     break
 
                 code = example.get(text_column)
@@ -990,44 +2369,65 @@ class QuickMultiLanguageAnalyzer:
                     # Skip unsupported/unknown languages
                     continue
 
-                ensure_lang_bucket(language)
+                produced += 1
+                sample_id = example.get('id', f'sample_{i}')
+                if sample_rate < 1:
+                    sketch = self._samples.get(language) or self._begin_sample(language, sample_rate, sample_seed)
+                    sketch.population += 1
+                    if not keep_sample(str(sample_id), sample_rate, sample_seed):
+                        continue
+                yield code, language, (sample_id, language), None
 
+        tokenize_before = Counter(self.tokenize_counters)
+        cache_before = Counter(self.result_cache.counters) if self.result_cache is not None else None
+        limits_before = Counter(self.limit_counters)
+        stages_before = Counter(self.stage_counters)
+        node_types_before = self.node_types.snapshot()
+        try:
+            pbar = tqdm(iterator, desc="Analyzing HF samples", unit="samples")
+            for (sample_id, language), code, compact, sample_time in self._iter_batch_tokenized(
+                    iter_samples(pbar), tokenize_batch, tokenize_batch_bytes):
+                ensure_lang_bucket(language)
+                stage_times = self._take_stage_times(sample_id)
+                if compact is None:
+                    continue
+                score, rule_count, aligned_count, rules_list = compact
                 code_size = len(code)
-                sample_start = time.time()
-                score, details = self.calculate_rule_level_alignment(code, language)
-                sample_time = time.time() - sample_start
-
-                aligned_count = sum(1 for d in details.values() if d['fully_aligned'])
-
-                # Only keep unaligned rules for dataset path as well
-                rules_list = [
-                    {
-                        'rule_key': rk,
-                        'type': rd.get('type'),
-                        'start_byte': rd.get('start_byte'),
-                        'end_byte': rd.get('end_byte'),
-                        'start_aligned': rd.get('start_aligned'),
-                        'end_aligned': rd.get('end_aligned'),
-                        'fully_aligned': rd.get('fully_aligned'),
-                        'text_preview': rd.get('text_preview')
-                    }
-                    for rk, rd in details.items() if not rd.get('fully_aligned')
-                ]
+                if rules_list.truncated:
+                    self._count_limits({'truncated': rules_list.truncated})
+                self._count_stage_times(language, {'stage_times': stage_times})
+                self._count_node_types(language, rules_list)
+                self._count_sample(language, {'score': score, 'total_rules': rule_count, 'aligned_rules': aligned_count,
+                                              'unaligned_rules': rules_list})
+                self._observe_metrics(language, {'code_size': len(code), 'analysis_time': sample_time,
+                                                 'total_rules': rule_count, 'stage_times': stage_times})
+
+                # Only keep unaligned rules for dataset path as well (reduced key set)
+                rules_list.brief = True
                 # Add to report list only if not perfect
-                if rules_list:
-                    per_language_stats[language]['files'].append({
-                        'file': example.get('id', f'sample_{i}'),
+                if aligned_count < rule_count:
+                    sample_result = {
+                        'file': sample_id,
                         'score': score,
-                        'total_rules': len(details),
+                        'total_rules': rule_count,
                         'aligned_rules': aligned_count,
                         'unaligned_rules': rules_list,
                         'code_size': code_size,
                         'analysis_time': sample_time,
-                        'processing_speed': code_size / sample_time if sample_time > 0 else 0
-                    })
+                        'processing_speed': code_size / sample_time if sample_time > 0 else 0,
+                        'stage_times': stage_times
+                    }
+                    if rules_list.truncated:
+                        sample_result['truncated'] = rules_list.truncated
+                    if stream is not None:
+                        stream.write_file(language, sample_result)
+                        per_language_stats[language]['streamed_files'] += 1
+                        per_language_stats[language]['streamed_score'] += score
+                    else:
+                        per_language_stats[language]['files'].append(sample_result)
 
                 per_language_stats[language]['file_count'] += 1
-                per_language_stats[language]['total_rules'] += len(details)
+                per_language_stats[language]['total_rules'] += rule_count
                 per_language_stats[language]['total_aligned'] += aligned_count
                 per_language_stats[language]['total_code_size'] += code_size
                 per_language_stats[language]['total_analysis_time'] += sample_time
@@ -1043,7 +2443,7 @@ class QuickMultiLanguageAnalyzer:
                 lang_files_since_flush[language] += 1
 
                 # Flush per language if configured
-                if flush_every and lang_files_since_flush[language] >= flush_every:
+                if stream is None and flush_every and lang_files_since_flush[language] >= flush_every:
                     lang_chunk_index[language] += 1
                     files = per_language_stats[language]['files']
                     chunk_total_rules = sum(r['total_rules'] for r in files)
@@ -1074,15 +2474,23 @@ class QuickMultiLanguageAnalyzer:
                     lang_chunk_start_time[language] = time.time()
         finally:
             # tqdm will close itself when pbar goes out of scope
-            pass
+            if reader is not None:
+                reader.close()
+                print(f"📈 HF reader: {reader.summary()}")
 
         # Post-process aggregates and print summaries
         results: Dict[str, Dict] = {}
         for lang, stats in per_language_stats.items():
             files = stats['files']
-            if not files:
+            if stream is not None:
+                if not stats['streamed_files']:
+                    continue
+                scored_files, score_sum = stats['streamed_files'], stats['streamed_score']
+            elif not files:
                 continue
-            avg_score = sum(r['score'] for r in files) / len(files)
+            else:
+                scored_files, score_sum = len(files), sum(r['score'] for r in files)
+            avg_score = score_sum / scored_files
             avg_speed = stats['total_code_size'] / stats['total_analysis_time'] if stats['total_analysis_time'] > 0 else 0
 
             result = {
@@ -1095,9 +2503,12 @@ class QuickMultiLanguageAnalyzer:
                 'total_code_size': stats['total_code_size'],
                 'total_analysis_time': stats['total_analysis_time'],
                 'avg_processing_speed': avg_speed,
+                'scored_files': scored_files,
+                'score_sum': score_sum,
                 'files': files
             }
 
+            self._with_sample(lang, result)
             print(f"\n{lang.upper()} (HF) Analysis Summary:")
             print(f"  File count: {result['file_count']}")
             print(f"  Average score: {result['avg_score']:.2f}%")
@@ -1112,6 +2523,27 @@ class QuickMultiLanguageAnalyzer:
 
         overall_time = time.time() - overall_start_time
 
+        batched = self.tokenize_counters - tokenize_before
+        if batched['batch_calls']:
+            print(f"\nBatched tokenization: {batched['batch_calls']} calls for {batched['batched_files']} samples "
+                  f"({batched['batched_files'] / batched['batch_calls']:.1f} per call), {batched['batch_seconds']:.2f}s tokenizing")
+        cache_stats = self.cache_report(cache_before)
+        if cache_stats:
+            self._print_cache_stats(cache_stats)
+        limit_stats = self.limit_report(limits_before)
+        if limit_stats:
+            self._print_limit_stats(limit_stats)
+        stage_stats = self.stage_report(stages_before)
+        if stage_stats:
+            self._print_stage_stats(stage_stats)
+        node_type_stats = self.node_types.report(node_types_before)
+        if node_type_stats:
+            self._print_node_type_stats(node_type_stats)
+        sample_stats = self.sample_report(results)
+        if sample_stats:
+            self._print_sample_stats(sample_stats)
+        self._print_arena_stats()
+
         rankings = []
         if results:
             print(f"\n{'='*60}")
@@ -1133,7 +2565,8 @@ class QuickMultiLanguageAnalyzer:
                       f"(Total size: {result['total_code_size']/1024:.2f} KB)")
 
         # Save results (only detailed report)
-        self._save_results(results, rankings, output_dir, overall_time)
+        self._save_results(results, rankings, output_dir, overall_time, cache_stats=cache_stats, limit_stats=limit_stats,
+                           stage_stats=stage_stats, node_type_stats=node_type_stats, sample_stats=sample_stats)
         return results
     
     def run_analysis(self, code_dir: str = "code_samples", 
@@ -1144,8 +2577,24 @@ class QuickMultiLanguageAnalyzer:
                     per_file_timeout: int = 10,
                     max_files: Optional[int] = None,
                     batch_size: int = 0,
-                    start_index: int = 0) -> Dict:
-        """Run analysis"""
+                    start_index: int = 0,
+                    threads: int = 0,
+                    tokenize_batch: int = 0,
+                    tokenize_batch_bytes: int = 0,
+                    pipeline: bool = False,
+                    pipeline_depth: int = 64,
+                    incremental: bool = False,
+                    companions: Optional[List["QuickMultiLanguageAnalyzer"]] = None,
+                    schedule: str = 'largest',
+                    schedule_bytes: int = DEFAULT_BIN_BYTES,
+                    sample_rate: float = 1.0,
+                    sample_seed: int = 0) -> Dict:
+        """Run analysis
+
+        With companions (analyzers for further tokenizer models), each file is parsed
+        once for all models, every model gets its own reports, and the result is
+        {model: {language: result}}.
+        """
         available_languages = self.get_available_languages()
         
         if not available_languages:
@@ -1165,16 +2614,48 @@ class QuickMultiLanguageAnalyzer:
         
         # Record overall analysis start time
         overall_start_time = time.time()
+        analyzers = [self] + list(companions or [])
+        cache_before = [Counter(a.result_cache.counters) if a.result_cache is not None else None for a in analyzers]
+        limits_before = [Counter(a.limit_counters) for a in analyzers]
+        stages_before = [Counter(a.stage_counters) for a in analyzers]
+        node_types_before = [a.node_types.snapshot() for a in analyzers]
         
         results = {}
+        model_results = {a.model_name: {} for a in analyzers}
         for language in target_languages:
-            result = self.analyze_language_files(code_dir, language, flush_every=flush_every, output_dir=output_dir, workers=workers, per_file_timeout=per_file_timeout, max_files=max_files, batch_size=batch_size, start_index=start_index)
-            if result:
+            result = self.analyze_language_files(code_dir, language, flush_every=flush_every, output_dir=output_dir, workers=workers, per_file_timeout=per_file_timeout, max_files=max_files, batch_size=batch_size, start_index=start_index, threads=threads,
+                                                 tokenize_batch=tokenize_batch, tokenize_batch_bytes=tokenize_batch_bytes,
+                                                 pipeline=pipeline, pipeline_depth=pipeline_depth,
+                                                 incremental=incremental, companions=companions,
+                                                 schedule=schedule, schedule_bytes=schedule_bytes,
+                                                 sample_rate=sample_rate, sample_seed=sample_seed)
+            if companions:
+                for model, model_result in result.items():
+                    if model_result:
+                        model_results[model][language] = model_result
+            elif result:
                 results[language] = result
         
         # Calculate overall analysis time
         overall_analysis_time = time.time() - overall_start_time
-        
+
+        if companions:
+            for a, before, limits, stages, node_types in zip(analyzers, cache_before, limits_before, stages_before,
+                                                             node_types_before):
+                print(f"\n{'='*80}")
+                print(f"Results for tokenizer model: {a.model_name}")
+                print(f"{'='*80}")
+                a._report_results(model_results[a.model_name], overall_analysis_time, output_dir, before, limits, stages,
+                                  node_types)
+            return model_results
+        self._report_results(results, overall_analysis_time, output_dir, cache_before[0], limits_before[0], stages_before[0],
+                             node_types_before[0])
+        return results
+
+    def _report_results(self, results: Dict, overall_analysis_time: float, output_dir: str,
+                        cache_before: Optional[Counter] = None, limits_before: Optional[Counter] = None,
+                        stages_before: Optional[Counter] = None, node_types_before: Optional[Dict] = None):
+        """Print rankings, cache, per-file limit, stage and node type stats for a run and save its reports."""
         # Generate rankings
         rankings = []
         if results:
@@ -1200,15 +2681,220 @@ class QuickMultiLanguageAnalyzer:
                 print(f"{i:2d}. {lang:<12} {result['avg_processing_speed']/1024:.2f} KB/sec "
                       f"(Total size: {result['total_code_size']/1024:.2f} KB)")
         
+        cache_stats = self.cache_report(cache_before)
+        if cache_stats:
+            self._print_cache_stats(cache_stats)
+        limit_stats = self.limit_report(limits_before)
+        if limit_stats:
+            self._print_limit_stats(limit_stats)
+        stage_stats = self.stage_report(stages_before)
+        if stage_stats:
+            self._print_stage_stats(stage_stats)
+        node_type_stats = self.node_types.report(node_types_before)
+        if node_type_stats:
+            self._print_node_type_stats(node_type_stats)
+        sample_stats = self.sample_report(results)
+        if sample_stats:
+            self._print_sample_stats(sample_stats)
+        self._print_arena_stats()
+
         # Save results to files (only detailed report)
-        self._save_results(results, rankings, output_dir, overall_analysis_time)
-        
-        return results
+        self._save_results(results, rankings, output_dir, overall_analysis_time, cache_stats=cache_stats,
+                           limit_stats=limit_stats, stage_stats=stage_stats, node_type_stats=node_type_stats,
+                           sample_stats=sample_stats)
     
-    def _save_results(self, results: Dict, rankings: List, output_dir: str, overall_analysis_time: float, suffix: str = ""):
+    def run_sharded(self, run_dir: str, code_dir: str = "code_samples", target_languages: Optional[List[str]] = None,
+                    shard_size: int = 1000, lease_seconds: float = 900, hf_options: Optional[Dict] = None,
+                    **analysis_options) -> Optional[Dict]:
+        """Work through the shards of the run manifest in run_dir (run_manifest.py).
+
+        Without a manifest one is planned first: the sorted files of code_dir per
+        target language, or the first hf_options['limit'] examples of a dataset
+        (hf_options holds the analyze_hf_dataset arguments). Then shards that are
+        neither checkpointed nor claimed by a live worker are claimed one at a time,
+        analyzed into run_dir/shards/<model>/<shard> and checkpointed. analysis_options
+        go to analyze_language_files (workers, threads, pipeline, ...). Returns the
+        merged aggregates once every shard of this model is done, else None.
+        """
+        if RunManifest.exists(run_dir):
+            manifest = RunManifest.load(run_dir)
+        else:
+            manifest = RunManifest.create(run_dir, self._plan_groups(code_dir, target_languages, hf_options), shard_size)
+            print(f"✓ Planned {len(manifest.shards)} shards in {Path(run_dir) / 'manifest.json'}")
+        owner = f"{socket.gethostname()}:{os.getpid()}"
+        auth_token = (hf_options or {}).get('use_auth_token')
+        analyzed = 0
+        while True:
+            lease = manifest.claim_next(self.model_name, owner, lease_seconds)
+            if lease is None:
+                break
+            with lease:
+                shard, group = lease.shard, manifest.group(lease.shard)
+                files = None if 'dataset' in group else manifest.shard_files(shard)
+                results = self._analyze_shard(shard, group['name'], str(manifest.report_dir(self.model_name, shard)),
+                                              group.get('dataset'), group.get('code_dir'), group.get('language'), files,
+                                              auth_token, analysis_options)
+                lease.complete(results)
+                analyzed += 1
+
+        pending = manifest.pending(self.model_name)
+        print(f"\n✓ Analyzed {analyzed} shards in this worker; {len(manifest.shards) - len(pending)}/{len(manifest.shards)} done")
+        if pending:
+            print(f"  {len(pending)} shards are still claimed by other workers; rerun to pick up any whose worker died")
+            return None
+        summary_path = manifest.write_summary(self.model_name)
+        merged = manifest.merge(self.model_name)
+        print(f"📁 Merged results of all shards saved to: {summary_path}")
+        return merged
+
+    def run_remote_worker(self, coordinator_url: str, upload_results: bool = False, auth_token: Optional[str] = None,
+                          coordinator_token: Optional[str] = None, **analysis_options) -> int:
+        """Analyze shards handed out by a run coordinator (run_coordinator.py) until it has none left.
+
+        Reports go to the shard's report directory named by the coordinator (shared
+        storage), or with upload_results to a local temporary directory that is
+        uploaded to the coordinator and removed. coordinator_token is the
+        coordinator's shared --token, if it has one. Returns the number of shards analyzed.
+        """
+        client = CoordinatorClient(coordinator_url, f"{socket.gethostname()}:{os.getpid()}", token=coordinator_token)
+        analyzed = 0
+        while True:
+            lease = client.claim(self.model_name)
+            if lease is None:
+                break
+            with lease:
+                p = lease.payload
+                shard_dir = tempfile.mkdtemp(prefix=f"shard_{lease.shard['id']}_") if upload_results else p['report_dir']
+                try:
+                    results = self._analyze_shard(lease.shard, p['group'], shard_dir, p.get('dataset'), p.get('code_dir'),
+                                                  p.get('language'), [Path(f) for f in p.get('files', [])],
+                                                  auth_token, analysis_options)
+                    if upload_results:
+                        sent = client.upload_reports(self.model_name, lease.shard['id'], shard_dir)
+                        print(f"  ↑ Uploaded shard report ({sent / 1024:.1f} KB)")
+                finally:
+                    if upload_results:
+                        shutil.rmtree(shard_dir, ignore_errors=True)
+                if lease.lost:
+                    print(f"⚠️  Shard {lease.shard['id']} was handed to another worker while this one analyzed it")
+                if not lease.complete(results):
+                    print(f"⚠️  Shard {lease.shard['id']} was already completed by another worker")
+                analyzed += 1
+        print(f"\n✓ Analyzed {analyzed} shards from {coordinator_url}; the coordinator has none left")
+        return analyzed
+
+    def _analyze_shard(self, shard: Dict, group_name: str, shard_dir: str, dataset: Optional[Dict], code_dir: Optional[str],
+                       language: Optional[str], files: Optional[List[Path]], auth_token: Optional[str],
+                       analysis_options: Dict) -> Dict:
+        """Analyze one manifest shard (a dataset offset range or a file list) into shard_dir; returns its per-language results."""
+        print(f"\n▶ Shard {shard['id']} ({group_name}, {shard['count']} {'examples' if dataset else 'files'} "
+              f"from {shard['start']})")
+        start = time.time()
+        if dataset:
+            return self.analyze_hf_dataset(**dataset, use_auth_token=auth_token, output_dir=shard_dir,
+                                           start_index=shard['start'], max_examples=shard['count'],
+                                           tokenize_batch=analysis_options.get('tokenize_batch', 0),
+                                           tokenize_batch_bytes=analysis_options.get('tokenize_batch_bytes', 0),
+                                           sample_rate=analysis_options.get('sample_rate', 1.0),
+                                           sample_seed=analysis_options.get('sample_seed', 0),
+                                           prefetch=analysis_options.get('hf_prefetch', 0))
+        # One batch per shard: its part report is the shard report
+        file_options = {k: v for k, v in analysis_options.items() if not k.startswith('hf_')}
+        result = self.analyze_language_files(code_dir, language, output_dir=shard_dir,
+                                             batch_size=len(files), code_files=files, **file_options)
+        results = {language: result} if result else {}
+        if self.result_format == 'ndjson':
+            self._save_results(results, [], shard_dir, time.time() - start)
+        return results
+
+    def _plan_groups(self, code_dir: str, target_languages: Optional[List[str]], hf_options: Optional[Dict]) -> List[Dict]:
+        """Manifest groups for run_sharded: one per language with its sorted file list, or one dataset range."""
+        if hf_options is not None:
+            options = {k: v for k, v in hf_options.items() if k not in ('limit', 'use_auth_token')}
+            return [{'name': options['dataset_name'], 'dataset': options, 'example_count': hf_options['limit']}]
+        base_path = Path(code_dir).resolve()
+        languages = target_languages or self.get_available_languages()
+        groups = []
+        for language in languages:
+            if language not in self.parsers:
+                continue
+            files = {str(p.relative_to(base_path)) for p in iter_code_files(base_path, language)}
+            groups.append({'name': language, 'code_dir': str(base_path), 'language': language, 'files': files})
+        return groups
+
+    def print_incremental_stats(self, revision: str):
+        """Report (and reset) calculate_rule_level_incremental counters for one revision."""
+        c = self.incremental_counters
+        rules = c['rescored_rules'] + c['reused_rules']
+        print(f"\nIncremental {revision}: {c['incremental']} files re-analyzed incrementally, {c['full']} in full, "
+              f"{c['unchanged']} unchanged; {c['rescored_rules']} of {rules} rules rescored")
+        c.clear()
+
+    def _print_arena_stats(self):
+        """Per-file arena memory of the native contexts of this process (not of --workers processes)."""
+        if self.native_core is None:
+            return
+        arena = self.native_core.arena_report()
+        print(f"\nNative arena: {arena['high_water'] / 1024:.1f} KB high-water per context "
+              f"({arena['contexts']} contexts), {arena['block_allocations']} heap blocks over {arena['resets']} arena resets")
+
+    @staticmethod
+    def _print_cache_stats(cache_stats: Dict):
+        print(f"\nResult cache: {cache_stats['hits']} hits / {cache_stats['lookups']} lookups "
+              f"({cache_stats['hit_rate'] * 100:.1f}% hit rate) in {cache_stats['path']}")
+
+    @staticmethod
+    def _print_limit_stats(limit_stats: Dict):
+        def describe(counts):
+            return ', '.join(f"{n} by {reason.replace('_', ' ')}" for reason, n in counts.items()) or 'none'
+        print(f"\n⚠️  Per-file limits: truncated {describe(limit_stats['truncated'])}; "
+              f"skipped {describe(limit_stats['skipped'])}")
+
+    @staticmethod
+    def _print_stage_stats(stage_stats: Dict):
+        print("\nStage breakdown (share of timed stages):")
+        for language, breakdown in stage_stats.items():
+            shares = ', '.join(f"{stage} {share * 100:.0f}%" for stage, share in breakdown['share'].items() if share >= 0.005)
+            print(f"  {language:<12} {sum(breakdown['seconds'].values()):.2f}s over {breakdown['files']} files: {shares}")
+
+    def _print_node_type_stats(self, node_type_stats: Dict):
+        print("\nMost unaligned node types (unaligned / distinct rules):")
+        table = self.node_types.table()
+        for language, counts in node_type_stats.items():
+            worst = ', '.join(f"{name} {unaligned}/{rules}" for name, unaligned, rules in most_unaligned(counts, table[language]))
+            print(f"  {language:<12} {sum(1 for n in counts['rules'] if n)} types: {worst or 'all aligned'}")
+
+    @staticmethod
+    def _print_sample_stats(sample_stats: Dict):
+        def describe(estimate):
+            alignment = estimate['alignment']
+            if alignment is None:
+                return 'no rules'
+            text = f"alignment ≈ {alignment['estimate']:.2f}%"
+            if alignment['ci95'] is not None:
+                text += f" (95% CI {alignment['ci95'][0]:.2f}-{alignment['ci95'][1]:.2f}%)"
+            return f"{text}, median score {estimate['score_quantiles']['p50']:.1f}%"
+        overall = sample_stats['overall']
+        print(f"\nSampled {overall['files_sampled']} of {overall['files_seen']} files "
+              f"(rate {sample_stats['rate']:g}, seed {sample_stats['seed']}): {describe(overall)}")
+        for language, estimate in sample_stats['languages'].items():
+            print(f"  {language:<12} {estimate['files_sampled']}/{estimate['files_seen']} files: {describe(estimate)}")
+
+    def _save_results(self, results: Dict, rankings: List, output_dir: str, overall_analysis_time: float, suffix: str = "",
+                      cache_stats: Optional[Dict] = None, limit_stats: Optional[Dict] = None,
+                      stage_stats: Optional[Dict] = None, node_type_stats: Optional[Dict] = None,
+                      sample_stats: Optional[Dict] = None):
         """Save analysis results to files. Only writes detailed_analysis JSON.
 
         suffix: optional string to append to the detailed filename, e.g. "_python_part_1".
+        cache_stats: result cache counters (cache_report) added to the summary of the final report.
+        limit_stats: files truncated or skipped by per-file limits (limit_report), likewise.
+        stage_stats: per-language seconds and share of each stage (stage_report), likewise.
+        node_type_stats: per-language rule counts by node type id (NodeTypeTotals.report), likewise;
+        the id table is written next to the report as node_types_<model>.json.
+        sample_stats: estimates from a --sample_rate sample (sample_report), likewise.
+        With --result_format ndjson the files were already streamed: the final report
+        appends the language aggregates and the summary to the stream and closes it.
         """
         output_path = Path(output_dir)
         output_path.mkdir(parents=True, exist_ok=True)
@@ -1216,6 +2902,7 @@ class QuickMultiLanguageAnalyzer:
         # Save detailed results
         detailed_results = {
             'model': self.model_name,
+            'tokenizer_backend': self.tokenizer_backend.name,
             'timestamp': str(Path().resolve()),
             'overall_analysis_time': overall_analysis_time,
             'summary': {
@@ -1229,14 +2916,44 @@ class QuickMultiLanguageAnalyzer:
             'languages': results,
             'rankings': []  # rankings omitted by request
         }
-        
-        # Save detailed report
-        detailed_file = output_path / f"detailed_analysis_{self.model_name}{suffix}.json"
-        with open(detailed_file, 'w', encoding='utf-8') as f:
-            json.dump(detailed_results, f, ensure_ascii=False, indent=2)
+        if cache_stats:
+            detailed_results['summary']['result_cache'] = cache_stats
+        if limit_stats:
+            detailed_results['summary']['limits'] = limit_stats
+        if stage_stats:
+            detailed_results['summary']['stage_breakdown'] = stage_stats
+        if node_type_stats:
+            detailed_results['summary']['node_types'] = node_type_stats
+        if sample_stats:
+            detailed_results['summary']['sample'] = sample_stats
+        if self.detail_level != 'full':
+            detailed_results['summary']['detail_level'] = self.detail_level
         
         print(f"\n📁 Analysis results saved to:")
-        print(f"  - Detailed report: {detailed_file}")
+
+        if self.result_format == 'ndjson':
+            stream = self._result_stream(output_dir)
+            for lang, data in results.items():
+                stream.write(dict({'record': 'language'}, **{k: v for k, v in data.items() if k != 'files'}))
+            stream.write(dict({'record': 'summary', 'overall_analysis_time': overall_analysis_time}, **detailed_results['summary']))
+            self._close_result_stream(output_dir)
+            print(f"  - Result stream: {stream.path} ({stream.records} records, {stream.bytes_written / 1024:.1f} KB before compression)")
+
+        # Save detailed report (JSON is rendered from the per-file rule tables)
+        if self.result_format in ('json', 'both'):
+            detailed_file = output_path / f"detailed_analysis_{self.model_name}{suffix}.json"
+            with open(detailed_file, 'w', encoding='utf-8') as f:
+                json.dump(dict(detailed_results, languages=jsonable_results(results)), f, ensure_ascii=False, indent=2)
+            print(f"  - Detailed report: {detailed_file}")
+
+        # Save compact columnar report
+        if self.result_format in ('compact', 'both'):
+            compact_file = output_path / f"detailed_analysis_{self.model_name}{suffix}.acr"
+            write_compact_report(compact_file, detailed_results)
+            print(f"  - Compact report: {compact_file}")
+
+        if node_type_stats:
+            print(f"  - Node type ids: {self.node_types.write_table(node_types_path(output_dir, self.model_name))}")
 
 def estimate_processing_time(analyzer, language, avg_file_size, file_count):
     """Estimate time required to process a large number of files"""
@@ -1341,17 +3058,79 @@ def main():
     parser.add_argument('--output_dir', default='results/multilang', help='Output directory')
     parser.add_argument('--model', default='gpt2', help='Tokenizer model')
     parser.add_argument('--models', nargs='+', help='Analyze with multiple tokenizer models (space-separated)')
+    parser.add_argument('--single_pass', action='store_true',
+                        help='With --models, parse each file once and score it with every model (serial, local files only)')
     parser.add_argument('--no_progress_bar', action='store_true', help='Do not display progress bar')
     parser.add_argument('--emit_utf16', action='store_true', help='Emit UTF-16 code unit offsets alongside byte offsets for rules')
+    parser.add_argument('--no_native', action='store_true', help='Use the pure Python scoring loop even if build/alignment_core.so exists')
+    parser.add_argument('--tokenizer_backend', choices=TOKENIZER_BACKENDS, default='hf',
+                        help="Token offsets from the fast tokenizer's offset_mapping (hf) or native byte-level BPE (native_bpe)")
+    parser.add_argument('--tokenizer_threads', type=int, default=0,
+                        help='Threads per tokenize batch for --tokenizer_backend native_bpe (0 = up to 8)')
+    parser.add_argument('--result_format', choices=['json', 'compact', 'both', 'ndjson'], default='json',
+                        help='Detailed report format: JSON, compact columnar .acr (render with compact_results.py), both, '
+                             'or an NDJSON stream written while files are analyzed (see result_stream.py)')
+    parser.add_argument('--stream_compression', choices=['none', 'zstd'], default='none',
+                        help='Compress the --result_format ndjson stream (zstd needs the zstandard package)')
+    parser.add_argument('--detail_level', choices=list(DETAIL_LEVELS), default='full',
+                        help='Per unaligned rule: nothing (score: counts only), position and crossing flags (spans), '
+                             'or reasons, previews and token contexts (full)')
     parser.add_argument('--estimate', action='store_true', help='Estimate large-scale processing time')
     parser.add_argument('--file_count', type=int, default=1000000, help='Number of files for estimation')
     parser.add_argument('--avg_file_size', type=float, default=0, help='Average file size for estimation (bytes)')
     parser.add_argument('--flush_every', type=int, default=5000, help='Write a detailed report every N files to reduce memory usage (0=disable)')
     parser.add_argument('--workers', type=int, default=1, help='Number of worker processes for parallel analysis (1 = disable)')
-    parser.add_argument('--per_file_timeout', type=int, default=10, help='Per-file analysis timeout in seconds (skip files exceeding this)')
+    parser.add_argument('--threads', type=int, default=0,
+                        help='Analyze with N threads in this process, sharing one tokenizer (0/1 = disable; overrides --workers)')
+    parser.add_argument('--per_file_timeout', type=int, default=10,
+                        help='Per-file deadline in seconds with --workers/--threads: the parse, rule walk and scoring stop '
+                             'at it (files are skipped if it passes while parsing, truncated afterwards)')
+    parser.add_argument('--rule_budget', type=int, default=0,
+                        help='Extract and score at most N rules per file and flag the file as truncated (0=no limit)')
+    parser.add_argument('--trace_file', type=str, default=None,
+                        help='Write a Chrome trace (open in ui.perfetto.dev) of every file stage to this JSON file '
+                             '(one per model, suffixed with its name, with several --models)')
+    parser.add_argument('--metrics_port', type=int, default=0,
+                        help='Serve Prometheus metrics (files/s, bytes/s, latency histograms, cache hits, timeouts, '
+                             'queue depths, RSS) at http://--metrics_host:PORT/metrics during the run (0 = off)')
+    parser.add_argument('--metrics_host', type=str, default='127.0.0.1', help='Interface of the --metrics_port endpoint')
     parser.add_argument('--max_files', type=int, default=None, help='Maximum number of files to analyze (across this run)')
+    parser.add_argument('--sample_rate', type=float, default=1.0,
+                        help='Analyze a deterministic hash-based sample of this fraction of the files or dataset examples, '
+                             'and report estimates with 95%% confidence intervals (see sampling.py; 1 = all)')
+    parser.add_argument('--sample_seed', type=int, default=0, help='Seed of the --sample_rate hash (same seed, same sample)')
     parser.add_argument('--batch_size', type=int, default=0, help='Analyze files in fixed-size batches (e.g., 5000) and save after each batch')
+    parser.add_argument('--tokenize_batch', type=int, default=0,
+                        help='Tokenize up to N files per tokenizer call (serial and HF paths; 0/1 = one call per file)')
+    parser.add_argument('--tokenize_batch_bytes', type=int, default=0,
+                        help='Also cut a tokenizer batch once it holds this many characters of code (0 = no limit)')
+    parser.add_argument('--pipeline', action='store_true',
+                        help='Stream files through read/parse/tokenize/align/write stage threads (overrides --threads/--workers)')
+    parser.add_argument('--pipeline_depth', type=int, default=64, help='Files buffered between two pipeline stages')
+    parser.add_argument('--schedule', choices=list(SCHEDULES), default='largest',
+                        help='Dispatch order of local files: largest first, with --workers tasks of about --schedule_bytes '
+                             'of source each (largest), or path order and tasks of 64 files (walk)')
+    parser.add_argument('--schedule_bytes', type=int, default=DEFAULT_BIN_BYTES,
+                        help='Bytes of source per --workers task with --schedule largest')
     parser.add_argument('--start_index', type=int, default=0, help='Resume offset: 0-based file index to start from (e.g., 190000)')
+    parser.add_argument('--result_cache', type=str, default=None,
+                        help='SQLite file caching per-file results by content hash, so duplicate files are analyzed once')
+    parser.add_argument('--run_dir', type=str, default=None,
+                        help='Sharded, resumable run: plan a manifest of shards here (first run), then analyze shards '
+                             'not yet checkpointed; any number of processes or nodes may share the directory')
+    parser.add_argument('--shard_size', type=int, default=1000, help='Files (or dataset examples) per shard of a new --run_dir manifest')
+    parser.add_argument('--claim_timeout', type=float, default=900,
+                        help='Seconds without a heartbeat after which another worker takes over a claimed shard')
+    parser.add_argument('--coordinator', type=str, default=None, metavar='URL',
+                        help='Work as a node of a distributed run: analyze shards handed out by the run coordinator at URL '
+                             '(started with batch_run_stack_v2.py --serve)')
+    parser.add_argument('--upload_results', action='store_true',
+                        help='With --coordinator, upload shard reports to the coordinator instead of writing them to shared storage')
+    parser.add_argument('--coordinator_token', type=str, default=os.environ.get(TOKEN_ENV), metavar='TOKEN',
+                        help=f'With --coordinator, the shared token the coordinator was started with (default: ${TOKEN_ENV})')
+    parser.add_argument('--revisions', nargs='+', default=None, metavar='DIR',
+                        help='Checkouts of one repository at successive revisions (oldest first); each is analyzed '
+                             'incrementally against the previous one, with reports in output_dir/<DIR name>')
 
     # HuggingFace dataset options
     parser.add_argument('--hf_dataset', type=str, help='HuggingFace dataset name (e.g., bigcode/the-stack)')
@@ -1365,6 +3144,10 @@ def main():
     parser.add_argument('--no_hf_streaming', dest='hf_streaming', action='store_false', help='Disable streaming mode')
     parser.set_defaults(hf_streaming=True)
     parser.add_argument('--hf_token', type=str, default=None, help='HuggingFace auth token (if required)')
+    parser.add_argument('--hf_prefetch', type=int, default=0,
+                        help='Read up to N record batches ahead on background threads (0 = read inline)')
+    parser.add_argument('--hf_shard_parallelism', type=int, default=1,
+                        help='Read N dataset shards (streaming: data files) concurrently on reader threads')
     
     args = parser.parse_args()
     
@@ -1372,10 +3155,28 @@ def main():
     if args.no_progress_bar:
         import builtins
         builtins.tqdm = lambda x, **kwargs: x
+    if not 0 < args.sample_rate <= 1:
+        parser.error('--sample_rate must be in (0, 1]')
+    if args.hf_prefetch < 0 or args.hf_shard_parallelism < 1:
+        parser.error('--hf_prefetch must be >= 0 and --hf_shard_parallelism >= 1')
+    if args.single_pass and (args.revisions or args.hf_dataset):
+        parser.error('--single_pass analyzes local files and cannot be combined with --revisions or --hf_dataset')
+    if args.revisions and args.hf_dataset:
+        parser.error('--revisions analyzes local checkouts and cannot be combined with --hf_dataset')
+    if args.run_dir and (args.revisions or args.single_pass):
+        parser.error('--run_dir cannot be combined with --revisions or --single_pass')
+    if args.coordinator and (args.run_dir or args.revisions or args.single_pass):
+        parser.error('--coordinator cannot be combined with --run_dir, --revisions or --single_pass')
+    if args.run_dir and args.hf_dataset and not args.hf_limit and not RunManifest.exists(args.run_dir):
+        parser.error('planning a --run_dir over --hf_dataset needs --hf_limit (the number of examples to shard)')
+    if args.run_dir and args.start_index:
+        print("⚠️  --run_dir resumes from its checkpoints; --start_index is ignored")
+    if args.revisions and args.result_cache:
+        print("⚠️  --revisions reuses the previous revision's results; --result_cache is not consulted")
     
     # If estimation mode, only run once (use --model)
     if args.estimate:
-        analyzer = QuickMultiLanguageAnalyzer(model_name=args.model, emit_utf16_offsets=args.emit_utf16)
+        analyzer = QuickMultiLanguageAnalyzer(model_name=args.model, emit_utf16_offsets=args.emit_utf16, use_native=not args.no_native, result_format=args.result_format)
         # If estimation mode, only run estimation function
         language = args.language if args.language else 'python'
         estimate_processing_time(analyzer, language, args.avg_file_size, args.file_count)
@@ -1384,6 +3185,17 @@ def main():
         # Determine tokenizer models to run
         models_to_run = args.models if args.models and len(args.models) > 0 else [ args.model ]
 
+        metrics_registry = None
+        if args.metrics_port:
+            metrics_registry = Registry()
+            metrics_registry.collector(process_collector)
+            try:
+                metrics_server = MetricsServer(metrics_registry, args.metrics_host, args.metrics_port)
+                print(f"📈 Metrics at {metrics_server.url}")
+            except OSError as e:
+                print(f"⚠️  Metrics endpoint {args.metrics_host}:{args.metrics_port} unavailable: {e}")
+                metrics_registry = None
+
         multi_model_index = {
             'models': models_to_run,
             'runs': []
@@ -1391,61 +3203,145 @@ def main():
         # Track per-model, per-language summary for comparison
         per_model_language_summary = {}
 
-        for mdl in models_to_run:
+        # --single_pass: one run over the files for all models, the first model's analyzer parsing
+        model_runs = [models_to_run] if args.single_pass and len(models_to_run) > 1 else [[m] for m in models_to_run]
+
+        for run_models in model_runs:
+            mdl = run_models[0]
             print(f"\n{'='*80}")
-            print(f"Running analysis with tokenizer model: {mdl}")
+            print(f"Running analysis with tokenizer model{'s' if len(run_models) > 1 else ''}: {' '.join(run_models)}")
             print(f"{'='*80}")
 
-            analyzer = QuickMultiLanguageAnalyzer(model_name=mdl, emit_utf16_offsets=args.emit_utf16)
-
-        if args.hf_dataset:
+            analyzer, *companions = [
+                QuickMultiLanguageAnalyzer(model_name=m, emit_utf16_offsets=args.emit_utf16, use_native=not args.no_native, result_format=args.result_format,
+                                           result_cache=args.result_cache, detail_level=args.detail_level,
+                                           stream_compression=None if args.stream_compression == 'none' else args.stream_compression,
+                                           rule_budget=args.rule_budget, trace=bool(args.trace_file),
+                                           tokenizer_backend=args.tokenizer_backend, tokenizer_threads=args.tokenizer_threads)
+                for m in run_models]
+            if metrics_registry is not None:
+                for a in [analyzer, *companions]:
+                    a.register_metrics(metrics_registry)
+
+            if args.coordinator:
+                try:
+                    analyzer.run_remote_worker(args.coordinator, upload_results=args.upload_results, auth_token=args.hf_token,
+                                               coordinator_token=args.coordinator_token,
+                                               workers=args.workers, per_file_timeout=args.per_file_timeout, threads=args.threads,
+                                               tokenize_batch=args.tokenize_batch, tokenize_batch_bytes=args.tokenize_batch_bytes,
+                                               pipeline=args.pipeline, pipeline_depth=args.pipeline_depth,
+                                               schedule=args.schedule, schedule_bytes=args.schedule_bytes,
+                                               sample_rate=args.sample_rate, sample_seed=args.sample_seed,
+                                               hf_prefetch=args.hf_prefetch)
+                except (OSError, CoordinatorError) as e:
+                    print(f"❌ Run coordinator {args.coordinator}: {e}")
+                    raise SystemExit(1)
+            elif args.run_dir:
+                hf_options = None
+                if args.hf_dataset:
+                    hf_options = {'dataset_name': args.hf_dataset, 'split': args.hf_split, 'text_column': args.hf_text_column,
+                                  'dataset_config': args.hf_config, 'fixed_language': args.hf_language,
+                                  'language_field': args.hf_language_field, 'streaming': args.hf_streaming,
+                                  'limit': args.hf_limit, 'use_auth_token': args.hf_token}
+                target_languages = [args.language] if args.language else (None if args.all_languages else ['python'])
+                analyzer.run_sharded(args.run_dir, args.code_dir, target_languages, shard_size=args.shard_size,
+                                     lease_seconds=args.claim_timeout, hf_options=hf_options,
+                                     workers=args.workers, per_file_timeout=args.per_file_timeout, threads=args.threads,
+                                     tokenize_batch=args.tokenize_batch, tokenize_batch_bytes=args.tokenize_batch_bytes,
+                                     pipeline=args.pipeline, pipeline_depth=args.pipeline_depth,
+                                     schedule=args.schedule, schedule_bytes=args.schedule_bytes,
+                                     sample_rate=args.sample_rate, sample_seed=args.sample_seed,
+                                     hf_prefetch=args.hf_prefetch)
+            elif args.hf_dataset:
                 _ = analyzer.analyze_hf_dataset(
-                dataset_name=args.hf_dataset,
-                split=args.hf_split,
-                text_column=args.hf_text_column,
-                dataset_config=args.hf_config,
-                fixed_language=args.hf_language,
-                language_field=args.hf_language_field,
-                limit=args.hf_limit,
-                streaming=args.hf_streaming,
-                use_auth_token=args.hf_token,
-                output_dir=args.output_dir,
+                    dataset_name=args.hf_dataset,
+                    split=args.hf_split,
+                    text_column=args.hf_text_column,
+                    dataset_config=args.hf_config,
+                    fixed_language=args.hf_language,
+                    language_field=args.hf_language_field,
+                    limit=args.hf_limit,
+                    streaming=args.hf_streaming,
+                    use_auth_token=args.hf_token,
+                    output_dir=args.output_dir,
                     flush_every=args.flush_every,
-            )
-        else:
-            if args.language:
-                target_languages = [args.language]
-            elif args.all_languages:
-                target_languages = None  # Analyze all available languages
+                    tokenize_batch=args.tokenize_batch,
+                    tokenize_batch_bytes=args.tokenize_batch_bytes,
+                    sample_rate=args.sample_rate,
+                    sample_seed=args.sample_seed,
+                    prefetch=args.hf_prefetch,
+                    shard_parallelism=args.hf_shard_parallelism,
+                )
             else:
-                target_languages = ['python']  # Default to analyzing only Python
-
+                if args.language:
+                    target_languages = [args.language]
+                elif args.all_languages:
+                    target_languages = None  # Analyze all available languages
+                else:
+                    target_languages = ['python']  # Default to analyzing only Python
+
+                if args.revisions:
+                    # Every revision but the last is only kept for the next one to diff against
+                    for revision in args.revisions[:-1]:
+                        analyzer.run_analysis(revision, target_languages, str(Path(args.output_dir) / Path(revision).name),
+                                              flush_every=args.flush_every, max_files=args.max_files, incremental=True)
+                        analyzer.print_incremental_stats(revision)
+                    code_dir = args.revisions[-1]
+                    output_dir = str(Path(args.output_dir) / Path(code_dir).name)
+                else:
+                    code_dir, output_dir = args.code_dir, args.output_dir
                 run_results = analyzer.run_analysis(
-                    args.code_dir,
+                    code_dir,
                     target_languages,
-                    args.output_dir,
+                    output_dir,
                     flush_every=args.flush_every,
                     workers=args.workers,
                     per_file_timeout=args.per_file_timeout,
                     max_files=args.max_files,
                     batch_size=args.batch_size,
                     start_index=args.start_index,
+                    threads=args.threads,
+                    tokenize_batch=args.tokenize_batch,
+                    tokenize_batch_bytes=args.tokenize_batch_bytes,
+                    pipeline=args.pipeline,
+                    pipeline_depth=args.pipeline_depth,
+                    schedule=args.schedule,
+                    schedule_bytes=args.schedule_bytes,
+                    sample_rate=args.sample_rate,
+                    sample_seed=args.sample_seed,
+                    incremental=bool(args.revisions),
+                    companions=companions,
                 )
+                if args.revisions:
+                    analyzer.print_incremental_stats(code_dir)
                 # Save simple per-language avg_score/overall_alignment for comparison
-                per_model_language_summary[mdl] = {
-                    lang: {
-                        'avg_score': data.get('avg_score', 0.0),
-                        'overall_alignment': data.get('overall_alignment', 0.0),
-                        'file_count': data.get('file_count', 0)
+                for m, model_run_results in (run_results.items() if companions else [(mdl, run_results)]):
+                    per_model_language_summary[m] = {
+                        lang: {
+                            'avg_score': data.get('avg_score', 0.0),
+                            'overall_alignment': data.get('overall_alignment', 0.0),
+                            'file_count': data.get('file_count', 0)
+                        }
+                        for lang, data in model_run_results.items()
                     }
-                    for lang, data in run_results.items()
-                }
+
+            if args.trace_file:
+                # Companions trace their own scoring; the run's parse stages are on the first analyzer's
+                for a in companions:
+                    analyzer.stage_trace.extend(a.stage_trace.drain())
+                trace_path = Path(args.trace_file)
+                if len(model_runs) > 1:
+                    trace_path = trace_path.with_name(f"{trace_path.stem}_{mdl.replace('/', '_')}{trace_path.suffix}")
+                events = analyzer.write_trace(trace_path)
+                dropped = analyzer.stage_trace.dropped
+                print(f"\n🧭 Stage trace saved to: {trace_path} ({events} events{f', {dropped} dropped' if dropped else ''})")
 
             # Record per-model output file paths for convenience
-            multi_model_index['runs'].append({
-                'model': mdl,
-                'detailed_report': str(Path(args.output_dir) / f"detailed_analysis_{mdl}.json")
-            })
+            for m in run_models:
+                multi_model_index['runs'].append({
+                    'model': m,
+                    'detailed_report': str(Path(args.output_dir) / f"detailed_analysis_{m}.json")
+                })
 
         # Save a small multi-model index file for downstream tools
         try:
@@ -6,10 +6,18 @@ Batch runner for analyzer.py over Stack V2 dedup preprocessed outputs.
 - Scans base_dir for subdirectories named like *_code_output
 - For each such directory, runs analyzer.py for the specified languages
   with chunked saving to reduce memory usage.
+- With --run_dir, plans one sharded manifest over every directory and language
+  instead (run_manifest.py) and starts --parallel analyzer workers that claim
+  shards from it; rerunning the command (on this or other nodes sharing the
+  directory) resumes from the shard checkpoints.
+- With --run_dir and --serve, coordinates a multi-node run instead: shards of
+  the manifest are handed out over HTTP (run_coordinator.py) to worker nodes
+  started with --coordinator URL, and their aggregates are merged here.
 """
 
 import os
 import sys
+import time
 import argparse
 import subprocess
 from pathlib import Path
@@ -85,6 +93,87 @@ def run_analyzer(analyzer_path: Path,
     return proc.returncode
 
 
+def plan_run_manifest(run_dir: Path, targets, languages_arg, shard_size: int):
+    """Write the run manifest for all target directories (unless run_dir already has one)."""
+    from run_manifest import RunManifest
+    if RunManifest.exists(run_dir):
+        manifest = RunManifest.load(run_dir)
+        print(f"✓ Resuming {run_dir}: {len(manifest.shards)} shards already planned")
+        return manifest
+    from analyzer import iter_code_files  # only needed to plan
+
+    groups = []
+    for code_dir in targets:
+        languages = languages_arg or [infer_language_from_dir(code_dir.name)]
+        for language in languages:
+            if language not in SUPPORTED_LANGUAGES:
+                print(f"⚠️  Skipping {code_dir.name}: unsupported or unknown language {language}")
+                continue
+            base = code_dir.resolve()
+            files = {str(p.relative_to(base)) for p in iter_code_files(base, language)}
+            print(f"  {code_dir.name} | {language}: {len(files)} files")
+            groups.append({'name': f"{code_dir.name}/{language}", 'code_dir': str(base), 'language': language, 'files': files})
+    manifest = RunManifest.create(run_dir, groups, shard_size)
+    print(f"✓ Planned {len(manifest.shards)} shards in {run_dir / 'manifest.json'}")
+    return manifest
+
+
+def run_workers(analyzer_path: Path, source_args: list[str], parallel: int, output_dir: Path,
+                models: list[str] | None, extra_args: list[str] | None = None, env: dict | None = None) -> int:
+    """Run `parallel` analyzer.py workers at once on a shard source (--run_dir or --coordinator); returns the number that failed."""
+    cmd = [sys.executable, str(analyzer_path), *source_args, "--output_dir", str(output_dir), "--no_progress_bar"]
+    if models:
+        cmd += ["--models", *models]
+    if extra_args:
+        cmd += list(extra_args)
+    print(f"Starting {parallel} workers on {' '.join(source_args)}")
+    procs = [subprocess.Popen(cmd, env=env) for _ in range(parallel)]
+    return sum(1 for proc in procs if proc.wait() != 0)
+
+
+def worker_env(token: str | None) -> dict | None:
+    """Environment of local analyzer.py workers: the coordinator token goes there rather than on their command line."""
+    from run_coordinator import TOKEN_ENV
+    return {**os.environ, TOKEN_ENV: token} if token else None
+
+
+def serve_run(analyzer_path: Path, manifest, address: str, models: list[str], claim_timeout: float, parallel: int,
+              output_dir: Path, extra_args: list[str] | None = None, token: str | None = None) -> int:
+    """Coordinate a multi-node run of manifest until every shard of every model is done.
+
+    `parallel` local workers (0 for none) are started against the coordinator too.
+    With token, workers must send it with every request (see --token).
+    """
+    from run_coordinator import RunCoordinator, start_server, POLL_SECONDS
+    host, _, port = address.rpartition(":")
+    coordinator = RunCoordinator(manifest, models, claim_timeout)
+    server = start_server(coordinator, host or "0.0.0.0", int(port), token)
+    if not token and host not in ("localhost", "127.0.0.1", "::1"):
+        print(f"⚠️  Serving without --token: anyone who can reach port {server.server_address[1]} can claim and complete shards")
+    url = f"http://{host if host not in ('', '0.0.0.0') else 'localhost'}:{server.server_address[1]}"
+    print(f"✓ Coordinating {len(manifest.shards)} shards x {len(models)} model(s) at {url}")
+    print(f"  Start worker nodes with: python batch_run_stack_v2.py --coordinator http://<this host>:{server.server_address[1]} --parallel N")
+    procs = []
+    if parallel > 0:
+        cmd = [sys.executable, str(analyzer_path), "--coordinator", url, "--output_dir", str(output_dir),
+               "--no_progress_bar", "--models", *models, *(extra_args or [])]
+        print(f"Starting {parallel} local workers")
+        procs = [subprocess.Popen(cmd, env=worker_env(token)) for _ in range(parallel)]
+    last_report = time.time()
+    while not coordinator.finished.wait(POLL_SECONDS):
+        if time.time() - last_report >= 60:
+            status = coordinator.status()
+            done = ", ".join(f"{m}: {v['done']}/{status['shards']}" for m, v in status['models'].items())
+            print(f"  [{status['elapsed'] / 60:.1f} min] {done} shards done; {status['workers']} live workers")
+            last_report = time.time()
+    time.sleep(2 * POLL_SECONDS)  # let polling workers hear that the run is done
+    server.shutdown()
+    failures = sum(1 for proc in procs if proc.wait() != 0)
+    print("\n" + "=" * 80)
+    print(f"Run complete: merged summaries in {manifest.run_dir}" + (f" ({failures} local workers failed)" if failures else ""))
+    return 0 if failures == 0 else 2
+
+
 def main():
     parser = argparse.ArgumentParser(description="Batch runner for analyzer.py over *_code_output directories")
     parser.add_argument("--base_dir", type=str,
@@ -99,10 +188,30 @@ def main():
                         help="Flush detailed report every N files (0 to disable)")
     parser.add_argument("--models", nargs="+", default=None,
                         help="Optional list of tokenizer models to run (defaults to analyzer's --model)")
+    parser.add_argument("--run_dir", type=str, default=None,
+                        help="Sharded, resumable run over all directories: manifest, checkpoints and shard reports go here")
+    parser.add_argument("--shard_size", type=int, default=5000, help="Files per shard of a new --run_dir manifest")
+    parser.add_argument("--parallel", type=int, default=None,
+                        help="Analyzer workers to run on this node with --run_dir or --coordinator "
+                             "(default 1; with --serve default 0, coordinating only)")
+    parser.add_argument("--claim_timeout", type=float, default=900,
+                        help="With --run_dir, seconds after which a silent worker's shard is taken over")
+    parser.add_argument("--serve", type=str, default=None, metavar="[HOST:]PORT",
+                        help="With --run_dir, coordinate a multi-node run: hand shards out to --coordinator workers")
+    parser.add_argument("--coordinator", type=str, default=None, metavar="URL",
+                        help="Run --parallel workers on this node for the run coordinator at URL (no --base_dir needed)")
+    parser.add_argument("--token", type=str, default=os.environ.get("RUN_COORDINATOR_TOKEN"),
+                        help="Shared secret of --serve and its --coordinator workers, sent with every request "
+                             "(default: $RUN_COORDINATOR_TOKEN)")
     parser.add_argument("--extra", nargs=argparse.REMAINDER,
                         help="Extra args passed through to analyzer.py (must come after --)")
 
     args = parser.parse_args()
+    if args.serve and not args.run_dir:
+        parser.error("--serve needs --run_dir (the coordinator's manifest and checkpoints)")
+    if args.coordinator and args.run_dir:
+        parser.error("--coordinator workers get their shards from the coordinator; drop --run_dir")
+    parallel = args.parallel if args.parallel is not None else (0 if args.serve else 1)
 
     base_dir = Path(args.base_dir).expanduser()
     output_base = Path(args.output_base)
@@ -113,11 +222,40 @@ def main():
         print(f"Error: analyzer.py not found at {analyzer_path}")
         return 1
 
+    if args.coordinator:
+        from run_coordinator import CoordinatorClient
+        try:
+            models = args.models or list(CoordinatorClient(args.coordinator, "", token=args.token).status()["models"])
+        except OSError as e:
+            print(f"❌ Run coordinator {args.coordinator} is not reachable: {e}")
+            return 1
+        failures = run_workers(analyzer_path, ["--coordinator", args.coordinator], max(1, parallel), output_base,
+                               models, args.extra, worker_env(args.token))
+        print("\n" + "=" * 80)
+        print(f"Workers finished: {max(1, parallel) - failures}/{max(1, parallel)} successful")
+        return 0 if failures == 0 else 2
+
     targets = find_code_output_dirs(base_dir)
     if not targets:
         print(f"No *_code_output directories found under {base_dir}")
         return 1
 
+    if args.run_dir:
+        run_dir = Path(args.run_dir).expanduser()
+        manifest = plan_run_manifest(run_dir, targets, args.languages, args.shard_size)
+        if not manifest.shards:
+            print("No files to analyze")
+            return 1
+        if args.serve:
+            return serve_run(analyzer_path, manifest, args.serve, args.models or ["gpt2"], args.claim_timeout,
+                             parallel, output_base, args.extra, args.token)
+        parallel = max(1, parallel)
+        failures = run_workers(analyzer_path, ["--run_dir", str(run_dir), "--claim_timeout", str(args.claim_timeout)],
+                               parallel, output_base, args.models, args.extra)
+        print("\n" + "=" * 80)
+        print(f"Workers finished: {parallel - failures}/{parallel} successful; merged summaries in {run_dir}")
+        return 0 if failures == 0 else 2
+
     total = 0
     failures = 0
     for code_dir in targets:
@@ -0,0 +1,427 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Alignment benchmark on a large synthetic file
+
+Concatenates a code sample (code_samples/cpp/example.cpp by default) until it
+reaches the per-file size limit (1 MB, MAX_CODE_BYTES in analyzer.py) and times
+the rule-level alignment with the Python and native scoring loops. The
+containing-token lookup and the UTF-8 offset maps are also timed on their own,
+against the old linear scan and per-character Python loop, and per-file
+tokenizer calls against batched ones (--tokenize_batch) on copies of the sample.
+When the tokenizer is byte-level BPE, the native_bpe tokenizer backend is timed
+against the offset_mapping path, both ending in token byte spans.
+
+--scaling instead sweeps translation units from generate_corpus.py over sizes
+and nesting depths, timing parse, rule extraction and the alignment loop, and
+prints each stage's growth exponent between successive sizes (1.0 is linear)
+so superlinear costs show up before they hit a real corpus.
+
+--stress is the regression target for deep trees: it grows each template-heavy
+fixture of generate_corpus.py --stress over --stress_scales and checks that
+parse, extraction and alignment time and peak memory (Python heap while
+building per-rule details, plus the native arenas) grow linearly in the node
+count. It exits with status 1 when any of them grows faster than
+node_count**SUPERLINEAR_EXPONENT.
+"""
+
+import sys
+import math
+import gc
+import time
+import argparse
+import tracemalloc
+from bisect import bisect_left, bisect_right
+from pathlib import Path
+from typing import Optional
+
+from analyzer import QuickMultiLanguageAnalyzer
+from generate_corpus import STRESS_SHAPES, generate, generate_stress, parse_size
+from tokenizer_backends import NativeBPEBackend, make_backend
+
+MAX_CODE_BYTES = 1 * 1024 * 1024
+# A stage whose time grows faster than size**SUPERLINEAR_EXPONENT between two sizes is flagged
+SUPERLINEAR_EXPONENT = 1.3
+
+
+def build_large_code(sample_path: Path, target_bytes: int = MAX_CODE_BYTES) -> str:
+    """Repeat whole copies of the sample while the result stays within target_bytes."""
+    sample = sample_path.read_text(encoding='utf-8')
+    if not sample.endswith('\n'):
+        sample += '\n'
+    sample_bytes = len(sample.encode('utf-8'))
+    copies = max(1, target_bytes // sample_bytes)
+    return sample * copies
+
+
+def time_call(func, repeat: int):
+    """Best wall time over repeat runs, and the last result."""
+    best = float('inf')
+    result = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = func()
+        best = min(best, time.perf_counter() - start)
+    return best, result
+
+
+def token_lookup_benchmark(analyzer: QuickMultiLanguageAnalyzer, code: str, language: str, linear_samples: int):
+    """Time indexed vs linear containing-token lookup over every rule boundary."""
+    code_bytes = code.encode('utf-8')
+    encoding = analyzer.tokenizer(code, add_special_tokens=False, return_offsets_mapping=True)
+    char_to_byte, _ = analyzer._offset_maps(code, code_bytes, False)
+    token_boundaries = [(char_to_byte[s], char_to_byte[e]) for s, e in encoding['offset_mapping'] if e > s]
+    rules = analyzer._extract_rule_spans(analyzer.parsers[language].parse(code_bytes))
+    positions = [rules.starts[i] for i in range(rules.count)] + [rules.ends[i] for i in range(rules.count)]
+
+    token_starts = [tb[0] for tb in token_boundaries]
+    token_ends = [tb[1] for tb in token_boundaries]
+
+    def indexed():
+        for pos in positions:
+            prefix = bisect_left(token_starts, pos)
+            bisect_right(token_ends, pos, 0, prefix)
+
+    def linear(sample):
+        for pos in sample:
+            for tb_start, tb_end in token_boundaries:
+                if tb_start < pos < tb_end:
+                    break
+
+    indexed_time, _ = time_call(indexed, 1)
+    sample = positions[::max(1, len(positions) // linear_samples)][:linear_samples]
+    linear_time, _ = time_call(lambda: linear(sample), 1)
+    linear_estimate = linear_time / max(1, len(sample)) * len(positions)
+    return len(positions), len(token_boundaries), indexed_time, linear_estimate
+
+
+def offset_maps_benchmark(analyzer: QuickMultiLanguageAnalyzer, code: str, repeat: int):
+    """Time the char->byte + byte->UTF-16 maps in Python and with the native kernel."""
+    code_bytes = code.encode('utf-8')
+    native_core = analyzer.native_core
+    analyzer.native_core = None
+    python_time, expected = time_call(lambda: analyzer._offset_maps(code, code_bytes, True), repeat)
+    native_time = None
+    if native_core is not None:
+        analyzer.native_core = native_core
+        native_time, result = time_call(lambda: analyzer._offset_maps(code, code_bytes, True), repeat)
+        if list(result[0]) != list(expected[0]) or list(result[1]) != list(expected[1]):
+            print("  ❌ native offset maps differ from the Python maps")
+    return python_time, native_time
+
+
+def tokenize_batch_benchmark(analyzer: QuickMultiLanguageAnalyzer, sample: str, files: int, batch: int, repeat: int):
+    """Time one tokenizer call per file vs one call per `batch` files."""
+    codes = [sample] * files
+
+    def per_file():
+        for code in codes:
+            analyzer.tokenizer(code, add_special_tokens=False, return_offsets_mapping=True)
+
+    def batched():
+        for start in range(0, files, batch):
+            analyzer._batch_offset_mappings(codes[start:start + batch])
+
+    per_file_time, _ = time_call(per_file, repeat)
+    batched_time, _ = time_call(batched, repeat)
+    return per_file_time, batched_time
+
+
+def tokenizer_backend_benchmark(analyzer: QuickMultiLanguageAnalyzer, sample: str, files: int, batch: int,
+                                repeat: int):
+    """Time token byte spans from the offset_mapping path vs native_bpe batches; None when it does not apply."""
+    if analyzer.native_core is None:
+        return None
+    backend = make_backend('native_bpe', analyzer.tokenizer, analyzer.native_core)
+    if not isinstance(backend, NativeBPEBackend):
+        return None
+    codes = [sample] * files
+    sample_bytes = sample.encode('utf-8')
+
+    def offset_mapping():
+        for code in codes:
+            analyzer._token_boundaries(code, sample_bytes)
+
+    def native_batched():
+        for start in range(0, files, batch):
+            backend.encode_batch(codes[start:start + batch], [sample_bytes] * len(codes[start:start + batch]))
+
+    hf_time, _ = time_call(offset_mapping, repeat)
+    native_time, _ = time_call(native_batched, repeat)
+    if list(backend.encode(sample, sample_bytes)) != list(analyzer._token_boundaries(sample, sample_bytes) or []):
+        print("  ❌ native_bpe token spans differ from the offset_mapping path")
+    return hf_time, native_time, backend.describe()
+
+
+def scaling_benchmark(analyzer: QuickMultiLanguageAnalyzer, language: str, sizes, depths, repeat: int):
+    """Time parse, rule extraction and alignment on generated units of every size x depth.
+
+    Returns rows of (depth, bytes, rules, {stage: seconds}); the alignment is timed
+    on an offset_mapping computed beforehand, so tokenization is not part of it.
+    """
+    rows = []
+    parser = analyzer._thread_parser(language)
+    for depth in depths:
+        for size in sizes:
+            code = generate(language, size, depth)
+            code_bytes = code.encode('utf-8')
+            parse_time, _ = time_call(lambda: parser.parse(code_bytes), repeat)
+            extract_time, rules = time_call(lambda: analyzer._extract_rules(code_bytes, language), repeat)
+            offsets = analyzer.tokenizer(code, add_special_tokens=False, return_offsets_mapping=True)['offset_mapping']
+            # rules stay valid until the next extract, which only the next size makes
+            align_time, _ = time_call(lambda: analyzer._align_rules(code, code_bytes, rules, False, offsets=offsets), repeat)
+            rows.append((depth, len(code_bytes), rules.count,
+                         {'parse': parse_time, 'extract': extract_time, 'align': align_time}))
+    return rows
+
+
+def print_scaling(rows):
+    """Per-KB cost of each stage and its growth exponent against the previous size of the same depth."""
+    stages = ('parse', 'extract', 'align')
+    print(f"  {'depth':>5} {'KB':>8} {'rules':>9}  " + '  '.join(f"{s + ' us/KB':>13} {'exp':>5}" for s in stages))
+    cliffs = []
+    previous = None
+    for depth, size, rules, times in rows:
+        if previous is not None and previous[0] != depth:
+            previous = None
+        cells = []
+        for stage in stages:
+            per_kb = times[stage] / (size / 1024) * 1e6
+            exponent = ''
+            if previous is not None and size > previous[1] and previous[3][stage] > 0 and times[stage] > 0:
+                value = math.log(times[stage] / previous[3][stage]) / math.log(size / previous[1])
+                exponent = f"{value:.2f}"
+                if value > SUPERLINEAR_EXPONENT:
+                    cliffs.append((stage, depth, previous[1], size, value))
+            cells.append(f"{per_kb:>13.1f} {exponent:>5}")
+        print(f"  {depth:>5} {size / 1024:>8.0f} {rules:>9}  " + '  '.join(cells))
+        previous = (depth, size, rules, times)
+    if cliffs:
+        for stage, depth, small, large, value in cliffs:
+            print(f"  ⚠️  {stage} superlinear at depth {depth}: {small / 1024:.0f} -> {large / 1024:.0f} KB grows as size^{value:.2f}")
+    else:
+        print(f"  ✓ every stage within size^{SUPERLINEAR_EXPONENT}")
+
+
+def growth_exponent(small, large, small_x, large_x) -> Optional[float]:
+    """Exponent k with large/small = (large_x/small_x)**k; None when either side is not measurable."""
+    if small <= 0 or large <= 0 or large_x <= small_x:
+        return None
+    return math.log(large / small) / math.log(large_x / small_x)
+
+
+def fitted_exponent(points) -> Optional[float]:
+    """Least-squares slope of log(value) on log(x) over (x, value) points; steadier than any one step."""
+    points = [(math.log(x), math.log(value)) for x, value in points if x > 0 and value > 0]
+    if len(points) < 2:
+        return None
+    mean_x = sum(x for x, _ in points) / len(points)
+    mean_y = sum(y for _, y in points) / len(points)
+    spread = sum((x - mean_x) ** 2 for x, _ in points)
+    if spread == 0:
+        return None
+    return sum((x - mean_x) * (y - mean_y) for x, y in points) / spread
+
+
+def stress_benchmark(analyzer: QuickMultiLanguageAnalyzer, shapes, scales, repeat: int):
+    """Time and peak memory of every stress shape x scale.
+
+    Returns rows of (shape, scale, bytes, rules, {metric: value}). Times are best
+    of repeat with the garbage collector off, as timeit does, so collections of
+    earlier objects do not land on whichever fixture triggers them; memory is the
+    traced Python peak of a full alignment with per-rule details plus the native
+    context's arena high-water mark.
+    """
+    rows = []
+    parser = analyzer._thread_parser('cpp')
+    native_core = analyzer.native_core
+    for shape in shapes:
+        for scale in scales:
+            code = generate_stress(shape, scale)
+            code_bytes = code.encode('utf-8')
+            offsets = analyzer.tokenizer(code, add_special_tokens=False, return_offsets_mapping=True)['offset_mapping']
+            gc.collect()
+            gc.disable()
+            try:
+                parse_time, _ = time_call(lambda: parser.parse(code_bytes), repeat)
+                extract_time, rules = time_call(lambda: analyzer._extract_rules(code_bytes, 'cpp'), repeat)
+                rule_count = rules.count
+                align_time, _ = time_call(lambda: analyzer._align_rules(code, code_bytes, rules, False, offsets=offsets),
+                                          repeat)
+            finally:
+                gc.enable()
+            # A fresh context, so the high-water mark is this file's
+            if native_core is not None:
+                analyzer.native_core = native_core.clone()
+            tracemalloc.start()
+            analyzer.calculate_rule_level_alignment(code, 'cpp')
+            _, peak = tracemalloc.get_traced_memory()
+            tracemalloc.stop()
+            if native_core is not None:
+                peak += analyzer.native_core.arena_usage().high_water
+                analyzer.native_core.close()
+                analyzer.native_core = native_core
+            rows.append((shape, scale, len(code_bytes), rule_count,
+                         {'parse': parse_time, 'extract': extract_time, 'align': align_time, 'memory': peak}))
+    return rows
+
+
+def print_stress(rows) -> bool:
+    """Per-node cost of each metric and its growth exponent in node count; True when all stay linear.
+
+    Steps between successive scales are printed; the check uses the exponent fitted
+    over each shape's whole sweep, since single steps of small fixtures are noisy.
+    """
+    metrics = ('parse', 'extract', 'align', 'memory')
+    units = {'parse': 'us/knode', 'extract': 'us/knode', 'align': 'us/knode', 'memory': 'B/node'}
+    print(f"  {'shape':>9} {'scale':>6} {'KB':>7} {'nodes':>8}  "
+          + '  '.join(f"{m + ' ' + units[m]:>17} {'exp':>5}" for m in metrics))
+    cliffs = []
+    shapes = list(dict.fromkeys(row[0] for row in rows))
+    for shape in shapes:
+        series = [row for row in rows if row[0] == shape]
+        previous = None
+        for _, scale, size, nodes, values in series:
+            cells = []
+            for metric in metrics:
+                per_node = values[metric] / max(nodes, 1) * (1 if metric == 'memory' else 1e9)
+                exponent = growth_exponent(previous[4][metric], values[metric], previous[3], nodes) if previous else None
+                cells.append(f"{per_node:>17.1f} {'' if exponent is None else f'{exponent:.2f}':>5}")
+            print(f"  {shape:>9} {scale:>6} {size / 1024:>7.0f} {nodes:>8}  " + '  '.join(cells))
+            previous = (shape, scale, size, nodes, values)
+        cells = []
+        for metric in metrics:
+            exponent = fitted_exponent([(row[3], row[4][metric]) for row in series])
+            if exponent is not None and exponent > SUPERLINEAR_EXPONENT:
+                cliffs.append((metric, shape, series[0][3], series[-1][3], exponent))
+            cells.append(f"{'':>17} {'' if exponent is None else f'{exponent:.2f}':>5}")
+        print(f"  {shape:>9} {'fit':>6} {'':>7} {'':>8}  " + '  '.join(cells))
+    for metric, shape, small, large, exponent in cliffs:
+        print(f"  ❌ {metric} superlinear on {shape}: {small} -> {large} nodes grows as nodes^{exponent:.2f}")
+    if not cliffs:
+        print(f"  ✓ time and memory within nodes^{SUPERLINEAR_EXPONENT} on every shape")
+    return not cliffs
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark rule-level alignment on a 1 MB file')
+    parser.add_argument('--sample', default='code_samples/cpp/example.cpp', help='Source file to repeat')
+    parser.add_argument('--language', default='cpp', help='Language of the sample')
+    parser.add_argument('--model', default='gpt2', help='Tokenizer model name')
+    parser.add_argument('--target_bytes', type=int, default=MAX_CODE_BYTES, help='Size of the generated input')
+    parser.add_argument('--repeat', type=int, default=3, help='Runs per measurement (best time is reported)')
+    parser.add_argument('--linear_samples', type=int, default=500,
+                        help='Boundaries timed with the linear scan; its total is extrapolated')
+    parser.add_argument('--tokenize_files', type=int, default=1024, help='Sample copies for the batched tokenization timing')
+    parser.add_argument('--tokenize_batch', type=int, default=64, help='Files per batched tokenizer call')
+    parser.add_argument('--scaling', action='store_true',
+                        help='Sweep generated units (generate_corpus.py) over --scaling_sizes x --scaling_depths instead')
+    parser.add_argument('--scaling_sizes', default='16KB,64KB,256KB,1MB', help='Comma-separated unit sizes for --scaling')
+    parser.add_argument('--scaling_depths', default='1,4,16', help='Comma-separated nesting depths for --scaling')
+    parser.add_argument('--stress', action='store_true',
+                        help='Check time and memory stay linear in node count on template-heavy fixtures instead')
+    parser.add_argument('--stress_shapes', default='all',
+                        help=f"Comma-separated --stress shapes ({', '.join(STRESS_SHAPES)}) or all")
+    parser.add_argument('--stress_scales', default='500,1000,2000,4000', help='Comma-separated --stress scales')
+    args = parser.parse_args()
+
+    if args.stress:
+        shapes = STRESS_SHAPES if args.stress_shapes == 'all' else args.stress_shapes.split(',')
+        unknown = [shape for shape in shapes if shape not in STRESS_SHAPES]
+        if unknown:
+            parser.error(f"unknown stress shapes: {', '.join(unknown)}")
+        try:
+            scales = sorted(int(scale) for scale in args.stress_scales.split(','))
+        except ValueError as e:
+            parser.error(str(e))
+        analyzer = QuickMultiLanguageAnalyzer(model_name=args.model, allowed_languages=['cpp'])
+        if 'cpp' not in analyzer.parsers:
+            print("❌ cpp parser unavailable")
+            return 1
+        print(f"\nStress fixtures by node count (best of {args.repeat}):")
+        return 0 if print_stress(stress_benchmark(analyzer, shapes, scales, args.repeat)) else 1
+
+    if args.scaling:
+        try:
+            sizes = [parse_size(s) for s in args.scaling_sizes.split(',')]
+            depths = [int(d) for d in args.scaling_depths.split(',')]
+        except ValueError as e:
+            parser.error(str(e))
+        if args.language not in ('c', 'cpp'):
+            print("❌ --scaling generates C and C++ only")
+            return 1
+        analyzer = QuickMultiLanguageAnalyzer(model_name=args.model, allowed_languages=[args.language])
+        if args.language not in analyzer.parsers:
+            print(f"❌ {args.language} parser unavailable")
+            return 1
+        print(f"\nScaling on generated {args.language} units (best of {args.repeat}):")
+        print_scaling(scaling_benchmark(analyzer, args.language, sorted(sizes), depths, args.repeat))
+        return 0
+
+    sample_path = Path(args.sample)
+    if not sample_path.exists():
+        print(f"❌ Sample file does not exist: {sample_path}")
+        return 1
+
+    analyzer = QuickMultiLanguageAnalyzer(model_name=args.model, allowed_languages=[args.language])
+    if args.language not in analyzer.parsers:
+        print(f"❌ {args.language} parser unavailable")
+        return 1
+
+    code = build_large_code(sample_path, args.target_bytes)
+    code_size = len(code.encode('utf-8'))
+    print(f"\nInput: {sample_path.name} repeated to {code_size / 1024:.0f} KB")
+
+    native_core, native_languages = analyzer.native_core, analyzer.native_languages
+    analyzer.native_core, analyzer.native_languages = None, {}
+    python_time, python_result = time_call(lambda: analyzer.calculate_rule_level_summary(code, args.language), args.repeat)
+    print(f"  Python scoring:   {python_time:.3f}s  ({code_size / python_time / 1024:.0f} KB/s), "
+          f"score {python_result[0]:.2f}%, {python_result[1]} rules")
+
+    if native_core is not None:
+        analyzer.native_core, analyzer.native_languages = native_core, native_languages
+        native_time, native_result = time_call(lambda: analyzer.calculate_rule_level_summary(code, args.language), args.repeat)
+        status = '✓' if native_result[:3] == python_result[:3] else '❌ result mismatch'
+        print(f"  Native scoring:   {native_time:.3f}s  ({code_size / native_time / 1024:.0f} KB/s), "
+              f"{python_time / native_time:.1f}x {status}")
+        # The reset after the largest file coalesces each arena into one block; from then on nothing is allocated
+        analyzer.calculate_rule_level_summary(code, args.language)
+        blocks = native_core.arena_usage().block_allocations
+        analyzer.calculate_rule_level_summary(code, args.language)
+        usage = native_core.arena_usage()
+        steady = '✓ no heap blocks on repeat' if usage.block_allocations == blocks else '❌ arena still allocating'
+        print(f"  Native arena:     {usage.high_water / 1024:.0f} KB high-water, {usage.block_allocations} heap blocks, {steady}")
+    else:
+        print("  Native scoring:   ⚠️  build/alignment_core.so not found (run: python build_native.py)")
+
+    n_queries, n_tokens, indexed_time, linear_estimate = token_lookup_benchmark(
+        analyzer, code, args.language, args.linear_samples)
+    print(f"\nContaining-token lookup ({n_queries} boundaries, {n_tokens} tokens):")
+    print(f"  bisect:           {indexed_time:.3f}s")
+    print(f"  linear (est.):    {linear_estimate:.1f}s  ({linear_estimate / max(indexed_time, 1e-9):.0f}x slower)")
+
+    non_ascii = sum(1 for ch in code if ord(ch) > 0x7F)
+    python_maps, native_maps = offset_maps_benchmark(analyzer, code, args.repeat)
+    print(f"\nUTF-8 offset maps ({non_ascii} non-ASCII of {len(code)} characters):")
+    print(f"  Python:           {python_maps:.3f}s")
+    if native_maps is not None:
+        print(f"  Native ({analyzer.native_core.simd_kernel}):    {native_maps:.3f}s  ({python_maps / max(native_maps, 1e-9):.0f}x)")
+
+    per_file_tok, batched_tok = tokenize_batch_benchmark(
+        analyzer, sample_path.read_text(encoding='utf-8'), args.tokenize_files, args.tokenize_batch, args.repeat)
+    print(f"\nTokenization ({args.tokenize_files} copies of {sample_path.name}):")
+    print(f"  one call per file: {per_file_tok:.3f}s")
+    print(f"  {args.tokenize_batch} files per call: {batched_tok:.3f}s  ({per_file_tok / max(batched_tok, 1e-9):.1f}x)")
+
+    backends = tokenizer_backend_benchmark(
+        analyzer, sample_path.read_text(encoding='utf-8'), args.tokenize_files, args.tokenize_batch, args.repeat)
+    if backends is not None:
+        hf_time, native_time, description = backends
+        print(f"\nToken byte spans ({args.tokenize_files} copies):")
+        print(f"  offset_mapping:    {hf_time:.3f}s")
+        print(f"  {description}: {native_time:.3f}s  ({hf_time / max(native_time, 1e-9):.1f}x)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
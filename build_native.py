@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Build script for the native alignment core
+
+Compiles native/*.cpp into build/alignment_core.so, next to the compiled
+Tree-sitter language libraries. analyzer.py picks the library up automatically
+and falls back to the pure Python scoring loop when it is missing.
+
+The native tree walker needs the tree-sitter C runtime: either a tree-sitter
+checkout (--tree_sitter_dir / $TREE_SITTER_DIR, compiled from lib/src/lib.c)
+or an installed libtree-sitter found through pkg-config. Use the same
+tree-sitter version as the Python binding so both produce identical trees.
+Without it the library is still built, and rules are extracted in Python.
+
+--bench also builds build/alignment_bench, the Google Benchmark suite of
+native/alignment_bench.cpp (libbenchmark through pkg-config, else -lbenchmark).
+"""
+
+import os
+import sys
+import shlex
+import argparse
+import subprocess
+import sysconfig
+import unicodedata
+from pathlib import Path
+
+SCRIPT_DIR = Path(__file__).resolve().parent
+NATIVE_DIR = SCRIPT_DIR / 'native'
+BUILD_DIR = SCRIPT_DIR / 'build'
+UNICODE_TABLE = NATIVE_DIR / 'unicode_alnum.inc'
+CLASS_TABLE = NATIVE_DIR / 'unicode_classes.inc'
+
+CORE_SOURCES = ['alignment_core.cpp', 'tree_walker.cpp', 'offset_maps.cpp', 'bpe.cpp']
+BENCH_SOURCES = ['alignment_bench.cpp']
+
+
+def generate_unicode_table(path: Path = UNICODE_TABLE):
+    """Write the non-ASCII str.isalnum() ranges used by the word-char check.
+
+    The table is generated from this interpreter's unicodedata so native
+    mid-word detection matches `ch.isalnum()` exactly.
+    """
+    ranges = []
+    start = None
+    for cp in range(0x80, sys.maxunicode + 1):
+        if chr(cp).isalnum():
+            if start is None:
+                start = cp
+        elif start is not None:
+            ranges.append((start, cp - 1))
+            start = None
+    if start is not None:
+        ranges.append((start, sys.maxunicode))
+
+    lines = [
+        f"// Generated by build_native.py from Python {sys.version_info.major}.{sys.version_info.minor} "
+        f"unicodedata {unicodedata.unidata_version}. Do not edit.",
+        f"// Non-ASCII code point ranges for which str.isalnum() is true ({len(ranges)} ranges).",
+        f"#define AC_UNICODE_VERSION \"{unicodedata.unidata_version}\"",
+    ]
+    for lo, hi in ranges:
+        lines.append(f"{{0x{lo:05X}, 0x{hi:05X}}},")
+    path.write_text("\n".join(lines) + "\n", encoding='utf-8')
+    print(f"✓ Wrote {len(ranges)} Unicode alnum ranges to {path.relative_to(SCRIPT_DIR)}")
+
+
+def generate_class_table(path: Path = CLASS_TABLE):
+    """Write the non-ASCII \\p{L} and \\p{N} ranges of the native BPE pre-tokenizer (bpe.cpp)."""
+    ranges = []
+    for cp in range(0x80, sys.maxunicode + 1):
+        category = unicodedata.category(chr(cp))[0]
+        cls = {'L': 1, 'N': 2}.get(category)
+        if cls is None:
+            continue
+        if ranges and ranges[-1][2] == cls and ranges[-1][1] == cp - 1:
+            ranges[-1][1] = cp
+        else:
+            ranges.append([cp, cp, cls])
+
+    lines = [
+        f"// Generated by build_native.py from Python {sys.version_info.major}.{sys.version_info.minor} "
+        f"unicodedata {unicodedata.unidata_version}. Do not edit.",
+        f"// Non-ASCII letter (1) and number (2) code point ranges ({len(ranges)} ranges).",
+    ]
+    for lo, hi, cls in ranges:
+        lines.append(f"{{0x{lo:05X}, 0x{hi:05X}, {cls}}},")
+    path.write_text("\n".join(lines) + "\n", encoding='utf-8')
+    print(f"✓ Wrote {len(ranges)} Unicode letter/number ranges to {path.relative_to(SCRIPT_DIR)}")
+
+
+def shared_library_flags():
+    if sys.platform == 'darwin':
+        return ['-dynamiclib']
+    return ['-shared']
+
+
+def run(cmd) -> bool:
+    print(' '.join(shlex.quote(c) for c in cmd))
+    return subprocess.run(cmd).returncode == 0
+
+
+def find_tree_sitter(tree_sitter_dir: str):
+    """Return (compile_flags, link_inputs) for the tree-sitter runtime, or None if unavailable."""
+    if tree_sitter_dir:
+        root = Path(tree_sitter_dir).expanduser()
+        lib_c = root / 'lib' / 'src' / 'lib.c'
+        include = root / 'lib' / 'include'
+        if not lib_c.exists() or not (include / 'tree_sitter' / 'api.h').exists():
+            print(f"✗ {root} does not look like a tree-sitter checkout (missing lib/src/lib.c or lib/include)")
+            return None
+        return ['-I', str(include)], {'sources': [lib_c], 'includes': [include, root / 'lib' / 'src']}
+    try:
+        cflags = subprocess.run(['pkg-config', '--cflags', 'tree-sitter'], capture_output=True, text=True)
+        libs = subprocess.run(['pkg-config', '--libs', 'tree-sitter'], capture_output=True, text=True)
+    except FileNotFoundError:
+        return None
+    if cflags.returncode != 0 or libs.returncode != 0:
+        return None
+    return shlex.split(cflags.stdout), {'libs': shlex.split(libs.stdout)}
+
+
+def tree_sitter_inputs(cc, tree_sitter, opt):
+    """(defines, link inputs) for the core with or without the tree-sitter runtime; None if lib.c fails to build."""
+    defines = ['-DAC_HAVE_TREE_SITTER=0']
+    link_inputs = []
+    if tree_sitter is not None:
+        ts_flags, ts_link = tree_sitter
+        defines = ['-DAC_HAVE_TREE_SITTER=1', *ts_flags]
+        # Compile the runtime amalgamation (lib.c) as C, then link it into the core
+        for source in ts_link.get('sources', []):
+            obj = BUILD_DIR / 'obj' / 'tree_sitter_lib.o'
+            obj.parent.mkdir(parents=True, exist_ok=True)
+            includes = [f for inc in ts_link['includes'] for f in ('-I', str(inc))]
+            if not run([*cc, '-std=c11', '-fPIC', '-fvisibility=hidden', *opt, *includes, '-c', str(source), '-o', str(obj)]):
+                return None
+            link_inputs.append(str(obj))
+        link_inputs += ts_link.get('libs', [])
+        if sys.platform.startswith('linux'):
+            link_inputs.append('-ldl')
+    return defines, link_inputs
+
+
+def optimization_flags(debug: bool):
+    return ['-O0', '-g'] if debug else ['-O3', '-DNDEBUG']
+
+
+def compile_core(cxx, cc, extra_flags, output: Path, tree_sitter, debug: bool = False) -> bool:
+    sources = [str(NATIVE_DIR / s) for s in CORE_SOURCES]
+    opt = optimization_flags(debug)
+    inputs = tree_sitter_inputs(cc, tree_sitter, opt)
+    if inputs is None:
+        return False
+    defines, link_inputs = inputs
+    cmd = [*cxx, '-std=c++17', '-fPIC', '-fvisibility=hidden', '-Wall', '-Wextra',
+           *opt, *defines, *shared_library_flags(), '-I', str(NATIVE_DIR),
+           *sources, *link_inputs, '-o', str(output), *extra_flags]
+    return run(cmd)
+
+
+def benchmark_flags():
+    """(compile flags, link flags) of Google Benchmark."""
+    try:
+        cflags = subprocess.run(['pkg-config', '--cflags', 'benchmark'], capture_output=True, text=True)
+        libs = subprocess.run(['pkg-config', '--libs', 'benchmark'], capture_output=True, text=True)
+        if cflags.returncode == 0 and libs.returncode == 0:
+            return shlex.split(cflags.stdout), shlex.split(libs.stdout) + ['-pthread']
+    except FileNotFoundError:
+        pass
+    return [], ['-lbenchmark', '-pthread']
+
+
+def compile_bench(cxx, cc, extra_flags, output: Path, tree_sitter, debug: bool = False) -> bool:
+    """Link the benchmark suite with the core sources into one executable."""
+    sources = [str(NATIVE_DIR / s) for s in BENCH_SOURCES + CORE_SOURCES]
+    opt = optimization_flags(debug)
+    inputs = tree_sitter_inputs(cc, tree_sitter, opt)
+    if inputs is None:
+        return False
+    defines, link_inputs = inputs
+    bench_cflags, bench_libs = benchmark_flags()
+    cmd = [*cxx, '-std=c++17', '-Wall', '-Wextra', *opt, *defines, *bench_cflags, '-I', str(NATIVE_DIR),
+           *sources, *link_inputs, *bench_libs, '-o', str(output), *extra_flags]
+    return run(cmd)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build the native alignment core')
+    parser.add_argument('--cxx', default=os.environ.get('CXX') or sysconfig.get_config_var('CXX') or 'c++',
+                        help='C++ compiler to use (default: $CXX)')
+    parser.add_argument('--cc', default=os.environ.get('CC') or sysconfig.get_config_var('CC') or 'cc',
+                        help='C compiler used for the tree-sitter runtime (default: $CC)')
+    parser.add_argument('--tree_sitter_dir', default=os.environ.get('TREE_SITTER_DIR', ''),
+                        help='tree-sitter source checkout providing lib/src/lib.c (default: $TREE_SITTER_DIR, then pkg-config)')
+    parser.add_argument('--no_tree_sitter', action='store_true', help='Build without the native tree walker')
+    parser.add_argument('--debug', action='store_true', help='Build without optimizations and with debug info')
+    parser.add_argument('--bench', action='store_true',
+                        help='Also build build/alignment_bench (Google Benchmark suite of the native stages)')
+    parser.add_argument('--regen_unicode', action='store_true',
+                        help="Regenerate native/unicode_alnum.inc and unicode_classes.inc from this interpreter's unicodedata")
+    parser.add_argument('--extra_flags', default=os.environ.get('CXXFLAGS', ''),
+                        help='Extra compiler/linker flags')
+    args = parser.parse_args()
+
+    if args.regen_unicode or not UNICODE_TABLE.exists():
+        generate_unicode_table()
+    if args.regen_unicode or not CLASS_TABLE.exists():
+        generate_class_table()
+
+    BUILD_DIR.mkdir(parents=True, exist_ok=True)
+    output = BUILD_DIR / 'alignment_core.so'
+    tree_sitter = None if args.no_tree_sitter else find_tree_sitter(args.tree_sitter_dir)
+    if tree_sitter is None:
+        print("⚠️  tree-sitter runtime not found; building without the native tree walker")
+    if not compile_core(shlex.split(args.cxx), shlex.split(args.cc), shlex.split(args.extra_flags), output,
+                        tree_sitter, debug=args.debug):
+        print("❌ Native alignment core build failed")
+        return 1
+    print(f"✓ Native alignment core built: {output}" + (" (with tree walker)" if tree_sitter else ""))
+    if args.bench:
+        bench = BUILD_DIR / 'alignment_bench'
+        if not compile_bench(shlex.split(args.cxx), shlex.split(args.cc), shlex.split(args.extra_flags), bench,
+                             tree_sitter, debug=args.debug):
+            print("❌ Benchmark build failed (needs Google Benchmark, e.g. libbenchmark-dev)")
+            return 1
+        print(f"✓ Benchmark suite built: {bench}")
+        print(f"  Run: {bench.relative_to(SCRIPT_DIR)} --benchmark_out=bench.json --benchmark_out_format=json")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
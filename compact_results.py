@@ -0,0 +1,494 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Compact columnar result format (.acr)
+
+Unaligned rules are stored as fixed-width uint32 records with node types and
+previews interned into a string table, instead of one ~16-key dict per rule.
+Workers return UnalignedTable objects (cheap to pickle), and _save_results can
+write whole reports as a single mmap-able .acr file. The detailed JSON report
+is a rendering of this format:
+
+    python compact_results.py results/multilang/detailed_analysis_gpt2.acr -o report.json
+
+File layout (little-endian):
+    magic b'ACR1', u32 version, u64 header length, header JSON (metadata,
+    language aggregates and section offsets), then 8-byte aligned sections:
+    files (FILE_RECORD structs), records (RECORD_FIELDS uint32 per rule),
+    string offsets (uint64, n + 1) and the UTF-8 string blob.
+"""
+
+import sys
+import json
+import mmap
+import struct
+import argparse
+from array import array
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+MAGIC = b'ACR1'
+FORMAT_VERSION = 1
+NONE_ID = 0xFFFFFFFF
+
+# Record flags
+CROSSING_START = 0x01
+CROSSING_END = 0x02
+HAS_START_CONTEXT = 0x04
+HAS_END_CONTEXT = 0x08
+START_ALIGNED = 0x10
+END_ALIGNED = 0x20
+
+# uint32 fields per unaligned rule record
+(F_TYPE, F_START, F_END, F_FLAGS,
+ F_START_PREV_CP, F_START_CURR_CP, F_END_PREV_CP, F_END_CURR_CP,
+ F_ST_INDEX, F_ST_START, F_ST_END, F_ST_PREVIEW,
+ F_ET_INDEX, F_ET_START, F_ET_END, F_ET_PREVIEW,
+ F_TEXT_PREVIEW) = range(17)
+RECORD_FIELDS = 17
+
+# File flags
+FILE_HAS_PATH = 0x01
+FILE_HAS_IS_PERFECT = 0x02
+FILE_IS_PERFECT = 0x04
+FILE_BRIEF_RULES = 0x08
+FILE_ID_IS_INT = 0x10
+FILE_SCORE_IS_INT = 0x20  # score/processing_speed were int 0 rather than float
+FILE_SPEED_IS_INT = 0x40
+FILE_SPAN_RULES = 0x80  # rendered with --detail_level spans: no previews or token contexts
+
+# --detail_level: 'score' keeps only the counts, 'spans' each unaligned rule's
+# position and crossing flags, 'full' the whole details entry
+DETAIL_LEVELS = ('score', 'spans', 'full')
+
+# file sid, path sid, language sid, token source sid, flags, pad,
+# total_rules, aligned_rules, code_size, record_start, record_count,
+# score, analysis_time, processing_speed
+FILE_RECORD = struct.Struct('<IIIIII QQQQQ ddd')
+
+
+def unaligned_details_entry(rule_type: str, rule_start: int, rule_end: int, text_preview: str, token_source: str,
+                            start_chars: Optional[Tuple[str, str]], end_chars: Optional[Tuple[str, str]],
+                            token_start_context: Optional[Dict], token_end_context: Optional[Dict]) -> Dict:
+    """Details dict for a rule whose start and/or end boundary splits a word.
+
+    start_chars/end_chars are the (left, right) characters of a crossing boundary, None if not crossing.
+    """
+    crossing_start_reason = None
+    if start_chars is not None:
+        crossing_start_reason = f"rule.start_byte={rule_start} splits word between '{start_chars[0]}' and '{start_chars[1]}'"
+    crossing_end_reason = None
+    if end_chars is not None:
+        crossing_end_reason = f"rule.end_byte={rule_end} splits word between '{end_chars[0]}' and '{end_chars[1]}'"
+    return {
+        'type': rule_type,
+        'start_byte': rule_start,
+        'end_byte': rule_end,
+        'start_aligned': start_chars is None,
+        'end_aligned': end_chars is None,
+        'crossing_start': start_chars is not None,
+        'crossing_end': end_chars is not None,
+        'crossing_start_reason': crossing_start_reason,
+        'crossing_end_reason': crossing_end_reason,
+        'token_start_context': token_start_context,
+        'token_end_context': token_end_context,
+        'fully_aligned': False,
+        'text_preview': text_preview,
+        'explain_tree_sitter': f"Tree-sitter node '{rule_type}' spans bytes [{rule_start}, {rule_end}) from node.start_byte/end_byte.",
+        'explain_tokenizer': f"Token boundaries derived via {token_source}; offsets mapped to UTF-8 byte positions.",
+    }
+
+
+class StringTable:
+    """Interned strings; ids index self.strings."""
+
+    def __init__(self, strings: Optional[List[str]] = None):
+        self.strings: List[str] = list(strings) if strings else []
+        self._ids: Dict[str, int] = {s: i for i, s in enumerate(self.strings)}
+
+    def intern(self, value: Optional[str]) -> int:
+        if value is None:
+            return NONE_ID
+        sid = self._ids.get(value)
+        if sid is None:
+            sid = self._ids[value] = len(self.strings)
+            self.strings.append(value)
+        return sid
+
+    def get(self, sid: int) -> Optional[str]:
+        return None if sid == NONE_ID else self.strings[sid]
+
+
+class UnalignedTable:
+    """Unaligned rules of one file as fixed-width records plus a string table.
+
+    Rows are in first-occurrence order, like the details dict they replace.
+    brief=True renders the reduced key set used for HuggingFace samples. detail
+    is the --detail_level: a 'spans' table drops text and token context
+    previews, a 'score' table stores no rows at all. truncated names the limit
+    ('deadline' or 'rule_budget') that cut the file's analysis short, if any.
+    type_counts maps each node type of the file to its (distinct rules, distinct
+    aligned) counts, at every detail level (node_types.py).
+    """
+
+    def __init__(self, detail: str = 'full'):
+        self.records = array('I')
+        self.strings = StringTable()
+        self.token_source = ''
+        self.brief = False
+        self.detail = detail
+        self.truncated = None
+        self.type_counts: Dict[str, Tuple[int, int]] = {}
+
+    def __len__(self):
+        return len(self.records) // RECORD_FIELDS
+
+    def __getstate__(self):
+        return {'records': self.records, 'strings': self.strings.strings,
+                'token_source': self.token_source, 'brief': self.brief, 'detail': self.detail,
+                'truncated': self.truncated, 'type_counts': self.type_counts}
+
+    def __setstate__(self, state):
+        self.records = state['records']
+        self.strings = StringTable(state['strings'])
+        self.token_source = state['token_source']
+        self.brief = state['brief']
+        self.detail = state.get('detail', 'full')
+        self.truncated = state.get('truncated')
+        self.type_counts = state.get('type_counts', {})
+
+    def add(self, rule_type: str, rule_start: int, rule_end: int, text_preview: str, token_source: str,
+            start_chars: Optional[Tuple[str, str]], end_chars: Optional[Tuple[str, str]],
+            token_start_context: Optional[Dict], token_end_context: Optional[Dict]) -> Dict:
+        """Append one unaligned rule (same arguments as unaligned_details_entry).
+
+        Returns a placeholder details entry so callers can keep counting fully_aligned.
+        """
+        self.token_source = token_source
+        if self.detail != 'full':
+            if self.detail == 'score':
+                return {'fully_aligned': False}
+            text_preview = token_start_context = token_end_context = None
+        intern = self.strings.intern
+        flags = 0
+        if start_chars is None:
+            flags |= START_ALIGNED
+            start_cps = (0, 0)
+        else:
+            flags |= CROSSING_START
+            start_cps = (ord(start_chars[0]), ord(start_chars[1]))
+        if end_chars is None:
+            flags |= END_ALIGNED
+            end_cps = (0, 0)
+        else:
+            flags |= CROSSING_END
+            end_cps = (ord(end_chars[0]), ord(end_chars[1]))
+        contexts = []
+        for flag, ctx in ((HAS_START_CONTEXT, token_start_context), (HAS_END_CONTEXT, token_end_context)):
+            if ctx is None:
+                contexts += (NONE_ID, 0, 0, NONE_ID)
+            else:
+                flags |= flag
+                contexts += (ctx['token_index'], ctx['token_start'], ctx['token_end'], intern(ctx['token_text_preview']))
+        self.records.extend((intern(rule_type), rule_start, rule_end, flags, *start_cps, *end_cps,
+                             *contexts, intern(text_preview)))
+        return {'fully_aligned': False}
+
+    def rows(self):
+        """Yield each record as a tuple of RECORD_FIELDS ints."""
+        records = self.records
+        for base in range(0, len(records), RECORD_FIELDS):
+            yield records[base:base + RECORD_FIELDS]
+
+    def to_dicts(self) -> List[Dict]:
+        """Render as the unaligned_rules list of the JSON report."""
+        return [render_rule(row, self.strings.get, self.token_source, self.brief, self.detail == 'spans')
+                for row in self.rows()]
+
+
+def _context(row, base: int, present: bool, get_string) -> Optional[Dict]:
+    if not present:
+        return None
+    return {
+        'token_index': row[base],
+        'token_start': row[base + 1],
+        'token_end': row[base + 2],
+        'token_text_preview': get_string(row[base + 3]),
+    }
+
+
+def render_rule(row, get_string, token_source: str, brief: bool = False, spans: bool = False) -> Dict:
+    """One unaligned_rules entry, with the same keys and order as the JSON report."""
+    flags = row[F_FLAGS]
+    rule_type = get_string(row[F_TYPE])
+    rule_start, rule_end = row[F_START], row[F_END]
+    if spans:
+        return {
+            'rule_key': f"{rule_type}_{rule_start}_{rule_end}",
+            'type': rule_type,
+            'start_byte': rule_start,
+            'end_byte': rule_end,
+            'start_aligned': bool(flags & START_ALIGNED),
+            'end_aligned': bool(flags & END_ALIGNED),
+            'crossing_start': bool(flags & CROSSING_START),
+            'crossing_end': bool(flags & CROSSING_END),
+            'fully_aligned': False,
+        }
+    text_preview = get_string(row[F_TEXT_PREVIEW])
+    if brief:
+        return {
+            'rule_key': f"{rule_type}_{rule_start}_{rule_end}",
+            'type': rule_type,
+            'start_byte': rule_start,
+            'end_byte': rule_end,
+            'start_aligned': bool(flags & START_ALIGNED),
+            'end_aligned': bool(flags & END_ALIGNED),
+            'fully_aligned': False,
+            'text_preview': text_preview,
+        }
+    rd = unaligned_details_entry(
+        rule_type, rule_start, rule_end, text_preview, token_source,
+        (chr(row[F_START_PREV_CP]), chr(row[F_START_CURR_CP])) if flags & CROSSING_START else None,
+        (chr(row[F_END_PREV_CP]), chr(row[F_END_CURR_CP])) if flags & CROSSING_END else None,
+        _context(row, F_ST_INDEX, flags & HAS_START_CONTEXT, get_string),
+        _context(row, F_ET_INDEX, flags & HAS_END_CONTEXT, get_string),
+    )
+    return {
+        'rule_key': f"{rule_type}_{rule_start}_{rule_end}",
+        'type': rule_type,
+        'start_byte': rule_start,
+        'end_byte': rule_end,
+        'start_aligned': bool(flags & START_ALIGNED),
+        'end_aligned': bool(flags & END_ALIGNED),
+        'crossing_start': rd['crossing_start'],
+        'crossing_end': rd['crossing_end'],
+        'crossing_start_reason': rd['crossing_start_reason'],
+        'crossing_end_reason': rd['crossing_end_reason'],
+        'token_start_context': rd['token_start_context'],
+        'token_end_context': rd['token_end_context'],
+        'explain_tree_sitter': rd['explain_tree_sitter'],
+        'explain_tokenizer': rd['explain_tokenizer'],
+        'fully_aligned': False,
+        'text_preview': text_preview,
+    }
+
+
+def jsonable_results(results: Dict) -> Dict:
+    """Copy of a results dict with every UnalignedTable rendered to dicts (for json.dump)."""
+    rendered = {}
+    for lang, data in results.items():
+        files = []
+        for f in data.get('files', []):
+            rules = f.get('unaligned_rules')
+            if isinstance(rules, UnalignedTable):
+                f = dict(f, unaligned_rules=rules.to_dicts())
+            files.append(f)
+        rendered[lang] = dict(data, files=files)
+    return rendered
+
+
+def _pad8(n: int) -> int:
+    return (n + 7) & ~7
+
+
+def write_compact_report(path: Path, detailed_results: Dict):
+    """Write a detailed_results dict (as built by _save_results) as an .acr file.
+
+    Per-file unaligned_rules must be UnalignedTable objects.
+    """
+    strings = StringTable()
+    intern = strings.intern
+    files = bytearray()
+    records = array('I')
+    languages = {}
+    n_files = 0
+
+    for lang, data in detailed_results['languages'].items():
+        file_start = n_files
+        lang_sid = intern(lang)
+        for f in data.get('files', []):
+            rules = f.get('unaligned_rules')
+            if not isinstance(rules, UnalignedTable):
+                raise TypeError(f"{f.get('file')}: unaligned_rules must be an UnalignedTable")
+            record_start = len(records) // RECORD_FIELDS
+            remap = [intern(s) for s in rules.strings.strings]
+            for row in rules.rows():
+                row = list(row)
+                for field in (F_TYPE, F_ST_PREVIEW, F_ET_PREVIEW, F_TEXT_PREVIEW):
+                    if row[field] != NONE_ID:
+                        row[field] = remap[row[field]]
+                records.extend(row)
+
+            file_id = f.get('file')
+            flags = FILE_BRIEF_RULES if rules.brief else 0
+            if rules.detail == 'spans':
+                flags |= FILE_SPAN_RULES
+            if isinstance(file_id, int) and not isinstance(file_id, bool):
+                flags |= FILE_ID_IS_INT
+            if 'path' in f:
+                flags |= FILE_HAS_PATH
+            if isinstance(f['score'], int):
+                flags |= FILE_SCORE_IS_INT
+            if isinstance(f['processing_speed'], int):
+                flags |= FILE_SPEED_IS_INT
+            if 'is_perfect' in f:
+                flags |= FILE_HAS_IS_PERFECT
+                if f['is_perfect']:
+                    flags |= FILE_IS_PERFECT
+            files += FILE_RECORD.pack(
+                intern(str(file_id)), intern(f.get('path')), lang_sid, intern(rules.token_source), flags, 0,
+                f['total_rules'], f['aligned_rules'], f['code_size'], record_start, len(rules),
+                float(f['score']), float(f['analysis_time']), float(f['processing_speed']),
+            )
+            n_files += 1
+        languages[lang] = {
+            'aggregates': {k: v for k, v in data.items() if k != 'files'},
+            'file_range': [file_start, n_files - file_start],
+        }
+
+    blob = bytearray()
+    offsets = array('Q', [0])
+    for s in strings.strings:
+        blob += s.encode('utf-8', errors='surrogatepass')
+        offsets.append(len(blob))
+
+    metadata = {k: v for k, v in detailed_results.items() if k != 'languages'}
+    sections = [('files', bytes(files)), ('records', records.tobytes()),
+                ('string_offsets', offsets.tobytes()), ('strings', bytes(blob))]
+    header = {
+        'metadata': metadata,
+        'languages': languages,
+        'counts': {'files': n_files, 'records': len(records) // RECORD_FIELDS, 'strings': len(strings.strings)},
+        'record_fields': RECORD_FIELDS,
+        'file_record_size': FILE_RECORD.size,
+        'sections': {},
+    }
+    # Offsets depend on the header length, which depends on the offsets: size it with placeholders first
+    placeholder = 10 ** 15
+    header['sections'] = {name: [placeholder, len(data)] for name, data in sections}
+    prefix_len = len(MAGIC) + 4 + 8
+    header_len = len(json.dumps(header, ensure_ascii=False).encode('utf-8'))
+    offset = _pad8(prefix_len + header_len)
+    for name, data in sections:
+        header['sections'][name] = [offset, len(data)]
+        offset = _pad8(offset + len(data))
+    header_bytes = json.dumps(header, ensure_ascii=False).encode('utf-8')
+    header_bytes += b' ' * (header_len - len(header_bytes))
+
+    with open(path, 'wb') as out:
+        out.write(MAGIC + struct.pack('<IQ', FORMAT_VERSION, len(header_bytes)) + header_bytes)
+        for name, data in sections:
+            start = header['sections'][name][0]
+            out.write(b'\0' * (start - out.tell()))
+            out.write(data)
+
+
+class CompactReport:
+    """Read-only, mmap-backed view of an .acr file."""
+
+    def __init__(self, path: Path):
+        self.path = Path(path)
+        self._file = open(self.path, 'rb')
+        self._mm = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        if self._mm[:4] != MAGIC:
+            raise ValueError(f"{path} is not a compact results file")
+        version, header_len = struct.unpack_from('<IQ', self._mm, 4)
+        if version != FORMAT_VERSION:
+            raise ValueError(f"{path}: unsupported format version {version}")
+        self.header = json.loads(bytes(self._mm[16:16 + header_len]).decode('utf-8'))
+        view = memoryview(self._mm)
+        sections = self.header['sections']
+
+        def section(name):
+            start, length = sections[name]
+            return view[start:start + length]
+
+        self.files = section('files')
+        self.records = section('records').cast('I')
+        self._string_offsets = section('string_offsets').cast('Q')
+        self._strings = section('strings')
+
+    def close(self):
+        for name in ('files', 'records', '_string_offsets', '_strings'):
+            view = getattr(self, name, None)
+            if view is not None:
+                view.release()
+        self._mm.close()
+        self._file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def string(self, sid: int) -> Optional[str]:
+        if sid == NONE_ID:
+            return None
+        return bytes(self._strings[self._string_offsets[sid]:self._string_offsets[sid + 1]]).decode('utf-8', errors='surrogatepass')
+
+    def file_records(self, start: int, count: int):
+        for i in range(start, start + count):
+            yield FILE_RECORD.unpack_from(self.files, i * FILE_RECORD.size)
+
+    def rule_rows(self, record_start: int, record_count: int):
+        base = record_start * RECORD_FIELDS
+        for k in range(record_count):
+            yield self.records[base + k * RECORD_FIELDS:base + (k + 1) * RECORD_FIELDS]
+
+    def render(self) -> Dict:
+        """Rebuild the detailed_results dict written by the JSON report."""
+        result = dict(self.header['metadata'])
+        languages = {}
+        for lang, info in self.header['languages'].items():
+            files = []
+            for (file_sid, path_sid, _lang_sid, source_sid, flags, _pad, total_rules, aligned_rules, code_size,
+                 record_start, record_count, score, analysis_time, speed) in self.file_records(*info['file_range']):
+                file_id = self.string(file_sid)
+                entry = {'file': int(file_id) if flags & FILE_ID_IS_INT else file_id}
+                if flags & FILE_HAS_PATH:
+                    entry['path'] = self.string(path_sid)
+                brief = bool(flags & FILE_BRIEF_RULES)
+                spans = bool(flags & FILE_SPAN_RULES)
+                token_source = self.string(source_sid) or ''
+                entry['score'] = int(score) if flags & FILE_SCORE_IS_INT else score
+                entry['total_rules'] = total_rules
+                entry['aligned_rules'] = aligned_rules
+                entry['unaligned_rules'] = [render_rule(row, self.string, token_source, brief, spans)
+                                            for row in self.rule_rows(record_start, record_count)]
+                entry['code_size'] = code_size
+                entry['analysis_time'] = analysis_time
+                entry['processing_speed'] = int(speed) if flags & FILE_SPEED_IS_INT else speed
+                if flags & FILE_HAS_IS_PERFECT:
+                    entry['is_perfect'] = bool(flags & FILE_IS_PERFECT)
+                files.append(entry)
+            languages[lang] = dict(info['aggregates'], files=files)
+        # Keep the JSON report's key order: 'languages' sits between 'summary' and 'rankings'
+        ordered = {}
+        for key, value in result.items():
+            if key == 'rankings':
+                ordered['languages'] = languages
+            ordered[key] = value
+        ordered.setdefault('languages', languages)
+        return ordered
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Render a compact (.acr) results file as the detailed JSON report')
+    parser.add_argument('input', help='Path to an .acr file')
+    parser.add_argument('-o', '--output', help='Output JSON path (default: same name with .json)')
+    args = parser.parse_args()
+
+    input_path = Path(args.input)
+    output_path = Path(args.output) if args.output else input_path.with_suffix('.json')
+    with CompactReport(input_path) as report:
+        detailed_results = report.render()
+        counts = report.header['counts']
+    with open(output_path, 'w', encoding='utf-8') as f:
+        json.dump(detailed_results, f, ensure_ascii=False, indent=2)
+    print(f"✓ Rendered {counts['files']} files, {counts['records']} unaligned rules to {output_path}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Parallel source tree scan and size-aware scheduling
+
+scan_files walks a tree once, with its directories listed by a pool of threads
+(os.scandir), and keeps files whose suffix is one of a language's extensions
+together with their size. The sizes feed the scheduler: largest_first orders
+files so the biggest ones start first and small files fill in behind them, and
+byte_bins cuts that order into process-pool tasks of about the same number of
+bytes instead of the same number of files, so a task holding a few huge files
+does not finish long after the rest.
+"""
+
+import os
+import concurrent.futures
+from pathlib import Path
+from typing import Iterable, List, Sequence, Tuple
+
+# Directory listings run concurrently; they mostly wait on the filesystem
+DEFAULT_SCAN_THREADS = 8
+# Bytes of source per process-pool task with --schedule largest
+DEFAULT_BIN_BYTES = 4 * 1024 * 1024
+
+SCHEDULES = ('largest', 'walk')
+
+
+def _scan_dir(directory: str, extensions: frozenset):
+    """(matching (path, size) files, subdirectories) of one directory; unreadable ones are empty."""
+    files, subdirs = [], []
+    try:
+        with os.scandir(directory) as entries:
+            for entry in entries:
+                try:
+                    if entry.is_dir(follow_symlinks=False):
+                        subdirs.append(entry.path)
+                    elif os.path.splitext(entry.name)[1] in extensions and entry.is_file():
+                        files.append((entry.path, entry.stat().st_size))
+                except OSError:
+                    continue
+    except OSError:
+        pass
+    return files, subdirs
+
+
+def scan_files(root, extensions: Iterable[str], threads: int = DEFAULT_SCAN_THREADS) -> List[Tuple[Path, int]]:
+    """(path, size) of every file under root with one of extensions, sorted by path.
+
+    Symlinked directories are not descended into; symlinked files are followed.
+    """
+    extensions = frozenset(extensions)
+    found: List[Tuple[str, int]] = []
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max(1, threads), thread_name_prefix='scan') as pool:
+        pending = {pool.submit(_scan_dir, str(root), extensions)}
+        while pending:
+            done, pending = concurrent.futures.wait(pending, return_when=concurrent.futures.FIRST_COMPLETED)
+            for future in done:
+                files, subdirs = future.result()
+                found.extend(files)
+                pending.update(pool.submit(_scan_dir, d, extensions) for d in subdirs)
+    found.sort()
+    return [(Path(path), size) for path, size in found]
+
+
+def largest_first(files: Sequence[Tuple[Path, int]]) -> List[Tuple[Path, int]]:
+    """files ordered by size, largest first (ties keep their order)."""
+    return sorted(files, key=lambda f: -f[1])
+
+
+def byte_bins(files: Sequence[Tuple[Path, int]], budget: int = DEFAULT_BIN_BYTES) -> List[List[Tuple[Path, int]]]:
+    """Cut files, in order, into consecutive bins of at most budget bytes (a bigger file gets a bin of its own)."""
+    bins: List[List[Tuple[Path, int]]] = []
+    current: List[Tuple[Path, int]] = []
+    current_bytes = 0
+    for f in files:
+        if current and current_bytes + f[1] > budget:
+            bins.append(current)
+            current, current_bytes = [], 0
+        current.append(f)
+        current_bytes += f[1]
+    if current:
+        bins.append(current)
+    return bins
@@ -0,0 +1,458 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Synthetic C/C++ corpus generator
+
+Builds translation units of a chosen size and nesting depth out of the
+constructs of the golden samples. C++ units take those of
+code_samples/cpp/example.cpp: the Person/Employee class hierarchy, the
+Container<T> and max<T> templates, lambdas, structured bindings and UTF-8
+literals. C units take struct Person, create_person and the malloc blocks of
+code_samples/c/example.c. A file is a header followed by numbered units until
+it reaches the target size, so the size scales the rule count linearly and
+depth alone changes the shape: it is the length of the inheritance chain, the
+nesting of template arguments (Container<Container<...>>), lambdas and
+blocks, and, in C, of nested structs.
+
+--stress writes template-heavy C++ fixtures instead, each growing one
+construct of example.cpp to --scale: 'templates' nests Container<...> and
+std::map<std::string, ...> arguments scale deep, 'variadic' calls variadic
+templates with scale arguments and nests a TypeList<...> pack scale deep,
+'lambdas' chains scale nested lambdas, and 'main' fills main() with scale
+statement groups. Node count grows linearly with the scale and, except for
+'main', so does tree depth. Indentation stays flat so bytes are linear too.
+
+Output is deterministic for a seed. Files land in <output_dir>/<language>/,
+the layout analyzer.py --code_dir expects:
+
+    python generate_corpus.py --language both --size 1MB --depth 8 --files 4
+    python generate_corpus.py --stress all --scale 2000
+    python analyzer.py --code_dir synthetic_samples --language cpp
+"""
+
+import re
+import sys
+import random
+import argparse
+from pathlib import Path
+from typing import List
+
+NAMES = ['张三', '李四', '王五', '赵六', 'Alice', 'Bob', 'Zoë', 'Müller']
+POSITIONS = ['开发工程师', '产品经理', '测试工程师', 'designer', 'analyst']
+SUBJECTS = ['数学', '语文', '英语', 'physics', 'history']
+
+# Depth used when none is given; 1 is the shallowest
+DEFAULT_DEPTH = 2
+EXTENSIONS = {'c': '.c', 'cpp': '.cpp'}
+STRESS_SHAPES = ('templates', 'variadic', 'lambdas', 'main')
+DEFAULT_SCALE = 1000
+
+
+def parse_size(text: str) -> int:
+    """Bytes from '4096', '10KB', '1.5MB' (KB = 1024 bytes)."""
+    match = re.fullmatch(r'\s*([0-9]*\.?[0-9]+)\s*([KMG]?)B?\s*', text, re.IGNORECASE)
+    if not match:
+        raise ValueError(f"invalid size: {text!r}")
+    scale = {'': 1, 'K': 1024, 'M': 1024 ** 2, 'G': 1024 ** 3}[match.group(2).upper()]
+    return int(float(match.group(1)) * scale)
+
+
+def _indent(lines: List[str], levels: int = 1) -> List[str]:
+    pad = '    ' * levels
+    return [pad + line if line else line for line in lines]
+
+
+def _cpp_header() -> List[str]:
+    return [
+        '/**',
+        ' * 合成的C++测试文件 (generate_corpus.py)',
+        ' * Synthetic translation unit built from the constructs of example.cpp',
+        ' */',
+        '',
+        '#include <iostream>',
+        '#include <string>',
+        '#include <vector>',
+        '#include <map>',
+        '#include <memory>',
+        '#include <algorithm>',
+        '#include <iterator>',
+        '',
+        'constexpr double PI = 3.14159;',
+        '',
+    ]
+
+
+def _cpp_unit(i: int, depth: int, rng: random.Random) -> List[str]:
+    name, position, subject = rng.choice(NAMES), rng.choice(POSITIONS), rng.choice(SUBJECTS)
+    age, salary = rng.randint(20, 65), rng.randint(5000, 50000) + 0.5
+    person, employee, container = f'Person{i}', f'Employee{i}', f'Container{i}'
+    lines = [
+        f'// 单元 {i}: 类层次、模板、Lambda',
+        f'class {person} {{',
+        'protected:',
+        '    std::string name;',
+        '    int age;',
+        '',
+        'public:',
+        f'    {person}(const std::string& name, int age) : name(name), age(age) {{}}',
+        f'    virtual ~{person}() {{',
+        f'        std::cout << "{person}析构函数被调用" << std::endl;',
+        '    }',
+        '    virtual void greet() const {',
+        '        std::cout << "你好，我是" << name << std::endl;',
+        '    }',
+        '    std::string getName() const { return name; }',
+        '    int getAge() const { return age; }',
+        f'    friend std::ostream& operator<<(std::ostream& os, const {person}& person);',
+        '};',
+        '',
+        f'std::ostream& operator<<(std::ostream& os, const {person}& person) {{',
+        f'    os << "{person} [name=" << person.name << ", age=" << person.age << "]";',
+        '    return os;',
+        '}',
+        '',
+        f'class {employee} : public {person} {{',
+        'private:',
+        '    std::string position;',
+        '    double salary;',
+        '',
+        'public:',
+        f'    {employee}(const std::string& name, int age, const std::string& position, double salary)',
+        f'        : {person}(name, age), position(position), salary(salary) {{}}',
+        f'    ~{employee}() override {{',
+        f'        std::cout << "{employee}析构函数被调用" << std::endl;',
+        '    }',
+        '    void greet() const override {',
+        '        std::cout << "你好，我是" << name << "，担任" << position << "职位" << std::endl;',
+        '    }',
+        '    double getSalary() const { return salary; }',
+        '};',
+        '',
+    ]
+    # Inheritance chain, one level per depth
+    base = employee
+    for level in range(1, depth + 1):
+        derived = f'Manager{i}_{level}'
+        lines += [
+            f'class {derived} : public {base} {{',
+            'public:',
+            f'    using {base}::{base};',
+            f'    void greet() const override {{',
+            f'        {base}::greet();',
+            f'        std::cout << "级别 {level}" << std::endl;',
+            '    }',
+            '};',
+            '',
+        ]
+        base = derived
+    lines += [
+        'template<typename T>',
+        f'T max{i}(T a, T b) {{',
+        '    return (a > b) ? a : b;',
+        '}',
+        '',
+        'template<typename T>',
+        f'class {container} {{',
+        'private:',
+        '    std::vector<T> elements;',
+        '',
+        'public:',
+        '    void add(const T& element) { elements.push_back(element); }',
+        '    size_t size() const { return elements.size(); }',
+        '    const std::vector<T>& items() const { return elements; }',
+        '};',
+        '',
+    ]
+    # Template arguments nested depth deep: Container<Container<...<int>...>>
+    nested = 'int'
+    for _ in range(depth):
+        nested = f'{container}<{nested}>'
+    body = [
+        f'std::map<std::string, int> scores = {{{{"{subject}", {rng.randint(60, 100)}}}, {{"{rng.choice(SUBJECTS)}", {rng.randint(60, 100)}}}}};',
+        'for (const auto& [subject, score] : scores) {',
+        '    std::cout << subject << ": " << score << std::endl;',
+        '}',
+        f'{base} manager("{name}", {age}, "{position}", {salary});',
+        'manager.greet();',
+        f'std::shared_ptr<{person}> personPtr = std::make_shared<{employee}>(u8"{rng.choice(NAMES)}", {age + 1}, "{position}", {salary + 1000});',
+        'personPtr->greet();',
+        f'std::cout << "max = " << max{i}({rng.randint(0, 99)}, {rng.randint(0, 99)}) << std::endl;',
+        f'{nested} nested;',
+        f'std::cout << "嵌套模板大小: " << nested.size() << std::endl;',
+        f'std::vector<int> numbers = {{{", ".join(str(rng.randint(0, 99)) for _ in range(6))}}};',
+        'auto evenNumbers = std::vector<int>();',
+        'std::copy_if(numbers.begin(), numbers.end(), std::back_inserter(evenNumbers),',
+        '             [](int n) { return n % 2 == 0; });',
+    ]
+    # Lambdas nested depth deep, each calling the next
+    lam = ['return n + 1;']
+    for level in range(depth, 0, -1):
+        lam = [f'auto level{level} = [&](int n) {{'] + _indent(lam) + ['};', f'return level{level}(n * {level});']
+    body += ['auto chain = [&](int n) {'] + _indent(lam) + ['};', 'std::cout << "链式Lambda: " << chain(1) << std::endl;']
+    # Blocks nested depth deep
+    block = ['std::cout << "深度 " << k0 << std::endl;']
+    for level in range(depth - 1, -1, -1):
+        block = [f'for (int k{level} = 0; k{level} < 2; ++k{level}) {{'] + _indent(block) + ['}']
+    body += block
+    lines += [f'void exercise{i}() {{'] + _indent(body) + ['}', '']
+    return lines
+
+
+def _c_header() -> List[str]:
+    return [
+        '/**',
+        ' * 合成的C语言测试文件 (generate_corpus.py)',
+        ' * Synthetic translation unit built from the constructs of example.c',
+        ' */',
+        '',
+        '#include <stdio.h>',
+        '#include <stdlib.h>',
+        '#include <string.h>',
+        '',
+        '#define MAX_NAME_LENGTH 50',
+        '#define PI 3.14159',
+        '',
+        'int global_counter = 0;',
+        '',
+    ]
+
+
+def _c_unit(i: int, depth: int, rng: random.Random) -> List[str]:
+    name = rng.choice(NAMES)
+    person = f'Person{i}'
+    lines = [
+        f'// 单元 {i}: 结构体与动态内存',
+        f'struct {person} {{',
+        '    char name[MAX_NAME_LENGTH];',
+        '    int age;',
+        '    float height;',
+        '};',
+        '',
+    ]
+    # Structs nested depth deep
+    nested = ['int value;']
+    for level in range(depth, 0, -1):
+        nested = [f'struct Node{i}_{level} {{'] + _indent(nested) + [f'}} level{level};']
+    lines += [f'struct Tree{i} {{'] + _indent(nested) + ['    int size;', '};', '']
+    lines += [
+        f'struct {person} create_person{i}(const char* name, int age, float height) {{',
+        f'    struct {person} p;',
+        '    strncpy(p.name, name, MAX_NAME_LENGTH - 1);',
+        "    p.name[MAX_NAME_LENGTH - 1] = '\\0'; // 确保字符串结束",
+        '    p.age = age;',
+        '    p.height = height;',
+        '    return p;',
+        '}',
+        '',
+        f'void print_person{i}(struct {person} p) {{',
+        '    printf("姓名: %s\\n", p.name);',
+        '    printf("年龄: %d\\n", p.age);',
+        '    printf("身高: %.1f cm\\n", p.height);',
+        '}',
+        '',
+    ]
+    count = rng.randint(4, 16)
+    fill = [f'dynamic_array[i0] = i0 * {rng.randint(2, 20)};', 'printf("%d ", dynamic_array[i0]);']
+    for level in range(depth - 1, 0, -1):
+        fill = [f'for (int i{level} = 0; i{level} < 2; i{level}++) {{'] + _indent(fill) + ['}']
+    body = [
+        f'struct {person} person = create_person{i}("{name}", {rng.randint(20, 65)}, {rng.randint(150, 190)}.5f);',
+        f'print_person{i}(person);',
+        f'int* dynamic_array = (int*)malloc({count} * sizeof(int));',
+        'if (dynamic_array != NULL) {',
+        '    printf("\\n动态内存分配:\\n");',
+        f'    for (int i0 = 0; i0 < {count}; i0++) {{',
+    ] + _indent(fill, 2) + [
+        '    }',
+        '    free(dynamic_array);',
+        '}',
+        'global_counter++;',
+    ]
+    lines += [f'void exercise{i}(void) {{'] + _indent(body) + ['}', '']
+    return lines
+
+
+def generate(language: str, target_bytes: int, depth: int = DEFAULT_DEPTH, seed: int = 0) -> str:
+    """One translation unit of about target_bytes (whole units, at least one) for 'c' or 'cpp'."""
+    if language not in EXTENSIONS:
+        raise ValueError(f"unsupported language: {language} (expected c or cpp)")
+    depth = max(1, depth)
+    rng = random.Random(f"{language}:{seed}:{depth}")
+    header, unit = (_cpp_header, _cpp_unit) if language == 'cpp' else (_c_header, _c_unit)
+    lines = header()
+    size = sum(len(line.encode('utf-8')) + 1 for line in lines)
+    units = 0
+    while units == 0 or size < target_bytes:
+        block = unit(units, depth, rng)
+        lines += block
+        size += sum(len(line.encode('utf-8')) + 1 for line in block)
+        units += 1
+    void = '' if language == 'cpp' else 'void'
+    lines += [f'int main({void}) {{'] + [f'    exercise{k}();' for k in range(units)] + ['    return 0;', '}', '']
+    return '\n'.join(lines)
+
+
+def _stress_templates(scale: int, rng: random.Random):
+    """Container<...> and std::map<std::string, ...> template arguments nested scale deep."""
+    nested = 'int'
+    for level in range(scale):
+        nested = f'Container0<{nested}>' if level % 2 == 0 else f'std::map<std::string, {nested}>'
+    declarations = [f'using Nested = {nested};', '']
+    body = [
+        'Nested nested;',
+        'std::cout << "嵌套模板大小: " << sizeof(nested) << std::endl;',
+    ]
+    return declarations, body
+
+
+def _stress_variadic(scale: int, rng: random.Random):
+    """A variadic call with scale arguments, a fold over them and a TypeList pack nested scale deep."""
+    values = [rng.choice([str(rng.randint(0, 99)), f'{rng.randint(0, 99)}.5', f'std::string("{rng.choice(NAMES)}")'])
+              for _ in range(scale)]
+    numbers = [str(rng.randint(0, 99)) for _ in range(scale)]
+    nested = 'int'
+    for level in range(scale):
+        nested = f'TypeList<{rng.choice(["int", "double", "std::string", "char"])}, {nested}>'
+    declarations = [
+        'template<typename T>',
+        'void printAll(const T& value) {',
+        '    std::cout << value << std::endl;',
+        '}',
+        '',
+        'template<typename T, typename... Rest>',
+        'void printAll(const T& first, const Rest&... rest) {',
+        '    std::cout << first << ", ";',
+        '    printAll(rest...);',
+        '}',
+        '',
+        'template<typename... Args>',
+        'auto sumAll(Args... args) {',
+        '    return (args + ... + 0);',
+        '}',
+        '',
+        'template<typename... Ts>',
+        'struct TypeList {',
+        '    static constexpr size_t size = sizeof...(Ts);',
+        '};',
+        '',
+        f'using Types = {nested};',
+        '',
+    ]
+    body = [
+        f'printAll({", ".join(values)});',
+        f'std::cout << "总和: " << sumAll({", ".join(numbers)}) << std::endl;',
+        'std::cout << "类型数: " << Types::size << std::endl;',
+    ]
+    return declarations, body
+
+
+def _stress_lambdas(scale: int, rng: random.Random):
+    """scale lambdas nested in one another, each calling the next, as in example.cpp's copy_if predicate."""
+    opening = [f'    auto level{level} = [&](int n) {{' for level in range(1, scale + 1)]
+    closing = []
+    for level in range(scale, 0, -1):
+        closing += ['    };', f'    return level{level}(n * {rng.randint(1, 9)} % 1000);']
+    body = ['auto chain = [&](int n) {'] + opening + ['    return n + 1;'] + closing + [
+        '};',
+        'std::cout << "链式Lambda: " << chain(1) << std::endl;',
+    ]
+    return [], body
+
+
+def _stress_main(scale: int, rng: random.Random):
+    """scale statement groups from example.cpp's main(), one after another in a single body."""
+    body = [f'std::map<std::string, int> scores = {{{{"{rng.choice(SUBJECTS)}", {rng.randint(60, 100)}}}}};']
+    for k in range(scale):
+        body += [
+            f'Employee0 employee{k}("{rng.choice(NAMES)}", {rng.randint(20, 65)}, "{rng.choice(POSITIONS)}", '
+            f'{rng.randint(5000, 50000)}.5);',
+            f'employee{k}.greet();',
+            f'std::vector<int> numbers{k} = {{{", ".join(str(rng.randint(0, 99)) for _ in range(4))}}};',
+            f'auto even{k} = std::vector<int>();',
+            f'std::copy_if(numbers{k}.begin(), numbers{k}.end(), std::back_inserter(even{k}), '
+            f'[](int n) {{ return n % 2 == 0; }});',
+            'for (const auto& [subject, score] : scores) {',
+            f'    std::cout << subject << ": " << score + {k} << std::endl;',
+            '}',
+        ]
+    return [], body
+
+
+_STRESS_BUILDERS = {'templates': _stress_templates, 'variadic': _stress_variadic,
+                    'lambdas': _stress_lambdas, 'main': _stress_main}
+
+
+def generate_stress(shape: str, scale: int = DEFAULT_SCALE, seed: int = 0) -> str:
+    """A C++ translation unit with one template-heavy construct of example.cpp grown to scale (see STRESS_SHAPES)."""
+    if shape not in _STRESS_BUILDERS:
+        raise ValueError(f"unknown stress shape: {shape} (expected one of {', '.join(STRESS_SHAPES)})")
+    scale = max(1, scale)
+    rng = random.Random(f"stress:{shape}:{seed}:{scale}")
+    # The class hierarchy and templates the shapes instantiate: Person0, Employee0, Container0, max0
+    lines = _cpp_header() + _cpp_unit(0, 1, rng)
+    declarations, body = _STRESS_BUILDERS[shape](scale, rng)
+    lines += declarations
+    lines += ['int main() {', '    exercise0();'] + _indent(body) + ['    return 0;', '}', '']
+    return '\n'.join(lines)
+
+
+def write_corpus(output_dir, language: str, files: int, target_bytes: int, depth: int = DEFAULT_DEPTH,
+                 seed: int = 0) -> List[Path]:
+    """Write files translation units to output_dir/language/; returns their paths."""
+    directory = Path(output_dir) / language
+    directory.mkdir(parents=True, exist_ok=True)
+    paths = []
+    for k in range(files):
+        path = directory / f"synthetic_{target_bytes}_d{depth}_{k}{EXTENSIONS[language]}"
+        path.write_text(generate(language, target_bytes, depth, seed + k), encoding='utf-8')
+        paths.append(path)
+    return paths
+
+
+def write_stress(output_dir, shapes, scale: int = DEFAULT_SCALE, seed: int = 0) -> List[Path]:
+    """Write one fixture per stress shape to output_dir/cpp/; returns their paths."""
+    directory = Path(output_dir) / 'cpp'
+    directory.mkdir(parents=True, exist_ok=True)
+    paths = []
+    for shape in shapes:
+        path = directory / f"stress_{shape}_{scale}.cpp"
+        path.write_text(generate_stress(shape, scale, seed), encoding='utf-8')
+        paths.append(path)
+    return paths
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate synthetic C/C++ translation units from the golden sample constructs')
+    parser.add_argument('--language', choices=['c', 'cpp', 'both'], default='cpp', help='Language of the generated files')
+    parser.add_argument('--size', default='100KB', help='Target size per file, e.g. 10KB, 1MB')
+    parser.add_argument('--depth', type=int, default=DEFAULT_DEPTH,
+                        help='Nesting depth: inheritance chain, template arguments, lambdas and blocks')
+    parser.add_argument('--files', type=int, default=1, help='Files per language')
+    parser.add_argument('--seed', type=int, default=0, help='Seed of the first file (file k uses seed + k)')
+    parser.add_argument('--output_dir', default='synthetic_samples', help='Output directory (one subdirectory per language)')
+    parser.add_argument('--stress', choices=list(STRESS_SHAPES) + ['all'],
+                        help='Write template-heavy C++ stress fixtures of this shape instead')
+    parser.add_argument('--scale', type=int, default=DEFAULT_SCALE,
+                        help='Nesting depth or repetition count of the --stress construct')
+    args = parser.parse_args()
+
+    if args.stress:
+        shapes = STRESS_SHAPES if args.stress == 'all' else [args.stress]
+        for path in write_stress(args.output_dir, shapes, args.scale, args.seed):
+            print(f"✓ {path.name}: {path.stat().st_size / 1024:.1f} KB, scale {args.scale} in {path.parent}")
+        return 0
+
+    try:
+        target_bytes = parse_size(args.size)
+    except ValueError as e:
+        parser.error(str(e))
+    languages = ['c', 'cpp'] if args.language == 'both' else [args.language]
+    for language in languages:
+        paths = write_corpus(args.output_dir, language, args.files, target_bytes, args.depth, args.seed)
+        total = sum(p.stat().st_size for p in paths)
+        print(f"✓ {language}: {len(paths)} files, {total / 1024:.1f} KB, depth {args.depth} in {Path(args.output_dir) / language}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
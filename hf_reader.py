@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Prefetching HuggingFace dataset reader (--hf_prefetch, --hf_shard_parallelism)
+
+analyze_hf_dataset used to pull one example at a time from the dataset on the
+analysis thread, so every network or decompression stall stopped the
+analysis. PrefetchReader moves reading to background threads. They take
+record batches with Dataset.iter(batch_size), which decodes the Parquet/Arrow
+data a column at a time (pyarrow releases the GIL while it decompresses), and
+put them on one bounded queue of `prefetch` batches. The analysis thread takes
+rows off it by reference.
+
+With a shard parallelism of N > 1, the dataset is split with .shard(): one job
+per data file of a streaming dataset, N contiguous ranges otherwise. N threads
+work through the jobs, and their batches reach the analysis in arrival order.
+So that sampling and reports do not depend on that order, an example without
+an 'id' gets one from its position. For a map-style dataset that is its
+global index, the same as when reading sequentially ('sample_<i>'). For a
+streaming one it is its data file and row ('sample_<file>_<row>'). Offsets
+into the example order (manifest shards) need sequential reading, which one
+reader thread keeps.
+"""
+
+import queue
+import threading
+import time
+from collections import Counter
+from typing import Dict, Iterator, List, Optional, Sequence, Tuple
+
+DEFAULT_BATCH_SIZE = 64
+
+_DONE = object()
+
+
+def _batches(dataset, batch_size: int) -> Iterator[Dict[str, list]]:
+    """Column batches of dataset: Dataset.iter where the installed datasets has it, else grouped rows."""
+    iterate = getattr(dataset, 'iter', None)
+    if callable(iterate):
+        try:
+            yield from iterate(batch_size=batch_size)
+            return
+        except TypeError:
+            pass
+    rows: List[Dict] = []
+    for row in dataset:
+        rows.append(row)
+        if len(rows) >= batch_size:
+            yield _columns(rows)
+            rows = []
+    if rows:
+        yield _columns(rows)
+
+
+def _columns(rows: List[Dict]) -> Dict[str, list]:
+    columns: Dict[str, list] = {}
+    for k, row in enumerate(rows):
+        for key, value in row.items():
+            columns.setdefault(key, [None] * len(rows))[k] = value
+    return columns
+
+
+def shard_jobs(dataset, parallelism: int) -> List[Tuple[object, Optional[str], int]]:
+    """(shard, id prefix, first index) jobs: the whole dataset unless it can be split for parallel readers."""
+    if parallelism <= 1 or not callable(getattr(dataset, 'shard', None)):
+        return [(dataset, None, 0)]
+    n_shards = getattr(dataset, 'n_shards', None)
+    try:
+        if n_shards is not None:
+            # Streaming: one job per data file
+            if n_shards <= 1:
+                return [(dataset, None, 0)]
+            return [(dataset.shard(num_shards=n_shards, index=k), f"sample_{k}_", 0) for k in range(n_shards)]
+        total = len(dataset)
+        n = min(parallelism, max(1, total))
+        size, extra = divmod(total, n)
+        # contiguous=True shards: shard k starts at size * k + min(k, extra)
+        return [(dataset.shard(num_shards=n, index=k, contiguous=True), "sample_", size * k + min(k, extra))
+                for k in range(n)]
+    except (TypeError, ValueError, NotImplementedError):
+        return [(dataset, None, 0)]
+
+
+class PrefetchReader:
+    """Iterate dataset examples read ahead by background threads; close() (or leaving a for loop early) stops them."""
+
+    def __init__(self, dataset, prefetch: int = 8, parallelism: int = 1, batch_size: int = DEFAULT_BATCH_SIZE,
+                 columns: Optional[Sequence[str]] = None):
+        if columns:
+            select = getattr(dataset, 'select_columns', None)
+            present = getattr(dataset, 'column_names', None)
+            if callable(select) and present:
+                wanted = [c for c in columns if c in present]
+                if wanted:
+                    dataset = select(wanted)  # Parquet sources then decode only these columns
+        self.jobs = shard_jobs(dataset, parallelism)
+        self.parallelism = max(1, min(parallelism, len(self.jobs)))
+        self.batch_size = max(1, batch_size)
+        self.counters = Counter()
+        self._queue: queue.Queue = queue.Queue(maxsize=max(1, prefetch))
+        self._pending: queue.Queue = queue.Queue()
+        for job in self.jobs:
+            self._pending.put(job)
+        self._stop = threading.Event()
+        self._lock = threading.Lock()
+        self._threads: List[threading.Thread] = []
+
+    def __iter__(self):
+        self._threads = [threading.Thread(target=self._read, name=f"hf-reader-{k}", daemon=True)
+                         for k in range(self.parallelism)]
+        for thread in self._threads:
+            thread.start()
+        running = len(self._threads)
+        try:
+            while running:
+                start = time.perf_counter()
+                item = self._queue.get()
+                self.counters['wait_seconds'] += time.perf_counter() - start
+                if item is _DONE:
+                    running -= 1
+                    continue
+                if isinstance(item, BaseException):
+                    raise item
+                prefix, first, columns = item
+                names = list(columns)
+                values = [columns[name] for name in names]
+                ids = columns.get('id') if prefix is not None else None
+                for row, fields in enumerate(zip(*values)):
+                    example = dict(zip(names, fields))
+                    if prefix is not None and (ids is None or ids[row] is None):
+                        example['id'] = f"{prefix}{first + row}"
+                    yield example
+        finally:
+            self.close()
+
+    def _read(self):
+        try:
+            while not self._stop.is_set():
+                try:
+                    shard, prefix, first = self._pending.get_nowait()
+                except queue.Empty:
+                    break
+                self._count(shards=1)
+                for columns in _batches(shard, self.batch_size):
+                    n = len(next(iter(columns.values()), ()))
+                    if not self._put((prefix, first, columns)):
+                        return
+                    first += n
+                    self._count(batches=1, examples=n)
+        except Exception as e:
+            self._put(e)
+        finally:
+            self._put(_DONE)
+
+    def _count(self, **amounts):
+        with self._lock:
+            self.counters.update(amounts)
+
+    def _put(self, item) -> bool:
+        """Queue item, waiting for room unless the reader was closed; False once it is."""
+        start = time.perf_counter()
+        try:
+            while not self._stop.is_set():
+                try:
+                    self._queue.put(item, timeout=0.1)
+                    return True
+                except queue.Full:
+                    continue
+            return False
+        finally:
+            self._count(stall_seconds=time.perf_counter() - start)
+
+    def close(self):
+        self._stop.set()
+        for thread in self._threads:
+            thread.join()
+        self._threads = []
+
+    def summary(self) -> str:
+        c = self.counters
+        return (f"{int(c['examples'])} examples in {int(c['batches'])} batches from {int(c['shards'])} shards "
+                f"({self.parallelism} readers); analysis waited {c['wait_seconds']:.2f}s for data, "
+                f"readers {c['stall_seconds']:.2f}s for room")
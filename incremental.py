@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Incremental re-analysis of successive revisions of a file
+
+QuickMultiLanguageAnalyzer.calculate_rule_level_incremental keeps a FileState
+per path: the previous tree, token boundaries and per-rule results. A new
+revision is diffed against the previous one (line_edits), the edits are applied
+to the old tree with Tree.edit before reparsing, and only a few lines around
+each edit are re-tokenized (splice_tokens). Rules intersecting an edited window
+are scored again; the rules of every other subtree, with their unaligned
+records, are shifted over from the previous revision.
+"""
+
+import difflib
+from array import array
+from bisect import bisect_left, bisect_right
+from typing import Callable, List, NamedTuple, Optional, Tuple
+
+# Lines of context re-tokenized on each side of an edit, widened on a failed resync
+CONTEXT_LINES = (2, 8, 32)
+# Tokens next to a resync point that must match the previous tokenization
+SYNC_TOKENS = 2
+
+
+class Edit(NamedTuple):
+    """One changed byte range: old[old_start:old_end] became new[new_start:new_end]."""
+    old_start: int
+    old_end: int
+    new_start: int
+    new_end: int
+
+    @property
+    def delta(self) -> int:
+        return (self.new_end - self.new_start) - (self.old_end - self.old_start)
+
+
+class FileState:
+    """Everything kept from the last revision analyzed under one key.
+
+    Rule columns are in pre-order like RuleSpans; sizes[i] counts the rules in
+    rule i's subtree (itself included), dup[i] marks a repeat of an earlier
+    (type, start, end) and unaligned[i] a rule splitting a word. rows holds the
+    unaligned-table arguments of each first-occurrence unaligned rule, at the rule
+    indices in row_index.
+    """
+
+    __slots__ = ('language', 'code', 'code_bytes', 'tree', 'token_starts', 'token_ends', 'token_source',
+                 'types', 'starts', 'ends', 'sizes', 'dup', 'unaligned', 'row_index', 'rows', 'result')
+
+    def __init__(self, language: str, code: str, code_bytes: bytes, tree):
+        self.language = language
+        self.code = code
+        self.code_bytes = code_bytes
+        self.tree = tree
+        self.token_starts: List[int] = []
+        self.token_ends: List[int] = []
+        self.token_source = 'offset_mapping'
+        self.types = array('I')
+        self.starts = array('I')
+        self.ends = array('I')
+        self.sizes = array('I')
+        self.dup = bytearray()
+        self.unaligned = bytearray()
+        self.row_index = array('I')
+        self.rows: List[Tuple] = []
+        self.result = None
+
+
+def _line_offsets(lines: List[bytes]) -> List[int]:
+    offsets = [0]
+    for line in lines:
+        offsets.append(offsets[-1] + len(line))
+    return offsets
+
+
+def line_edits(old: bytes, new: bytes) -> List[Edit]:
+    """Changed ranges between two revisions, from a line diff, in increasing order.
+
+    Common leading and trailing lines are skipped before diffing, and each changed
+    block is trimmed to the bytes that actually differ.
+    """
+    old_lines = old.splitlines(keepends=True)
+    new_lines = new.splitlines(keepends=True)
+    head = 0
+    while head < len(old_lines) and head < len(new_lines) and old_lines[head] == new_lines[head]:
+        head += 1
+    tail = 0
+    while (tail < len(old_lines) - head and tail < len(new_lines) - head
+           and old_lines[-1 - tail] == new_lines[-1 - tail]):
+        tail += 1
+    old_mid = old_lines[head:len(old_lines) - tail]
+    new_mid = new_lines[head:len(new_lines) - tail]
+    old_offsets = _line_offsets(old_lines[:head] + old_mid)
+    new_offsets = _line_offsets(new_lines[:head] + new_mid)
+
+    edits = []
+    matcher = difflib.SequenceMatcher(None, old_mid, new_mid, autojunk=False)
+    for tag, i1, i2, j1, j2 in matcher.get_opcodes():
+        if tag == 'equal':
+            continue
+        old_start, old_end = old_offsets[head + i1], old_offsets[head + i2]
+        new_start, new_end = new_offsets[head + j1], new_offsets[head + j2]
+        # Trim bytes shared at both ends of the block
+        while old_start < old_end and new_start < new_end and old[old_start] == new[new_start]:
+            old_start += 1
+            new_start += 1
+        while old_end > old_start and new_end > new_start and old[old_end - 1] == new[new_end - 1]:
+            old_end -= 1
+            new_end -= 1
+        if edits and edits[-1].old_end >= old_start:
+            prev = edits.pop()
+            old_start, new_start = prev.old_start, prev.new_start
+        edits.append(Edit(old_start, old_end, new_start, new_end))
+    return edits
+
+
+def _point(text: bytes, pos: int) -> Tuple[int, int]:
+    return text.count(b'\n', 0, pos), pos - text.rfind(b'\n', 0, pos) - 1
+
+
+def apply_tree_edits(tree, edits: List[Edit], old: bytes, new: bytes):
+    """Tell tree about edits (in order), so the next parse can reuse its unchanged subtrees.
+
+    Edits are applied first to last: when edit k is applied, the text before it is
+    already the new revision's, so its start is new_start in both documents.
+    """
+    for edit in edits:
+        start = edit.new_start
+        start_point = _point(new, start)
+        removed = old[edit.old_start:edit.old_end]
+        newlines = removed.count(b'\n')
+        if newlines:
+            old_end_point = (start_point[0] + newlines, len(removed) - removed.rfind(b'\n') - 1)
+        else:
+            old_end_point = (start_point[0], start_point[1] + len(removed))
+        tree.edit(
+            start_byte=start,
+            old_end_byte=start + len(removed),
+            new_end_byte=edit.new_end,
+            start_point=start_point,
+            old_end_point=old_end_point,
+            new_end_point=_point(new, edit.new_end),
+        )
+
+
+def _line_window(text: bytes, start: int, end: int, context: int) -> Tuple[int, int]:
+    """[start, end) widened to whole lines plus context lines on each side."""
+    ws = text.rfind(b'\n', 0, start) + 1
+    for _ in range(context):
+        if ws == 0:
+            break
+        ws = text.rfind(b'\n', 0, ws - 1) + 1
+    we = end
+    for _ in range(context + 1):
+        nl = text.find(b'\n', we)
+        if nl == -1:
+            return ws, len(text)
+        we = nl + 1
+    return ws, we
+
+
+def _has(sorted_values, value: int) -> bool:
+    k = bisect_left(sorted_values, value)
+    return k < len(sorted_values) and sorted_values[k] == value
+
+
+def _matches_old(old_starts, old_ends, tokens, first: int, stop: int, shift: int) -> bool:
+    """Whether tokens[first:stop], moved back by shift, are tokens of the old revision."""
+    for start, end in tokens[first:stop]:
+        k = bisect_left(old_starts, start - shift)
+        if k == len(old_starts) or old_starts[k] != start - shift or old_ends[k] != end - shift:
+            return False
+    return True
+
+
+class TokenSplice(NamedTuple):
+    starts: List[int]
+    ends: List[int]
+    windows: List[Tuple[int, int]]   # re-tokenized [start, end] byte ranges, new coordinates
+    region_ends: List[int]           # window ends, for bisecting a position to its region
+    region_deltas: List[Tuple[int, int]]  # (byte shift, token index shift) after each window
+
+
+def splice_tokens(old_starts: List[int], old_ends: List[int], new: bytes, edits: List[Edit],
+                  tokenize_window: Callable[[int, int], Optional[List[Tuple[int, int]]]]) -> Optional[TokenSplice]:
+    """New token boundaries from the old ones plus re-tokenized windows around the edits.
+
+    tokenize_window(ws, we) returns byte-offset token boundaries of new[ws:we]
+    (relative to ws), or None. A window's tokens replace the old ones between two
+    resync points: the first token start after the window start, and the last
+    token end before its end, where the window's tokenization and the old one
+    share the boundary and the SYNC_TOKENS tokens on the far side of it. Tokens cut
+    short by the window edges, or changed through the tokenizer's lookahead, are
+    never used. Returns None if the old and new tokens do not resynchronize even
+    in the widest window; the caller then tokenizes the whole file.
+    """
+    starts: List[int] = []
+    ends: List[int] = []
+    windows, region_ends, region_deltas = [], [], []
+    old_k = 0          # next old token to copy
+    shift = 0          # byte shift of old positions past the previous group
+    prev_we = 0        # end of the previous group's window
+    k = 0
+    while k < len(edits):
+        for context in CONTEXT_LINES:
+            # Group edits whose windows overlap; windows never reach back into the previous group's
+            ws, we = _line_window(new, edits[k].new_start, edits[k].new_end, context)
+            ws = max(ws, prev_we)
+            group_end = k + 1
+            while group_end < len(edits):
+                next_ws, next_we = _line_window(new, edits[group_end].new_start, edits[group_end].new_end, context)
+                if next_ws >= we:
+                    break
+                we = max(we, next_we)
+                group_end += 1
+            group_delta = sum(edit.delta for edit in edits[k:group_end])
+            first_start, last_end = edits[k].new_start, edits[group_end - 1].new_end
+
+            window_tokens = tokenize_window(ws, we)
+            if window_tokens is None:
+                return None
+            new_tokens = [(ws + s, ws + e) for s, e in window_tokens]
+
+            # Left resync at p: the start of new token `first`, preceded by tokens the old revision has too
+            first = None
+            if ws == 0:
+                first, p = 0, 0
+            else:
+                for i in range(1 + SYNC_TOKENS, len(new_tokens)):
+                    pos = new_tokens[i][0]
+                    if pos > first_start:
+                        break
+                    if _has(old_starts, pos - shift) and \
+                            _matches_old(old_starts, old_ends, new_tokens, i - SYNC_TOKENS, i, shift):
+                        first, p = i, pos
+                        break
+            if first is None:
+                continue
+
+            # Right resync at q: the end of new token `last` (first - 1: nothing re-tokenized, q = p),
+            # followed by tokens the old revision has too
+            last = None
+            old_shift = shift + group_delta
+            if we == len(new):
+                last, q = len(new_tokens) - 1, len(new)
+            else:
+                for i in range(len(new_tokens) - 2 - SYNC_TOKENS, first - 2, -1):
+                    pos = new_tokens[i][1] if i >= first else p
+                    if pos < last_end:
+                        break
+                    boundary = _has(old_ends, pos - old_shift) or (i < first and _has(old_starts, pos - old_shift))
+                    if boundary and _matches_old(old_starts, old_ends, new_tokens, i + 1, i + 1 + SYNC_TOKENS, old_shift):
+                        last, q = i, pos
+                        break
+            if last is not None:
+                break
+        else:
+            return None
+
+        # Old tokens up to p (shifted), then the window's tokens up to q
+        copy_end = bisect_left(old_starts, p - shift, old_k)
+        if shift:
+            starts.extend(s + shift for s in old_starts[old_k:copy_end])
+            ends.extend(e + shift for e in old_ends[old_k:copy_end])
+        else:
+            starts.extend(old_starts[old_k:copy_end])
+            ends.extend(old_ends[old_k:copy_end])
+        for s, e in new_tokens[first:last + 1]:
+            starts.append(s)
+            ends.append(e)
+        shift += group_delta
+        old_k = bisect_left(old_starts, q - shift, copy_end)
+        windows.append((p, q))
+        region_ends.append(q)
+        region_deltas.append((shift, len(starts) - old_k))
+        prev_we = we
+        k = group_end
+
+    if shift:
+        starts.extend(s + shift for s in old_starts[old_k:])
+        ends.extend(e + shift for e in old_ends[old_k:])
+    else:
+        starts.extend(old_starts[old_k:])
+        ends.extend(old_ends[old_k:])
+    return TokenSplice(starts, ends, windows, region_ends, region_deltas)
+
+
+def merge_windows(windows: List[Tuple[int, int]]) -> List[Tuple[int, int]]:
+    """Sorted, disjoint union of closed [start, end] ranges."""
+    merged = []
+    for start, end in sorted(windows):
+        if merged and start <= merged[-1][1]:
+            if end > merged[-1][1]:
+                merged[-1] = (merged[-1][0], end)
+        else:
+            merged.append((start, end))
+    return merged
+
+
+def region_delta(splice: TokenSplice, pos: int) -> Tuple[int, int]:
+    """(byte shift, token index shift) from the old revision for a position outside every window."""
+    k = bisect_right(splice.region_ends, pos)
+    return splice.region_deltas[k - 1] if k else (0, 0)
+
+
+def shift_row(row: Tuple, byte_shift: int, token_shift: int) -> Tuple:
+    """An unaligned-table row (see FileState.rows) moved by byte_shift bytes and token_shift tokens."""
+    if not byte_shift and not token_shift:
+        return row
+    rule_type, start, end, preview, start_chars, end_chars, start_context, end_context = row
+
+    def moved(context):
+        if context is None:
+            return None
+        return {
+            'token_index': context['token_index'] + token_shift,
+            'token_start': context['token_start'] + byte_shift,
+            'token_end': context['token_end'] + byte_shift,
+            'token_text_preview': context['token_text_preview'],
+        }
+    return (rule_type, start + byte_shift, end + byte_shift, preview, start_chars, end_chars,
+            moved(start_context), moved(end_context))
@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Prometheus metrics for long-running batch and server modes
+
+A small registry of counters, gauges and histograms. It renders in the
+Prometheus text exposition format (0.0.4), which OpenMetrics scrapers also
+accept, and needs no prometheus_client. Values that some part of the analyzer
+already counts (result cache, per-file limits, pipeline queues, RSS) come from
+collectors: callbacks that the registry runs on every scrape.
+
+analyzer.py --metrics_port serves /metrics from a background thread during
+batch runs. analyzer_server.py serves it next to /stats, and
+analyze_memory_usage.py --live polls either one as a dashboard. Rates
+(files/s, bytes/s) are left to the scraper: they are the difference between
+two scrapes of the *_total counters.
+"""
+
+import os
+import re
+import math
+import threading
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from typing import Callable, Dict, Iterable, List, Optional, Tuple
+
+# Per-file and per-request latency buckets, in seconds
+LATENCY_BUCKETS = (0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0)
+
+CONTENT_TYPE = 'text/plain; version=0.0.4; charset=utf-8'
+
+
+def _escape(value) -> str:
+    return str(value).replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def _format_labels(labels: Dict) -> str:
+    if not labels:
+        return ''
+    return '{' + ','.join(f'{key}="{_escape(value)}"' for key, value in labels.items()) + '}'
+
+
+def _format_value(value: float) -> str:
+    if value == math.inf:
+        return '+Inf'
+    if isinstance(value, int) or float(value).is_integer():
+        return str(int(value))
+    return repr(float(value))
+
+
+class Family:
+    """One metric and its samples by label values; counters only go up, histograms count into buckets."""
+
+    def __init__(self, name: str, kind: str, help_text: str, labels: Tuple[str, ...] = (),
+                 buckets: Tuple[float, ...] = LATENCY_BUCKETS):
+        self.name = name
+        self.kind = kind
+        self.help = help_text
+        self.labels = tuple(labels)
+        self.buckets = tuple(buckets)
+        self._values: Dict[Tuple, object] = {}
+        self._lock = threading.Lock()
+
+    def _key(self, labels: Dict) -> Tuple:
+        return tuple(str(labels.get(name, '')) for name in self.labels)
+
+    def inc(self, amount: float = 1, **labels):
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = self._values.get(key, 0) + amount
+
+    def set(self, value: float, **labels):
+        key = self._key(labels)
+        with self._lock:
+            self._values[key] = value
+
+    def observe(self, value: float, **labels):
+        key = self._key(labels)
+        with self._lock:
+            state = self._values.get(key)
+            if state is None:
+                state = self._values[key] = [[0] * len(self.buckets), 0.0, 0]
+            for i, bound in enumerate(self.buckets):
+                if value <= bound:
+                    state[0][i] += 1
+                    break
+            state[1] += value
+            state[2] += 1
+
+    def samples(self) -> List[Tuple[str, Dict, float]]:
+        """(sample name, labels, value) rows, histograms expanded into cumulative buckets, _sum and _count."""
+        rows = []
+        with self._lock:
+            # observe() mutates histogram state in place: copy it here so each row set is one consistent snapshot
+            values = [(key, (list(value[0]), value[1], value[2]) if self.kind == 'histogram' else value)
+                      for key, value in self._values.items()]
+        for key, value in values:
+            labels = dict(zip(self.labels, key))
+            if self.kind != 'histogram':
+                rows.append((self.name, labels, value))
+                continue
+            counts, total, count = value
+            cumulative = 0
+            for bound, n in zip(self.buckets, counts):
+                cumulative += n
+                rows.append((f"{self.name}_bucket", dict(labels, le=_format_value(bound)), cumulative))
+            rows.append((f"{self.name}_bucket", dict(labels, le='+Inf'), count))
+            rows.append((f"{self.name}_sum", labels, total))
+            rows.append((f"{self.name}_count", labels, count))
+        return rows
+
+
+# A collector returns (name, kind, help, [(labels, value), ...]) families, computed at scrape time
+Collector = Callable[[], Iterable[Tuple[str, str, str, List[Tuple[Dict, float]]]]]
+
+
+class Registry:
+    """Metric families by name (created on first use, shared after) and scrape-time collectors."""
+
+    def __init__(self):
+        self._families: Dict[str, Family] = {}
+        self._collectors: List[Collector] = []
+        self._lock = threading.Lock()
+
+    def _family(self, name: str, kind: str, help_text: str, labels, **kwargs) -> Family:
+        with self._lock:
+            family = self._families.get(name)
+            if family is None:
+                family = self._families[name] = Family(name, kind, help_text, labels, **kwargs)
+            return family
+
+    def counter(self, name: str, help_text: str, labels: Tuple[str, ...] = ()) -> Family:
+        return self._family(name, 'counter', help_text, labels)
+
+    def gauge(self, name: str, help_text: str, labels: Tuple[str, ...] = ()) -> Family:
+        return self._family(name, 'gauge', help_text, labels)
+
+    def histogram(self, name: str, help_text: str, labels: Tuple[str, ...] = (),
+                  buckets: Tuple[float, ...] = LATENCY_BUCKETS) -> Family:
+        return self._family(name, 'histogram', help_text, labels, buckets=buckets)
+
+    def collector(self, collect: Collector):
+        with self._lock:
+            self._collectors.append(collect)
+
+    def render(self) -> str:
+        """Every family in the text exposition format; collector families of the same name are merged."""
+        with self._lock:
+            families = list(self._families.values())
+            collectors = list(self._collectors)
+        merged: Dict[str, Tuple[str, str, List]] = {}
+        for family in families:
+            merged[family.name] = (family.kind, family.help, family.samples())
+        for collect in collectors:
+            try:
+                collected = list(collect())
+            except Exception:
+                continue  # a failing collector must not break the scrape
+            for name, kind, help_text, rows in collected:
+                entry = merged.setdefault(name, (kind, help_text, []))
+                entry[2].extend((name, labels, value) for labels, value in rows)
+        lines = []
+        for name, (kind, help_text, rows) in merged.items():
+            lines.append(f"# HELP {name} {help_text}")
+            lines.append(f"# TYPE {name} {kind}")
+            lines.extend(f"{sample}{_format_labels(labels)} {_format_value(value)}" for sample, labels, value in rows)
+        return '\n'.join(lines) + '\n'
+
+
+def resident_memory_bytes() -> Optional[int]:
+    """RSS of this process from /proc (psutil elsewhere); None when neither is available."""
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * os.sysconf('SC_PAGE_SIZE')
+    except (OSError, ValueError, IndexError, AttributeError):
+        pass
+    try:
+        import psutil
+        return psutil.Process().memory_info().rss
+    except Exception:
+        return None
+
+
+def children_memory_bytes() -> Optional[int]:
+    """Summed RSS of this process's children (e.g. --workers processes); needs psutil."""
+    try:
+        import psutil
+    except ImportError:
+        return None
+    total = 0
+    for child in psutil.Process().children(recursive=True):
+        try:
+            total += child.memory_info().rss
+        except psutil.Error:
+            continue
+    return total
+
+
+def process_collector():
+    """RSS of this process and of its children."""
+    rss = resident_memory_bytes()
+    if rss is not None:
+        yield 'process_resident_memory_bytes', 'gauge', 'Resident memory of this process in bytes', [({}, rss)]
+    children = children_memory_bytes()
+    if children is not None:
+        yield ('process_children_resident_memory_bytes', 'gauge',
+               'Resident memory of child processes (--workers) in bytes', [({}, children)])
+
+
+class RunMetrics:
+    """Per-file counters and latency of analyzers, labeled by model and language."""
+
+    def __init__(self, registry: Registry):
+        labels = ('model', 'language')
+        self.files = registry.counter('analyzer_files_total', 'Files analyzed', labels)
+        self.bytes = registry.counter('analyzer_bytes_total', 'Characters of code analyzed', labels)
+        self.rules = registry.counter('analyzer_rules_total', 'Rules scored', labels)
+        self.latency = registry.histogram('analyzer_file_seconds', 'Per-file analysis time in seconds', labels)
+        self.stages = registry.counter('analyzer_stage_seconds_total', 'Seconds spent per analysis stage',
+                                       labels + ('stage',))
+
+    def observe_file(self, model: str, language: str, code_size: int, seconds: float, rules: int = 0,
+                     stage_times: Optional[Dict[str, float]] = None):
+        self.files.inc(model=model, language=language)
+        self.bytes.inc(code_size, model=model, language=language)
+        self.rules.inc(rules, model=model, language=language)
+        self.latency.observe(seconds, model=model, language=language)
+        for stage, stage_seconds in (stage_times or {}).items():
+            self.stages.inc(stage_seconds, model=model, language=language, stage=stage)
+
+
+class MetricsServer:
+    """GET /metrics of a registry, served from a background thread."""
+
+    def __init__(self, registry: Registry, host: str = '127.0.0.1', port: int = 9464):
+        handler = type('MetricsHandler', (_MetricsHandler,), {'registry': registry})
+        self._server = ThreadingHTTPServer((host, port), handler)
+        self._server.daemon_threads = True
+        self.url = f"http://{host}:{self._server.server_address[1]}/metrics"
+        threading.Thread(target=self._server.serve_forever, name='metrics-http', daemon=True).start()
+
+    def close(self):
+        self._server.shutdown()
+        self._server.server_close()
+
+
+class _MetricsHandler(BaseHTTPRequestHandler):
+    registry: Registry = None
+
+    def do_GET(self):
+        if self.path.split('?', 1)[0].rstrip('/') != '/metrics':
+            self.send_error(404)
+            return
+        body = self.registry.render().encode('utf-8')
+        self.send_response(200)
+        self.send_header('Content-Type', CONTENT_TYPE)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+_SAMPLE = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*)(?:\{(.*)\})?\s+(\S+)')
+_LABEL = re.compile(r'([a-zA-Z_][a-zA-Z0-9_]*)="((?:[^"\\]|\\.)*)"')
+
+
+def parse_metrics(text: str) -> List[Tuple[str, Dict[str, str], float]]:
+    """(name, labels, value) samples of a text exposition; comments and malformed lines are skipped."""
+    samples = []
+    for line in text.splitlines():
+        match = _SAMPLE.match(line)
+        if not match or line.startswith('#'):
+            continue
+        labels = {key: value.replace('\\"', '"').replace('\\n', '\n').replace('\\\\', '\\')
+                  for key, value in _LABEL.findall(match.group(2) or '')}
+        try:
+            samples.append((match.group(1), labels, float(match.group(3))))
+        except ValueError:
+            continue
+    return samples
+
+
+def fetch_metrics(url: str, timeout: float = 10) -> List[Tuple[str, Dict[str, str], float]]:
+    """Scrape url (a /metrics endpoint; '/metrics' is appended to a bare host:port) and parse it."""
+    if '://' not in url:
+        url = f"http://{url}"
+    if not url.rstrip('/').endswith('/metrics'):
+        url = url.rstrip('/') + '/metrics'
+    with urllib.request.urlopen(url, timeout=timeout) as response:
+        return parse_metrics(response.read().decode('utf-8'))
+
+
+def histogram_quantile(q: float, buckets: List[Tuple[float, float]]) -> Optional[float]:
+    """Quantile q from cumulative (upper bound, count) buckets, interpolated within a bucket like Prometheus."""
+    buckets = sorted(buckets)
+    if not buckets or buckets[-1][1] <= 0:
+        return None
+    rank = q * buckets[-1][1]
+    lower_bound, lower_count = 0.0, 0.0
+    for bound, count in buckets:
+        if count >= rank:
+            if bound == math.inf:
+                return lower_bound  # the highest finite bound is as far as the buckets tell
+            if count == lower_count:
+                return bound
+            return lower_bound + (bound - lower_bound) * (rank - lower_count) / (count - lower_count)
+        lower_bound, lower_count = bound, count
+    return lower_bound
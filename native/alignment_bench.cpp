@@ -0,0 +1,432 @@
+/*
+ * Benchmark suite for the native alignment core (Google Benchmark)
+ *
+ * Times each stage of the per-file path on its own: the UTF-8 offset maps,
+ * the tree walk, the token index sweep, the word-character test of rule
+ * boundaries (range table search against the lookup tables) and rule scoring. Inputs are the C and
+ * C++ golden samples from code_samples, and variants of them scaled to 10 KB,
+ * 100 KB and 1 MB, once reduced to ASCII and once with CJK comment lines
+ * mixed in. Token spans come from a GPT-2 style pre-tokenizer whose pieces are
+ * cut to at most four characters, which splits words the way a BPE vocabulary
+ * does. Rule spans come from the tree walker when it is built and the grammar
+ * library is found; otherwise words, bracket pairs and lines stand in for
+ * syntax nodes (the context reports which). Every benchmark reports bytes/s
+ * and, except the offset maps, nodes/s.
+ *
+ * Built by `python build_native.py --bench` into build/alignment_bench:
+ *
+ *   build/alignment_bench --corpus_dir=code_samples --grammar_dir=build \
+ *       --benchmark_out=bench.json --benchmark_out_format=json
+ */
+
+#include "alignment_core.h"
+#include "token_index.h"
+#include "word_chars.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Corpus {
+    std::string name;      // e.g. cpp_ascii_100KB
+    std::string language;  // c or cpp
+    std::string bytes;
+    std::vector<uint32_t> token_starts, token_ends;
+    std::vector<uint32_t> rule_types, rule_starts, rule_ends;
+};
+
+std::unique_ptr<Corpus> make_corpus(std::string name, const char *language, std::string bytes) {
+    std::unique_ptr<Corpus> c(new Corpus);
+    c->name = std::move(name);
+    c->language = language;
+    c->bytes = std::move(bytes);
+    return c;
+}
+
+struct Options {
+    std::string corpus_dir = "code_samples";
+    std::string grammar_dir = "build";
+};
+
+struct ContextDeleter {
+    void operator()(ac_context *ctx) const { ac_context_free(ctx); }
+};
+using ContextPtr = std::unique_ptr<ac_context, ContextDeleter>;
+
+struct LanguageDeleter {
+    void operator()(ac_language *lang) const { ac_language_free(lang); }
+};
+using LanguagePtr = std::unique_ptr<ac_language, LanguageDeleter>;
+
+bool read_file(const std::string &path, std::string &out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream data;
+    data << in.rdbuf();
+    out = data.str();
+    return true;
+}
+
+using ac::is_continuation;
+
+size_t char_length(const std::string &s, size_t pos) {
+    size_t n = 1;
+    while (pos + n < s.size() && is_continuation(static_cast<uint8_t>(s[pos + n]))) ++n;
+    return n;
+}
+
+// Every non-ASCII character becomes '?', so the ASCII fast paths see the whole file.
+std::string ascii_only(const std::string &s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i += char_length(s, i)) {
+        out += static_cast<uint8_t>(s[i]) < 0x80 ? s[i] : '?';
+    }
+    return out;
+}
+
+// A CJK comment line before every line that does not continue a macro; multi-byte
+// characters then make up most of the file.
+std::string with_cjk_comments(const std::string &s) {
+    static const char kComment[] = "// 对齐基准：中文注释与标识符混排，检查多字节边界\n";
+    std::string out;
+    out.reserve(s.size() * 3);
+    bool continued = false;
+    size_t line_start = 0;
+    while (line_start < s.size()) {
+        size_t line_end = s.find('\n', line_start);
+        line_end = line_end == std::string::npos ? s.size() : line_end + 1;
+        if (!continued) out += kComment;
+        out.append(s, line_start, line_end - line_start);
+        size_t last = line_end - line_start >= 2 && s[line_end - 1] == '\n' ? line_end - 2 : line_end - 1;
+        continued = s[last] == '\\';
+        line_start = line_end;
+    }
+    return out;
+}
+
+// Whole copies of s, as many as get closest to target bytes (at least one).
+std::string scaled(const std::string &s, size_t target) {
+    size_t copies = std::max<size_t>(1, (target + s.size() / 2) / s.size());
+    std::string out;
+    out.reserve(copies * s.size());
+    for (size_t i = 0; i < copies; ++i) out += s;
+    return out;
+}
+
+enum class CharClass { Letter, Digit, Space, Other };
+
+CharClass classify(uint8_t b) {
+    if (b >= 0x80 || (b >= 'A' && b <= 'Z') || (b >= 'a' && b <= 'z')) return CharClass::Letter;
+    if (b >= '0' && b <= '9') return CharClass::Digit;
+    if (b == ' ' || b == '\t' || b == '\n' || b == '\r' || b == '\f' || b == '\v') return CharClass::Space;
+    return CharClass::Other;
+}
+
+// GPT-2 style pre-tokenization (an optional leading space, then a run of letters,
+// digits or other characters; whitespace runs leave their last space to the next
+// piece), with pieces cut every kMaxPieceChars characters.
+void tokenize(Corpus &c) {
+    constexpr size_t kMaxPieceChars = 4;
+    const std::string &s = c.bytes;
+    auto piece = [&](size_t start, size_t end) {
+        size_t chars = 0, cut = start;
+        for (size_t i = start; i < end; i += char_length(s, i)) {
+            if (chars++ == kMaxPieceChars) {
+                c.token_starts.push_back(static_cast<uint32_t>(cut));
+                c.token_ends.push_back(static_cast<uint32_t>(i));
+                cut = i;
+                chars = 1;
+            }
+        }
+        c.token_starts.push_back(static_cast<uint32_t>(cut));
+        c.token_ends.push_back(static_cast<uint32_t>(end));
+    };
+    const size_t n = s.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i;
+        CharClass cls = classify(static_cast<uint8_t>(s[i]));
+        if (cls == CharClass::Space) {
+            size_t end = i;
+            while (end < n && classify(static_cast<uint8_t>(s[end])) == CharClass::Space) ++end;
+            if (end == n || s[end - 1] != ' ') {
+                piece(start, end);
+                i = end;
+                continue;
+            }
+            // The last space starts the next piece (" word")
+            if (end - 1 > start) piece(start, end - 1);
+            start = end - 1;
+            i = end;
+            cls = classify(static_cast<uint8_t>(s[i]));
+        }
+        while (i < n && classify(static_cast<uint8_t>(s[i])) == cls) i += char_length(s, i);
+        i = std::min(i, n);
+        piece(start, i);
+    }
+}
+
+bool is_word(const std::string &s, size_t i) {
+    CharClass cls = classify(static_cast<uint8_t>(s[i]));
+    return cls == CharClass::Letter || cls == CharClass::Digit || s[i] == '_';
+}
+
+// Without the tree walker: every word, snake_case word part, bracket pair and
+// non-blank line is a rule, in pre-order (by start, enclosing spans first).
+void approximate_rules(Corpus &c) {
+    enum : uint32_t { kWord, kWordPart, kBrackets, kLine };
+    struct Span { uint32_t type, start, end; };
+    std::vector<Span> spans;
+    std::vector<uint32_t> open;
+    const std::string &s = c.bytes;
+    size_t line_start = 0;
+    for (size_t i = 0; i <= s.size(); ++i) {
+        if (i == s.size() || s[i] == '\n') {
+            size_t a = line_start, b = i;
+            while (a < b && classify(static_cast<uint8_t>(s[a])) == CharClass::Space) ++a;
+            while (b > a && classify(static_cast<uint8_t>(s[b - 1])) == CharClass::Space) --b;
+            if (a < b) spans.push_back({kLine, static_cast<uint32_t>(a), static_cast<uint32_t>(b)});
+            line_start = i + 1;
+            continue;
+        }
+        char ch = s[i];
+        if (ch == '(' || ch == '[' || ch == '{') {
+            open.push_back(static_cast<uint32_t>(i));
+        } else if ((ch == ')' || ch == ']' || ch == '}') && !open.empty()) {
+            spans.push_back({kBrackets, open.back(), static_cast<uint32_t>(i + 1)});
+            open.pop_back();
+        } else if (is_word(s, i) && (i == 0 || !is_word(s, i - 1))) {
+            size_t end = i;
+            while (end < s.size() && is_word(s, end)) ++end;
+            spans.push_back({kWord, static_cast<uint32_t>(i), static_cast<uint32_t>(end)});
+            // The parts of snake_case words split them mid-word, which gives unaligned rules
+            for (size_t part = i, k = i; k <= end; ++k) {
+                if (k == end || s[k] == '_') {
+                    if (part > i && k > part) spans.push_back({kWordPart, static_cast<uint32_t>(part), static_cast<uint32_t>(k)});
+                    part = k + 1;
+                }
+            }
+        }
+    }
+    std::stable_sort(spans.begin(), spans.end(), [](const Span &a, const Span &b) {
+        return a.start != b.start ? a.start < b.start : a.end > b.end;
+    });
+    for (const Span &span : spans) {
+        c.rule_types.push_back(span.type);
+        c.rule_starts.push_back(span.start);
+        c.rule_ends.push_back(span.end);
+    }
+}
+
+bool walk_rules(Corpus &c, ac_context *ctx, const ac_language *lang) {
+    const auto *buf = reinterpret_cast<const uint8_t *>(c.bytes.data());
+    if (ac_extract_rules(ctx, lang, buf, c.bytes.size()) != AC_OK) return false;
+    size_t n = ac_rule_count(ctx);
+    c.rule_types.assign(ac_rule_types(ctx), ac_rule_types(ctx) + n);
+    c.rule_starts.assign(ac_rule_starts(ctx), ac_rule_starts(ctx) + n);
+    c.rule_ends.assign(ac_rule_ends(ctx), ac_rule_ends(ctx) + n);
+    return true;
+}
+
+void set_counters(benchmark::State &state, const Corpus &c, size_t nodes) {
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * c.bytes.size()));
+    if (nodes) {
+        state.counters["nodes"] = static_cast<double>(nodes);
+        state.counters["nodes/s"] = benchmark::Counter(static_cast<double>(nodes * state.iterations()),
+                                                       benchmark::Counter::kIsRate);
+    }
+}
+
+void bench_offset_maps(benchmark::State &state, const Corpus *c) {
+    ContextPtr ctx(ac_context_new());
+    const auto *buf = reinterpret_cast<const uint8_t *>(c->bytes.data());
+    size_t n_chars = 0;
+    for (auto _ : state) {
+        if (ac_context_offset_maps(ctx.get(), buf, c->bytes.size(), 1, &n_chars) != AC_OK) {
+            state.SkipWithError("ac_context_offset_maps failed");
+            break;
+        }
+        benchmark::DoNotOptimize(ac_char_to_byte(ctx.get()));
+    }
+    set_counters(state, *c, 0);
+    state.counters["chars"] = static_cast<double>(n_chars);
+}
+
+void bench_tree_walk(benchmark::State &state, const Corpus *c, const ac_language *lang) {
+    ContextPtr ctx(ac_context_new());
+    const auto *buf = reinterpret_cast<const uint8_t *>(c->bytes.data());
+    for (auto _ : state) {
+        if (ac_extract_rules(ctx.get(), lang, buf, c->bytes.size()) != AC_OK) {
+            state.SkipWithError("ac_extract_rules failed");
+            break;
+        }
+        benchmark::DoNotOptimize(ac_rule_starts(ctx.get()));
+    }
+    set_counters(state, *c, ac_rule_count(ctx.get()));
+}
+
+// The token lookups of the scoring loop, for the start and end of every rule.
+void bench_token_sweep(benchmark::State &state, const Corpus *c) {
+    for (auto _ : state) {
+        ac::TokenIndex tokens(c->token_starts.data(), c->token_ends.data(), c->token_starts.size());
+        size_t start_hint = 0, end_hint = 0;
+        int64_t found = 0;
+        for (size_t i = 0; i < c->rule_starts.size(); ++i) {
+            found += tokens.find(c->rule_starts[i], start_hint) >= 0;
+            found += tokens.find(c->rule_ends[i], end_hint) >= 0;
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    set_counters(state, *c, c->rule_starts.size());
+    state.counters["tokens"] = static_cast<double>(c->token_starts.size());
+}
+
+// The previous word-character test: UTF-8 decoding and a search of the range table.
+struct RangeTableText : ac::Utf8Text {
+    using ac::Utf8Text::Utf8Text;
+    static bool is_word(uint32_t cp) { return ac::is_word_codepoint_ranges(cp); }
+};
+
+template <class Text>
+int64_t crossing_boundaries(const Corpus &c, const uint8_t *buf, size_t len) {
+    const Text text(buf, len);
+    int64_t crossing = 0;
+    for (const auto *positions : {&c.rule_starts, &c.rule_ends}) {
+        for (uint32_t pos : *positions) {
+            if (pos == 0 || pos >= len || !Text::is_char_boundary(buf, len, pos)) continue;
+            crossing += text.is_word(Text::before(buf, len, pos)) & text.is_word(Text::at(buf, len, pos));
+        }
+    }
+    return crossing;
+}
+
+// The word-character test on both sides of every rule start and end, as the
+// scoring loop does it: with the kernel ac_score_rules picks (table) or the
+// range table search it replaced (ranges).
+template <bool kTables>
+void bench_word_chars(benchmark::State &state, const Corpus *c) {
+    const auto *buf = reinterpret_cast<const uint8_t *>(c->bytes.data());
+    const size_t len = c->bytes.size();
+    const bool ascii = ac_is_ascii(buf, len);
+    for (auto _ : state) {
+        int64_t crossing = !kTables ? crossing_boundaries<RangeTableText>(*c, buf, len)
+                           : ascii  ? crossing_boundaries<ac::AsciiText>(*c, buf, len)
+                                    : crossing_boundaries<ac::Utf8Text>(*c, buf, len);
+        benchmark::DoNotOptimize(crossing);
+    }
+    set_counters(state, *c, c->rule_starts.size());
+}
+
+void bench_score_rules(benchmark::State &state, const Corpus *c) {
+    ContextPtr ctx(ac_context_new());
+    const auto *buf = reinterpret_cast<const uint8_t *>(c->bytes.data());
+    ac_stats stats = {};
+    for (auto _ : state) {
+        int status = ac_score_rules(ctx.get(), buf, c->bytes.size(), c->rule_types.data(), c->rule_starts.data(),
+                                    c->rule_ends.data(), c->rule_starts.size(), c->token_starts.data(),
+                                    c->token_ends.data(), c->token_starts.size(), &stats);
+        if (status != AC_OK) {
+            state.SkipWithError("ac_score_rules failed");
+            break;
+        }
+        benchmark::DoNotOptimize(stats);
+    }
+    set_counters(state, *c, c->rule_starts.size());
+    state.counters["unaligned"] = static_cast<double>(stats.unaligned_count);
+}
+
+// Consume --corpus_dir= and --grammar_dir= before Google Benchmark sees the flags.
+Options parse_options(int &argc, char **argv) {
+    Options options;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--corpus_dir=", 0) == 0) {
+            options.corpus_dir = arg.substr(strlen("--corpus_dir="));
+        } else if (arg.rfind("--grammar_dir=", 0) == 0) {
+            options.grammar_dir = arg.substr(strlen("--grammar_dir="));
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options options = parse_options(argc, argv);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    struct Sample { const char *language; const char *path; };
+    const Sample samples[] = {{"cpp", "cpp/example.cpp"}, {"c", "c/example.c"}};
+    const struct { const char *name; size_t bytes; } sizes[] = {
+        {"10KB", 10 * 1024}, {"100KB", 100 * 1024}, {"1MB", 1024 * 1024}};
+
+    // Corpora are referenced by the registered benchmarks, so they must not move
+    std::vector<std::unique_ptr<Corpus>> corpora;
+    std::vector<std::pair<std::string, LanguagePtr>> languages;
+    std::string rule_source = "approximate";
+    ContextPtr ctx(ac_context_new());
+    for (const Sample &sample : samples) {
+        std::string source;
+        std::string path = options.corpus_dir + "/" + sample.path;
+        if (!read_file(path, source) || source.empty()) {
+            fprintf(stderr, "alignment_bench: cannot read %s (use --corpus_dir=)\n", path.c_str());
+            return 1;
+        }
+        std::string library = options.grammar_dir + "/languages_" + sample.language + ".so";
+        LanguagePtr lang(ac_language_load(library.c_str(), sample.language));
+
+        std::vector<std::unique_ptr<Corpus>> variants;
+        variants.push_back(make_corpus(std::string(sample.language) + "_example", sample.language, source));
+        std::string ascii = ascii_only(source), cjk = with_cjk_comments(source);
+        for (const auto &size : sizes) {
+            variants.push_back(make_corpus(std::string(sample.language) + "_ascii_" + size.name, sample.language,
+                                           scaled(ascii, size.bytes)));
+            variants.push_back(make_corpus(std::string(sample.language) + "_cjk_" + size.name, sample.language,
+                                           scaled(cjk, size.bytes)));
+        }
+        for (auto &c : variants) {
+            tokenize(*c);
+            if (!lang || !walk_rules(*c, ctx.get(), lang.get())) {
+                approximate_rules(*c);
+            } else {
+                rule_source = "tree_walker";
+            }
+            const Corpus *corpus = c.get();
+            benchmark::RegisterBenchmark(("OffsetMaps/" + c->name).c_str(), bench_offset_maps, corpus);
+            if (lang) {
+                benchmark::RegisterBenchmark(("TreeWalk/" + c->name).c_str(), bench_tree_walk, corpus,
+                                             static_cast<const ac_language *>(lang.get()));
+            }
+            benchmark::RegisterBenchmark(("TokenSweep/" + c->name).c_str(), bench_token_sweep, corpus);
+            benchmark::RegisterBenchmark(("WordChars/ranges/" + c->name).c_str(), bench_word_chars<false>, corpus);
+            benchmark::RegisterBenchmark(("WordChars/table/" + c->name).c_str(), bench_word_chars<true>, corpus);
+            benchmark::RegisterBenchmark(("ScoreRules/" + c->name).c_str(), bench_score_rules, corpus);
+            corpora.push_back(std::move(c));
+        }
+        languages.emplace_back(sample.language, std::move(lang));
+    }
+
+    benchmark::AddCustomContext("ac_abi_version", std::to_string(ac_abi_version()));
+    benchmark::AddCustomContext("ac_simd_kernel", ac_simd_kernel());
+    benchmark::AddCustomContext("ac_unicode_version", ac_unicode_version());
+    benchmark::AddCustomContext("ac_tree_walker", ac_has_tree_sitter() ? "yes" : "no");
+    benchmark::AddCustomContext("rule_source", rule_source);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Native alignment core
+ *
+ * Mirrors the per-rule loop of QuickMultiLanguageAnalyzer.calculate_rule_level_alignment:
+ * a rule boundary is crossing when the characters on both sides of it are
+ * word characters (str.isalnum() or '_', see word_chars.h). Only the compact
+ * unaligned records are handed back; Python formats details for those rules alone.
+ */
+
+#include "alignment_core.h"
+#include "context.h"
+#include "token_index.h"
+#include "word_chars.h"
+
+#include <algorithm>
+#include <new>
+
+namespace {
+
+const char kUnicodeVersion[] = AC_UNICODE_VERSION;
+
+struct Boundary {
+    bool crossing = false;
+    uint32_t prev_cp = 0;
+    uint32_t curr_cp = 0;
+};
+
+// Equivalent of the byte_to_char lookup plus the prev/curr word-char test.
+template <class Text>
+inline Boundary classify_boundary(const Text &text, const uint8_t *buf, size_t len, uint32_t pos) {
+    Boundary b;
+    if (pos > len || !Text::is_char_boundary(buf, len, pos)) return b;  // not a char boundary
+    if (pos == 0 || pos == len) return b;
+    b.prev_cp = Text::before(buf, len, pos);
+    b.curr_cp = Text::at(buf, len, pos);
+    b.crossing = text.is_word(b.prev_cp) & text.is_word(b.curr_cp);
+    return b;
+}
+
+// The per-rule loop over deduplicated rules, specialized on the text encoding (word_chars.h).
+template <class Text>
+int score_loop(ac_context *ctx, const uint8_t *buf, size_t len, const uint32_t *rule_types,
+               const uint32_t *rule_starts, const uint32_t *rule_ends, size_t n_rules,
+               const ac::TokenIndex &tokens, ac_stats &stats) {
+    uint32_t *type_rules = ctx->type_rules.data();
+    uint32_t *type_aligned = ctx->type_aligned.data();
+    const Text text(buf, len);
+    size_t start_hint = 0, end_hint = 0;
+    for (size_t i = 0; i < n_rules; ++i) {
+        if (i % AC_LIMIT_CHECK_INTERVAL == 0 && i && ctx->past_deadline()) {
+            stats.total_rules = i;
+            ctx->limit_hit |= AC_LIMIT_DEADLINE;
+            break;
+        }
+        Boundary s = classify_boundary(text, buf, len, rule_starts[i]);
+        Boundary e = classify_boundary(text, buf, len, rule_ends[i]);
+        bool fully_aligned = !s.crossing && !e.crossing;
+        bool first = !ctx->duplicate[i];
+        if (first) {
+            ++stats.distinct_rules;
+            ++type_rules[rule_types[i]];
+        }
+        if (fully_aligned) {
+            ++stats.aligned_rules;
+            if (first) {
+                ++stats.distinct_aligned;
+                ++type_aligned[rule_types[i]];
+            }
+            continue;
+        }
+        if (!first) continue;
+
+        ac_unaligned_record rec = {};
+        rec.rule_index = static_cast<uint32_t>(i);
+        rec.start_token = -1;
+        rec.end_token = -1;
+        if (s.crossing) {
+            rec.flags |= AC_CROSS_START;
+            rec.start_token = tokens.find(rule_starts[i], start_hint);
+            rec.start_prev_cp = s.prev_cp;
+            rec.start_curr_cp = s.curr_cp;
+        }
+        if (e.crossing) {
+            rec.flags |= AC_CROSS_END;
+            rec.end_token = tokens.find(rule_ends[i], end_hint);
+            rec.end_prev_cp = e.prev_cp;
+            rec.end_curr_cp = e.curr_cp;
+        }
+        try {
+            ctx->unaligned.push_back(rec);
+        } catch (const std::bad_alloc &) {
+            return AC_ERR_OUT_OF_MEMORY;
+        }
+    }
+    return AC_OK;
+}
+
+}  // namespace
+
+extern "C" {
+
+int ac_abi_version(void) { return AC_ABI_VERSION; }
+
+const char *ac_unicode_version(void) { return kUnicodeVersion; }
+
+uint64_t ac_monotonic_ns(void) { return ac::monotonic_ns(); }
+
+ac_context *ac_context_new(void) { return new (std::nothrow) ac_context(); }
+
+void ac_context_free(ac_context *ctx) { delete ctx; }
+
+int ac_context_arena_usage(const ac_context *ctx, ac_arena_usage *out_usage) {
+    if (!ctx || !out_usage) return AC_ERR_INVALID_ARGUMENT;
+    ac_arena_usage usage = {};
+    for (const ac::Arena *arena : {&ctx->score_arena, &ctx->walk_arena, &ctx->map_arena, &ctx->token_arena}) {
+        usage.in_use += arena->in_use();
+        usage.high_water += arena->high_water();
+        usage.capacity += arena->capacity();
+        usage.block_allocations += arena->block_allocations();
+        usage.resets += arena->resets();
+    }
+    *out_usage = usage;
+    return AC_OK;
+}
+
+int ac_context_set_limits(ac_context *ctx, const ac_limits *limits) {
+    if (!ctx) return AC_ERR_INVALID_ARGUMENT;
+    ctx->limits = limits ? *limits : ac_limits{};
+    return AC_OK;
+}
+
+uint32_t ac_context_limit_hit(const ac_context *ctx) { return ctx ? ctx->limit_hit : 0; }
+
+int ac_context_stage_times(const ac_context *ctx, ac_stage_times *out_times) {
+    if (!ctx || !out_times) return AC_ERR_INVALID_ARGUMENT;
+    *out_times = ctx->stage_times;
+    return AC_OK;
+}
+
+int ac_score_rules(ac_context *ctx,
+                   const uint8_t *buf, size_t len,
+                   const uint32_t *rule_types,
+                   const uint32_t *rule_starts,
+                   const uint32_t *rule_ends,
+                   size_t n_rules,
+                   const uint32_t *token_starts,
+                   const uint32_t *token_ends,
+                   size_t n_tokens,
+                   ac_stats *out_stats) {
+    if (!ctx || !out_stats || (len && !buf) ||
+        (n_rules && (!rule_types || !rule_starts || !rule_ends)) ||
+        (n_tokens && (!token_starts || !token_ends))) {
+        return AC_ERR_INVALID_ARGUMENT;
+    }
+
+    ctx->limit_hit = 0;
+    ctx->stage_times.dedup_ns = ctx->stage_times.score_ns = 0;
+    uint64_t stage_start = ac::monotonic_ns();
+    if (ctx->limits.max_rules && n_rules > ctx->limits.max_rules) {
+        n_rules = static_cast<size_t>(ctx->limits.max_rules);
+        ctx->limit_hit |= AC_LIMIT_RULES;
+    }
+    ctx->score_arena.reset();
+    ctx->duplicate.clear();
+    ctx->order.clear();
+    ctx->unaligned.clear();
+    ctx->type_rules.clear();
+    ctx->type_aligned.clear();
+    ctx->type_counts.clear();
+    // Per-type counters are flat arrays indexed by the (dense) type ids
+    uint32_t type_limit = 0;
+    for (size_t i = 0; i < n_rules; ++i) type_limit = std::max(type_limit, rule_types[i] + 1);
+    try {
+        ctx->duplicate.assign(n_rules, 0);
+        ctx->order.resize(n_rules);
+        ctx->type_rules.assign(type_limit, 0);
+        ctx->type_aligned.assign(type_limit, 0);
+    } catch (const std::bad_alloc &) {
+        return AC_ERR_OUT_OF_MEMORY;
+    }
+
+    // Rule details are keyed by (type, start, end); later duplicates collapse
+    // onto the first occurrence, so mark every member of a key group but the first.
+    for (size_t i = 0; i < n_rules; ++i) ctx->order[i] = static_cast<uint32_t>(i);
+    std::sort(ctx->order.begin(), ctx->order.end(), [&](uint32_t a, uint32_t b) {
+        if (rule_starts[a] != rule_starts[b]) return rule_starts[a] < rule_starts[b];
+        if (rule_ends[a] != rule_ends[b]) return rule_ends[a] < rule_ends[b];
+        if (rule_types[a] != rule_types[b]) return rule_types[a] < rule_types[b];
+        return a < b;
+    });
+    for (size_t k = 1; k < n_rules; ++k) {
+        uint32_t prev = ctx->order[k - 1], cur = ctx->order[k];
+        if (rule_starts[prev] == rule_starts[cur] && rule_ends[prev] == rule_ends[cur] &&
+            rule_types[prev] == rule_types[cur]) {
+            ctx->duplicate[cur] = 1;
+        }
+    }
+    uint64_t dedup_end = ac::monotonic_ns();
+    ctx->stage_times.dedup_ns = dedup_end - stage_start;
+
+    ac::TokenIndex tokens(token_starts, token_ends, n_tokens);
+    ac_stats stats = {};
+    stats.total_rules = n_rules;
+    // One kernel for the whole file: pure ASCII (most C/C++ sources) never decodes UTF-8
+    int status = ac_is_ascii(buf, len)
+        ? score_loop<ac::AsciiText>(ctx, buf, len, rule_types, rule_starts, rule_ends, n_rules, tokens, stats)
+        : score_loop<ac::Utf8Text>(ctx, buf, len, rule_types, rule_starts, rule_ends, n_rules, tokens, stats);
+    if (status != AC_OK) return status;
+    try {
+        for (uint32_t t = 0; t < type_limit; ++t) {
+            if (ctx->type_rules[t]) ctx->type_counts.push_back({t, ctx->type_rules[t], ctx->type_aligned[t]});
+        }
+    } catch (const std::bad_alloc &) {
+        return AC_ERR_OUT_OF_MEMORY;
+    }
+    stats.unaligned_count = ctx->unaligned.size();
+    stats.type_count = ctx->type_counts.size();
+    ctx->stage_times.score_ns = ac::monotonic_ns() - dedup_end;
+    *out_stats = stats;
+    return ctx->limit_hit ? AC_TRUNCATED : AC_OK;
+}
+
+const ac_unaligned_record *ac_unaligned_records(const ac_context *ctx) {
+    return ctx && !ctx->unaligned.empty() ? ctx->unaligned.data() : nullptr;
+}
+
+const ac_type_count *ac_type_counts(const ac_context *ctx) {
+    return ctx && !ctx->type_counts.empty() ? ctx->type_counts.data() : nullptr;
+}
+
+}  // extern "C"
@@ -0,0 +1,237 @@
+/*
+ * Native alignment core - C ABI
+ *
+ * Scores Tree-sitter rule spans against tokenizer boundaries over a UTF-8
+ * buffer. The library is loaded with ctypes by alignment_native.py, so only
+ * plain C types cross this boundary.
+ */
+
+#ifndef ALIGNMENT_CORE_H
+#define ALIGNMENT_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define AC_API __declspec(dllexport)
+#else
+#define AC_API __attribute__((visibility("default")))
+#endif
+
+#define AC_ABI_VERSION 8
+
+/* Status codes returned by ac_* entry points. */
+#define AC_OK 0
+#define AC_TRUNCATED 1  /* a limit was hit (see ac_context_limit_hit); the results cover a prefix */
+#define AC_ERR_INVALID_ARGUMENT -1
+#define AC_ERR_OUT_OF_MEMORY -2
+#define AC_ERR_UNAVAILABLE -3  /* built without the tree-sitter runtime */
+#define AC_ERR_PARSE -4
+#define AC_ERR_DEADLINE -5  /* the deadline passed before there was anything to return */
+
+/* ac_context_limit_hit flags */
+#define AC_LIMIT_DEADLINE 0x1u
+#define AC_LIMIT_RULES 0x2u
+
+/* ac_unaligned_record.flags */
+#define AC_CROSS_START 0x1u
+#define AC_CROSS_END 0x2u
+
+typedef struct ac_context ac_context;
+typedef struct ac_language ac_language;
+typedef struct ac_bpe ac_bpe;
+
+typedef struct {
+    uint64_t total_rules;      /* every rule passed in; drives the score */
+    uint64_t aligned_rules;
+    uint64_t distinct_rules;   /* unique (type, start, end) keys, i.e. len(details) */
+    uint64_t distinct_aligned;
+    uint64_t unaligned_count;  /* number of records from ac_unaligned_records */
+    uint64_t type_count;       /* number of records from ac_type_counts */
+} ac_stats;
+
+/*
+ * One record per distinct unaligned rule, in first-occurrence order.
+ * Token indices are -1 when the boundary is not crossing or no token
+ * strictly contains it. Code points are the characters on each side of a
+ * crossing boundary (0 when absent).
+ */
+typedef struct {
+    uint32_t rule_index;
+    uint32_t flags;
+    int32_t start_token;
+    int32_t end_token;
+    uint32_t start_prev_cp;
+    uint32_t start_curr_cp;
+    uint32_t end_prev_cp;
+    uint32_t end_curr_cp;
+} ac_unaligned_record;
+
+/*
+ * Distinct rules, and distinct fully aligned ones, of one rule type id, for
+ * every id among the rules scored, in id order. They sum to distinct_rules
+ * and distinct_aligned.
+ */
+typedef struct {
+    uint32_t type_id;
+    uint32_t rules;
+    uint32_t aligned;
+} ac_type_count;
+
+/*
+ * Memory of a context's per-file arenas. Each entry point resets its arena
+ * instead of freeing, so after the largest file block_allocations stops
+ * growing. high_water sums the peak of each arena.
+ */
+typedef struct {
+    uint64_t in_use;             /* bytes holding the current results */
+    uint64_t high_water;
+    uint64_t capacity;           /* bytes reserved from the heap */
+    uint64_t block_allocations;  /* heap allocations made by the arenas so far */
+    uint64_t resets;
+} ac_arena_usage;
+
+/*
+ * Per-context limits, applied to every later ac_extract_rules and
+ * ac_score_rules call until changed. Both are cooperative: the walk and the
+ * scoring loop check them every AC_LIMIT_CHECK_INTERVAL nodes or rules, and
+ * the parser is given the time left. A call that stops early returns
+ * AC_TRUNCATED with results for the rules it got to (a pre-order prefix of
+ * the tree, or of the rules passed in).
+ */
+typedef struct {
+    uint64_t deadline_ns;  /* ac_monotonic_ns() value; 0 = none */
+    uint64_t max_rules;    /* rules extracted or scored at most; 0 = no limit */
+} ac_limits;
+
+#define AC_LIMIT_CHECK_INTERVAL 4096
+
+/*
+ * Steady-clock time of each native stage, as measured by the last call of
+ * the entry point that runs it: ac_extract_rules sets parse_ns and walk_ns,
+ * ac_score_rules dedup_ns (sorting rules into key groups) and score_ns.
+ * Stages a call did not reach are 0.
+ */
+typedef struct {
+    uint64_t parse_ns;
+    uint64_t walk_ns;
+    uint64_t dedup_ns;
+    uint64_t score_ns;
+} ac_stage_times;
+
+AC_API int ac_abi_version(void);
+AC_API const char *ac_unicode_version(void);
+AC_API uint64_t ac_monotonic_ns(void);
+
+/* Contexts own per-file scratch and result buffers; use one per thread. */
+AC_API ac_context *ac_context_new(void);
+AC_API void ac_context_free(ac_context *ctx);
+AC_API int ac_context_arena_usage(const ac_context *ctx, ac_arena_usage *out_usage);
+AC_API int ac_context_set_limits(ac_context *ctx, const ac_limits *limits);  /* NULL clears them */
+AC_API uint32_t ac_context_limit_hit(const ac_context *ctx);              /* AC_LIMIT_* of the last call */
+AC_API int ac_context_stage_times(const ac_context *ctx, ac_stage_times *out_times);
+
+/*
+ * Score n_rules spans (byte offsets into buf) against n_tokens token byte
+ * spans. Rule type ids are dense interned ids: compared for equality, and
+ * the per-type counters of ac_type_counts are arrays indexed by them.
+ * Results stay valid until the next call on the same context. When a limit
+ * stops the loop, out_stats counts the rules scored so far (total_rules
+ * included) and AC_TRUNCATED is returned.
+ */
+AC_API int ac_score_rules(ac_context *ctx,
+                          const uint8_t *buf, size_t len,
+                          const uint32_t *rule_types,
+                          const uint32_t *rule_starts,
+                          const uint32_t *rule_ends,
+                          size_t n_rules,
+                          const uint32_t *token_starts,
+                          const uint32_t *token_ends,
+                          size_t n_tokens,
+                          ac_stats *out_stats);
+
+AC_API const ac_unaligned_record *ac_unaligned_records(const ac_context *ctx);
+AC_API const ac_type_count *ac_type_counts(const ac_context *ctx);
+
+/*
+ * Tree walker. Grammars are loaded from the compiled language libraries in
+ * build/ by their Tree-sitter symbol (e.g. "cpp" -> tree_sitter_cpp). Node
+ * type names are interned to dense per-grammar ids. Languages are read-only
+ * after loading and may be shared between contexts.
+ */
+AC_API int ac_has_tree_sitter(void);
+AC_API ac_language *ac_language_load(const char *library_path, const char *symbol);
+AC_API void ac_language_free(ac_language *lang);
+AC_API uint32_t ac_language_type_count(const ac_language *lang);
+AC_API const char *ac_language_type_name(const ac_language *lang, uint32_t type_id);
+
+/*
+ * Parse buf and walk the tree with a TreeCursor in pre-order, keeping every
+ * node whose type is non-empty and does not start with "ERROR" (the same
+ * rules as the Python extract_rules). Results are exposed as flat arrays
+ * that stay valid until the next ac_extract_rules call on the context, and
+ * can be passed straight to ac_score_rules. A limit hit during the walk
+ * returns AC_TRUNCATED with the rules found so far; a parse that runs out of
+ * time returns AC_ERR_DEADLINE.
+ */
+AC_API int ac_extract_rules(ac_context *ctx, const ac_language *lang, const uint8_t *buf, size_t len);
+AC_API size_t ac_rule_count(const ac_context *ctx);
+AC_API const uint32_t *ac_rule_types(const ac_context *ctx);
+AC_API const uint32_t *ac_rule_starts(const ac_context *ctx);
+AC_API const uint32_t *ac_rule_ends(const ac_context *ctx);
+
+/*
+ * UTF-8 offset maps, computed in one pass. char_to_byte (optional) gets
+ * n_chars + 1 entries, the last being len; char_capacity = len + 1 is always
+ * enough. byte_to_utf16 (optional) gets len + 1 entries: the UTF-16 index of
+ * the character each byte belongs to, and the total at [len]. ASCII runs are
+ * scanned with SIMD; ac_simd_kernel names the variant in use.
+ */
+AC_API const char *ac_simd_kernel(void);
+AC_API int ac_is_ascii(const uint8_t *buf, size_t len);
+AC_API int ac_offset_maps(const uint8_t *buf, size_t len,
+                          uint32_t *char_to_byte, size_t char_capacity,
+                          uint32_t *byte_to_utf16,
+                          size_t *out_chars);
+
+/*
+ * ac_offset_maps into buffers owned by the context, valid until the next
+ * ac_context_offset_maps call on it. byte_to_utf16 is only filled (and
+ * ac_byte_to_utf16 non-NULL) when with_utf16 is set.
+ */
+AC_API int ac_context_offset_maps(ac_context *ctx, const uint8_t *buf, size_t len, int with_utf16,
+                                  size_t *out_chars);
+AC_API const uint32_t *ac_char_to_byte(const ac_context *ctx);
+AC_API const uint32_t *ac_byte_to_utf16(const ac_context *ctx);
+
+/*
+ * Byte-level BPE in the style of GPT-2 (bpe.cpp). A model is built from the
+ * tokenizer's merges in rank order, merge i being left_lens[i] bytes followed
+ * by right_lens[i] bytes of merge_bytes (raw bytes, not the byte-level
+ * alphabet). Merges whose parts no earlier merge produces are dropped;
+ * ac_bpe_merge_count counts the rest. Models are read-only and may be shared
+ * between contexts.
+ *
+ * ac_bpe_encode splits buf with the GPT-2 pre-tokenizer pattern and merges
+ * each piece, writing the byte span of every token, widened to whole UTF-8
+ * characters like a fast tokenizer's offset_mapping, into buffers owned by the
+ * context. They stay valid until the next ac_bpe_encode call on it.
+ */
+
+AC_API ac_bpe *ac_bpe_new(const uint8_t *merge_bytes, const uint32_t *left_lens, const uint32_t *right_lens,
+                          size_t n_merges);
+AC_API void ac_bpe_free(ac_bpe *bpe);
+AC_API size_t ac_bpe_merge_count(const ac_bpe *bpe);
+AC_API int ac_bpe_encode(ac_context *ctx, const ac_bpe *bpe, const uint8_t *buf, size_t len, size_t *out_tokens);
+AC_API const uint32_t *ac_token_starts(const ac_context *ctx);
+AC_API const uint32_t *ac_token_ends(const ac_context *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALIGNMENT_CORE_H */
@@ -0,0 +1,170 @@
+/*
+ * Bump allocator for per-file scratch
+ *
+ * An Arena hands out memory from large blocks by bumping a pointer and frees
+ * nothing individually; reset() makes all of it reusable at once. When a file
+ * needed more than the first block, reset() replaces the blocks with a single
+ * one sized to the high-water mark, so once the largest file has been seen a
+ * context processes every further file without touching the heap.
+ * ArenaArray is a growable array of trivially copyable values on top of it.
+ */
+
+#ifndef ALIGNMENT_ARENA_H
+#define ALIGNMENT_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace ac {
+
+class Arena {
+public:
+    static constexpr size_t kMinBlock = 64 * 1024;
+
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena() { release(); }
+
+    // size bytes aligned to align (a power of two); throws std::bad_alloc.
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        size_t offset = (used_ + align - 1) & ~(align - 1);
+        if (blocks_.empty() || offset + size > blocks_.back().size) {
+            add_block(size + align);
+            offset = 0;
+        }
+        Block &block = blocks_.back();
+        used_ = offset + size;
+        in_use_ = retired_ + used_;
+        if (in_use_ > high_water_) high_water_ = in_use_;
+        return block.data + offset;
+    }
+
+    template <typename T>
+    T *allocate_array(size_t n) {
+        static_assert(std::is_trivially_copyable<T>::value, "arena memory is never destructed");
+        if (n > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+        size_t size = n * sizeof(T);
+        return static_cast<T *>(allocate(size > 0 ? size : 1, alignof(T)));
+    }
+
+    // Forget every allocation; keeps (or coalesces) the blocks for the next file.
+    void reset() {
+        ++resets_;
+        if (blocks_.size() > 1) {
+            size_t size = high_water_;
+            release();
+            add_block(size);
+        }
+        used_ = 0;
+        retired_ = 0;
+        in_use_ = 0;
+    }
+
+    size_t in_use() const { return in_use_; }
+    size_t high_water() const { return high_water_; }
+    size_t capacity() const { return capacity_; }
+    uint64_t block_allocations() const { return block_allocations_; }
+    uint64_t resets() const { return resets_; }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    void add_block(size_t min_size) {
+        size_t size = kMinBlock;
+        while (size < min_size) size *= 2;
+        if (!blocks_.empty()) retired_ += used_;
+        blocks_.reserve(blocks_.size() + 1);  // may throw before anything is allocated
+        char *data = static_cast<char *>(std::malloc(size));
+        if (!data) throw std::bad_alloc();
+        blocks_.push_back({data, size});
+        capacity_ += size;
+        ++block_allocations_;
+        used_ = 0;
+    }
+
+    void release() {
+        for (Block &block : blocks_) std::free(block.data);
+        blocks_.clear();
+        capacity_ = 0;
+    }
+
+    std::vector<Block> blocks_;
+    size_t used_ = 0;      // bytes taken from the last block
+    size_t retired_ = 0;   // bytes taken from earlier blocks
+    size_t in_use_ = 0;
+    size_t high_water_ = 0;
+    size_t capacity_ = 0;
+    uint64_t block_allocations_ = 0;
+    uint64_t resets_ = 0;
+};
+
+// Growable array in an Arena. Growing copies into a new arena slot and leaves
+// the old one unused until the arena is reset, so reserve() the expected size.
+// Contents are invalidated by the arena's reset(); call clear() alongside it.
+template <typename T>
+class ArenaArray {
+    static_assert(std::is_trivially_copyable<T>::value, "ArenaArray holds trivially copyable values");
+
+public:
+    explicit ArenaArray(Arena &arena) : arena_(&arena) {}
+    ArenaArray(const ArenaArray &) = delete;
+    ArenaArray &operator=(const ArenaArray &) = delete;
+
+    void clear() {
+        data_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+    }
+
+    void reserve(size_t n) {
+        if (n <= capacity_) return;
+        T *data = arena_->allocate_array<T>(n);
+        if (size_) std::memcpy(data, data_, size_ * sizeof(T));
+        data_ = data;
+        capacity_ = n;
+    }
+
+    // Size n with unspecified contents.
+    void resize(size_t n) {
+        reserve(n);
+        size_ = n;
+    }
+
+    void assign(size_t n, const T &value) {
+        resize(n);
+        for (size_t i = 0; i < n; ++i) data_[i] = value;
+    }
+
+    void push_back(const T &value) {
+        if (size_ == capacity_) reserve(capacity_ ? capacity_ * 2 : 64);
+        data_[size_++] = value;
+    }
+
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T *begin() { return data_; }
+    T *end() { return data_ + size_; }
+    T &operator[](size_t i) { return data_[i]; }
+    const T &operator[](size_t i) const { return data_[i]; }
+
+private:
+    Arena *arena_;
+    T *data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+}  // namespace ac
+
+#endif /* ALIGNMENT_ARENA_H */
@@ -0,0 +1,370 @@
+/*
+ * Native byte-level BPE
+ *
+ * Tokenizes like a GPT-2 style fast tokenizer (ByteLevel pre-tokenizer with
+ * its regex, then BPE over the UTF-8 bytes of each piece) and hands back the
+ * byte span of every token, so the analyzer gets token boundaries without an
+ * offset_mapping in characters and a char->byte map to convert it. Only the
+ * merge ranks matter for where tokens end; token ids are never produced.
+ *
+ * The fast tokenizer reports a token that covers part of a multi-byte
+ * character with the offsets of the whole character. Spans are widened the
+ * same way, so boundaries match the offset_mapping path byte for byte.
+ */
+
+#include "alignment_core.h"
+#include "context.h"
+#include "word_chars.h"
+
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+struct ac_bpe {
+    struct Merge {
+        uint32_t rank;
+        uint32_t id;
+    };
+    // Symbol ids: 0-255 are single bytes, then one per merge result
+    std::unordered_map<uint64_t, Merge> merges;
+    size_t merge_count = 0;
+
+    const Merge *find(uint32_t left, uint32_t right) const {
+        auto it = merges.find((static_cast<uint64_t>(left) << 32) | right);
+        return it == merges.end() ? nullptr : &it->second;
+    }
+};
+
+namespace ac {
+
+namespace {
+
+enum CharClass : uint8_t { kOther = 0, kLetter = 1, kNumber = 2, kSpace = 3 };
+
+struct ClassRange {
+    uint32_t lo;
+    uint32_t hi;
+    uint8_t cls;
+};
+
+// Non-ASCII \p{L} and \p{N} ranges, generated from unicodedata like unicode_alnum.inc
+constexpr ClassRange kClassRanges[] = {
+#include "unicode_classes.inc"
+};
+
+struct AsciiClassTable {
+    uint8_t cls[128] = {};
+
+    constexpr AsciiClassTable() {
+        for (int c = '0'; c <= '9'; ++c) cls[c] = kNumber;
+        for (int c = 'A'; c <= 'Z'; ++c) cls[c] = kLetter;
+        for (int c = 'a'; c <= 'z'; ++c) cls[c] = kLetter;
+        for (int c = '\t'; c <= '\r'; ++c) cls[c] = kSpace;
+        cls[static_cast<unsigned char>(' ')] = kSpace;
+    }
+};
+
+constexpr AsciiClassTable kAsciiClass{};
+
+// \s is the Unicode White_Space property
+bool is_unicode_space(uint32_t cp) {
+    return cp == 0x85 || cp == 0xA0 || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 ||
+           cp == 0x2029 || cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+uint8_t char_class(uint32_t cp) {
+    if (cp < 0x80) return kAsciiClass.cls[cp];
+    if (is_unicode_space(cp)) return kSpace;
+    size_t lo = 0, hi = sizeof(kClassRanges) / sizeof(kClassRanges[0]);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (kClassRanges[mid].hi < cp) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < sizeof(kClassRanges) / sizeof(kClassRanges[0]) && kClassRanges[lo].lo <= cp) return kClassRanges[lo].cls;
+    return kOther;
+}
+
+// The character at pos: its class, and the offset after it.
+struct Char {
+    uint8_t cls;
+    size_t next;
+};
+
+inline Char char_at(const uint8_t *buf, size_t len, size_t pos) {
+    if (buf[pos] < 0x80) return {kAsciiClass.cls[buf[pos]], pos + 1};
+    size_t next = pos + 1;
+    while (next < len && next - pos < 4 && is_continuation(buf[next])) ++next;
+    return {char_class(decode_at(buf, len, pos)), next};
+}
+
+size_t run_of(const uint8_t *buf, size_t len, size_t pos, uint8_t cls) {
+    while (pos < len) {
+        Char c = char_at(buf, len, pos);
+        if (c.cls != cls) break;
+        pos = c.next;
+    }
+    return pos;
+}
+
+// End of the piece starting at pos under the GPT-2 pattern
+//   's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+// with its alternatives tried in order, as the regex engine does.
+size_t piece_end(const uint8_t *buf, size_t len, size_t pos) {
+    if (buf[pos] == '\'' && pos + 1 < len) {
+        uint8_t c1 = buf[pos + 1];
+        if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') return pos + 2;
+        if (pos + 2 < len) {
+            uint8_t c2 = buf[pos + 2];
+            if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) return pos + 3;
+        }
+    }
+    size_t body = buf[pos] == ' ' ? pos + 1 : pos;
+    if (body < len) {
+        Char c = char_at(buf, len, body);
+        if (c.cls != kSpace) return run_of(buf, len, c.next, c.cls);
+    }
+    // Whitespace: the run, less its last character when it has several and text follows
+    size_t end = pos, last = pos;
+    while (end < len) {
+        Char c = char_at(buf, len, end);
+        if (c.cls != kSpace) break;
+        last = end;
+        end = c.next;
+    }
+    if (end < len && last > pos) return last;
+    return end;
+}
+
+// Direct-mapped cache of short pieces and their token lengths, per context
+constexpr size_t kCachedPiece = 24;
+constexpr size_t kCacheSlots = 4096;
+
+struct CacheSlot {
+    uint8_t len;
+    uint8_t n_tokens;
+    uint8_t bytes[kCachedPiece];
+    uint8_t token_lens[kCachedPiece];
+};
+
+inline size_t piece_hash(const uint8_t *p, size_t n) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < n; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    return static_cast<size_t>(h ^ (h >> 29)) & (kCacheSlots - 1);
+}
+
+struct Symbol {
+    uint32_t id;
+    uint32_t len;  // 0 once merged into its left neighbour
+    int32_t prev;
+    int32_t next;
+};
+
+struct Candidate {
+    uint32_t rank;
+    uint32_t pos;
+    uint32_t id;
+};
+
+}  // namespace
+
+// Merge scratch in the context's token arena, and the piece cache of the last model used
+struct BpeState {
+    explicit BpeState(Arena &arena) : symbols(arena), heap(arena), lens(arena) {}
+
+    ArenaArray<Symbol> symbols;
+    ArenaArray<Candidate> heap;
+    ArenaArray<uint32_t> lens;
+    const ac_bpe *owner = nullptr;
+    CacheSlot cache[kCacheSlots];
+};
+
+void destroy_bpe_state(BpeState *state) { delete state; }
+
+namespace {
+
+inline bool before(const Candidate &a, const Candidate &b) {
+    return a.rank != b.rank ? a.rank < b.rank : a.pos < b.pos;
+}
+
+// Binary min-heap on (rank, pos) in a caller-sized array
+struct CandidateHeap {
+    Candidate *data;
+    size_t size = 0;
+
+    void push(Candidate c) {
+        size_t i = size++;
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!before(c, data[parent])) break;
+            data[i] = data[parent];
+            i = parent;
+        }
+        data[i] = c;
+    }
+
+    Candidate pop() {
+        Candidate top = data[0];
+        Candidate last = data[--size];
+        size_t i = 0;
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= size) break;
+            if (child + 1 < size && before(data[child + 1], data[child])) ++child;
+            if (!before(data[child], last)) break;
+            data[i] = data[child];
+            i = child;
+        }
+        if (size) data[i] = last;
+        return top;
+    }
+};
+
+// Lowest-rank pair first, leftmost among equal ranks (the fast tokenizer's merge order).
+// Appends the byte length of each token of the n-byte piece to state.lens.
+void merge_piece(BpeState &state, const ac_bpe *bpe, const uint8_t *piece, size_t n) {
+    // Each merge queues at most two pairs, after at most n - 1 initial ones
+    state.symbols.resize(n);
+    state.heap.resize(3 * n);
+    Symbol *sym = state.symbols.data();
+    CandidateHeap heap{state.heap.data()};
+    for (size_t i = 0; i < n; ++i) {
+        sym[i] = {piece[i], 1, static_cast<int32_t>(i) - 1, i + 1 < n ? static_cast<int32_t>(i + 1) : -1};
+    }
+    for (size_t i = 0; i + 1 < n; ++i) {
+        if (const ac_bpe::Merge *m = bpe->find(sym[i].id, sym[i + 1].id)) {
+            heap.push({m->rank, static_cast<uint32_t>(i), m->id});
+        }
+    }
+    while (heap.size) {
+        Candidate c = heap.pop();
+        Symbol &left = sym[c.pos];
+        if (!left.len || left.next < 0) continue;
+        Symbol &right = sym[left.next];
+        const ac_bpe::Merge *m = bpe->find(left.id, right.id);
+        if (!m || m->id != c.id) continue;  // stale: a neighbour was merged since
+        left.id = c.id;
+        left.len += right.len;
+        right.len = 0;
+        left.next = right.next;
+        if (left.next >= 0) sym[left.next].prev = static_cast<int32_t>(c.pos);
+        if (left.prev >= 0) {
+            if (const ac_bpe::Merge *p = bpe->find(sym[left.prev].id, left.id)) {
+                heap.push({p->rank, static_cast<uint32_t>(left.prev), p->id});
+            }
+        }
+        if (left.next >= 0) {
+            if (const ac_bpe::Merge *p = bpe->find(left.id, sym[left.next].id)) heap.push({p->rank, c.pos, p->id});
+        }
+    }
+    for (int32_t i = 0; i >= 0; i = sym[i].next) state.lens.push_back(sym[i].len);
+}
+
+}  // namespace
+
+}  // namespace ac
+
+extern "C" {
+
+ac_bpe *ac_bpe_new(const uint8_t *merge_bytes, const uint32_t *left_lens, const uint32_t *right_lens,
+                   size_t n_merges) {
+    if (n_merges && (!merge_bytes || !left_lens || !right_lens)) return nullptr;
+    ac_bpe *bpe = new (std::nothrow) ac_bpe();
+    if (!bpe) return nullptr;
+    try {
+        std::unordered_map<std::string, uint32_t> ids;
+        for (uint32_t b = 0; b < 256; ++b) ids.emplace(std::string(1, static_cast<char>(b)), b);
+        bpe->merges.reserve(n_merges);
+        const char *p = reinterpret_cast<const char *>(merge_bytes);
+        uint32_t rank = 0;
+        for (size_t i = 0; i < n_merges; ++i) {
+            std::string left(p, left_lens[i]), right(p + left_lens[i], right_lens[i]);
+            p += left_lens[i] + right_lens[i];
+            auto l = ids.find(left), r = ids.find(right);
+            if (l == ids.end() || r == ids.end()) continue;  // parts never produced: the merge cannot apply
+            uint64_t key = (static_cast<uint64_t>(l->second) << 32) | r->second;
+            if (bpe->merges.count(key)) continue;  // the first (lowest) rank wins
+            auto merged = ids.emplace(left + right, static_cast<uint32_t>(ids.size())).first;
+            bpe->merges.emplace(key, ac_bpe::Merge{rank++, merged->second});
+        }
+        bpe->merge_count = rank;
+    } catch (const std::bad_alloc &) {
+        delete bpe;
+        return nullptr;
+    }
+    return bpe;
+}
+
+void ac_bpe_free(ac_bpe *bpe) { delete bpe; }
+
+size_t ac_bpe_merge_count(const ac_bpe *bpe) { return bpe ? bpe->merge_count : 0; }
+
+int ac_bpe_encode(ac_context *ctx, const ac_bpe *bpe, const uint8_t *buf, size_t len, size_t *out_tokens) {
+    if (!ctx || !bpe || (!buf && len) || !out_tokens || len > INT32_MAX) return AC_ERR_INVALID_ARGUMENT;
+    *out_tokens = 0;
+    ctx->token_arena.reset();
+    ctx->token_starts.clear();
+    ctx->token_ends.clear();
+    try {
+        if (!ctx->bpe) ctx->bpe = new ac::BpeState(ctx->token_arena);
+        ac::BpeState &state = *ctx->bpe;
+        state.symbols.clear();
+        state.heap.clear();
+        state.lens.clear();
+        if (state.owner != bpe) {
+            for (ac::CacheSlot &slot : state.cache) slot.len = 0;
+            state.owner = bpe;
+        }
+        // Source code averages about four bytes per token
+        ctx->token_starts.reserve(len / 4 + 16);
+        ctx->token_ends.reserve(len / 4 + 16);
+        for (size_t pos = 0; pos < len;) {
+            size_t end = ac::piece_end(buf, len, pos);
+            size_t n = end - pos;
+            const uint8_t *piece = buf + pos;
+            state.lens.resize(0);  // keeps the capacity for the next piece
+            if (n == 1) {
+                state.lens.push_back(1);
+            } else if (n <= ac::kCachedPiece) {
+                ac::CacheSlot &slot = state.cache[ac::piece_hash(piece, n)];
+                if (slot.len == n && std::memcmp(slot.bytes, piece, n) == 0) {
+                    for (uint8_t k = 0; k < slot.n_tokens; ++k) state.lens.push_back(slot.token_lens[k]);
+                } else {
+                    ac::merge_piece(state, bpe, piece, n);
+                    slot.len = static_cast<uint8_t>(n);
+                    slot.n_tokens = static_cast<uint8_t>(state.lens.size());
+                    std::memcpy(slot.bytes, piece, n);
+                    for (size_t k = 0; k < state.lens.size(); ++k) slot.token_lens[k] = static_cast<uint8_t>(state.lens[k]);
+                }
+            } else {
+                ac::merge_piece(state, bpe, piece, n);
+            }
+            size_t token = pos;
+            for (uint32_t token_len : state.lens) {
+                // Widen to whole characters, as the offset_mapping of a byte-level tokenizer is
+                size_t s = token, e = token + token_len;
+                while (s > 0 && ac::is_continuation(buf[s])) --s;
+                while (e < len && ac::is_continuation(buf[e])) ++e;
+                ctx->token_starts.push_back(static_cast<uint32_t>(s));
+                ctx->token_ends.push_back(static_cast<uint32_t>(e));
+                token += token_len;
+            }
+            pos = end;
+        }
+    } catch (const std::bad_alloc &) {
+        return AC_ERR_OUT_OF_MEMORY;
+    }
+    *out_tokens = ctx->token_starts.size();
+    return AC_OK;
+}
+
+const uint32_t *ac_token_starts(const ac_context *ctx) {
+    return ctx && !ctx->token_starts.empty() ? ctx->token_starts.data() : nullptr;
+}
+
+const uint32_t *ac_token_ends(const ac_context *ctx) {
+    return ctx && !ctx->token_ends.empty() ? ctx->token_ends.data() : nullptr;
+}
+
+}  // extern "C"
@@ -0,0 +1,81 @@
+/*
+ * Internal definition of ac_context, shared by the native core translation units.
+ */
+
+#ifndef ALIGNMENT_CONTEXT_H
+#define ALIGNMENT_CONTEXT_H
+
+#include "alignment_core.h"
+#include "arena.h"
+
+#include <chrono>
+
+namespace ac {
+
+// Parser state owned by tree_walker.cpp; opaque to the scoring code.
+struct WalkerState;
+void destroy_walker_state(WalkerState *state);
+
+// BPE merge scratch and piece cache owned by bpe.cpp.
+struct BpeState;
+void destroy_bpe_state(BpeState *state);
+
+inline uint64_t monotonic_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+}  // namespace ac
+
+// Per-file results and scratch live in arenas, one per entry point, each reset
+// by the next call of that entry point (results stay valid until then).
+struct ac_context {
+    ac::Arena score_arena;
+    ac::Arena walk_arena;
+    ac::Arena map_arena;
+    ac::Arena token_arena;
+
+    // Scoring scratch
+    ac::ArenaArray<uint8_t> duplicate{score_arena};
+    ac::ArenaArray<uint32_t> order{score_arena};
+    ac::ArenaArray<ac_unaligned_record> unaligned{score_arena};
+    // Distinct and distinct aligned rules by type id, compacted into type_counts
+    ac::ArenaArray<uint32_t> type_rules{score_arena};
+    ac::ArenaArray<uint32_t> type_aligned{score_arena};
+    ac::ArenaArray<ac_type_count> type_counts{score_arena};
+
+    // Rules filled by ac_extract_rules, as struct-of-arrays
+    ac::ArenaArray<uint32_t> rule_types{walk_arena};
+    ac::ArenaArray<uint32_t> rule_starts{walk_arena};
+    ac::ArenaArray<uint32_t> rule_ends{walk_arena};
+
+    // Offset maps filled by ac_context_offset_maps
+    ac::ArenaArray<uint32_t> char_to_byte{map_arena};
+    ac::ArenaArray<uint32_t> byte_to_utf16{map_arena};
+
+    // Token spans filled by ac_bpe_encode
+    ac::ArenaArray<uint32_t> token_starts{token_arena};
+    ac::ArenaArray<uint32_t> token_ends{token_arena};
+
+    ac::WalkerState *walker = nullptr;
+    ac::BpeState *bpe = nullptr;
+
+    // ac_context_set_limits, and the AC_LIMIT_* flags of the last entry point call
+    ac_limits limits = {};
+    uint32_t limit_hit = 0;
+
+    // Stage timers of the last ac_extract_rules / ac_score_rules call
+    ac_stage_times stage_times = {};
+
+    bool past_deadline() const { return limits.deadline_ns && ac::monotonic_ns() >= limits.deadline_ns; }
+
+    ac_context() = default;
+    ac_context(const ac_context &) = delete;
+    ac_context &operator=(const ac_context &) = delete;
+    ~ac_context() {
+        ac::destroy_walker_state(walker);
+        ac::destroy_bpe_state(bpe);
+    }
+};
+
+#endif /* ALIGNMENT_CONTEXT_H */
@@ -0,0 +1,180 @@
+/*
+ * UTF-8 offset maps
+ *
+ * Builds the char->byte and byte->UTF-16 maps the analyzer used to compute
+ * with one ch.encode('utf-8') per character. ASCII runs are found with SIMD
+ * (AVX2 when the CPU has it, else SSE2 on x86-64, NEON on AArch64) and filled
+ * as identity ranges; only non-ASCII characters are decoded one at a time.
+ */
+
+#include "alignment_core.h"
+#include "context.h"
+
+#include <cstring>
+#include <new>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define AC_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define AC_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Number of leading bytes below 0x80, scalar 8 bytes at a time.
+size_t ascii_run_scalar(const uint8_t *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, buf + i, sizeof(word));
+        if (word & 0x8080808080808080ull) break;
+    }
+    while (i < len && buf[i] < 0x80) ++i;
+    return i;
+}
+
+#if defined(AC_SIMD_X86)
+
+size_t ascii_run_sse2(const uint8_t *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i)));
+        if (mask) return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return i + ascii_run_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t ascii_run_avx2(const uint8_t *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        int mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + i)));
+        if (mask) return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return i + ascii_run_sse2(buf + i, len - i);
+}
+
+using AsciiRunFn = size_t (*)(const uint8_t *, size_t);
+
+AsciiRunFn select_ascii_run() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? ascii_run_avx2 : ascii_run_sse2;
+}
+
+size_t ascii_run(const uint8_t *buf, size_t len) {
+    static const AsciiRunFn fn = select_ascii_run();
+    return fn(buf, len);
+}
+
+const char *ascii_kernel_name() { return select_ascii_run() == ascii_run_avx2 ? "avx2" : "sse2"; }
+
+#elif defined(AC_SIMD_NEON)
+
+size_t ascii_run(const uint8_t *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(buf + i)) >= 0x80) break;
+    }
+    return i + ascii_run_scalar(buf + i, len - i);
+}
+
+const char *ascii_kernel_name() { return "neon"; }
+
+#else
+
+size_t ascii_run(const uint8_t *buf, size_t len) { return ascii_run_scalar(buf, len); }
+
+const char *ascii_kernel_name() { return "scalar"; }
+
+#endif
+
+}  // namespace
+
+extern "C" {
+
+const char *ac_simd_kernel(void) { return ascii_kernel_name(); }
+
+int ac_is_ascii(const uint8_t *buf, size_t len) {
+    if (len && !buf) return 0;
+    return ascii_run(buf, len) == len;
+}
+
+int ac_offset_maps(const uint8_t *buf, size_t len,
+                   uint32_t *char_to_byte, size_t char_capacity,
+                   uint32_t *byte_to_utf16,
+                   size_t *out_chars) {
+    if ((len && !buf) || len > UINT32_MAX || !out_chars) return AC_ERR_INVALID_ARGUMENT;
+    // Every character is at least one byte, so len + 1 entries always suffice;
+    // a smaller capacity is only valid if the caller knows the character count.
+    size_t pos = 0, chars = 0;
+    uint32_t utf16 = 0;
+    while (pos < len) {
+        size_t run = ascii_run(buf + pos, len - pos);
+        if (char_to_byte) {
+            if (chars + run >= char_capacity) return AC_ERR_INVALID_ARGUMENT;
+            for (size_t k = 0; k < run; ++k) char_to_byte[chars + k] = static_cast<uint32_t>(pos + k);
+        }
+        if (byte_to_utf16) {
+            for (size_t k = 0; k < run; ++k) byte_to_utf16[pos + k] = utf16 + static_cast<uint32_t>(k);
+        }
+        pos += run;
+        chars += run;
+        utf16 += static_cast<uint32_t>(run);
+        if (pos >= len) break;
+
+        // One multi-byte character; interior bytes map to the character's first UTF-16 unit.
+        uint8_t lead = buf[pos];
+        size_t blen = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+        if (blen > len - pos) blen = len - pos;
+        if (char_to_byte) {
+            if (chars >= char_capacity) return AC_ERR_INVALID_ARGUMENT;
+            char_to_byte[chars] = static_cast<uint32_t>(pos);
+        }
+        if (byte_to_utf16) {
+            for (size_t k = 0; k < blen; ++k) byte_to_utf16[pos + k] = utf16;
+        }
+        pos += blen;
+        chars += 1;
+        utf16 += blen == 4 ? 2 : 1;  // code points above U+FFFF are surrogate pairs
+    }
+    if (char_to_byte) {
+        if (chars >= char_capacity) return AC_ERR_INVALID_ARGUMENT;
+        char_to_byte[chars] = static_cast<uint32_t>(len);
+    }
+    if (byte_to_utf16) byte_to_utf16[len] = utf16;
+    *out_chars = chars;
+    return AC_OK;
+}
+
+int ac_context_offset_maps(ac_context *ctx, const uint8_t *buf, size_t len, int with_utf16,
+                           size_t *out_chars) {
+    if (!ctx || (len && !buf) || len > UINT32_MAX || !out_chars) return AC_ERR_INVALID_ARGUMENT;
+    ctx->map_arena.reset();
+    ctx->char_to_byte.clear();
+    ctx->byte_to_utf16.clear();
+    try {
+        ctx->char_to_byte.resize(len + 1);
+        if (with_utf16) ctx->byte_to_utf16.resize(len + 1);
+    } catch (const std::bad_alloc &) {
+        return AC_ERR_OUT_OF_MEMORY;
+    }
+    size_t chars = 0;
+    int status = ac_offset_maps(buf, len, ctx->char_to_byte.data(), len + 1,
+                                with_utf16 ? ctx->byte_to_utf16.data() : nullptr, &chars);
+    if (status != AC_OK) return status;
+    ctx->char_to_byte.resize(chars + 1);
+    *out_chars = chars;
+    return AC_OK;
+}
+
+const uint32_t *ac_char_to_byte(const ac_context *ctx) {
+    return ctx && !ctx->char_to_byte.empty() ? ctx->char_to_byte.data() : nullptr;
+}
+
+const uint32_t *ac_byte_to_utf16(const ac_context *ctx) {
+    return ctx && !ctx->byte_to_utf16.empty() ? ctx->byte_to_utf16.data() : nullptr;
+}
+
+}  // extern "C"
@@ -0,0 +1,66 @@
+/*
+ * Token lookup of the scoring loop, shared with the benchmark suite
+ * (alignment_bench.cpp).
+ */
+
+#ifndef ALIGNMENT_TOKEN_INDEX_H
+#define ALIGNMENT_TOKEN_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace ac {
+
+// First token i with starts[i] < pos < ends[i]. Offsets from a tokenizer are
+// monotone (starts and ends both non-decreasing), which makes the tokens with
+// start < pos a prefix and, within it, those with end > pos a suffix: the
+// answer is the first index of that suffix if it lies inside the prefix.
+// Crossing starts arrive in non-decreasing order (rules are pre-order), so
+// lookups gallop forward from the previous answer, which degrades to a merge
+// sweep over the tokens; out-of-order queries fall back to a full binary search.
+class TokenIndex {
+public:
+    TokenIndex(const uint32_t *starts, const uint32_t *ends, size_t n)
+        : starts_(starts), ends_(ends), n_(n), monotone_(true) {
+        for (size_t i = 1; i < n && monotone_; ++i) {
+            monotone_ = starts[i - 1] <= starts[i] && ends[i - 1] <= ends[i];
+        }
+    }
+
+    int32_t find(uint32_t pos, size_t &hint) const {
+        if (!monotone_) return find_linear(pos);
+        // prefix = number of tokens with start < pos
+        size_t lo = 0, hi = n_;
+        if (hint <= n_ && (hint == 0 || starts_[hint - 1] < pos)) {
+            lo = hint;
+            size_t step = 1;
+            while (lo + step <= n_ && starts_[lo + step - 1] < pos) {
+                lo += step;
+                step <<= 1;
+            }
+            hi = std::min(n_, lo + step);
+        }
+        size_t prefix = std::lower_bound(starts_ + lo, starts_ + hi, pos) - starts_;
+        hint = prefix;
+        size_t first = std::upper_bound(ends_, ends_ + prefix, pos) - ends_;
+        return first < prefix ? static_cast<int32_t>(first) : -1;
+    }
+
+private:
+    int32_t find_linear(uint32_t pos) const {
+        for (size_t i = 0; i < n_; ++i) {
+            if (starts_[i] < pos && pos < ends_[i]) return static_cast<int32_t>(i);
+        }
+        return -1;
+    }
+
+    const uint32_t *starts_;
+    const uint32_t *ends_;
+    size_t n_;
+    bool monotone_;
+};
+
+}  // namespace ac
+
+#endif /* ALIGNMENT_TOKEN_INDEX_H */
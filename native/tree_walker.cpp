@@ -0,0 +1,260 @@
+/*
+ * Native tree walker
+ *
+ * Replaces the recursive Python extract_rules: parses with the tree-sitter C
+ * API and walks the tree with a TreeCursor, so no per-node Python objects are
+ * created and deep trees cannot hit a recursion limit.
+ */
+
+#include "alignment_core.h"
+#include "context.h"
+
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef AC_HAVE_TREE_SITTER
+#define AC_HAVE_TREE_SITTER 0
+#endif
+
+#if AC_HAVE_TREE_SITTER
+#include <dlfcn.h>
+#include <tree_sitter/api.h>
+#endif
+
+struct ac_language {
+#if AC_HAVE_TREE_SITTER
+    void *handle = nullptr;
+    const TSLanguage *ts_language = nullptr;
+#endif
+    // TSSymbol -> interned type id; several symbols may share one name.
+    std::vector<uint32_t> symbol_type;
+    std::vector<std::string> type_names;
+    std::vector<uint8_t> type_skipped;  // empty or ERROR* types never become rules
+};
+
+namespace ac {
+
+#if AC_HAVE_TREE_SITTER
+
+struct WalkerState {
+    TSParser *parser = nullptr;
+    const TSLanguage *language = nullptr;
+};
+
+void destroy_walker_state(WalkerState *state) {
+    if (!state) return;
+    if (state->parser) ts_parser_delete(state->parser);
+    delete state;
+}
+
+#else
+
+struct WalkerState {};
+
+void destroy_walker_state(WalkerState *state) { delete state; }
+
+#endif
+
+}  // namespace ac
+
+#if AC_HAVE_TREE_SITTER
+namespace {
+
+void intern_symbols(ac_language *lang) {
+    const uint32_t symbol_count = ts_language_symbol_count(lang->ts_language);
+    std::unordered_map<std::string, uint32_t> ids;
+    lang->symbol_type.assign(UINT16_MAX + 1, 0);
+    auto intern = [&](TSSymbol symbol) {
+        const char *name = ts_language_symbol_name(lang->ts_language, symbol);
+        std::string key = name ? name : "";
+        auto it = ids.find(key);
+        if (it == ids.end()) {
+            it = ids.emplace(key, static_cast<uint32_t>(lang->type_names.size())).first;
+            lang->type_skipped.push_back(key.empty() || key.compare(0, 5, "ERROR") == 0);
+            lang->type_names.push_back(std::move(key));
+        }
+        lang->symbol_type[symbol] = it->second;
+    };
+    for (uint32_t symbol = 0; symbol < symbol_count && symbol <= UINT16_MAX; ++symbol) {
+        intern(static_cast<TSSymbol>(symbol));
+    }
+    intern(static_cast<TSSymbol>(-1));  // ts_builtin_sym_error
+}
+
+}  // namespace
+#endif
+
+extern "C" {
+
+int ac_has_tree_sitter(void) { return AC_HAVE_TREE_SITTER ? 1 : 0; }
+
+ac_language *ac_language_load(const char *library_path, const char *symbol) {
+#if AC_HAVE_TREE_SITTER
+    if (!library_path || !symbol) return nullptr;
+    void *handle = dlopen(library_path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return nullptr;
+    std::string entry = std::string("tree_sitter_") + symbol;
+    auto fn = reinterpret_cast<const TSLanguage *(*)(void)>(dlsym(handle, entry.c_str()));
+    const TSLanguage *ts_language = fn ? fn() : nullptr;
+    if (!ts_language) {
+        dlclose(handle);
+        return nullptr;
+    }
+    // Reject grammars generated for an ABI this runtime cannot load.
+    uint32_t version = ts_language_version(ts_language);
+    if (version < TREE_SITTER_MIN_COMPATIBLE_LANGUAGE_VERSION || version > TREE_SITTER_LANGUAGE_VERSION) {
+        dlclose(handle);
+        return nullptr;
+    }
+    ac_language *lang = new (std::nothrow) ac_language();
+    if (!lang) {
+        dlclose(handle);
+        return nullptr;
+    }
+    lang->handle = handle;
+    lang->ts_language = ts_language;
+    try {
+        intern_symbols(lang);
+    } catch (const std::bad_alloc &) {
+        ac_language_free(lang);
+        return nullptr;
+    }
+    return lang;
+#else
+    (void)library_path;
+    (void)symbol;
+    return nullptr;
+#endif
+}
+
+void ac_language_free(ac_language *lang) {
+    if (!lang) return;
+#if AC_HAVE_TREE_SITTER
+    if (lang->handle) dlclose(lang->handle);
+#endif
+    delete lang;
+}
+
+uint32_t ac_language_type_count(const ac_language *lang) {
+    return lang ? static_cast<uint32_t>(lang->type_names.size()) : 0;
+}
+
+const char *ac_language_type_name(const ac_language *lang, uint32_t type_id) {
+    if (!lang || type_id >= lang->type_names.size()) return nullptr;
+    return lang->type_names[type_id].c_str();
+}
+
+int ac_extract_rules(ac_context *ctx, const ac_language *lang, const uint8_t *buf, size_t len) {
+#if AC_HAVE_TREE_SITTER
+    if (!ctx || !lang || (len && !buf) || len > UINT32_MAX) return AC_ERR_INVALID_ARGUMENT;
+    ctx->limit_hit = 0;
+    ctx->stage_times.parse_ns = ctx->stage_times.walk_ns = 0;
+    ctx->walk_arena.reset();
+    ctx->rule_types.clear();
+    ctx->rule_starts.clear();
+    ctx->rule_ends.clear();
+
+    try {
+        if (!ctx->walker) ctx->walker = new ac::WalkerState();
+    } catch (const std::bad_alloc &) {
+        return AC_ERR_OUT_OF_MEMORY;
+    }
+    ac::WalkerState *state = ctx->walker;
+    if (!state->parser && !(state->parser = ts_parser_new())) return AC_ERR_OUT_OF_MEMORY;
+    if (state->language != lang->ts_language) {
+        if (!ts_parser_set_language(state->parser, lang->ts_language)) return AC_ERR_PARSE;
+        state->language = lang->ts_language;
+    }
+
+    // The parser cannot hand back a partial tree, so it gets the time that is left
+    uint64_t timeout_us = 0;
+    if (ctx->limits.deadline_ns) {
+        uint64_t now = ac::monotonic_ns();
+        if (now >= ctx->limits.deadline_ns) {
+            ctx->limit_hit = AC_LIMIT_DEADLINE;
+            return AC_ERR_DEADLINE;
+        }
+        timeout_us = (ctx->limits.deadline_ns - now) / 1000 + 1;
+    }
+    ts_parser_set_timeout_micros(state->parser, timeout_us);
+    uint64_t parse_start = ac::monotonic_ns();
+    TSTree *tree = ts_parser_parse_string(state->parser, nullptr,
+                                          reinterpret_cast<const char *>(buf),
+                                          static_cast<uint32_t>(len));
+    uint64_t walk_start = ac::monotonic_ns();
+    ctx->stage_times.parse_ns = walk_start - parse_start;
+    if (!tree) {
+        if (!timeout_us) return AC_ERR_PARSE;
+        ts_parser_reset(state->parser);  // drop the half-done parse instead of resuming it next time
+        ctx->limit_hit = AC_LIMIT_DEADLINE;
+        return AC_ERR_DEADLINE;
+    }
+
+    int status = AC_OK;
+    const uint64_t max_rules = ctx->limits.max_rules;
+    TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree));
+    try {
+        size_t expected = len / 4 + 16;
+        if (max_rules && expected > max_rules) expected = static_cast<size_t>(max_rules);
+        ctx->rule_types.reserve(expected);
+        ctx->rule_starts.reserve(expected);
+        ctx->rule_ends.reserve(expected);
+        for (size_t visited = 1;; ++visited) {
+            if (visited % AC_LIMIT_CHECK_INTERVAL == 0 && ctx->past_deadline()) {
+                ctx->limit_hit = AC_LIMIT_DEADLINE;
+                break;
+            }
+            TSNode node = ts_tree_cursor_current_node(&cursor);
+            uint32_t type_id = lang->symbol_type[ts_node_symbol(node)];
+            if (!lang->type_skipped[type_id]) {
+                if (max_rules && ctx->rule_types.size() >= max_rules) {
+                    ctx->limit_hit = AC_LIMIT_RULES;
+                    break;
+                }
+                ctx->rule_types.push_back(type_id);
+                ctx->rule_starts.push_back(ts_node_start_byte(node));
+                ctx->rule_ends.push_back(ts_node_end_byte(node));
+            }
+            if (ts_tree_cursor_goto_first_child(&cursor)) continue;
+            bool done = false;
+            while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+                if (!ts_tree_cursor_goto_parent(&cursor)) {
+                    done = true;
+                    break;
+                }
+            }
+            if (done) break;
+        }
+    } catch (const std::bad_alloc &) {
+        status = AC_ERR_OUT_OF_MEMORY;
+    }
+    ts_tree_cursor_delete(&cursor);
+    ts_tree_delete(tree);
+    ctx->stage_times.walk_ns = ac::monotonic_ns() - walk_start;
+    return status == AC_OK && ctx->limit_hit ? AC_TRUNCATED : status;
+#else
+    (void)ctx;
+    (void)lang;
+    (void)buf;
+    (void)len;
+    return AC_ERR_UNAVAILABLE;
+#endif
+}
+
+size_t ac_rule_count(const ac_context *ctx) { return ctx ? ctx->rule_types.size() : 0; }
+
+const uint32_t *ac_rule_types(const ac_context *ctx) {
+    return ctx && !ctx->rule_types.empty() ? ctx->rule_types.data() : nullptr;
+}
+
+const uint32_t *ac_rule_starts(const ac_context *ctx) {
+    return ctx && !ctx->rule_starts.empty() ? ctx->rule_starts.data() : nullptr;
+}
+
+const uint32_t *ac_rule_ends(const ac_context *ctx) {
+    return ctx && !ctx->rule_ends.empty() ? ctx->rule_ends.data() : nullptr;
+}
+
+}  // extern "C"
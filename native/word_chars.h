@@ -0,0 +1,169 @@
+/*
+ * Word-character policies of the scoring kernel, shared with the benchmark
+ * suite (alignment_bench.cpp).
+ *
+ * A word character is one for which Python's ch.isalnum() or ch == '_' holds,
+ * in every language: that is what the Python loop tests, and native results
+ * must match it. What differs between files is the encoding. Most C and C++
+ * sources are pure ASCII, where a byte is a character and a 256-entry constexpr
+ * table answers the test without decoding. Other buffers decode UTF-8 and look
+ * code points up in a two-level bitmap built once from the generated
+ * str.isalnum() ranges (unicode_alnum.inc). Neither lookup branches on the
+ * character. ac_score_rules picks the policy once per call.
+ */
+
+#ifndef ALIGNMENT_WORD_CHARS_H
+#define ALIGNMENT_WORD_CHARS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ac {
+
+struct CodepointRange {
+    uint32_t lo;
+    uint32_t hi;
+};
+
+inline constexpr CodepointRange kAlnumRanges[] = {
+#include "unicode_alnum.inc"
+};
+
+// [A-Za-z0-9_] by byte value; bytes of 0x80 and up are never word characters on their own.
+struct AsciiWordTable {
+    bool word[256] = {};
+
+    constexpr AsciiWordTable() {
+        for (int c = '0'; c <= '9'; ++c) word[c] = true;
+        for (int c = 'A'; c <= 'Z'; ++c) word[c] = true;
+        for (int c = 'a'; c <= 'z'; ++c) word[c] = true;
+        word[static_cast<unsigned char>('_')] = true;
+    }
+};
+
+inline constexpr AsciiWordTable kAsciiWord{};
+
+// One bit per code point in blocks of 256. Blocks with the same bits share
+// storage (most are all clear or all set): a 16 KB index and about 4 KB of blocks.
+// The index covers 21 bits, as far as a malformed 4-byte sequence decodes.
+class UnicodeWordTable {
+public:
+    static constexpr uint32_t kBlockBits = 8;
+    static constexpr uint32_t kIndexSize = (1u << 21) >> kBlockBits;
+
+    UnicodeWordTable() {
+        Block ascii = {};
+        for (uint32_t cp = 0; cp < 0x80; ++cp) {
+            if (kAsciiWord.word[cp]) ascii.bits[cp >> 6] |= uint64_t(1) << (cp & 63);
+        }
+        blocks_.push_back(Block{});
+        size_t next_range = 0;
+        const size_t n_ranges = sizeof(kAlnumRanges) / sizeof(kAlnumRanges[0]);
+        for (uint32_t block = 0; block < kIndexSize; ++block) {
+            Block bits = block == 0 ? ascii : Block{};
+            uint32_t lo = block << kBlockBits, hi = lo + (1u << kBlockBits) - 1;
+            while (next_range < n_ranges && kAlnumRanges[next_range].hi < lo) ++next_range;
+            for (size_t r = next_range; r < n_ranges && kAlnumRanges[r].lo <= hi; ++r) {
+                uint32_t from = kAlnumRanges[r].lo < lo ? lo : kAlnumRanges[r].lo;
+                uint32_t to = kAlnumRanges[r].hi > hi ? hi : kAlnumRanges[r].hi;
+                for (uint32_t cp = from; cp <= to; ++cp) {
+                    bits.bits[(cp - lo) >> 6] |= uint64_t(1) << (cp & 63);
+                }
+            }
+            index_[block] = intern(bits);
+        }
+    }
+
+    bool contains(uint32_t cp) const {
+        const Block &block = blocks_[index_[(cp >> kBlockBits) & (kIndexSize - 1)]];
+        return (block.bits[(cp >> 6) & 3] >> (cp & 63)) & 1;
+    }
+
+    size_t block_count() const { return blocks_.size(); }
+
+private:
+    struct Block {
+        uint64_t bits[4] = {};
+    };
+
+    uint16_t intern(const Block &bits) {
+        for (size_t i = 0; i < blocks_.size(); ++i) {
+            const Block &b = blocks_[i];
+            if (b.bits[0] == bits.bits[0] && b.bits[1] == bits.bits[1] && b.bits[2] == bits.bits[2] &&
+                b.bits[3] == bits.bits[3]) {
+                return static_cast<uint16_t>(i);
+            }
+        }
+        blocks_.push_back(bits);
+        return static_cast<uint16_t>(blocks_.size() - 1);
+    }
+
+    std::vector<Block> blocks_;
+    uint16_t index_[kIndexSize];
+};
+
+inline const UnicodeWordTable &unicode_word_table() {
+    static const UnicodeWordTable table;
+    return table;
+}
+
+inline bool is_continuation(uint8_t b) { return (b & 0xC0) == 0x80; }
+
+// Decode the code point starting at pos. Input comes from str.encode('utf-8'),
+// so malformed sequences only need to be handled without reading out of range.
+inline uint32_t decode_at(const uint8_t *buf, size_t len, size_t pos) {
+    uint8_t b0 = buf[pos];
+    if (b0 < 0x80) return b0;
+    int extra = b0 >= 0xF0 ? 3 : b0 >= 0xE0 ? 2 : b0 >= 0xC0 ? 1 : 0;
+    uint32_t cp = b0 & (0x3F >> extra);
+    for (int i = 1; i <= extra; ++i) {
+        if (pos + i >= len || !is_continuation(buf[pos + i])) return 0xFFFD;
+        cp = (cp << 6) | (buf[pos + i] & 0x3F);
+    }
+    return cp;
+}
+
+inline uint32_t decode_before(const uint8_t *buf, size_t len, size_t pos) {
+    size_t start = pos - 1;
+    while (start > 0 && pos - start < 4 && is_continuation(buf[start])) --start;
+    return decode_at(buf, len, start);
+}
+
+// Every byte is a character (the buffer passed ac_is_ascii).
+struct AsciiText {
+    explicit AsciiText(const uint8_t *, size_t) {}
+    static bool is_char_boundary(const uint8_t *, size_t, size_t) { return true; }
+    static uint32_t before(const uint8_t *buf, size_t, size_t pos) { return buf[pos - 1]; }
+    static uint32_t at(const uint8_t *buf, size_t, size_t pos) { return buf[pos]; }
+    static bool is_word(uint32_t cp) { return kAsciiWord.word[cp & 0xFF]; }
+};
+
+// Any UTF-8; offsets inside a character are not boundaries.
+struct Utf8Text {
+    explicit Utf8Text(const uint8_t *, size_t) : table(unicode_word_table()) {}
+    static bool is_char_boundary(const uint8_t *buf, size_t len, size_t pos) {
+        return pos >= len || !is_continuation(buf[pos]);
+    }
+    static uint32_t before(const uint8_t *buf, size_t len, size_t pos) { return decode_before(buf, len, pos); }
+    static uint32_t at(const uint8_t *buf, size_t len, size_t pos) { return decode_at(buf, len, pos); }
+    bool is_word(uint32_t cp) const { return table.contains(cp); }
+
+    const UnicodeWordTable &table;
+};
+
+// Binary search of the range table, which the bitmap replaced; a reference for tests and benchmarks.
+inline bool is_word_codepoint_ranges(uint32_t cp) {
+    if (cp < 0x80) return kAsciiWord.word[cp];
+    size_t lo = 0, hi = sizeof(kAlnumRanges) / sizeof(kAlnumRanges[0]);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (kAlnumRanges[mid].hi < cp) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < sizeof(kAlnumRanges) / sizeof(kAlnumRanges[0]) && kAlnumRanges[lo].lo <= cp;
+}
+
+}  // namespace ac
+
+#endif  // ALIGNMENT_WORD_CHARS_H
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Per-node-type rule counters
+
+The scoring loops (native and Python) count distinct rules and distinct fully
+aligned rules per type id into flat arrays, and a file's result carries the
+types that occur in it as UnalignedTable.type_counts. NodeTypeTotals sums
+those per language into flat arrays over a dense id table of its own, so the
+summary stores one list of counts per language, indexed by id, and the names
+are written once per run (node_types_<model>.json) rather than once per file
+or per rule key. A type's counts sum over files like total_rules and
+total_aligned do, and the types of a language add up to them.
+"""
+
+import json
+import threading
+from array import array
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+
+def table_path(output_dir, model_name: str) -> Path:
+    return Path(output_dir) / f"node_types_{model_name}.json"
+
+
+def column_type_counts(types, dup, unaligned, type_names) -> Dict[str, Tuple[int, int]]:
+    """type_counts of rule columns where dup marks repeated keys and unaligned word-splitting rules."""
+    rules = [0] * len(type_names)
+    aligned = [0] * len(type_names)
+    for type_id, repeat, split in zip(types, dup, unaligned):
+        if not repeat:
+            rules[type_id] += 1
+            aligned[type_id] += not split
+    return {type_names[t]: (n, aligned[t]) for t, n in enumerate(rules) if n}
+
+
+class NodeTypeTotals:
+    """Distinct and aligned rules per language and node type, as arrays indexed by interned ids."""
+
+    def __init__(self):
+        self.ids: Dict[str, Dict[str, int]] = {}
+        self.names: Dict[str, List[str]] = {}
+        self.rules: Dict[str, array] = {}
+        self.aligned: Dict[str, array] = {}
+        self._lock = threading.Lock()
+
+    def add(self, language: str, type_counts: Dict[str, Tuple[int, int]]):
+        if not type_counts:
+            return
+        with self._lock:
+            ids = self.ids.get(language)
+            if ids is None:
+                ids = self.ids[language] = {}
+                self.names[language] = []
+                self.rules[language] = array('Q')
+                self.aligned[language] = array('Q')
+            names, rules, aligned = self.names[language], self.rules[language], self.aligned[language]
+            for name, (n, n_aligned) in type_counts.items():
+                type_id = ids.get(name)
+                if type_id is None:
+                    type_id = ids[name] = len(names)
+                    names.append(name)
+                    rules.append(0)
+                    aligned.append(0)
+                rules[type_id] += n
+                aligned[type_id] += n_aligned
+
+    def snapshot(self) -> Dict[str, Tuple[array, array]]:
+        with self._lock:
+            return {language: (array('Q', self.rules[language]), array('Q', self.aligned[language]))
+                    for language in self.rules}
+
+    def report(self, before: Optional[Dict[str, Tuple[array, array]]] = None) -> Optional[Dict]:
+        """{language: {'rules': [...], 'aligned': [...]}} since the snapshot before, indexed by table() ids."""
+        report = {}
+        with self._lock:
+            for language in sorted(self.rules):
+                rules, aligned = list(self.rules[language]), list(self.aligned[language])
+                old_rules, old_aligned = (before or {}).get(language, ((), ()))
+                for i, (n, n_aligned) in enumerate(zip(old_rules, old_aligned)):
+                    rules[i] -= n
+                    aligned[i] -= n_aligned
+                if any(rules):
+                    report[language] = {'rules': rules, 'aligned': aligned}
+        return report or None
+
+    def table(self) -> Dict[str, List[str]]:
+        """Node type names per language, by id."""
+        with self._lock:
+            return {language: list(names) for language, names in sorted(self.names.items())}
+
+    def write_table(self, path) -> Path:
+        path = Path(path)
+        path.parent.mkdir(parents=True, exist_ok=True)
+        with open(path, 'w', encoding='utf-8') as f:
+            json.dump(self.table(), f, ensure_ascii=False, indent=1)
+        return path
+
+
+def most_unaligned(counts: Dict, names: List[str], n: int = 3) -> List[Tuple[str, int, int]]:
+    """(type, unaligned, rules) of the n types of one language report entry with the most unaligned rules."""
+    rows = [(names[t], rules - aligned, rules) for t, (rules, aligned) in enumerate(zip(counts['rules'], counts['aligned']))
+            if rules > aligned]
+    return sorted(rows, key=lambda row: (-row[1], row[0]))[:n]
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Streaming stage pipeline with bounded queues
+
+Each stage runs on its own thread and hands items to the next through a
+queue.Queue of fixed depth, so a slow stage blocks the ones feeding it
+(backpressure) instead of letting items pile up in memory. The source is
+consumed lazily on the calling thread and the sink runs on the last thread.
+analyzer.py wires read -> parse -> tokenize -> align -> write onto this
+(--pipeline).
+"""
+
+import queue
+import threading
+import time
+from collections import Counter
+from typing import Callable, Dict, Iterable, List, Optional
+
+_DONE = object()
+
+
+class Stage:
+    """One pipeline stage.
+
+    fn maps an item to an item, or to None to drop it. With max_items > 1 or
+    max_weight > 0 the stage is batched: fn receives a list of up to max_items
+    items (cut early once the summed weight(item) reaches max_weight) and
+    returns the list of items to pass on.
+    """
+
+    def __init__(self, name: str, fn: Callable, max_items: int = 1, max_weight: int = 0,
+                 weight: Optional[Callable] = None):
+        self.name = name
+        self.fn = fn
+        self.max_items = max(1, max_items)
+        self.max_weight = max_weight
+        self.weight = weight or (lambda item: 1)
+
+    @property
+    def batched(self) -> bool:
+        return self.max_items > 1 or self.max_weight > 0
+
+
+class Pipeline:
+    """Run items from a source through stages into a sink.
+
+    An exception raised by a stage fn drops the items involved and is counted
+    in errors; an exception raised by the sink stops the run and is re-raised
+    from run() once every thread has drained.
+    """
+
+    def __init__(self, stages: List[Stage], queue_depth: int = 64):
+        self.stages = stages
+        self.queue_depth = max(1, queue_depth)
+        self.busy_seconds = Counter()
+        self.items = Counter()
+        self.errors = Counter()
+        self._sink_error = None
+        self._queues: List[queue.Queue] = []
+
+    def run(self, source: Iterable, sink: Callable) -> 'Pipeline':
+        queues = self._queues = [queue.Queue(maxsize=self.queue_depth) for _ in range(len(self.stages) + 1)]
+        threads = [threading.Thread(target=self._run_stage, args=(stage, queues[i], queues[i + 1]),
+                                    name=f"pipeline-{stage.name}", daemon=True)
+                   for i, stage in enumerate(self.stages)]
+        threads.append(threading.Thread(target=self._run_sink, args=(sink, queues[-1]),
+                                        name="pipeline-sink", daemon=True))
+        for thread in threads:
+            thread.start()
+        try:
+            for item in source:
+                if self._sink_error is not None:
+                    break
+                queues[0].put(item)
+        finally:
+            queues[0].put(_DONE)
+            for thread in threads:
+                thread.join()
+        if self._sink_error is not None:
+            raise self._sink_error
+        return self
+
+    def _run_stage(self, stage: Stage, inbox: queue.Queue, outbox: queue.Queue):
+        done = False
+        while not done:
+            item = inbox.get()
+            if item is _DONE:
+                break
+            if not stage.batched:
+                start = time.perf_counter()
+                try:
+                    result = stage.fn(item)
+                except Exception:
+                    self.errors[stage.name] += 1
+                    result = None
+                self.busy_seconds[stage.name] += time.perf_counter() - start
+                self.items[stage.name] += 1
+                if result is not None:
+                    outbox.put(result)
+                continue
+
+            # Batched stage: keep taking items until the batch is full or the input ends
+            batch = [item]
+            weight = stage.weight(item)
+            while len(batch) < stage.max_items and not (stage.max_weight and weight >= stage.max_weight):
+                item = inbox.get()
+                if item is _DONE:
+                    done = True
+                    break
+                batch.append(item)
+                weight += stage.weight(item)
+            start = time.perf_counter()
+            try:
+                results = stage.fn(batch)
+            except Exception:
+                self.errors[stage.name] += len(batch)
+                results = []
+            self.busy_seconds[stage.name] += time.perf_counter() - start
+            self.items[stage.name] += len(batch)
+            for result in results:
+                outbox.put(result)
+        outbox.put(_DONE)
+
+    def _run_sink(self, sink: Callable, inbox: queue.Queue):
+        while True:
+            item = inbox.get()
+            if item is _DONE:
+                return
+            if self._sink_error is not None:
+                continue  # keep draining so upstream stages never block
+            start = time.perf_counter()
+            try:
+                sink(item)
+            except Exception as e:
+                self._sink_error = e
+            self.busy_seconds['write'] += time.perf_counter() - start
+            self.items['write'] += 1
+
+    def queue_depths(self) -> Dict[str, int]:
+        """Items waiting in front of each stage (and the sink, 'write') right now; safe from any thread."""
+        names = [stage.name for stage in self.stages] + ['write']
+        return {name: q.qsize() for name, q in zip(names, self._queues)}
+
+    def summary(self) -> str:
+        """One line of per-stage busy time, e.g. 'read 0.41s, parse 2.10s, ...'."""
+        names = [stage.name for stage in self.stages] + ['write']
+        parts = [f"{name} {self.busy_seconds[name]:.2f}s" for name in names]
+        errors = sum(self.errors.values())
+        return ", ".join(parts) + (f" ({errors} files dropped on errors)" if errors else "")
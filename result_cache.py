@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Persistent content-hash cache of per-file alignment results
+
+Corpora such as The Stack hold many exact copies of the same file (vendored
+headers, generated boilerplate). The cache maps (content hash, language,
+tokenizer model, grammar version, detail level) to the compact per-file result (score, rule
+counts and the UnalignedTable of unaligned rules), so a repeated file is looked up
+instead of parsed and tokenized again. Entries live in one SQLite file, which
+worker processes and threads can share (--result_cache path/to/cache.db).
+"""
+
+import hashlib
+import pickle
+import sqlite3
+import threading
+from collections import Counter
+from pathlib import Path
+from typing import Optional, Tuple
+
+# Bump when a change to rule extraction or scoring makes cached results stale
+CACHE_VERSION = 2
+
+
+def content_digest(code_bytes) -> bytes:
+    """16-byte BLAKE2b digest of a file's UTF-8 bytes (bytes, bytearray or mmap)."""
+    return hashlib.blake2b(code_bytes, digest_size=16).digest()
+
+
+def grammar_version(library_path: Path, symbol: str) -> str:
+    """Identifies a compiled grammar: digest of the language library plus its symbol."""
+    digest = hashlib.blake2b(digest_size=16)
+    with open(library_path, 'rb') as f:
+        for block in iter(lambda: f.read(1 << 20), b''):
+            digest.update(block)
+    return f"{symbol}:{digest.hexdigest()}"
+
+
+class ResultCache:
+    """Compact results keyed by content digest and analysis configuration.
+
+    get/put are safe to call from several threads; each process opens its own
+    connection. Writes are best-effort: a locked or unwritable database only
+    costs a cache miss. counters holds hits, misses and stores for this process.
+    """
+
+    def __init__(self, path, model_name: str, detail_level: str = 'full'):
+        self.path = Path(path)
+        self.model_name = model_name
+        self.detail_level = detail_level
+        self.counters = Counter()
+        self._lock = threading.Lock()
+        self.path.parent.mkdir(parents=True, exist_ok=True)
+        self._db = sqlite3.connect(str(self.path), timeout=30, isolation_level=None, check_same_thread=False)
+        self._db.execute('PRAGMA journal_mode=WAL')
+        self._db.execute('PRAGMA synchronous=NORMAL')
+        self._db.execute('CREATE TABLE IF NOT EXISTS results ('
+                         'digest BLOB NOT NULL, language TEXT NOT NULL, config TEXT NOT NULL, '
+                         'result BLOB NOT NULL, PRIMARY KEY (digest, language, config)) WITHOUT ROWID')
+
+    def config_key(self, grammar: str) -> str:
+        key = f"v{CACHE_VERSION}|{self.model_name}|{grammar}"
+        # Reduced --detail_level tables are stored apart from full ones
+        return key if self.detail_level == 'full' else f"{key}|{self.detail_level}"
+
+    def get(self, digest: bytes, language: str, grammar: str) -> Optional[Tuple]:
+        """(score, total_rules, aligned_rules, UnalignedTable) or None on a miss."""
+        try:
+            with self._lock:
+                row = self._db.execute('SELECT result FROM results WHERE digest=? AND language=? AND config=?',
+                                       (digest, language, self.config_key(grammar))).fetchone()
+            result = pickle.loads(row[0]) if row is not None else None
+        except (sqlite3.Error, pickle.UnpicklingError, EOFError):
+            result = None
+        self.counters['hits' if result is not None else 'misses'] += 1
+        return result
+
+    def put(self, digest: bytes, language: str, grammar: str, result: Tuple):
+        try:
+            blob = pickle.dumps(result, protocol=pickle.HIGHEST_PROTOCOL)
+            with self._lock:
+                self._db.execute('INSERT OR REPLACE INTO results VALUES (?, ?, ?, ?)',
+                                 (digest, language, self.config_key(grammar), blob))
+            self.counters['stores'] += 1
+        except sqlite3.Error:
+            self.counters['store_errors'] += 1
+
+    def close(self):
+        with self._lock:
+            self._db.close()
+
+
+def cache_summary(counters: Counter) -> dict:
+    """Hit-rate block for the final report."""
+    lookups = counters['hits'] + counters['misses']
+    return {
+        'lookups': lookups,
+        'hits': counters['hits'],
+        'misses': counters['misses'],
+        'hit_rate': counters['hits'] / lookups if lookups else 0.0,
+    }
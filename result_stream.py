@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Append-only NDJSON result stream (--result_format ndjson)
+
+Instead of keeping every imperfect file in memory and dumping whole reports
+with json.dump, each per-file result is handed to a background writer thread
+that renders it to one JSON line and writes it through a large buffer,
+optionally zstd-compressed (--stream_compression zstd, needs the zstandard
+package). The analyzer only keeps running counters, so memory stays flat however
+many files are processed. Lines carry a 'record' key:
+
+    header    model, detail level and stream format version
+    file      one imperfect file (language, score, counts, unaligned_rules, ...)
+    language  aggregates of one language (the report's per-language block without files)
+    summary   the report summary, written once when the stream is closed
+
+    python result_stream.py results/multilang/detailed_analysis_gpt2.ndjson.zst --summary
+"""
+
+import io
+import sys
+import json
+import queue
+import argparse
+import threading
+from pathlib import Path
+from typing import Dict, Iterator, Optional
+
+from compact_results import UnalignedTable
+
+STREAM_VERSION = 1
+ZSTD_SUFFIX = '.zst'
+
+
+def _zstd():
+    try:
+        import zstandard  # type: ignore
+        return zstandard
+    except ImportError:
+        return None
+
+
+def stream_path(output_dir, model_name: str, compression: Optional[str] = None) -> Path:
+    """Where the NDJSON stream of one model's run goes."""
+    suffix = '.ndjson' + (ZSTD_SUFFIX if compression == 'zstd' else '')
+    return Path(output_dir) / f"detailed_analysis_{model_name}{suffix}"
+
+
+class ResultStream:
+    """Background NDJSON writer; write() may be called from any thread.
+
+    Records are queued (at most queue_size, so a slow disk throttles the
+    producers instead of growing memory) and rendered, encoded and buffered on
+    the writer thread, which writes buffer_size bytes at a time. An error on the
+    writer thread is raised again by the next write() or close().
+    """
+
+    def __init__(self, path, compression: Optional[str] = None, header: Optional[Dict] = None,
+                 buffer_size: int = 1 << 20, queue_size: int = 1024, level: int = 3):
+        self.path = Path(path)
+        self.path.parent.mkdir(parents=True, exist_ok=True)
+        self.records = 0
+        self.bytes_written = 0
+        self._buffer_size = buffer_size
+        self._queue: "queue.Queue" = queue.Queue(maxsize=queue_size)
+        self._error: Optional[BaseException] = None
+        self._closed = False
+        zstandard = _zstd() if compression == 'zstd' else None
+        if compression == 'zstd' and zstandard is None:
+            raise RuntimeError("zstd compression needs the zstandard package (pip install zstandard)")
+        if compression not in (None, 'zstd'):
+            raise ValueError(f"Unsupported stream compression: {compression}")
+        self._raw = open(self.path, 'wb')
+        self._sink = self._raw
+        if zstandard is not None:
+            self._sink = zstandard.ZstdCompressor(level=level).stream_writer(self._raw)
+        self._thread = threading.Thread(target=self._run, name='result-stream', daemon=True)
+        self._thread.start()
+        self.write(dict({'record': 'header', 'version': STREAM_VERSION}, **(header or {})))
+
+    def write(self, record: Dict):
+        """Queue one record; UnalignedTable values are rendered on the writer thread."""
+        if self._error is not None:
+            raise RuntimeError(f"result stream {self.path} failed") from self._error
+        self._queue.put(record)
+
+    def write_file(self, language: str, file_result: Dict):
+        self.write(dict({'record': 'file', 'language': language}, **file_result))
+
+    def _run(self):
+        buffer = bytearray()
+        while True:
+            record = self._queue.get()
+            if record is None:
+                break
+            if self._error is not None:
+                continue  # keep draining so producers never block on a dead writer
+            try:
+                rules = record.get('unaligned_rules')
+                if isinstance(rules, UnalignedTable):
+                    record = dict(record, unaligned_rules=rules.to_dicts())
+                buffer += json.dumps(record, ensure_ascii=False).encode('utf-8', errors='surrogatepass')
+                buffer += b'\n'
+                self.records += 1
+                if len(buffer) >= self._buffer_size:
+                    self._flush(buffer)
+            except BaseException as e:
+                self._error = e
+        if self._error is None:
+            try:
+                self._flush(buffer)
+            except BaseException as e:
+                self._error = e
+
+    def _flush(self, buffer: bytearray):
+        if buffer:
+            self._sink.write(buffer)
+            self.bytes_written += len(buffer)
+            buffer.clear()
+
+    def close(self):
+        """Write out everything queued and close the file."""
+        if self._closed:
+            return
+        self._closed = True
+        self._queue.put(None)
+        self._thread.join()
+        try:
+            if self._sink is not self._raw:
+                self._sink.close()  # finishes the zstd frame and closes the file
+        finally:
+            if not self._raw.closed:
+                self._raw.close()
+        if self._error is not None:
+            raise RuntimeError(f"result stream {self.path} failed") from self._error
+
+
+def read_stream(path) -> Iterator[Dict]:
+    """Records of an NDJSON result stream, plain or .zst."""
+    path = Path(path)
+    with open(path, 'rb') as raw:
+        if path.suffix == ZSTD_SUFFIX:
+            zstandard = _zstd()
+            if zstandard is None:
+                raise RuntimeError("reading a .zst stream needs the zstandard package (pip install zstandard)")
+            lines = io.TextIOWrapper(zstandard.ZstdDecompressor().stream_reader(raw), encoding='utf-8')
+        else:
+            lines = io.TextIOWrapper(raw, encoding='utf-8')
+        for line in lines:
+            if line.strip():
+                yield json.loads(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Inspect an NDJSON result stream (.ndjson or .ndjson.zst)')
+    parser.add_argument('input', help='Path to the stream')
+    parser.add_argument('--summary', action='store_true', help='Only print the header, language and summary records')
+    args = parser.parse_args()
+
+    files = 0
+    for record in read_stream(args.input):
+        if record.get('record') == 'file':
+            files += 1
+            if args.summary:
+                continue
+        print(json.dumps(record, ensure_ascii=False))
+    if args.summary:
+        print(f"✓ {files} file records")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
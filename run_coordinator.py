@@ -0,0 +1,389 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Coordinator/worker protocol for multi-node sharded runs (--coordinator)
+
+A coordinator owns a run directory (run_manifest.py) and hands its shards out
+over HTTP, so worker nodes need neither the run directory nor a shared
+filesystem for claims. Workers claim a shard, send heartbeats while they
+analyze it, then either write its reports to the shard's report directory on
+shared storage or upload them (--upload_results), and finally post the shard's
+per-language aggregates, which the coordinator checkpoints. A shard whose worker
+stops sending heartbeats for lease_seconds is handed out again. Once every shard
+of a model is done, the coordinator merges the checkpoints into
+summary_<model>.json, exactly as for a local --run_dir run.
+
+    POST /claim      {model, worker}                  -> {shard, ...} | {wait: s} | {done: true}
+    POST /heartbeat  {model, shard, worker}           -> {ok}
+    POST /complete   {model, shard, worker, languages}
+    PUT  /report/<model>/<shard>/<file name>          (body: a report file)
+    GET  /status
+
+With a shared token (--token), POST and PUT requests must carry it in the
+X-Run-Token header; the coordinator answers 401 otherwise. Request bodies are
+capped (MAX_POST_BYTES, MAX_UPLOAD_BYTES) and a larger Content-Length gets 413.
+
+Local shards are sent as absolute file paths, so worker nodes must see the code
+directories at the same path (or analyze a --hf_dataset manifest).
+"""
+
+import hmac
+import json
+import os
+import time
+import threading
+import urllib.error
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+from typing import Dict, List, Optional
+
+from run_manifest import RunManifest, model_key
+
+# How long a worker waits before asking again when every pending shard is leased
+POLL_SECONDS = 5.0
+# Largest request bodies the coordinator reads: protocol messages and uploaded report files
+MAX_POST_BYTES = 16 * 1024 * 1024
+MAX_UPLOAD_BYTES = 1024 * 1024 * 1024
+TOKEN_HEADER = 'X-Run-Token'
+# Where --token defaults from, and how batch_run_stack_v2.py hands it to its analyzer.py workers
+TOKEN_ENV = 'RUN_COORDINATOR_TOKEN'
+
+
+class RunCoordinator:
+    """Shard leases of one manifest for a set of models; the coordinator is their only owner."""
+
+    def __init__(self, manifest: RunManifest, models: List[str], lease_seconds: float = 900):
+        self.manifest = manifest
+        self.models = list(models)
+        self.lease_seconds = lease_seconds
+        self.started = time.time()
+        self.finished = threading.Event()
+        self._lock = threading.Lock()
+        self._leases: Dict[tuple, Dict] = {}   # (model, shard id) -> {'worker', 'seen'}
+        self._shards = {s['id']: s for s in manifest.shards}
+        self._done = {m: {s['id'] for s in manifest.shards if manifest.is_done(m, s)} for m in self.models}
+        self._workers: Dict[str, float] = {}
+        for model in self.models:
+            self._check_finished(model)
+
+    def claim(self, model: str, worker: str) -> Dict:
+        self._check_model(model)
+        now = time.time()
+        with self._lock:
+            self._workers[worker] = now
+            done = self._done[model]
+            waiting = False
+            for shard in self.manifest.shards:
+                if shard['id'] in done:
+                    continue
+                lease = self._leases.get((model, shard['id']))
+                if lease is not None and now - lease['seen'] < self.lease_seconds:
+                    waiting = True
+                    continue
+                self._leases[(model, shard['id'])] = {'worker': worker, 'seen': now}
+                return self._shard_payload(model, shard)
+        return {'wait': POLL_SECONDS} if waiting else {'done': True}
+
+    def _shard_payload(self, model: str, shard: Dict) -> Dict:
+        group = self.manifest.group(shard)
+        payload = {'model': model, 'shard': shard, 'group': group['name'], 'lease_seconds': self.lease_seconds,
+                   'report_dir': str(self.manifest.report_dir(model, shard))}
+        if 'dataset' in group:
+            payload['dataset'] = group['dataset']
+        else:
+            payload['language'] = group['language']
+            payload['code_dir'] = group['code_dir']
+            payload['files'] = [str(p) for p in self.manifest.shard_files(shard)]
+        return payload
+
+    def heartbeat(self, model: str, shard_id: str, worker: str) -> bool:
+        """Refresh a lease; False when the shard was handed to another worker (or is done)."""
+        self._check_model(model)
+        with self._lock:
+            self._workers[worker] = time.time()
+            lease = self._leases.get((model, shard_id))
+            if lease is None or lease['worker'] != worker:
+                return False
+            lease['seen'] = time.time()
+            return True
+
+    def complete(self, model: str, shard_id: str, worker: str, languages: Dict[str, Dict]) -> bool:
+        """Checkpoint a finished shard; the first completion of a shard wins.
+
+        Only the lease holder may complete a shard, unless its lease has expired
+        (or was lost with a coordinator restart), in which case any worker may.
+        """
+        self._check_model(model)
+        shard = self._get_shard(shard_id)
+        with self._lock:
+            if shard_id in self._done[model]:
+                return False
+            lease = self._leases.get((model, shard_id))
+            if lease is not None and lease['worker'] != worker and time.time() - lease['seen'] < self.lease_seconds:
+                return False
+            self.manifest.write_checkpoint(model, shard, languages, worker)
+            self._done[model].add(shard_id)
+            self._leases.pop((model, shard_id), None)
+        self._check_finished(model)
+        return True
+
+    def report_path(self, model: str, shard_id: str, name: str) -> Path:
+        """Where an uploaded report file of a shard is stored (name loses any directory part)."""
+        self._check_model(model)
+        name = Path(name).name
+        if not name or name.startswith('.'):
+            raise ValueError(f"invalid report file name: {name!r}")
+        return self.manifest.report_dir(model, self._get_shard(shard_id)) / name
+
+    def status(self) -> Dict:
+        now = time.time()
+        with self._lock:
+            live = {worker for worker, seen in self._workers.items() if now - seen < self.lease_seconds}
+            return {
+                'shards': len(self.manifest.shards),
+                'models': {m: {'done': len(self._done[m]),
+                               'leased': sum(1 for (lm, _), lease in self._leases.items()
+                                             if lm == m and now - lease['seen'] < self.lease_seconds)}
+                           for m in self.models},
+                'workers': len(live),
+                'elapsed': now - self.started,
+                'finished': self.finished.is_set(),
+            }
+
+    def _check_finished(self, model: str):
+        if len(self._done[model]) < len(self.manifest.shards):
+            return
+        summary_path = self.manifest.run_dir / f"summary_{model_key(model)}.json"
+        if not summary_path.exists():
+            self.manifest.write_summary(model)
+            print(f"📁 All {len(self.manifest.shards)} shards of {model} done; merged results saved to: {summary_path}")
+        if all(len(self._done[m]) == len(self.manifest.shards) for m in self.models):
+            self.finished.set()
+
+    def _check_model(self, model: str):
+        if model not in self._done:
+            raise ValueError(f"model {model!r} is not part of this run (coordinator models: {', '.join(self.models)})")
+
+    def _get_shard(self, shard_id: str) -> Dict:
+        shard = self._shards.get(shard_id)
+        if shard is None:
+            raise ValueError(f"unknown shard {shard_id!r}")
+        return shard
+
+
+class _BodyTooLarge(ValueError):
+    pass
+
+
+class _Handler(BaseHTTPRequestHandler):
+    coordinator: RunCoordinator = None
+    token: Optional[str] = None
+
+    def do_GET(self):
+        if self.path.rstrip('/') == '/status':
+            self._reply(200, self.coordinator.status())
+        else:
+            self._reply(404, {'error': f"no such endpoint: {self.path}"})
+
+    def do_POST(self):
+        c = self.coordinator
+        if not self._authorized():
+            return
+        try:
+            body = json.loads(self._body(MAX_POST_BYTES) or b'{}')
+            if not isinstance(body, dict):
+                raise ValueError("request body must be a JSON object")
+            endpoint = self.path.rstrip('/')
+            if endpoint == '/claim':
+                self._reply(200, c.claim(body['model'], body['worker']))
+            elif endpoint == '/heartbeat':
+                self._reply(200, {'ok': c.heartbeat(body['model'], body['shard'], body['worker'])})
+            elif endpoint == '/complete':
+                self._reply(200, {'ok': c.complete(body['model'], body['shard'], body['worker'], body['languages'])})
+            else:
+                self._reply(404, {'error': f"no such endpoint: {self.path}"})
+        except _BodyTooLarge as e:
+            self._reply(413, {'error': str(e)})
+        except (KeyError, TypeError, ValueError) as e:
+            self._reply(400, {'error': str(e)})
+
+    def do_PUT(self):
+        if not self._authorized():
+            return
+        parts = self.path.strip('/').split('/')
+        if len(parts) != 4 or parts[0] != 'report':
+            self._reply(404, {'error': f"no such endpoint: {self.path}"})
+            return
+        try:
+            length = self._content_length(MAX_UPLOAD_BYTES)
+            model = next((m for m in self.coordinator.models if model_key(m) == parts[1]), parts[1])
+            path = self.coordinator.report_path(model, parts[2], urllib.request.unquote(parts[3]))
+        except _BodyTooLarge as e:
+            self._reply(413, {'error': str(e)})
+            return
+        except ValueError as e:
+            self._reply(400, {'error': str(e)})
+            return
+        path.parent.mkdir(parents=True, exist_ok=True)
+        tmp = path.with_name(f".{path.name}.{os.getpid()}.{threading.get_ident()}.upload")
+        with open(tmp, 'wb') as f:
+            while length > 0:
+                chunk = self.rfile.read(min(length, 1 << 20))
+                if not chunk:
+                    break
+                f.write(chunk)
+                length -= len(chunk)
+        if length > 0:
+            tmp.unlink()
+            self._reply(400, {'error': 'report upload ended before Content-Length bytes'})
+            return
+        tmp.replace(path)
+        self._reply(200, {'ok': True, 'bytes': path.stat().st_size})
+
+    def _authorized(self) -> bool:
+        """Check the shared token of a mutating request; replies 401 (and returns False) when it is wrong."""
+        if self.token is None or hmac.compare_digest(self.headers.get(TOKEN_HEADER, '').encode('utf-8'),
+                                                     self.token.encode('utf-8')):
+            return True
+        self.close_connection = True  # the unread body must not be parsed as the next request
+        self._reply(401, {'error': f"missing or wrong {TOKEN_HEADER} header (see --token)"})
+        return False
+
+    def _content_length(self, limit: int) -> int:
+        try:
+            length = int(self.headers.get('Content-Length') or 0)
+        except ValueError:
+            raise ValueError("invalid Content-Length header") from None
+        if length < 0:
+            raise ValueError("invalid Content-Length header")
+        if length > limit:
+            self.close_connection = True
+            raise _BodyTooLarge(f"request body of {length} bytes exceeds the {limit} byte limit")
+        return length
+
+    def _body(self, limit: int) -> bytes:
+        return self.rfile.read(self._content_length(limit))
+
+    def _reply(self, status: int, data: Dict):
+        body = json.dumps(data).encode('utf-8')
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass  # one line per heartbeat would drown the console
+
+
+def start_server(coordinator: RunCoordinator, host: str = '0.0.0.0', port: int = 8765,
+                 token: Optional[str] = None) -> ThreadingHTTPServer:
+    """Serve coordinator on a background thread; returns the server (call shutdown() to stop it).
+
+    With token, POST and PUT requests must send it in the X-Run-Token header.
+    """
+    handler = type('CoordinatorHandler', (_Handler,), {'coordinator': coordinator, 'token': token or None})
+    server = ThreadingHTTPServer((host, port), handler)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, name='run-coordinator', daemon=True).start()
+    return server
+
+
+class CoordinatorError(RuntimeError):
+    pass
+
+
+class CoordinatorClient:
+    """Worker side of the protocol."""
+
+    def __init__(self, url: str, worker: str, timeout: float = 60, token: Optional[str] = None):
+        self.url = url.rstrip('/')
+        self.worker = worker
+        self.timeout = timeout
+        self.token = token
+
+    def _request(self, method: str, path: str, data: Optional[bytes] = None, content_type: str = 'application/json') -> Dict:
+        headers = {'Content-Type': content_type}
+        if self.token:
+            headers[TOKEN_HEADER] = self.token
+        request = urllib.request.Request(self.url + path, data=data, method=method, headers=headers)
+        try:
+            with urllib.request.urlopen(request, timeout=self.timeout) as response:
+                return json.loads(response.read() or b'{}')
+        except urllib.error.HTTPError as e:
+            try:
+                message = json.loads(e.read()).get('error', e.reason)
+            except ValueError:
+                message = e.reason
+            raise CoordinatorError(f"{method} {path}: {message}") from e
+
+    def _post(self, path: str, data: Dict) -> Dict:
+        return self._request('POST', path, json.dumps(data).encode('utf-8'))
+
+    def status(self) -> Dict:
+        return self._request('GET', '/status')
+
+    def claim(self, model: str) -> Optional["RemoteLease"]:
+        """Block until a shard of model is handed out (a RemoteLease) or every shard is done (None)."""
+        while True:
+            reply = self._post('/claim', {'model': model, 'worker': self.worker})
+            if reply.get('done'):
+                return None
+            if 'wait' in reply:
+                time.sleep(reply['wait'])
+                continue
+            return RemoteLease(self, reply)
+
+    def upload_reports(self, model: str, shard_id: str, report_dir) -> int:
+        """PUT every file of a locally written shard report to the coordinator; returns the bytes sent."""
+        sent = 0
+        for path in sorted(Path(report_dir).rglob('*')):
+            if path.is_file():
+                data = path.read_bytes()
+                self._request('PUT', f"/report/{model_key(model)}/{shard_id}/{urllib.request.quote(path.name)}",
+                              data, 'application/octet-stream')
+                sent += len(data)
+        return sent
+
+
+class RemoteLease:
+    """A shard handed out by the coordinator; a heartbeat thread keeps the lease while it is held."""
+
+    def __init__(self, client: CoordinatorClient, payload: Dict):
+        self.client = client
+        self.payload = payload
+        self.model = payload['model']
+        self.shard = payload['shard']
+        self.lost = False
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._heartbeat, args=(max(1.0, payload['lease_seconds'] / 3),),
+                                        name='remote-lease', daemon=True)
+        self._thread.start()
+
+    def _heartbeat(self, interval: float):
+        while not self._stop.wait(interval):
+            try:
+                if not self.client._post('/heartbeat', {'model': self.model, 'shard': self.shard['id'],
+                                                        'worker': self.client.worker}).get('ok'):
+                    self.lost = True
+            except (OSError, CoordinatorError):
+                pass  # the coordinator may be restarting; the next beat retries
+
+    def complete(self, languages: Dict[str, Dict]) -> bool:
+        """Send the shard's per-language aggregates (without file lists); False if another worker finished it first."""
+        self.release()
+        languages = {lang: {k: v for k, v in block.items() if k != 'files'} for lang, block in languages.items()}
+        return self.client._post('/complete', {'model': self.model, 'shard': self.shard['id'],
+                                               'worker': self.client.worker, 'languages': languages}).get('ok', False)
+
+    def release(self):
+        self._stop.set()
+        if self._thread.is_alive() and self._thread is not threading.current_thread():
+            self._thread.join()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.release()
@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Sharded run manifests with atomic per-shard checkpoints (--run_dir)
+
+A manifest fixes the work of a long run up front: the sorted file list of each
+(code_dir, language) group, or a range of dataset example offsets, cut into
+shards of --shard_size. Workers in any number of processes or on any number of
+nodes sharing the run directory claim shards one at a time, analyze them and
+write a checkpoint atomically. After a preemption, rerunning the same command
+skips finished shards, re-claims shards whose claim went stale, and never walks
+the source tree again.
+
+Layout of a run directory:
+    manifest.json                 groups and shards
+    files/<group>.txt             a group's files, relative to its code_dir, sorted
+    claims/<model>/<shard>.claim  owner of a shard being analyzed; its mtime is the lease heartbeat
+    claims/<model>/.<shard>.claim.takeover.<inode>.<n>  held while one worker replaces a stale claim
+    done/<model>/<shard>.json     checkpoint: the shard's per-language aggregates
+    shards/<model>/<shard>/       the shard's detailed report
+    summary_<model>.json          aggregates merged over all shards, once every shard is done
+"""
+
+import os
+import json
+import uuid
+import time
+import threading
+from pathlib import Path
+from typing import Dict, List, Optional
+
+from sampling import merge_sketches
+
+MANIFEST_VERSION = 1
+MANIFEST_NAME = 'manifest.json'
+
+# Summed when shard checkpoints are merged; the rest of a language block is derived.
+# avg_score is over imperfect files only (the report's file list), so blocks carry
+# their count and score sum: scored_files and score_sum.
+ADDITIVE_FIELDS = ('file_count', 'total_rules', 'total_aligned', 'total_code_size', 'total_analysis_time',
+                   'scored_files', 'score_sum')
+
+
+def _temp_path(path: Path, suffix: str = 'tmp') -> Path:
+    """A hidden sibling of path no other process or node writes (the run directory may be shared storage)."""
+    return path.with_name(f".{path.name}.{uuid.uuid4().hex}.{suffix}")
+
+
+def write_json_atomic(path: Path, data) -> Path:
+    """Write JSON to a temporary file in the same directory, fsync it and rename it over path."""
+    path = Path(path)
+    path.parent.mkdir(parents=True, exist_ok=True)
+    tmp = _temp_path(path)
+    with open(tmp, 'w', encoding='utf-8') as f:
+        json.dump(data, f, ensure_ascii=False, indent=2)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(tmp, path)
+    _fsync_dir(path.parent)
+    return path
+
+
+def _fsync_dir(directory: Path):
+    try:
+        fd = os.open(directory, os.O_RDONLY)
+    except OSError:
+        return
+    try:
+        os.fsync(fd)
+    except OSError:
+        pass
+    finally:
+        os.close(fd)
+
+
+def model_key(model_name: str) -> str:
+    """Directory-safe name of a tokenizer model (e.g. 'bigcode/starcoder' -> 'bigcode__starcoder')."""
+    return model_name.replace('/', '__')
+
+
+def merge_language_results(blocks: List[Dict]) -> Dict:
+    """One language's aggregates from several shards' aggregates (without file lists).
+
+    avg_score is score_sum / scored_files over all shards, as a single run over the
+    same files reports it; checkpoints written before those fields existed fall back
+    to the file-count weighted mean of the shard averages. --sample_rate sketches
+    are merged.
+    """
+    merged = {'language': blocks[0]['language']}
+    for field in ADDITIVE_FIELDS:
+        merged[field] = sum(b.get(field, 0) for b in blocks)
+    if all('scored_files' in b for b in blocks):
+        scored = merged['scored_files']
+        merged['avg_score'] = merged['score_sum'] / scored if scored else 0.0
+    else:
+        files = merged['file_count']
+        merged['avg_score'] = sum(b['avg_score'] * b['file_count'] for b in blocks) / files if files else 0.0
+    merged['overall_alignment'] = merged['total_aligned'] / merged['total_rules'] * 100 if merged['total_rules'] else 0.0
+    merged['avg_processing_speed'] = (merged['total_code_size'] / merged['total_analysis_time']
+                                      if merged['total_analysis_time'] > 0 else 0.0)
+    sample = merge_sketches([b.get('sample') for b in blocks])
+    if sample is not None:
+        merged['sample'] = sample.to_dict()
+    return merged
+
+
+class ShardLease:
+    """A claimed shard; a heartbeat thread refreshes the claim while the lease is held."""
+
+    def __init__(self, manifest: "RunManifest", model_name: str, shard: Dict, owner: str, lease_seconds: float):
+        self.manifest = manifest
+        self.model_name = model_name
+        self.shard = shard
+        self.owner = owner
+        self.path = manifest.claim_path(model_name, shard)
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._heartbeat, args=(max(1.0, lease_seconds / 3),),
+                                        name='shard-lease', daemon=True)
+        self._thread.start()
+
+    def _heartbeat(self, interval: float):
+        while not self._stop.wait(interval):
+            try:
+                os.utime(self.path)
+            except OSError:
+                pass
+
+    def complete(self, languages: Dict[str, Dict]):
+        """Checkpoint the shard's per-language aggregates and drop the claim."""
+        self.manifest.write_checkpoint(self.model_name, self.shard, languages, self.owner)
+        self.release()
+
+    def release(self):
+        self._stop.set()
+        self._thread.join()
+        try:
+            if json.loads(self.path.read_text(encoding='utf-8')).get('owner') == self.owner:
+                self.path.unlink()
+        except (OSError, ValueError):
+            pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.release()
+
+
+class RunManifest:
+    """Groups and shards of a run directory, and the claims and checkpoints of its workers."""
+
+    def __init__(self, run_dir, data: Dict):
+        self.run_dir = Path(run_dir)
+        self.data = data
+        self.groups: List[Dict] = data['groups']
+        self.shards: List[Dict] = data['shards']
+        self._files: Dict[int, List[str]] = {}
+
+    @staticmethod
+    def exists(run_dir) -> bool:
+        return (Path(run_dir) / MANIFEST_NAME).exists()
+
+    @classmethod
+    def load(cls, run_dir) -> "RunManifest":
+        with open(Path(run_dir) / MANIFEST_NAME, 'r', encoding='utf-8') as f:
+            data = json.load(f)
+        if data.get('version') != MANIFEST_VERSION:
+            raise ValueError(f"{run_dir}: unsupported manifest version {data.get('version')}")
+        return cls(run_dir, data)
+
+    @classmethod
+    def create(cls, run_dir, groups: List[Dict], shard_size: int) -> "RunManifest":
+        """Write a manifest for groups, or load the one another worker published first.
+
+        A local group is {'name', 'code_dir', 'language', 'files': [relative paths]};
+        a dataset group is {'name', 'dataset': {...analyze_hf_dataset arguments},
+        'example_count': n}. Groups without files or examples are dropped.
+        """
+        run_dir = Path(run_dir)
+        shard_size = max(1, int(shard_size))
+        entries, shards = [], []
+        for group in groups:
+            group = dict(group)
+            files = group.pop('files', None)
+            if files is not None:
+                files = sorted(files)
+                group['file_count'] = len(files)
+                group['file_list'] = f"files/{len(entries)}.txt"
+                list_path = run_dir / group['file_list']
+                list_path.parent.mkdir(parents=True, exist_ok=True)
+                tmp = _temp_path(list_path)
+                tmp.write_text(''.join(f"{name}\n" for name in files), encoding='utf-8')
+                os.replace(tmp, list_path)
+            count = group['file_count'] if files is not None else int(group.get('example_count') or 0)
+            if not count:
+                continue
+            index = len(entries)
+            entries.append(group)
+            for start in range(0, count, shard_size):
+                shards.append({'id': f"{len(shards):06d}", 'group': index, 'start': start,
+                               'count': min(shard_size, count - start)})
+        data = {'version': MANIFEST_VERSION, 'created': time.time(), 'shard_size': shard_size,
+                'groups': entries, 'shards': shards}
+
+        # Publish with link(), which fails if a concurrent worker already published one
+        manifest_path = run_dir / MANIFEST_NAME
+        tmp = write_json_atomic(_temp_path(run_dir / MANIFEST_NAME, 'new'), data)
+        try:
+            os.link(tmp, manifest_path)
+            _fsync_dir(run_dir)
+        except FileExistsError:
+            return cls.load(run_dir)
+        finally:
+            tmp.unlink()
+        return cls(run_dir, data)
+
+    def group(self, shard: Dict) -> Dict:
+        return self.groups[shard['group']]
+
+    def shard_files(self, shard: Dict) -> List[Path]:
+        """Absolute paths of a local shard's files."""
+        index = shard['group']
+        names = self._files.get(index)
+        if names is None:
+            text = (self.run_dir / self.groups[index]['file_list']).read_text(encoding='utf-8')
+            names = self._files[index] = text.splitlines()
+        base = Path(self.groups[index]['code_dir'])
+        return [base / name for name in names[shard['start']:shard['start'] + shard['count']]]
+
+    def claim_path(self, model_name: str, shard: Dict) -> Path:
+        return self.run_dir / 'claims' / model_key(model_name) / f"{shard['id']}.claim"
+
+    def checkpoint_path(self, model_name: str, shard: Dict) -> Path:
+        return self.run_dir / 'done' / model_key(model_name) / f"{shard['id']}.json"
+
+    def report_dir(self, model_name: str, shard: Dict) -> Path:
+        return self.run_dir / 'shards' / model_key(model_name) / shard['id']
+
+    def is_done(self, model_name: str, shard: Dict) -> bool:
+        return self.checkpoint_path(model_name, shard).exists()
+
+    def pending(self, model_name: str) -> List[Dict]:
+        return [s for s in self.shards if not self.is_done(model_name, s)]
+
+    def claim_next(self, model_name: str, owner: str, lease_seconds: float = 900) -> Optional[ShardLease]:
+        """Claim the first shard that is neither done nor held under a live lease (None when there is none).
+
+        A claim is live while its file was touched less than lease_seconds ago; a
+        stale one (its worker died) is taken over by exactly one worker (see _take_over).
+        """
+        for shard in self.shards:
+            if self.is_done(model_name, shard):
+                continue
+            path = self.claim_path(model_name, shard)
+            path.parent.mkdir(parents=True, exist_ok=True)
+            claim = json.dumps({'owner': owner, 'claimed': time.time()})
+            try:
+                fd = os.open(path, os.O_CREAT | os.O_EXCL | os.O_WRONLY, 0o644)
+            except FileExistsError:
+                if not self._take_over(path, claim, lease_seconds):
+                    continue
+            else:
+                with os.fdopen(fd, 'w', encoding='utf-8') as f:
+                    f.write(claim)
+            lease = ShardLease(self, model_name, shard, owner, lease_seconds)
+            if self.is_done(model_name, shard):
+                lease.release()  # finished by a worker that held it before us
+                continue
+            return lease
+        return None
+
+    @staticmethod
+    def _take_over(path: Path, claim: str, lease_seconds: float) -> bool:
+        """Replace the claim at path with claim if it is stale; True for the one worker that does.
+
+        Workers that find the same stale claim race for an O_EXCL marker named after
+        its inode, and the winner replaces it only if path still is that stale file.
+        Whoever comes later finds a new inode or a fresh mtime. A marker older than
+        the lease belongs to a worker that died mid-takeover; the next one (.1, .2,
+        ...) is tried then.
+        """
+        try:
+            stale = path.stat()
+        except FileNotFoundError:
+            return False  # released just now: done, or free on the next pass
+        if time.time() - stale.st_mtime < lease_seconds:
+            return False
+        for attempt in range(16):
+            marker = path.with_name(f".{path.name}.takeover.{stale.st_ino}.{attempt}")
+            try:
+                fd = os.open(marker, os.O_CREAT | os.O_EXCL | os.O_WRONLY, 0o644)
+            except FileExistsError:
+                try:
+                    if time.time() - marker.stat().st_mtime < lease_seconds:
+                        return False  # another worker is taking it over
+                except FileNotFoundError:
+                    return False  # taken over just now
+                continue
+            os.close(fd)
+            try:
+                current = path.stat()
+                if current.st_ino != stale.st_ino or time.time() - current.st_mtime < lease_seconds:
+                    return False
+                tmp = _temp_path(path)
+                tmp.write_text(claim, encoding='utf-8')
+                os.replace(tmp, path)
+                return True
+            except OSError:
+                return False
+            finally:
+                try:
+                    marker.unlink()
+                except OSError:
+                    pass
+        return False
+
+    def write_checkpoint(self, model_name: str, shard: Dict, languages: Dict[str, Dict], owner: str):
+        write_json_atomic(self.checkpoint_path(model_name, shard), {
+            'shard': shard['id'],
+            'group': self.group(shard)['name'],
+            'model': model_name,
+            'owner': owner,
+            'completed': time.time(),
+            'report_dir': str(self.report_dir(model_name, shard)),
+            'languages': {lang: {k: v for k, v in block.items() if k != 'files'} for lang, block in languages.items()},
+        })
+
+    def merge(self, model_name: str) -> Dict:
+        """Aggregates of every checkpointed shard, per group and language."""
+        per_group: Dict[str, Dict[str, List[Dict]]] = {}
+        done = 0
+        for shard in self.shards:
+            try:
+                with open(self.checkpoint_path(model_name, shard), 'r', encoding='utf-8') as f:
+                    checkpoint = json.load(f)
+            except FileNotFoundError:
+                continue
+            done += 1
+            bucket = per_group.setdefault(self.group(shard)['name'], {})
+            for lang, block in checkpoint['languages'].items():
+                bucket.setdefault(lang, []).append(block)
+        groups = {name: {lang: merge_language_results(blocks) for lang, blocks in langs.items()}
+                  for name, langs in per_group.items()}
+        blocks = [block for langs in groups.values() for block in langs.values()]
+        summary = {
+            'total_files': sum(b['file_count'] for b in blocks),
+            'total_rules': sum(b['total_rules'] for b in blocks),
+            'total_aligned': sum(b['total_aligned'] for b in blocks),
+            'total_code_size': sum(b['total_code_size'] for b in blocks),
+        }
+        sampled: Dict[str, List[Dict]] = {}
+        for block in blocks:
+            if block.get('sample'):
+                sampled.setdefault(block['language'], []).append(block['sample'])
+        if sampled:
+            overall = merge_sketches([state for states in sampled.values() for state in states]).estimate()
+            del overall['node_types']  # names are per grammar
+            summary['sample'] = {'overall': overall,
+                                 'languages': {lang: merge_sketches(states).estimate() for lang, states in sorted(sampled.items())}}
+        return {
+            'model': model_name,
+            'shards': {'total': len(self.shards), 'done': done},
+            'summary': summary,
+            'groups': groups,
+        }
+
+    def write_summary(self, model_name: str) -> Path:
+        return write_json_atomic(self.run_dir / f"summary_{model_key(model_name)}.json", self.merge(model_name))
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Deterministic file sampling and mergeable sketches for approximate statistics
+
+--sample_rate R analyzes about a fraction R of the files (or dataset
+examples). A file is kept when a keyed hash of its path relative to the code
+directory (an example's id) falls below R, so the same files are picked on
+every run, machine and worker, and a rerun after a tokenizer change re-scores
+the same subsample. Parsing and tokenizing are per file, so sampling files is
+what saves compute; sampling rules within a file would save only the scoring.
+
+Rules of one file are not independent, so the sample is a cluster sample and
+the corpus alignment rate (aligned / distinct rules) is estimated with the
+ratio estimator over files. Its 95% confidence interval uses the variance of
+the per-file residuals, with the finite population correction for the files
+seen. Node type rates use the same estimator on each type's per-file counts.
+A Sketch holds the sums these need, plus a histogram of file scores for
+quantiles. Sketches only add up, so worker results, shards and separate runs
+merge exactly (merge, from_dict) before anything is estimated.
+"""
+
+import math
+import hashlib
+import threading
+from typing import Dict, List, Optional
+
+# Score histogram bins: 0.5 points wide over 0..100 (quantiles are within 0.25 points)
+SCORE_BINS = 201
+Z_95 = 1.959964
+
+
+def sample_hash(key: str, seed: int = 0) -> float:
+    """Uniform value in [0, 1) for key; the same for every process and run with the same seed."""
+    digest = hashlib.blake2b(key.encode('utf-8', errors='surrogatepass'), digest_size=8,
+                             key=str(seed).encode('ascii')).digest()
+    return int.from_bytes(digest, 'big') / 2 ** 64
+
+
+def keep_sample(key: str, rate: float, seed: int = 0) -> bool:
+    return rate >= 1 or sample_hash(key, seed) < rate
+
+
+def _ratio_interval(n: int, population: int, sums: List[float]) -> Optional[Dict]:
+    """Ratio estimate sum(y) / sum(x) of n sampled clusters out of population, with its 95% interval."""
+    sx, sy, sxx, syy, sxy = sums
+    if sx <= 0:
+        return None
+    ratio = sy / sx
+    estimate = {'estimate': ratio * 100, 'ci95': None}
+    if n >= 2:
+        residual = max(0.0, syy - 2 * ratio * sxy + ratio * ratio * sxx) / (n - 1)
+        fpc = max(0.0, 1 - n / population) if population else 1.0
+        half = Z_95 * math.sqrt(fpc * residual * n) / sx
+        estimate['ci95'] = [max(0.0, ratio - half) * 100, min(1.0, ratio + half) * 100]
+    return estimate
+
+
+class Sketch:
+    """Additive per-language sums over sampled files: rules (x) and aligned rules (y), overall and per node type."""
+
+    def __init__(self, rate: float = 1.0, seed: int = 0):
+        self.rate = rate
+        self.seed = seed
+        self.population = 0  # files (examples) the sample was drawn from
+        self.files = 0
+        self.sums = [0.0] * 5  # sum x, sum y, sum x^2, sum y^2, sum xy
+        self.scores = [0] * SCORE_BINS
+        self.node_types: Dict[str, List[float]] = {}
+        self._lock = threading.Lock()
+
+    @staticmethod
+    def _add(sums: List[float], x: float, y: float):
+        sums[0] += x
+        sums[1] += y
+        sums[2] += x * x
+        sums[3] += y * y
+        sums[4] += x * y
+
+    def add(self, score: float, rules: int, aligned: int, type_counts: Optional[Dict] = None):
+        """Count one sampled file: its score, distinct rules and aligned ones, and its per-type counts."""
+        with self._lock:
+            self.files += 1
+            self._add(self.sums, rules, aligned)
+            self.scores[min(SCORE_BINS - 1, max(0, int(score * 2)))] += 1
+            for name, (n, n_aligned) in (type_counts or {}).items():
+                sums = self.node_types.get(name)
+                if sums is None:
+                    sums = self.node_types[name] = [0.0] * 5
+                self._add(sums, n, n_aligned)
+
+    def merge(self, other: 'Sketch') -> 'Sketch':
+        with self._lock:
+            self.population += other.population
+            self.files += other.files
+            self.sums = [a + b for a, b in zip(self.sums, other.sums)]
+            self.scores = [a + b for a, b in zip(self.scores, other.scores)]
+            for name, sums in other.node_types.items():
+                mine = self.node_types.setdefault(name, [0.0] * 5)
+                for i, value in enumerate(sums):
+                    mine[i] += value
+        return self
+
+    def to_dict(self) -> Dict:
+        with self._lock:
+            return {'rate': self.rate, 'seed': self.seed, 'population': self.population, 'files': self.files,
+                    'sums': list(self.sums), 'scores': list(self.scores),
+                    'node_types': {name: list(sums) for name, sums in self.node_types.items()}}
+
+    @classmethod
+    def from_dict(cls, data: Dict) -> 'Sketch':
+        sketch = cls(data.get('rate', 1.0), data.get('seed', 0))
+        sketch.population = data.get('population', 0)
+        sketch.files = data.get('files', 0)
+        sketch.sums = list(data.get('sums', sketch.sums))
+        sketch.scores = list(data.get('scores', sketch.scores))
+        sketch.node_types = {name: list(sums) for name, sums in data.get('node_types', {}).items()}
+        return sketch
+
+    def score_quantile(self, q: float) -> Optional[float]:
+        total = sum(self.scores)
+        if not total:
+            return None
+        rank, seen = q * total, 0
+        for i, count in enumerate(self.scores):
+            seen += count
+            if count and seen >= rank:
+                return min(100.0, i / 2 + 0.25)
+        return 100.0
+
+    def estimate(self, type_ids: Optional[Dict[str, int]] = None) -> Dict:
+        """Estimates of the corpus the sample was drawn from.
+
+        Node type rates are keyed by name, or with type_ids a list by id (None where a type has no rules).
+        """
+        n, population = self.files, max(self.population, self.files)
+        report = {
+            'rate': self.rate,
+            'files_seen': population,
+            'files_sampled': n,
+            'alignment': _ratio_interval(n, population, self.sums),
+            'score_quantiles': {f"p{int(q * 100)}": self.score_quantile(q) for q in (0.1, 0.5, 0.9)},
+        }
+        if n:
+            sx, _, sxx = self.sums[0], self.sums[1], self.sums[2]
+            total = {'estimate': population * sx / n, 'ci95': None}
+            if n >= 2:
+                variance = max(0.0, sxx - sx * sx / n) / (n - 1)
+                half = Z_95 * population * math.sqrt(max(0.0, 1 - n / population) * variance / n)
+                total['ci95'] = [max(0.0, total['estimate'] - half), total['estimate'] + half]
+            report['total_rules'] = total
+        types = {name: _ratio_interval(n, population, sums) for name, sums in sorted(self.node_types.items())}
+        if type_ids is None:
+            report['node_types'] = types
+        else:
+            by_id: List[Optional[Dict]] = [None] * (max(type_ids.values(), default=-1) + 1)
+            for name, estimate in types.items():
+                if name in type_ids:
+                    by_id[type_ids[name]] = estimate
+            report['node_types'] = by_id
+        return report
+
+
+def merge_sketches(states: List[Dict]) -> Optional[Sketch]:
+    """One Sketch from the to_dict() states of several (e.g. shards' language blocks); None without any."""
+    merged = None
+    for state in states:
+        if not state:
+            continue
+        sketch = Sketch.from_dict(state)
+        merged = sketch if merged is None else merged.merge(sketch)
+    return merged
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Per-stage timers for the analysis hot path
+
+analysis_time covers a whole file; these timers split it into STAGES: reading
+the source, parsing, the rule walk, tokenization, the UTF-8 offset maps, and
+scoring (dedup is the native core's sort of rules into key groups, see
+ac_context_stage_times; the Python loop counts it under score). Every thread
+has a StageClock that the analyzer laps with time.monotonic_ns() as a file
+moves through the stages, and take() hands the file's times to its result as
+'stage_times'. Results are how worker processes report back anyway, so the
+per-language breakdown in the summary is a sum over results wherever they
+were analyzed.
+
+With a TraceRecorder every lap is also a Chrome trace event (open the file in
+https://ui.perfetto.dev or chrome://tracing). Worker processes send their
+events back with their results, and CLOCK_MONOTONIC is shared by the
+processes of one machine, so they line up on one timeline.
+"""
+
+import os
+import json
+import time
+import threading
+from pathlib import Path
+from typing import Dict, List, Optional
+
+STAGES = ('read', 'parse', 'walk', 'tokenize', 'offset_maps', 'dedup', 'score')
+
+# Events kept by a TraceRecorder; later ones are counted as dropped
+MAX_TRACE_EVENTS = 2_000_000
+
+
+class StageClock:
+    """Stage times (ns) of the file the owning thread is working on, and their trace events."""
+
+    __slots__ = ('ns', 'events', 'recorder', 'tid')
+
+    def __init__(self, recorder: Optional['TraceRecorder'] = None):
+        self.ns: Dict[str, int] = {}
+        self.recorder = recorder
+        self.events: Optional[List] = [] if recorder is not None else None
+        self.tid = threading.get_native_id()
+
+    def lap(self, stage: str, start_ns: int) -> int:
+        """Count start_ns..now under stage; returns now, the start of the next lap."""
+        end = time.monotonic_ns()
+        self.record(stage, start_ns, end - start_ns)
+        return end
+
+    def record(self, stage: str, start_ns: int, duration_ns: int):
+        self.ns[stage] = self.ns.get(stage, 0) + duration_ns
+        if self.events is not None:
+            self.events.append((stage, start_ns, duration_ns))
+
+    def merge(self, ns: Dict[str, int]):
+        """Add stage times measured elsewhere (e.g. a parse shared by several models)."""
+        for stage, value in ns.items():
+            self.ns[stage] = self.ns.get(stage, 0) + value
+
+    def take(self, label=None) -> Dict[str, int]:
+        """The stage times so far, resetting the clock; trace events go to the recorder tagged with label."""
+        ns, self.ns = self.ns, {}
+        if self.events:
+            self.recorder.add(self.events, self.tid, None if label is None else str(label))
+            self.events = []
+        return ns
+
+
+def stage_seconds(ns: Dict[str, int]) -> Dict[str, float]:
+    """A file's 'stage_times': seconds per stage, in STAGES order."""
+    return {stage: ns[stage] / 1e9 for stage in STAGES if stage in ns}
+
+
+def stage_breakdown(seconds: Dict[str, float], files: int) -> Dict:
+    """Summary entry of one language: files, seconds per stage and each stage's share of their sum."""
+    total = sum(seconds.values())
+    return {
+        'files': files,
+        'seconds': {stage: seconds[stage] for stage in STAGES if stage in seconds},
+        'share': {stage: seconds[stage] / total for stage in STAGES if stage in seconds} if total > 0 else {},
+    }
+
+
+class TraceRecorder:
+    """Thread-safe buffer of complete ('X') trace events, written as a Chrome trace JSON file."""
+
+    def __init__(self, max_events: int = MAX_TRACE_EVENTS):
+        self.pid = os.getpid()
+        self.max_events = max_events
+        self.dropped = 0
+        self._events: List = []
+        self._lock = threading.Lock()
+
+    def add(self, events, tid: int, label: Optional[str]):
+        self.extend([(name, start, duration, self.pid, tid, label) for name, start, duration in events])
+
+    def extend(self, events: List):
+        """Add events of drain(), e.g. sent back by a worker process."""
+        with self._lock:
+            room = self.max_events - len(self._events)
+            if room < len(events):
+                self.dropped += len(events) - max(0, room)
+                events = events[:max(0, room)]
+            self._events.extend(events)
+
+    def drain(self) -> List:
+        with self._lock:
+            events, self._events = self._events, []
+        return events
+
+    def write(self, path) -> int:
+        """Write the events (timestamps in microseconds) to path; returns how many were written."""
+        events = self.drain()
+        trace = []
+        for name, start, duration, pid, tid, label in events:
+            event = {'name': name, 'cat': 'stage', 'ph': 'X', 'ts': start / 1000, 'dur': duration / 1000,
+                     'pid': pid, 'tid': tid}
+            if label is not None:
+                event['args'] = {'file': label}
+            trace.append(event)
+        path = Path(path)
+        path.parent.mkdir(parents=True, exist_ok=True)
+        with open(path, 'w', encoding='utf-8') as f:
+            json.dump({'traceEvents': trace, 'displayTimeUnit': 'ms',
+                       'otherData': {'dropped_events': self.dropped}}, f, ensure_ascii=False)
+        return len(trace)
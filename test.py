@@ -228,6 +228,421 @@ def test_code_samples():
     print(f"\nFound {found_files}/{len(expected_dirs)} language directories, {total_files} sample files in total")
     return found_files > 0
 
+def test_native_alignment_core():
+    """Check the native alignment core against the Python loop on the C/C++ golden samples"""
+    print("\n" + "=" * 60)
+    print("Native Alignment Core Parity Test")
+    print("=" * 60)
+
+    try:
+        from analyzer import QuickMultiLanguageAnalyzer
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    golden_inputs = {
+        'cpp': Path('./code_samples/cpp/example.cpp'),
+        'c': Path('./code_samples/c/example.c'),
+    }
+
+    analyzer = QuickMultiLanguageAnalyzer(model_name='gpt2', allowed_languages=list(golden_inputs))
+    native_core = analyzer.native_core
+    native_languages = analyzer.native_languages
+    if native_core is None:
+        print("⚠️  build/alignment_core.so not found, skipping (run: python build_native.py)")
+        return True
+
+    passed = True
+    for language, sample_path in golden_inputs.items():
+        if language not in analyzer.parsers or not sample_path.exists():
+            print(f"⚠️  {language}: parser or {sample_path} unavailable, skipping")
+            continue
+        code = sample_path.read_text(encoding='utf-8')
+
+        if language in native_languages:
+            code_bytes = code.encode('utf-8')
+            native_rules = native_core.extract_rules(native_languages[language], code_bytes)
+            python_rules = analyzer._extract_rule_spans(analyzer.parsers[language].parse(code_bytes))
+            as_tuples = lambda r: [(r.type_name(i), r.starts[i], r.ends[i]) for i in range(r.count)]
+            if as_tuples(native_rules) != as_tuples(python_rules):
+                print(f"❌ {sample_path.name}: native tree walker rules differ from the Python walker")
+                passed = False
+
+        code_bytes = code.encode('utf-8')
+        native_maps = native_core.offset_maps(code_bytes, len(code), True)
+        analyzer.native_core = None
+        python_maps = analyzer._offset_maps(code, code_bytes, True)
+        analyzer.native_core = native_core
+        if list(native_maps[0]) != list(python_maps[0]) or list(native_maps[1]) != list(python_maps[1]):
+            print(f"❌ {sample_path.name}: native UTF-8 offset maps differ from Python")
+            passed = False
+
+        analyzer.native_core, analyzer.native_languages = None, {}
+        expected_score, expected_details = analyzer.calculate_rule_level_alignment(code, language)
+        analyzer.native_core, analyzer.native_languages = native_core, native_languages
+        score, details = analyzer.calculate_rule_level_alignment(code, language)
+        summary_score, total_rules, aligned_rules, unaligned = analyzer.calculate_rule_level_summary(code, language)
+
+        expected_unaligned = {k: v for k, v in expected_details.items() if not v['fully_aligned']}
+        matches = (
+            score == expected_score and summary_score == expected_score
+            and list(details.items()) == list(expected_details.items())
+            and total_rules == len(expected_details)
+            and aligned_rules == len(expected_details) - len(expected_unaligned)
+            and list(unaligned.items()) == list(expected_unaligned.items())
+        )
+
+        # A rule budget stops the native and the Python loop at the same rule
+        analyzer.rule_budget = 50
+        analyzer.native_core, analyzer.native_languages = None, {}
+        expected_budgeted = analyzer.calculate_rule_level_summary(code, language)[:3]
+        analyzer.native_core, analyzer.native_languages = native_core, native_languages
+        budgeted = analyzer.calculate_rule_level_summary(code, language)[:3]
+        analyzer.rule_budget = 0
+        if budgeted != expected_budgeted or analyzer._thread_state.limit_hit != 'rule_budget':
+            print(f"❌ {sample_path.name}: --rule_budget results differ between native and Python")
+            matches = False
+        # Per-node-type counts agree too, and add up to the distinct rule counters
+        analyzer.native_core, analyzer.native_languages = None, {}
+        expected_types = analyzer.calculate_rule_level_compact(code, language)[3].type_counts
+        analyzer.native_core, analyzer.native_languages = native_core, native_languages
+        type_counts = analyzer.calculate_rule_level_compact(code, language)[3].type_counts
+        if (type_counts != expected_types or sum(n for n, _ in type_counts.values()) != total_rules
+                or sum(a for _, a in type_counts.values()) != aligned_rules):
+            print(f"❌ {sample_path.name}: per-node-type counts differ between native and Python")
+            matches = False
+        # Every native call above was timed, and the stage timers start over for each file
+        analyzer._take_stage_times()
+        analyzer.calculate_rule_level_summary(code, language)
+        stage_times = analyzer._take_stage_times()
+        if native_core.stage_times().score_ns == 0 or not {'tokenize', 'dedup', 'score'} <= set(stage_times):
+            print(f"❌ {sample_path.name}: stage timers missing ({sorted(stage_times)})")
+            matches = False
+        if matches:
+            print(f"✓ {sample_path.name}: score {score:.2f}%, {total_rules} rules, {len(unaligned)} unaligned")
+        else:
+            print(f"❌ {sample_path.name}: native {score:.4f}% vs Python {expected_score:.4f}%")
+            passed = False
+
+    return passed
+
+def test_compact_results():
+    """Check that the compact .acr report renders back to the same JSON as the per-rule dicts"""
+    print("\n" + "=" * 60)
+    print("Compact Result Format Test")
+    print("=" * 60)
+
+    try:
+        import json
+        import tempfile
+        from analyzer import QuickMultiLanguageAnalyzer
+        from compact_results import CompactReport, write_compact_report
+        from result_stream import ResultStream, read_stream
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    sample_path = Path('./code_samples/cpp/example.cpp')
+    analyzer = QuickMultiLanguageAnalyzer(model_name='gpt2', allowed_languages=['cpp'])
+    if 'cpp' not in analyzer.parsers or not sample_path.exists():
+        print("⚠️  cpp parser or sample unavailable, skipping")
+        return True
+    code = sample_path.read_text(encoding='utf-8')
+
+    _, _, _, details = analyzer.calculate_rule_level_summary(code, 'cpp')
+    score, rule_count, aligned_count, table = analyzer.calculate_rule_level_compact(code, 'cpp')
+    rows = table.to_dicts()
+    expected_rows = [dict({'rule_key': rk}, **{k: v for k, v in rd.items() if k not in ('start_utf16', 'end_utf16')})
+                     for rk, rd in details.items()]
+    if [sorted(r.items()) for r in rows] != [sorted(r.items()) for r in expected_rows]:
+        print("❌ UnalignedTable rows differ from the unaligned details dicts")
+        return False
+
+    # Reduced --detail_level tables keep the counts; spans rows are a subset of the full entries
+    for detail in ('score', 'spans'):
+        analyzer.detail_level = detail
+        reduced_score, reduced_rules, reduced_aligned, reduced = analyzer.calculate_rule_level_compact(code, 'cpp')
+        expected_reduced = [] if detail == 'score' else [{k: r[k] for k in reduced_row} for r, reduced_row in zip(rows, reduced.to_dicts())]
+        if (reduced_score, reduced_rules, reduced_aligned) != (score, rule_count, aligned_count) or reduced.to_dicts() != expected_reduced:
+            print(f"❌ --detail_level {detail} result differs from the full one")
+            return False
+    analyzer.detail_level = 'full'
+
+    file_result = {'file': sample_path.name, 'path': str(sample_path), 'score': score, 'total_rules': rule_count,
+                   'aligned_rules': aligned_count, 'unaligned_rules': table, 'code_size': len(code),
+                   'analysis_time': 0.5, 'processing_speed': len(code) / 0.5, 'is_perfect': len(table) == 0}
+    detailed_results = {'model': 'gpt2', 'summary': {'total_files': 1},
+                        'languages': {'cpp': {'language': 'cpp', 'file_count': 1, 'files': [file_result]}}, 'rankings': []}
+    with tempfile.TemporaryDirectory() as tmp:
+        compact_file = Path(tmp) / 'report.acr'
+        write_compact_report(compact_file, detailed_results)
+        with CompactReport(compact_file) as report:
+            rendered = report.render()
+        expected = dict(detailed_results, languages={'cpp': dict(detailed_results['languages']['cpp'],
+                                                                 files=[dict(file_result, unaligned_rules=rows)])})
+        if json.dumps(rendered, ensure_ascii=False) != json.dumps(expected, ensure_ascii=False):
+            print("❌ Rendered .acr report differs from the JSON report")
+            return False
+        stream = ResultStream(Path(tmp) / 'report.ndjson', header={'model': 'gpt2'})
+        stream.write_file('cpp', file_result)
+        stream.close()
+        streamed = [r for r in read_stream(stream.path) if r['record'] == 'file']
+        if streamed != [dict({'record': 'file', 'language': 'cpp'}, **dict(file_result, unaligned_rules=rows))]:
+            print("❌ NDJSON result stream differs from the JSON report")
+            return False
+        json_size = len(json.dumps(expected, ensure_ascii=False, indent=2).encode('utf-8'))
+        print(f"✓ {len(table)} unaligned rules round-trip; .acr {compact_file.stat().st_size} bytes vs JSON {json_size} bytes")
+    return True
+
+def test_incremental_analysis():
+    """Check that re-analyzing edited revisions incrementally matches analyzing them from scratch"""
+    print("\n" + "=" * 60)
+    print("Incremental Re-analysis Test")
+    print("=" * 60)
+
+    try:
+        from analyzer import QuickMultiLanguageAnalyzer
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    sample_path = Path('./code_samples/cpp/example.cpp')
+    analyzer = QuickMultiLanguageAnalyzer(model_name='gpt2', allowed_languages=['cpp'])
+    if 'cpp' not in analyzer.parsers or not sample_path.exists():
+        print("⚠️  cpp parser or sample unavailable, skipping")
+        return True
+    lines = sample_path.read_text(encoding='utf-8').split('\n')
+    middle = len(lines) // 2
+    revisions = [
+        lines,
+        lines[:middle] + ['int added_function(int x) { return x * 2 + 1; }'] + lines[middle:],
+        lines[:3] + [lines[3] + ' // edited'] + lines[4:middle] + lines[middle + 5:],
+    ]
+    for i, revision in enumerate(revisions):
+        code = '\n'.join(revision)
+        incremental = analyzer.calculate_rule_level_incremental('example.cpp', code, 'cpp')
+        full = analyzer.calculate_rule_level_compact(code, 'cpp')
+        if (incremental[:3] != full[:3] or incremental[3].to_dicts() != full[3].to_dicts()
+                or incremental[3].type_counts != full[3].type_counts):
+            print(f"❌ Revision {i}: incremental result differs from a full analysis")
+            return False
+    counters = analyzer.incremental_counters
+    print(f"✓ {len(revisions)} revisions match; {counters['rescored_rules']} rules rescored, "
+          f"{counters['reused_rules']} reused")
+    return True
+
+def test_tokenizer_backends():
+    """Check the native byte-level BPE against the Python reference and the offset_mapping path"""
+    print("\n" + "=" * 60)
+    print("Tokenizer Backend Parity Test")
+    print("=" * 60)
+
+    try:
+        from analyzer import QuickMultiLanguageAnalyzer
+        from tokenizer_backends import OffsetMappingBackend, byte_level_spec, reference_boundaries
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    analyzer = QuickMultiLanguageAnalyzer(model_name='gpt2', allowed_languages=['cpp', 'c', 'python'],
+                                          tokenizer_backend='native_bpe')
+    if analyzer.native_core is None:
+        print("⚠️  build/alignment_core.so not found, skipping (run: python build_native.py)")
+        return True
+
+    samples = [path for path in sorted(Path('./code_samples').rglob('*.*')) if path.is_file()]
+    texts = [path.read_text(encoding='utf-8', errors='replace') for path in samples]
+    texts.append("naïve = 'it\u2019s' # 日本語  \n\n\t\tvalue_٣ = 3.14 😀😀   ")
+
+    # A hand-made merge list that hits indentation, identifiers and multi-byte characters
+    merges = [(b' ', b' '), (b'  ', b'  '), (b'i', b'n'), (b' ', b'in'), (b'in', b't'), (b'r', b'e'),
+              (b'e', b'r'), (b' ', b'r'), (b' r', b'e'), (b'\n', b' '), (b'\xc3', b'\xaf'), (b'\xe6', b'\x97'),
+              (b'\xe6\x97', b'\xa5'), (b'\xf0', b'\x9f'), (b'in', b'in')]
+    bpe = analyzer.native_core.load_bpe(merges)
+    passed = True
+    for text in texts:
+        starts, ends = analyzer.native_core.bpe_encode(bpe, text.encode('utf-8'))
+        if list(zip(starts, ends)) != reference_boundaries(text, merges):
+            print(f"❌ native BPE spans differ from the Python reference ({text[:30]!r}...)")
+            passed = False
+            break
+    else:
+        print(f"✓ native BPE matches the Python reference on {len(texts)} texts ({bpe.merge_count} merges)")
+    bpe.close()
+
+    # With a real byte-level tokenizer, both backends give the same token byte spans and scores
+    spec, reason = byte_level_spec(analyzer.tokenizer)
+    if spec is None:
+        print(f"⚠️  offset_mapping parity skipped: {reason}")
+        return passed
+    native_backend, hf_backend = analyzer.tokenizer_backend, OffsetMappingBackend(analyzer.tokenizer)
+    for path, text in zip(samples, texts):
+        code_bytes = text.encode('utf-8')
+        native = analyzer._token_boundaries(text, code_bytes)
+        analyzer.tokenizer_backend = hf_backend
+        expected = analyzer._token_boundaries(text, code_bytes)
+        analyzer.tokenizer_backend = native_backend
+        if list(native or []) != list(expected or []):
+            print(f"❌ {path.name}: native_bpe token spans differ from the offset_mapping path")
+            passed = False
+    if passed:
+        print(f"✓ native_bpe spans match the offset_mapping path on {len(samples)} sample files")
+    return passed
+
+def test_stress_fixtures():
+    """Check template-heavy stress fixtures: deep trees walk completely and memory stays linear in node count"""
+    print("\n" + "=" * 60)
+    print("Template Stress Fixture Test")
+    print("=" * 60)
+
+    try:
+        import tracemalloc
+        from analyzer import QuickMultiLanguageAnalyzer
+        from generate_corpus import STRESS_SHAPES, generate_stress
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    analyzer = QuickMultiLanguageAnalyzer(model_name='gpt2', allowed_languages=['cpp'])
+    if 'cpp' not in analyzer.parsers:
+        print("⚠️  cpp parser unavailable, skipping")
+        return True
+    native_core, native_languages = analyzer.native_core, analyzer.native_languages
+
+    passed = True
+    # Nested deeper than the Python recursion limit, except main(), which is long rather than deep
+    deep = sys.getrecursionlimit() + 200
+    for shape in STRESS_SHAPES:
+        scale = 300 if shape == 'main' else deep
+        code = generate_stress(shape, scale)
+        try:
+            analyzer.native_core, analyzer.native_languages = None, {}
+            expected = analyzer.calculate_rule_level_summary(code, 'cpp')[:3]
+            analyzer.native_core, analyzer.native_languages = native_core, native_languages
+            result = analyzer.calculate_rule_level_summary(code, 'cpp')[:3]
+        except RecursionError:
+            print(f"❌ {shape}: recursion limit hit on a deep tree")
+            passed = False
+            continue
+        finally:
+            analyzer.native_core, analyzer.native_languages = native_core, native_languages
+        if result != expected or expected[1] == 0:
+            print(f"❌ {shape}: native {result} vs Python {expected}")
+            passed = False
+            continue
+
+        # Peak memory of a full alignment with per-rule details, per rule, at 1x and 4x the size
+        per_rule = []
+        for size in (150, 600):
+            fixture = generate_stress(shape, size)
+            tracemalloc.start()
+            details = analyzer.calculate_rule_level_alignment(fixture, 'cpp')[1]
+            _, peak = tracemalloc.get_traced_memory()
+            tracemalloc.stop()
+            per_rule.append(peak / max(len(details), 1))
+        if per_rule[1] > per_rule[0] * 1.25:
+            print(f"❌ {shape}: peak memory per rule grows from {per_rule[0]:.0f} to {per_rule[1]:.0f} bytes")
+            passed = False
+        else:
+            print(f"✓ {shape}: {expected[1]} rules at scale {scale}, "
+                  f"{per_rule[0]:.0f} -> {per_rule[1]:.0f} bytes per rule from 1x to 4x size")
+    return passed
+
+def test_sharded_merge():
+    """Check that merging shard checkpoints reports the same averages as a single run over the same files"""
+    print("\n" + "=" * 60)
+    print("Sharded Result Merge Test")
+    print("=" * 60)
+
+    try:
+        import tempfile
+        from analyzer import QuickMultiLanguageAnalyzer
+        from run_manifest import merge_language_results
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    sample_path = Path('./code_samples/cpp/example.cpp')
+    analyzer = QuickMultiLanguageAnalyzer(model_name='gpt2', allowed_languages=['cpp'])
+    if 'cpp' not in analyzer.parsers or not sample_path.exists():
+        print("⚠️  cpp parser or sample unavailable, skipping")
+        return True
+
+    with tempfile.TemporaryDirectory() as tmp:
+        code_dir = Path(tmp) / 'code'
+        code_dir.mkdir()
+        # Two files every rule of which aligns with this tokenizer
+        candidates = ['int main() { return 0; }\n', 'int value = 1;\n', 'void f() {}\n', '{ }\n', '( )\n']
+        perfect_codes = [code for code in candidates
+                         if (lambda summary: summary[1] and summary[1] == summary[2])(
+                             analyzer.calculate_rule_level_summary(code, 'cpp'))][:2]
+        if len(perfect_codes) < 2:
+            print("⚠️  no all-aligned fixture files with this tokenizer, skipping")
+            return True
+        perfect = []
+        for k, code in enumerate(perfect_codes):
+            path = code_dir / f"perfect_{k}.cpp"
+            path.write_text(code, encoding='utf-8')
+            perfect.append(path)
+        mixed = code_dir / 'example.cpp'
+        mixed.write_text(sample_path.read_text(encoding='utf-8'), encoding='utf-8')
+
+        # Shard 0 has only perfect files, shard 1 a perfect and an imperfect one
+        shards = [[perfect[0]], [perfect[1], mixed]]
+        blocks = []
+        for k, files in enumerate(shards):
+            result = analyzer.analyze_language_files(str(code_dir), 'cpp', output_dir=str(Path(tmp) / f"shard_{k}"),
+                                                     batch_size=len(files), code_files=files)
+            blocks.append({key: value for key, value in result.items() if key != 'files'})
+        if blocks[1]['total_aligned'] == blocks[1]['total_rules']:
+            print(f"⚠️  {sample_path.name} aligns fully with this tokenizer, skipping")
+            return True
+        merged = merge_language_results(blocks)
+        # The unsharded run goes through the same batch path that --run_dir shards take
+        files = perfect + [mixed]
+        single = analyzer.analyze_language_files(str(code_dir), 'cpp', output_dir=str(Path(tmp) / 'single'),
+                                                 batch_size=len(files), code_files=files)
+
+    fields = ('file_count', 'total_rules', 'total_aligned')
+    if any(merged[field] != single[field] for field in fields) or abs(merged['avg_score'] - single['avg_score']) > 1e-9:
+        print(f"❌ merged shards report avg {merged['avg_score']:.4f}% over {merged['file_count']} files, "
+              f"a single run {single['avg_score']:.4f}% over {single['file_count']}")
+        return False
+    print(f"✓ merged shards match a single run: avg {merged['avg_score']:.2f}% over {merged['file_count']} files")
+    return True
+
+def test_multi_model_limits():
+    """Check that --single_pass companions flag files truncated by the shared rule extraction"""
+    print("\n" + "=" * 60)
+    print("Multi-model Rule Budget Test")
+    print("=" * 60)
+
+    try:
+        import tempfile
+        from analyzer import QuickMultiLanguageAnalyzer
+    except Exception as e:
+        print(f"❌ Unable to import analyzer: {e}")
+        return False
+
+    analyzer, companion = [QuickMultiLanguageAnalyzer(model_name=m, allowed_languages=['cpp'], rule_budget=50)
+                           for m in ('gpt2', 'bert-base-uncased')]
+    if 'cpp' not in analyzer.parsers or not Path('./code_samples/cpp/example.cpp').exists():
+        print("⚠️  cpp parser or sample unavailable, skipping")
+        return True
+    with tempfile.TemporaryDirectory() as tmp:
+        results = analyzer.analyze_language_files('./code_samples', 'cpp', output_dir=tmp, companions=[companion])
+
+    passed = True
+    for a in (analyzer, companion):
+        files = results.get(a.model_name, {}).get('files', [])
+        truncated = a.limit_counters[('truncated', 'rule_budget')]
+        if not files or any(f.get('truncated') != 'rule_budget' for f in files) or truncated != len(files):
+            print(f"❌ {a.model_name}: {truncated} of {len(files)} files counted as truncated by the rule budget")
+            passed = False
+        else:
+            print(f"✓ {a.model_name}: {len(files)} files truncated at 50 rules")
+    return passed
+
 def main():
     """Main test function"""
     print("Quick Analyzer Simplified Test")
@@ -238,6 +653,27 @@ def main():
     
     # Test code samples
     samples_test_passed = test_code_samples()
+
+    # Test native alignment core parity
+    native_test_passed = test_native_alignment_core()
+
+    # Test compact result format round trip
+    compact_test_passed = test_compact_results()
+
+    # Test incremental re-analysis against full analysis
+    incremental_test_passed = test_incremental_analysis()
+
+    # Test per-file limits with --single_pass companions
+    multi_model_test_passed = test_multi_model_limits()
+
+    # Test merging sharded run checkpoints
+    merge_test_passed = test_sharded_merge()
+
+    # Test tokenizer backends against each other
+    backends_test_passed = test_tokenizer_backends()
+
+    # Test deep template-heavy fixtures
+    stress_test_passed = test_stress_fixtures()
     
     print("\n" + "=" * 60)
     print("Test Summary")
@@ -252,8 +688,44 @@ def main():
         print("✓ Code samples test passed")
     else:
         print("❌ Code samples test failed")
+
+    if native_test_passed:
+        print("✓ Native alignment core test passed")
+    else:
+        print("❌ Native alignment core test failed")
+
+    if compact_test_passed:
+        print("✓ Compact result format test passed")
+    else:
+        print("❌ Compact result format test failed")
+
+    if incremental_test_passed:
+        print("✓ Incremental re-analysis test passed")
+    else:
+        print("❌ Incremental re-analysis test failed")
+
+    if multi_model_test_passed:
+        print("✓ Multi-model rule budget test passed")
+    else:
+        print("❌ Multi-model rule budget test failed")
+
+    if merge_test_passed:
+        print("✓ Sharded result merge test passed")
+    else:
+        print("❌ Sharded result merge test failed")
+
+    if backends_test_passed:
+        print("✓ Tokenizer backend test passed")
+    else:
+        print("❌ Tokenizer backend test failed")
+
+    if stress_test_passed:
+        print("✓ Template stress fixture test passed")
+    else:
+        print("❌ Template stress fixture test failed")
     
-    if core_test_passed and samples_test_passed:
+    if core_test_passed and samples_test_passed and native_test_passed and compact_test_passed and incremental_test_passed \
+            and multi_model_test_passed and merge_test_passed and backends_test_passed and stress_test_passed:
         print("\n🎉 All tests passed! You can use analyzer.py for complete analysis")
         print("\nRecommended command:")
         print("  python analyzer.py")
@@ -263,7 +735,10 @@ def main():
             print("  - Make sure all dependencies are installed: pip install -r requirements.txt")
             print("  - Run analyzer.py first to compile language libraries")
     
-    return core_test_passed and samples_test_passed
+    return core_test_passed and samples_test_passed and native_test_passed and compact_test_passed \
+        and incremental_test_passed \
+        and multi_model_test_passed and merge_test_passed \
+        and backends_test_passed and stress_test_passed
 
 if __name__ == "__main__":
     success = main()
@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Tokenizer backends: where token byte spans come from (--tokenizer_backend)
+
+Rules are scored against the byte spans of the tokens of a file. The 'hf'
+backend asks the fast tokenizer for its offset_mapping, which is in
+characters, so the analyzer also builds a char->byte map per file to convert
+it. The 'native_bpe' backend runs GPT-2 style byte-level BPE in the native
+core (native/bpe.cpp) with the tokenizer's own merges, and gets byte spans
+straight away. A batch is split over threads, each with its own native
+context; ctypes releases the GIL for the call.
+
+native_bpe only takes tokenizers it reproduces exactly: a BPE model without
+dropout or subword affixes, no normalizer, the ByteLevel pre-tokenizer with
+its regex and no prefix space, and untrimmed offsets. Others keep 'hf', with
+a note. A file that contains one of the tokenizer's added tokens (such as
+<|endoftext|>) goes to the fast tokenizer as well, because that splits added
+tokens out before pre-tokenizing.
+
+reference_boundaries() is the same algorithm in pure Python, for parity tests
+of the native engine.
+"""
+
+import os
+import json
+import threading
+import unicodedata
+import concurrent.futures
+from collections import Counter
+from typing import Dict, List, Optional, Sequence, Tuple
+
+from alignment_native import load_native_core
+
+TOKENIZER_BACKENDS = ('hf', 'native_bpe')
+
+# \s of the pre-tokenizer regex: the Unicode White_Space property
+WHITE_SPACE = frozenset(map(chr, [*range(0x09, 0x0E), 0x20, 0x85, 0xA0, 0x1680, *range(0x2000, 0x200B),
+                                  0x2028, 0x2029, 0x202F, 0x205F, 0x3000]))
+
+
+class ByteBoundaries(list):
+    """(start, end) byte spans of tokens, as a backend emits them; no char->byte conversion needed."""
+    token_source = 'native_bpe'
+
+
+def bytes_to_unicode() -> Dict[int, str]:
+    """GPT-2's map from bytes to the printable characters byte-level vocabularies and merges are written in."""
+    printable = list(range(ord('!'), ord('~') + 1)) + list(range(0xA1, 0xAD)) + list(range(0xAE, 0x100))
+    mapping, extra = {}, 0
+    for b in range(256):
+        if b in printable:
+            mapping[b] = chr(b)
+        else:
+            mapping[b] = chr(256 + extra)
+            extra += 1
+    return mapping
+
+
+def byte_level_spec(tokenizer) -> Tuple[Optional[Dict], str]:
+    """({'merges': [(left, right) bytes], 'added_tokens': [...]}, '') for a tokenizer native_bpe
+    reproduces, else (None, the reason)."""
+    backend = getattr(tokenizer, 'backend_tokenizer', None)
+    if backend is None:
+        return None, 'not a fast tokenizer'
+    try:
+        config = json.loads(backend.to_str())
+    except Exception as e:
+        return None, f'no tokenizer.json ({e})'
+    model = config.get('model') or {}
+    if model.get('type') != 'BPE':
+        return None, f"{model.get('type')} model"
+    if model.get('dropout') or model.get('continuing_subword_prefix') or model.get('end_of_word_suffix') \
+            or model.get('ignore_merges'):
+        return None, 'BPE dropout, subword affixes or ignore_merges'
+    if config.get('normalizer'):
+        return None, 'normalizer'
+    pre = config.get('pre_tokenizer') or {}
+    if pre.get('type') != 'ByteLevel' or pre.get('add_prefix_space') or not pre.get('use_regex', True):
+        return None, 'pre-tokenizer other than ByteLevel without a prefix space'
+    if (config.get('post_processor') or {}).get('trim_offsets'):
+        return None, 'trimmed offsets'
+    decode = {c: b for b, c in bytes_to_unicode().items()}
+    merges = []
+    try:
+        for merge in model.get('merges', []):
+            left, right = merge.split(' ', 1) if isinstance(merge, str) else merge
+            merges.append((bytes(decode[c] for c in left), bytes(decode[c] for c in right)))
+    except (KeyError, ValueError):
+        return None, 'merges outside the byte-level alphabet'
+    added = [token['content'] for token in config.get('added_tokens', []) if token.get('content')]
+    return {'merges': merges, 'added_tokens': added}, ''
+
+
+class OffsetMappingBackend:
+    """The fast tokenizer's offset_mapping: character offsets, mapped to bytes by the analyzer."""
+    name = 'hf'
+
+    def __init__(self, tokenizer):
+        self.tokenizer = tokenizer
+        self.counters = Counter()
+
+    def encode(self, code: str, code_bytes=None):
+        return self.tokenizer(code, add_special_tokens=False, return_offsets_mapping=True).get('offset_mapping')
+
+    def encode_batch(self, codes: List[str], codes_bytes: Optional[Sequence] = None) -> List[Optional[List]]:
+        """offset_mapping for several files from one tokenizer call; None entries are tokenized per file."""
+        try:
+            mappings = self.tokenizer(codes, add_special_tokens=False, return_offsets_mapping=True).get('offset_mapping')
+        except Exception:
+            mappings = None
+        if mappings is None or len(mappings) != len(codes):
+            return [None] * len(codes)
+        return list(mappings)
+
+    def describe(self) -> str:
+        return 'fast tokenizer offset_mapping'
+
+
+class NativeBPEBackend:
+    """Byte-level BPE in the native core, emitting byte spans (ByteBoundaries)."""
+    name = 'native_bpe'
+
+    def __init__(self, core, spec: Dict, fallback: OffsetMappingBackend, threads: int = 0):
+        self._core = core
+        self._bpe = core.load_bpe(spec['merges'])
+        self.merge_count = self._bpe.merge_count
+        self.added_tokens = spec['added_tokens']
+        self.fallback = fallback
+        self.threads = threads if threads > 0 else min(8, os.cpu_count() or 1)
+        self.counters = Counter()
+        self._local = threading.local()
+        self._lock = threading.Lock()
+        self._pool: Optional[concurrent.futures.ThreadPoolExecutor] = None
+
+    def _thread_core(self):
+        core = getattr(self._local, 'core', None)
+        if core is None:
+            core = self._local.core = self._core.clone()
+        return core
+
+    def encode(self, code: str, code_bytes=None):
+        if self.added_tokens and any(token in code for token in self.added_tokens):
+            with self._lock:
+                self.counters['fallback_files'] += 1
+            return self.fallback.encode(code)
+        if code_bytes is None:
+            code_bytes = code.encode('utf-8', errors='surrogatepass')
+        starts, ends = self._thread_core().bpe_encode(self._bpe, code_bytes)
+        return ByteBoundaries(zip(starts, ends))
+
+    def _encode_or_none(self, code: str, code_bytes=None):
+        try:
+            return self.encode(code, code_bytes)
+        except Exception:
+            return None
+
+    def encode_batch(self, codes: List[str], codes_bytes: Optional[Sequence] = None) -> List[Optional[List]]:
+        """Spans of several files, spread over the backend's threads; None entries are tokenized per file."""
+        codes_bytes = codes_bytes if codes_bytes is not None else [None] * len(codes)
+        if self.threads <= 1 or len(codes) < 2:
+            return [self._encode_or_none(code, code_bytes) for code, code_bytes in zip(codes, codes_bytes)]
+        with self._lock:
+            if self._pool is None:
+                self._pool = concurrent.futures.ThreadPoolExecutor(self.threads, thread_name_prefix='native-bpe')
+        return list(self._pool.map(self._encode_or_none, codes, codes_bytes))
+
+    def describe(self) -> str:
+        return f"native byte-level BPE, {self.merge_count} merges, {self.threads} threads per batch"
+
+
+def make_backend(name: str, tokenizer, core=None, threads: int = 0):
+    """The backend called name for tokenizer; 'hf' when native_bpe cannot reproduce it (with a note)."""
+    hf = OffsetMappingBackend(tokenizer)
+    if name == 'hf':
+        return hf
+    if name != 'native_bpe':
+        raise ValueError(f"unknown tokenizer backend {name!r} (choose from {', '.join(TOKENIZER_BACKENDS)})")
+    spec, reason = byte_level_spec(tokenizer)
+    if spec is None:
+        print(f"⚠️  native_bpe cannot reproduce this tokenizer ({reason}); using its offset_mapping")
+        return hf
+    core = core if core is not None else load_native_core()
+    if core is None:
+        print("⚠️  native_bpe needs the native core (python build_native.py); using the offset_mapping")
+        return hf
+    return NativeBPEBackend(core, spec, hf, threads)
+
+
+def _char_class(ch: str) -> str:
+    if ch in WHITE_SPACE:
+        return 's'
+    category = unicodedata.category(ch)[0]
+    return category if category in 'LN' else 'o'
+
+
+def reference_pieces(text: str) -> List[Tuple[int, int]]:
+    """Character spans of the GPT-2 pre-tokenizer pattern over text (what native/bpe.cpp piece_end splits)."""
+    pieces, pos, n = [], 0, len(text)
+    while pos < n:
+        if text[pos] == "'" and text[pos + 1:pos + 2] in ('s', 't', 'm', 'd'):
+            end = pos + 2
+        elif text[pos] == "'" and text[pos + 1:pos + 3] in ('re', 've', 'll'):
+            end = pos + 3
+        else:
+            body = pos + 1 if text[pos] == ' ' else pos
+            cls = _char_class(text[body]) if body < n else 's'
+            end = body
+            if cls != 's':
+                while end < n and _char_class(text[end]) == cls:
+                    end += 1
+            else:
+                end = pos
+                while end < n and _char_class(text[end]) == 's':
+                    end += 1
+                if end < n and end - pos > 1:
+                    end -= 1
+        pieces.append((pos, end))
+        pos = end
+    return pieces
+
+
+def reference_boundaries(text: str, merges: List[Tuple[bytes, bytes]]) -> List[Tuple[int, int]]:
+    """Token byte spans of text under merges: pre-tokenize, then merge the lowest-ranked pair until none is left."""
+    ranks: Dict[Tuple[bytes, bytes], int] = {}
+    known = {bytes([b]) for b in range(256)}
+    for left, right in merges:
+        if left in known and right in known and (left, right) not in ranks:
+            ranks[(left, right)] = len(ranks)
+            known.add(left + right)
+    data = text.encode('utf-8', errors='surrogatepass')
+    char_to_byte = [0]
+    for ch in text:
+        char_to_byte.append(char_to_byte[-1] + len(ch.encode('utf-8', errors='surrogatepass')))
+    spans = []
+    for start, end in reference_pieces(text):
+        b0 = char_to_byte[start]
+        parts = [bytes([b]) for b in data[b0:char_to_byte[end]]]
+        while len(parts) > 1:
+            rank, i = min((ranks.get((parts[k], parts[k + 1]), len(ranks)), k) for k in range(len(parts) - 1))
+            if rank == len(ranks):
+                break
+            parts[i:i + 2] = [parts[i] + parts[i + 1]]
+        for part in parts:
+            s, e = b0, b0 + len(part)
+            while s > 0 and data[s] & 0xC0 == 0x80:
+                s -= 1
+            while e < len(data) and data[e] & 0xC0 == 0x80:
+                e += 1
+            spans.append((s, e))
+            b0 += len(part)
+    return spans
@@ -301,6 +301,49 @@ def create_comprehensive_dashboard(report):
     
     print("综合仪表板已保存: results/multilang/comprehensive_dashboard.png")
 
+def create_node_type_chart(language='cpp', model='gpt2', top=15):
+    """创建按节点类型的未对齐率图表 (summary 中的 node_types 按 node_types_<model>.json 的 id 索引)"""
+    detailed_file = Path(f"results/multilang/detailed_analysis_{model}.json")
+    table_file = Path(f"results/multilang/node_types_{model}.json")
+    if not detailed_file.exists() or not table_file.exists():
+        print(f"跳过节点类型图表: 找不到 {detailed_file} 或 {table_file}")
+        return
+    with open(detailed_file, 'r', encoding='utf-8') as f:
+        counts = json.load(f)['summary'].get('node_types', {}).get(language)
+    with open(table_file, 'r', encoding='utf-8') as f:
+        names = json.load(f).get(language, [])
+    if not counts:
+        print(f"跳过节点类型图表: {detailed_file} 中没有 {language} 的节点类型统计")
+        return
+
+    # 规则最多的节点类型, 按未对齐率排序
+    rows = sorted(((names[t], rules, rules - aligned) for t, (rules, aligned)
+                   in enumerate(zip(counts['rules'], counts['aligned'])) if rules),
+                  key=lambda row: row[1], reverse=True)[:top]
+    rows.sort(key=lambda row: row[2] / row[1])
+    types = [row[0] for row in rows]
+    rates = [row[2] / row[1] * 100 for row in rows]
+
+    fig, ax = plt.subplots(figsize=(12, max(4, len(rows) * 0.45)))
+    bars = ax.barh(types, rates, color=plt.cm.RdYlBu_r(np.array(rates) / 100), edgecolor='black', alpha=0.8)
+    for bar, (_, rules, unaligned) in zip(bars, rows):
+        ax.text(bar.get_width() + 0.5, bar.get_y() + bar.get_height()/2,
+                f'{unaligned}/{rules}', ha='left', va='center', fontsize=9)
+
+    ax.set_xlabel('未对齐规则比例 (%)', fontsize=12, fontweight='bold')
+    ax.set_ylabel('节点类型', fontsize=12, fontweight='bold')
+    ax.set_title(f'{language.upper()} 各节点类型的未对齐率\n(规则最多的 {len(rows)} 种, {model} 模型)',
+                 fontsize=14, fontweight='bold', pad=20)
+    ax.set_xlim(0, 110)
+    ax.grid(axis='x', alpha=0.3)
+
+    output_file = f'results/multilang/node_type_alignment_{language}.png'
+    plt.tight_layout()
+    plt.savefig(output_file, dpi=300, bbox_inches='tight')
+    plt.close()
+
+    print(f"节点类型图表已保存: {output_file}")
+
 def main():
     """主函数"""
     
@@ -308,6 +351,9 @@ def main():
     print("多语言分析结果可视化")
     print("=" * 60)
     
+    # 节点类型图表只需要 analyzer.py 的详细报告
+    create_node_type_chart()
+
     # 加载数据
     report = load_cross_language_report()
     if not report: